@@ -3,120 +3,896 @@
 // found in the LICENSE file.
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
 
 #include <fuse_lowlevel.h>
 
+#include <common/mutex.h>
+#include <common/timer.h>
 #include <sdk/bfs.h>
 
-// not used
-// baidu::bfs::FS* g_fs;
+using baidu::common::Mutex;
+using baidu::common::MutexLock;
+
+baidu::bfs::FS* g_fs;
 std::string g_bfs_path;
 std::string g_bfs_cluster;
+/// Seconds the kernel may cache entries and attributes
+double g_cache_timeout = 1.0;
+/// Entry id of g_bfs_path, what FUSE_ROOT_ID stands for
+int64_t g_root_id;
 
 #define BFS "\e[0;32m[BFS]\e[0m "
+#define BFSERR "\e[0;31m[BFS]\e[0m "
 
-static void bfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, 
-                           struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s\n", __func__);
+/// Attributes of a bfs entry as handed to the kernel
+struct Attr {
+    int64_t entry_id;
+    struct stat st;
+    std::string link;
+};
+
+/// An inode the kernel holds a reference to. Inode numbers are the entry
+/// ids of the bfs entries, entries are looked up by the entry id of the
+/// parent and the name, paths are only built for calls the sdk takes by path.
+struct Inode {
+    fuse_ino_t parent;
+    std::string name;
+    uint64_t nlookup;
+    Attr attr;
+    double expire;
+    /// Bytes written through open handles, not seen by the nameserver yet
+    int64_t write_size;
+};
+
+/// Attributes listed by opendir, answer the lookups of the entries that
+/// follow (ls -l, find) without another rpc
+struct DirHint {
+    Attr attr;
+    double expire;
+};
+
+typedef std::pair<fuse_ino_t, std::string> Dentry;
+
+Mutex g_mu;
+std::map<fuse_ino_t, Inode> g_inodes;
+std::map<Dentry, fuse_ino_t> g_dentries;
+std::map<Dentry, DirHint> g_dir_hints;
+const size_t kMaxDirHints = 100000;
+
+struct FileHandle {
+    baidu::bfs::File* file;
+    bool write;
+    /// Next offset of a sequential write
+    int64_t size;
+    Mutex mu;
+    FileHandle(baidu::bfs::File* f, bool w) : file(f), write(w), size(0) {}
+};
+
+struct DirHandle {
+    std::vector<std::pair<std::string, struct stat> > entries;
+};
+
+static double Now() {
+    return baidu::common::timer::get_micros() / 1000000.0;
 }
 
-static void bfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
-    fprintf(stderr, BFS"%s(%s)\n", __func__, name);
+static int ToErrno(int32_t ret) {
+    switch (ret) {
+        case baidu::bfs::OK:
+            return 0;
+        case baidu::bfs::BAD_PARAMETER:
+            return ENOENT;
+        case baidu::bfs::PERMISSION_DENIED:
+            return EACCES;
+        case baidu::bfs::NOT_ENOUGH_QUOTA:
+            return EDQUOT;
+        case baidu::bfs::NOT_ENOUGH_SPACE:
+            return ENOSPC;
+        case baidu::bfs::OVERLOAD:
+            return EAGAIN;
+        case baidu::bfs::TIMEOUT:
+            return ETIMEDOUT;
+        default:
+            return EIO;
+    }
 }
 
-static void bfs_ll_readdir(fuse_req_t req, fuse_ino_t ino, 
-                           size_t size, off_t off, struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s\n", __func__);
+static void ToAttr(const baidu::bfs::BfsFileInfo& info, Attr* attr) {
+    struct stat* st = &attr->st;
+    memset(st, 0, sizeof(*st));
+    attr->entry_id = info.entry_id;
+    attr->link.clear();
+    int type = (info.mode >> 9) & 3;
+    if (type == 1) {
+        st->st_mode = (info.mode & 0777) | S_IFDIR;
+        st->st_nlink = 2;
+        st->st_size = 4096;
+    } else if (type == 2) {
+        attr->link = info.link;
+        st->st_mode = 0777 | S_IFLNK;
+        st->st_nlink = 1;
+        st->st_size = attr->link.size();
+    } else {
+        st->st_mode = (info.mode & 0777) | S_IFREG;
+        st->st_nlink = 1;
+        st->st_size = info.size;
+    }
+    st->st_ino = info.entry_id;
+    st->st_uid = getuid();
+    st->st_gid = getgid();
+    st->st_blksize = 1024 * 1024;
+    st->st_blocks = st->st_size ? (st->st_size - 1) / 512 + 1 : 0;
+    st->st_atime = st->st_mtime = st->st_ctime = info.ctime;
 }
 
-static void bfs_ll_open(fuse_req_t req, fuse_ino_t ino, 
-                        struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s\n", __func__);
+/// Path of 'ino' in bfs, g_mu held. Empty if the kernel no longer knows it.
+static std::string PathOf(fuse_ino_t ino) {
+    if (ino == FUSE_ROOT_ID) {
+        return g_bfs_path;
+    }
+    std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+    if (it == g_inodes.end()) {
+        return "";
+    }
+    std::string parent = PathOf(it->second.parent);
+    if (parent.empty()) {
+        return "";
+    }
+    return (parent == "/" ? parent : parent + "/") + it->second.name;
+}
+
+static std::string ChildPath(fuse_ino_t parent, const char* name) {
+    MutexLock lock(&g_mu);
+    std::string path = PathOf(parent);
+    if (path.empty()) {
+        return "";
+    }
+    return (path == "/" ? path : path + "/") + name;
+}
+
+static int64_t EntryOf(fuse_ino_t ino) {
+    if (ino == FUSE_ROOT_ID) {
+        return g_root_id;
+    }
+    MutexLock lock(&g_mu);
+    std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+    return it == g_inodes.end() ? -1 : it->second.attr.entry_id;
 }
 
-static void bfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, 
+/// Make the next getattr of 'ino' go to the nameserver, g_mu held
+static void ExpireAttr(fuse_ino_t ino) {
+    std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+    if (it != g_inodes.end()) {
+        it->second.expire = 0;
+    }
+}
+
+/// Drop what is cached about 'name' of 'parent' after a change through this mount
+static void Invalidate(fuse_ino_t parent, const std::string& name) {
+    MutexLock lock(&g_mu);
+    Dentry key(parent, name);
+    g_dir_hints.erase(key);
+    std::map<Dentry, fuse_ino_t>::iterator it = g_dentries.find(key);
+    if (it != g_dentries.end()) {
+        ExpireAttr(it->second);
+        g_dentries.erase(it);
+    }
+}
+
+static int LookupEntry(fuse_ino_t parent, const char* name, Attr* attr) {
+    {
+        MutexLock lock(&g_mu);
+        std::map<Dentry, DirHint>::iterator it = g_dir_hints.find(Dentry(parent, name));
+        if (it != g_dir_hints.end()) {
+            if (it->second.expire > Now()) {
+                *attr = it->second.attr;
+                return 0;
+            }
+            g_dir_hints.erase(it);
+        }
+    }
+    int64_t parent_id = EntryOf(parent);
+    if (parent_id < 0) {
+        return ESTALE;
+    }
+    baidu::bfs::BfsFileInfo info;
+    int32_t ret = g_fs->Lookup(parent_id, name, &info);
+    if (ret != baidu::bfs::OK) {
+        return ToErrno(ret);
+    }
+    ToAttr(info, attr);
+    return 0;
+}
+
+/// Take a kernel reference to 'name' of 'parent' and fill the reply
+static void AddEntry(fuse_ino_t parent, const char* name, const Attr& attr,
+                     struct fuse_entry_param* e) {
+    MutexLock lock(&g_mu);
+    Dentry key(parent, name);
+    fuse_ino_t ino = attr.entry_id;
+    std::map<Dentry, fuse_ino_t>::iterator dit = g_dentries.find(key);
+    if (dit != g_dentries.end() && g_inodes[dit->second].attr.entry_id == attr.entry_id) {
+        // Same entry, keep the inode the kernel has even if it was truncated to a new id
+        ino = dit->second;
+    }
+    Inode& inode = g_inodes[ino];
+    if (inode.nlookup == 0) {
+        inode.write_size = 0;
+    }
+    inode.parent = parent;
+    inode.name = name;
+    inode.nlookup++;
+    inode.attr = attr;
+    inode.attr.st.st_ino = ino;
+    inode.expire = Now() + g_cache_timeout;
+    g_dentries[key] = ino;
+
+    memset(e, 0, sizeof(*e));
+    e->ino = ino;
+    e->attr = inode.attr.st;
+    e->attr.st_size = std::max<int64_t>(e->attr.st_size, inode.write_size);
+    e->attr_timeout = g_cache_timeout;
+    e->entry_timeout = g_cache_timeout;
+}
+
+/// Attributes of 'ino', from the cache while they are fresh
+static int GetAttr(fuse_ino_t ino, Attr* attr) {
+    std::string name;
+    fuse_ino_t parent = 0;
+    {
+        MutexLock lock(&g_mu);
+        std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+        if (it != g_inodes.end()) {
+            if (it->second.expire > Now()) {
+                *attr = it->second.attr;
+                attr->st.st_size = std::max<int64_t>(attr->st.st_size, it->second.write_size);
+                return 0;
+            }
+            parent = it->second.parent;
+            name = it->second.name;
+        } else if (ino != FUSE_ROOT_ID) {
+            return ESTALE;
+        }
+    }
+    baidu::bfs::BfsFileInfo info;
+    int32_t ret = baidu::bfs::OK;
+    if (ino == FUSE_ROOT_ID) {
+        ret = g_fs->Stat(g_bfs_path.c_str(), &info);
+    } else {
+        int64_t parent_id = EntryOf(parent);
+        if (parent_id < 0) {
+            return ESTALE;
+        }
+        ret = g_fs->Lookup(parent_id, name.c_str(), &info);
+    }
+    if (ret != baidu::bfs::OK) {
+        return ToErrno(ret);
+    }
+    ToAttr(info, attr);
+    attr->st.st_ino = ino;
+    MutexLock lock(&g_mu);
+    std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+    if (it == g_inodes.end()) {
+        if (ino != FUSE_ROOT_ID) {
+            return ESTALE;
+        }
+        it = g_inodes.insert(std::make_pair(ino, Inode())).first;
+        it->second.parent = FUSE_ROOT_ID;
+        it->second.nlookup = 1;
+    }
+    Inode& inode = it->second;
+    inode.attr = *attr;
+    inode.expire = Now() + g_cache_timeout;
+    attr->st.st_size = std::max<int64_t>(attr->st.st_size, inode.write_size);
+    return 0;
+}
+
+static void bfs_ll_init(void* userdata, struct fuse_conn_info* conn) {
+#ifdef FUSE_CAP_BIG_WRITES
+    conn->want |= FUSE_CAP_BIG_WRITES;
+#endif
+#ifdef FUSE_CAP_ASYNC_READ
+    conn->want |= FUSE_CAP_ASYNC_READ;
+#endif
+}
+
+static void bfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    Attr attr;
+    int err = LookupEntry(parent, name, &attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    struct fuse_entry_param e;
+    AddEntry(parent, name, attr, &e);
+    fuse_reply_entry(req, &e);
+}
+
+static void bfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup) {
+    {
+        MutexLock lock(&g_mu);
+        std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+        if (it != g_inodes.end() && ino != FUSE_ROOT_ID) {
+            Inode& inode = it->second;
+            inode.nlookup -= std::min<uint64_t>(inode.nlookup, nlookup);
+            if (inode.nlookup == 0) {
+                std::map<Dentry, fuse_ino_t>::iterator dit =
+                    g_dentries.find(Dentry(inode.parent, inode.name));
+                if (dit != g_dentries.end() && dit->second == ino) {
+                    g_dentries.erase(dit);
+                }
+                g_inodes.erase(it);
+            }
+        }
+    }
+    fuse_reply_none(req);
+}
+
+static void bfs_ll_getattr(fuse_req_t req, fuse_ino_t ino,
                            struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s\n", __func__);
+    Attr attr;
+    int err = GetAttr(ino, &attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    fuse_reply_attr(req, &attr.st, g_cache_timeout);
 }
 
-static void bfs_ll_read(fuse_req_t req, fuse_ino_t ino, 
-                        size_t size, off_t off, struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s(size:%lu, off:%ld)\n", __func__, size, off);
+static void bfs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr,
+                           int to_set, struct fuse_file_info* fi) {
+    std::string path;
+    {
+        MutexLock lock(&g_mu);
+        path = PathOf(ino);
+    }
+    Attr old_attr;
+    int err = path.empty() ? ESTALE : GetAttr(ino, &old_attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        FileHandle* fh = fi ? reinterpret_cast<FileHandle*>(fi->fh) : NULL;
+        if (fh && fh->write) {
+            // Only the length already written, ftruncate after O_TRUNC
+            MutexLock lock(&fh->mu);
+            if (attr->st_size != fh->size) {
+                fuse_reply_err(req, EPERM);
+                return;
+            }
+        } else if (attr->st_size == 0) {
+            baidu::bfs::File* file = NULL;
+            int32_t ret = g_fs->OpenFile(path.c_str(), O_WRONLY | O_TRUNC,
+                                         old_attr.st.st_mode & 0777, &file,
+                                         baidu::bfs::WriteOptions());
+            if (ret != baidu::bfs::OK) {
+                fuse_reply_err(req, ToErrno(ret));
+                return;
+            }
+            file->Close();
+            delete file;
+        } else {
+            fuse_reply_err(req, EPERM);
+            return;
+        }
+    }
+    if (to_set & FUSE_SET_ATTR_MODE) {
+        int32_t ret = g_fs->Chmod(attr->st_mode & 0777, path.c_str());
+        if (ret != baidu::bfs::OK) {
+            fuse_reply_err(req, ToErrno(ret));
+            return;
+        }
+    }
+    {
+        MutexLock lock(&g_mu);
+        ExpireAttr(ino);
+    }
+    // Times, owner and group are not kept in bfs, they are taken as set
+    Attr new_attr;
+    err = GetAttr(ino, &new_attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    fuse_reply_attr(req, &new_attr.st, g_cache_timeout);
 }
 
-static void bfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, 
-                         size_t size, off_t off, struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s(size:%lu, off:%ld)\n", __func__, size, off);
+static void bfs_ll_readlink(fuse_req_t req, fuse_ino_t ino) {
+    Attr attr;
+    int err = GetAttr(ino, &attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if (!S_ISLNK(attr.st.st_mode)) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    fuse_reply_readlink(req, attr.link.c_str());
 }
 
-static void bfs_ll_mknod(fuse_req_t req, fuse_ino_t parent, 
-                         const char *name, mode_t mode, dev_t dev) {
-    fprintf(stderr, BFS"%s(%s)\n", __func__, name);
+/// Reply to mkdir, symlink and create with the entry just made
+static int ReplyNewEntry(fuse_req_t req, fuse_ino_t parent, const char* name,
+                         struct fuse_entry_param* e) {
+    Invalidate(parent, name);
+    Attr attr;
+    int err = LookupEntry(parent, name, &attr);
+    if (err) {
+        return err;
+    }
+    AddEntry(parent, name, attr, e);
+    return 0;
 }
 
-static void bfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, 
+static void bfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent,
                          const char *name, mode_t mode) {
-    fprintf(stderr, BFS"%s(%s)\n", __func__, name);
+    std::string path = ChildPath(parent, name);
+    if (path.empty()) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    Attr attr;
+    if (LookupEntry(parent, name, &attr) == 0) {
+        fuse_reply_err(req, EEXIST);
+        return;
+    }
+    int32_t ret = g_fs->CreateDirectory(path.c_str());
+    if (ret == baidu::bfs::OK) {
+        ret = g_fs->Chmod(mode & 0777, path.c_str());
+    }
+    if (ret != baidu::bfs::OK) {
+        fuse_reply_err(req, ToErrno(ret));
+        return;
+    }
+    struct fuse_entry_param e;
+    int err = ReplyNewEntry(req, parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    fuse_reply_entry(req, &e);
 }
 
-static void bfs_ll_create(fuse_req_t req, fuse_ino_t parent, 
-                          const char *name, mode_t mode, 
+static int CreateFile(fuse_ino_t parent, const char* name, mode_t mode,
+                      baidu::bfs::File** file) {
+    std::string path = ChildPath(parent, name);
+    if (path.empty()) {
+        return ESTALE;
+    }
+    Attr attr;
+    if (LookupEntry(parent, name, &attr) == 0) {
+        return EEXIST;
+    }
+    int32_t ret = g_fs->OpenFile(path.c_str(), O_WRONLY, mode & 0777, file,
+                                 baidu::bfs::WriteOptions());
+    return ToErrno(ret);
+}
+
+static void bfs_ll_mknod(fuse_req_t req, fuse_ino_t parent,
+                         const char *name, mode_t mode, dev_t dev) {
+    if (!S_ISREG(mode)) {
+        fuse_reply_err(req, EPERM);
+        return;
+    }
+    baidu::bfs::File* file = NULL;
+    int err = CreateFile(parent, name, mode, &file);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    file->Close();
+    delete file;
+    struct fuse_entry_param e;
+    err = ReplyNewEntry(req, parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    fuse_reply_entry(req, &e);
+}
+
+static void bfs_ll_create(fuse_req_t req, fuse_ino_t parent,
+                          const char *name, mode_t mode,
                           struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s(%s)\n", __func__, name);
+    baidu::bfs::File* file = NULL;
+    int err = CreateFile(parent, name, mode, &file);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    struct fuse_entry_param e;
+    err = ReplyNewEntry(req, parent, name, &e);
+    if (err) {
+        file->Close();
+        delete file;
+        fuse_reply_err(req, err);
+        return;
+    }
+    fi->fh = reinterpret_cast<uint64_t>(new FileHandle(file, true));
+    fi->direct_io = 0;
+    fi->keep_cache = 0;
+    if (fuse_reply_create(req, &e, fi) != 0) {
+        FileHandle* fh = reinterpret_cast<FileHandle*>(fi->fh);
+        fh->file->Close();
+        delete fh->file;
+        delete fh;
+    }
 }
 
-static void bfs_ll_statfs(fuse_req_t req, fuse_ino_t ino){
-    fprintf(stderr, BFS"%s\n", __func__);
+static void bfs_ll_symlink(fuse_req_t req, const char* link, fuse_ino_t parent,
+                           const char* name) {
+    std::string path = ChildPath(parent, name);
+    if (path.empty()) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int32_t ret = g_fs->Symlink(link, path.c_str());
+    if (ret != baidu::bfs::OK) {
+        fuse_reply_err(req, ToErrno(ret));
+        return;
+    }
+    struct fuse_entry_param e;
+    int err = ReplyNewEntry(req, parent, name, &e);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    fuse_reply_entry(req, &e);
+}
+
+static void bfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    std::string path = ChildPath(parent, name);
+    if (path.empty()) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int32_t ret = g_fs->DeleteFile(path.c_str());
+    Invalidate(parent, name);
+    fuse_reply_err(req, ToErrno(ret));
+}
+
+static void bfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    std::string path = ChildPath(parent, name);
+    if (path.empty()) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    Attr attr;
+    int err = LookupEntry(parent, name, &attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if (!S_ISDIR(attr.st.st_mode)) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+    baidu::bfs::BfsFileInfo* files = NULL;
+    int num = 0;
+    int32_t ret = g_fs->ListDirectoryById(attr.entry_id, &files, &num);
+    delete[] files;
+    if (ret != baidu::bfs::OK) {
+        fuse_reply_err(req, ToErrno(ret));
+        return;
+    }
+    if (num > 0) {
+        fuse_reply_err(req, ENOTEMPTY);
+        return;
+    }
+    ret = g_fs->DeleteDirectory(path.c_str(), false);
+    Invalidate(parent, name);
+    fuse_reply_err(req, ToErrno(ret));
 }
 
-static void bfs_ll_rename(fuse_req_t req, fuse_ino_t sparent, 
-                          const char *sname, fuse_ino_t tparent, 
+static void bfs_ll_rename(fuse_req_t req, fuse_ino_t sparent,
+                          const char *sname, fuse_ino_t tparent,
                           const char *tname) {
-    fprintf(stderr, BFS"%s(source name:%s, target name:%s)\n", __func__, sname, tname);
+    std::string src = ChildPath(sparent, sname);
+    std::string dst = ChildPath(tparent, tname);
+    if (src.empty() || dst.empty()) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    int32_t ret = g_fs->Rename(src.c_str(), dst.c_str());
+    if (ret != baidu::bfs::OK) {
+        fuse_reply_err(req, ToErrno(ret));
+        return;
+    }
+    {
+        MutexLock lock(&g_mu);
+        g_dir_hints.erase(Dentry(sparent, sname));
+        g_dir_hints.erase(Dentry(tparent, tname));
+        std::map<Dentry, fuse_ino_t>::iterator it = g_dentries.find(Dentry(tparent, tname));
+        if (it != g_dentries.end()) {
+            ExpireAttr(it->second);
+            g_dentries.erase(it);
+        }
+        // The entry id stays, so does the inode the kernel has
+        it = g_dentries.find(Dentry(sparent, sname));
+        if (it != g_dentries.end()) {
+            fuse_ino_t ino = it->second;
+            g_dentries.erase(it);
+            Inode& inode = g_inodes[ino];
+            inode.parent = tparent;
+            inode.name = tname;
+            g_dentries[Dentry(tparent, tname)] = ino;
+        }
+    }
+    fuse_reply_err(req, 0);
 }
 
 static void bfs_ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t tparent, const char *tname) {
-    fprintf(stderr, BFS"%s(target name:%s)\n", __func__, tname);
+    // No hard links in bfs
+    fuse_reply_err(req, EPERM);
 }
 
-static void bfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
-    fprintf(stderr, BFS"%s(%s)\n", __func__, name);
+static void bfs_ll_open(fuse_req_t req, fuse_ino_t ino,
+                        struct fuse_file_info *fi) {
+    int64_t old_entry_id = EntryOf(ino);
+    std::string path;
+    {
+        MutexLock lock(&g_mu);
+        path = PathOf(ino);
+        ExpireAttr(ino);
+    }
+    Attr attr;
+    int err = path.empty() ? ESTALE : GetAttr(ino, &attr);
+    if (err) {
+        fuse_reply_err(req, err);
+        return;
+    }
+    if (S_ISDIR(attr.st.st_mode)) {
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+    int accmode = fi->flags & O_ACCMODE;
+    baidu::bfs::File* file = NULL;
+    int32_t ret = baidu::bfs::OK;
+    if (accmode == O_RDONLY) {
+        ret = g_fs->OpenFile(path.c_str(), O_RDONLY, &file, baidu::bfs::ReadOptions());
+    } else if (accmode == O_WRONLY && ((fi->flags & O_TRUNC) || attr.st.st_size == 0)) {
+        ret = g_fs->OpenFile(path.c_str(), O_WRONLY | O_TRUNC, attr.st.st_mode & 0777,
+                             &file, baidu::bfs::WriteOptions());
+    } else {
+        // Files are written once from the start, no append, no read-write
+        fuse_reply_err(req, EPERM);
+        return;
+    }
+    if (ret != baidu::bfs::OK) {
+        fuse_reply_err(req, ToErrno(ret));
+        return;
+    }
+    fi->fh = reinterpret_cast<uint64_t>(new FileHandle(file, accmode != O_RDONLY));
+    fi->direct_io = 0;
+    // A rewritten file gets a new entry id, so an unchanged one means the
+    // pages the kernel cached are still good
+    fi->keep_cache = (accmode == O_RDONLY && attr.entry_id == old_entry_id);
+    if (fuse_reply_open(req, fi) != 0) {
+        FileHandle* fh = reinterpret_cast<FileHandle*>(fi->fh);
+        fh->file->Close();
+        delete fh->file;
+        delete fh;
+    }
 }
 
-static void bfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
-    fprintf(stderr, BFS"%s(%s)\n", __func__, name);
+static void ReadDone(fuse_req_t req, char* buf, int32_t ret) {
+    if (ret < 0) {
+        fuse_reply_err(req, EIO);
+    } else {
+        fuse_reply_buf(req, buf, ret);
+    }
+    delete[] buf;
+}
+
+static void bfs_ll_read(fuse_req_t req, fuse_ino_t ino,
+                        size_t size, off_t off, struct fuse_file_info *fi) {
+    FileHandle* fh = reinterpret_cast<FileHandle*>(fi->fh);
+    if (fh->write) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+    // Replied from the sdk callback, the session thread is free for the
+    // next request while the chunkserver answers
+    char* buf = new char[size];
+    int32_t ret = fh->file->AioRead(buf, size, off,
+                                    std::bind(&ReadDone, req, buf, std::placeholders::_1));
+    if (ret != baidu::bfs::OK) {
+        delete[] buf;
+        fuse_reply_err(req, ToErrno(ret));
+    }
+}
+
+static void bfs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
+                         size_t size, off_t off, struct fuse_file_info *fi) {
+    FileHandle* fh = reinterpret_cast<FileHandle*>(fi->fh);
+    if (!fh->write) {
+        fuse_reply_err(req, EBADF);
+        return;
+    }
+    MutexLock lock(&fh->mu);
+    if (off < fh->size) {
+        fprintf(stderr, BFSERR"Write %lu bytes at %ld before the end %ld of #%lu\n",
+                size, off, fh->size, ino);
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    static const int32_t kZeroSize = 256 * 1024;
+    static char zeros[kZeroSize] = {0};
+    while (fh->size < off) {
+        int32_t len = std::min<int64_t>(kZeroSize, off - fh->size);
+        int32_t w = fh->file->Write(zeros, len);
+        if (w != len) {
+            fuse_reply_err(req, EIO);
+            return;
+        }
+        fh->size += len;
+    }
+    int32_t w = fh->file->Write(buf, size);
+    if (w < 0) {
+        fuse_reply_err(req, EIO);
+        return;
+    }
+    fh->size += w;
+    {
+        MutexLock inode_lock(&g_mu);
+        std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+        if (it != g_inodes.end()) {
+            it->second.write_size = std::max(it->second.write_size, fh->size);
+        }
+    }
+    fuse_reply_write(req, w);
+}
+
+static void bfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    FileHandle* fh = reinterpret_cast<FileHandle*>(fi->fh);
+    int32_t ret = baidu::bfs::OK;
+    if (fh->write) {
+        MutexLock lock(&fh->mu);
+        ret = fh->file->Sync();
+    }
+    fuse_reply_err(req, ToErrno(ret));
 }
 
-static void bfs_ll_fsync(fuse_req_t req, fuse_ino_t ino, 
+static void bfs_ll_fsync(fuse_req_t req, fuse_ino_t ino,
                          int datasync, struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s\n", __func__);
+    bfs_ll_flush(req, ino, fi);
+}
+
+static void bfs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    FileHandle* fh = reinterpret_cast<FileHandle*>(fi->fh);
+    int32_t ret = fh->file->Close();
+    if (ret != baidu::bfs::OK) {
+        fprintf(stderr, BFSERR"Close #%lu fail ret=%d\n", ino, ret);
+    }
+    delete fh->file;
+    if (fh->write) {
+        MutexLock lock(&g_mu);
+        std::map<fuse_ino_t, Inode>::iterator it = g_inodes.find(ino);
+        if (it != g_inodes.end()) {
+            it->second.write_size = 0;
+            it->second.expire = 0;
+        }
+    }
+    delete fh;
+    fuse_reply_err(req, ToErrno(ret));
+}
+
+static void bfs_ll_opendir(fuse_req_t req, fuse_ino_t ino,
+                           struct fuse_file_info *fi) {
+    int64_t dir_id = EntryOf(ino);
+    if (dir_id < 0) {
+        fuse_reply_err(req, ESTALE);
+        return;
+    }
+    baidu::bfs::BfsFileInfo* files = NULL;
+    int num = 0;
+    int32_t ret = g_fs->ListDirectoryById(dir_id, &files, &num);
+    if (ret != baidu::bfs::OK) {
+        fuse_reply_err(req, ToErrno(ret));
+        return;
+    }
+    DirHandle* dh = new DirHandle;
+    dh->entries.reserve(num + 2);
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_mode = S_IFDIR;
+    st.st_ino = ino;
+    dh->entries.push_back(std::make_pair(std::string("."), st));
+    dh->entries.push_back(std::make_pair(std::string(".."), st));
+    double expire = Now() + g_cache_timeout;
+    {
+        MutexLock lock(&g_mu);
+        if (g_dir_hints.size() > kMaxDirHints) {
+            g_dir_hints.clear();
+        }
+        for (int i = 0; i < num; i++) {
+            DirHint& hint = g_dir_hints[Dentry(ino, files[i].name)];
+            ToAttr(files[i], &hint.attr);
+            hint.expire = expire;
+            dh->entries.push_back(std::make_pair(std::string(files[i].name), hint.attr.st));
+        }
+    }
+    delete[] files;
+    fi->fh = reinterpret_cast<uint64_t>(dh);
+    if (fuse_reply_open(req, fi) != 0) {
+        delete dh;
+    }
+}
+
+static void bfs_ll_readdir(fuse_req_t req, fuse_ino_t ino,
+                           size_t size, off_t off, struct fuse_file_info *fi) {
+    DirHandle* dh = reinterpret_cast<DirHandle*>(fi->fh);
+    std::vector<char> buf(size);
+    size_t len = 0;
+    for (size_t i = off; i < dh->entries.size(); i++) {
+        size_t entry_len = fuse_add_direntry(req, &buf[len], size - len,
+                                             dh->entries[i].first.c_str(),
+                                             &dh->entries[i].second, i + 1);
+        if (entry_len > size - len) {
+            break;
+        }
+        len += entry_len;
+    }
+    fuse_reply_buf(req, len ? &buf[0] : NULL, len);
+}
+
+static void bfs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    delete reinterpret_cast<DirHandle*>(fi->fh);
+    fuse_reply_err(req, 0);
 }
 
-static void bfs_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, 
+static void bfs_ll_fsyncdir(fuse_req_t req, fuse_ino_t ino,
                             int datasync, struct fuse_file_info *fi) {
-    fprintf(stderr, BFS"%s\n", __func__);
+    fuse_reply_err(req, 0);
+}
+
+static void bfs_ll_statfs(fuse_req_t req, fuse_ino_t ino){
+    struct statvfs st;
+    memset(&st, 0, sizeof(st));
+    st.f_bsize = 1024 * 1024;
+    st.f_frsize = 1024 * 1024;
+    st.f_blocks = 1UL << 30;
+    st.f_bfree = 1UL << 30;
+    st.f_bavail = 1UL << 30;
+    st.f_files = 1UL << 30;
+    st.f_ffree = 1UL << 30;
+    st.f_favail = 1UL << 30;
+    st.f_namemax = 1023;
+    fuse_reply_statfs(req, &st);
 }
 
 static void bfs_ll_access(fuse_req_t req, fuse_ino_t ino, int mask) {
-    fprintf(stderr, BFS"%s\n", __func__);
+    fuse_reply_err(req, 0);
 }
 
 
 int parse_bfs_args(int* argc, char* argv[]) {
     if (*argc < 2) {
-        fprintf(stderr, "Usage: %s mount_point [-d]"
+        fprintf(stderr, "Usage: %s mount_point [-d] [-s]"
                         " [-c bfs_cluster_addr]"
-                        " [-p bfs_path]\n",
+                        " [-p bfs_path]"
+                        " [-t cache_timeout]\n",
                 argv[0]);
         fprintf(stderr, "\t-d                    Fuse debug (optional)\n"
+                        "\t-s                    Single threaded (optional)\n"
                         "\t-c bfs_cluster_addr   Ip:port\n"
                         "\t-p bfs_path           The path in BFS which you mount to the mount_point\n"
+                        "\t-t cache_timeout      Seconds the kernel caches entries and attributes,"
+                        " default 1\n"
                         "Example:\n"
                         "       %s /mnt/bfs -d -c 127.0.0.1:8827 -p /\n",
                 argv[0]);
@@ -130,6 +906,9 @@ int parse_bfs_args(int* argc, char* argv[]) {
         } else if (strncmp(argv[i], "-p", 2) == 0) {
             g_bfs_path = argv[i + 1];
             printf(BFS"Use path: %s\n", g_bfs_path.c_str());
+        } else if (strncmp(argv[i], "-t", 2) == 0) {
+            g_cache_timeout = atof(argv[i + 1]);
+            printf(BFS"Use cache timeout: %.1fs\n", g_cache_timeout);
         } else {
             continue;
         }
@@ -140,41 +919,72 @@ int parse_bfs_args(int* argc, char* argv[]) {
         *argc -= 2;
     }
     argv[*argc] = NULL;
+    if (g_bfs_path.empty()) {
+        g_bfs_path = "/";
+    } else if (g_bfs_path.size() > 1 && g_bfs_path[g_bfs_path.size() - 1] == '/') {
+        g_bfs_path.resize(g_bfs_path.size() - 1);
+    }
+    if (g_bfs_cluster.empty()) {
+        g_bfs_cluster = "localhost:8828";
+    }
     return 0;
 }
 
 int main(int argc, char *argv[])
 {
-    static struct fuse_lowlevel_ops ll_oper = {
-        .lookup = bfs_ll_lookup;
-        .getattr = bfs_ll_getattr;
-        .readdir = bfs_ll_readdir;
-        .open = bfs_ll_open;
-        .opendir = bfs_ll_opendir;
-        .read = bfs_ll_read;
-        .write = bfs_ll_write;
-        .mknod = bfs_ll_mknod;
-        .mkdir = bfs_ll_mkdir;
-        .create = bfs_ll_create;
-        .statfs = bfs_ll_statfs;
-        .rename = bfs_ll_rename;
-        .link = bfs_ll_link;
-        .unlink = bfs_ll_unlink;
-        .rmdir = bfs_ll_rmdir;
-        .fsync = bfs_ll_fsync;
-        .fsyncdir = bfs_ll_fsyncdir;
-        .access = bfs_ll_access;
-    };
+    static struct fuse_lowlevel_ops ll_oper;
+    memset(&ll_oper, 0, sizeof(ll_oper));
+    ll_oper.init = bfs_ll_init;
+    ll_oper.lookup = bfs_ll_lookup;
+    ll_oper.forget = bfs_ll_forget;
+    ll_oper.getattr = bfs_ll_getattr;
+    ll_oper.setattr = bfs_ll_setattr;
+    ll_oper.readlink = bfs_ll_readlink;
+    ll_oper.mknod = bfs_ll_mknod;
+    ll_oper.mkdir = bfs_ll_mkdir;
+    ll_oper.unlink = bfs_ll_unlink;
+    ll_oper.rmdir = bfs_ll_rmdir;
+    ll_oper.symlink = bfs_ll_symlink;
+    ll_oper.rename = bfs_ll_rename;
+    ll_oper.link = bfs_ll_link;
+    ll_oper.open = bfs_ll_open;
+    ll_oper.read = bfs_ll_read;
+    ll_oper.write = bfs_ll_write;
+    ll_oper.flush = bfs_ll_flush;
+    ll_oper.release = bfs_ll_release;
+    ll_oper.fsync = bfs_ll_fsync;
+    ll_oper.opendir = bfs_ll_opendir;
+    ll_oper.readdir = bfs_ll_readdir;
+    ll_oper.releasedir = bfs_ll_releasedir;
+    ll_oper.fsyncdir = bfs_ll_fsyncdir;
+    ll_oper.statfs = bfs_ll_statfs;
+    ll_oper.access = bfs_ll_access;
+    ll_oper.create = bfs_ll_create;
 
     if (parse_bfs_args(&argc, argv) != 0) {
         return -1;
     }
 
+    if (!baidu::bfs::FS::OpenFileSystem(g_bfs_cluster.c_str(), &g_fs,
+                                        baidu::bfs::FSOptions())) {
+        fprintf(stderr, BFSERR"Open file system: %s fail\n", g_bfs_cluster.c_str());
+        return -1;
+    }
+    baidu::bfs::BfsFileInfo root;
+    int32_t ret = g_fs->Stat(g_bfs_path.c_str(), &root);
+    if (ret != baidu::bfs::OK || !(root.mode & 01000)) {
+        fprintf(stderr, BFSERR"Mount path %s is not a directory ret=%d\n",
+                g_bfs_path.c_str(), ret);
+        return -1;
+    }
+    g_root_id = root.entry_id;
+
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
     char *mountpoint = NULL;
+    int multithreaded = 0;
 
     int err = 0;
-    if ((err = fuse_parse_cmdline(&args, &mountpoint, NULL, NULL)) != 0) {
+    if ((err = fuse_parse_cmdline(&args, &mountpoint, &multithreaded, NULL)) != 0) {
         fprintf(stderr, "fuse parse command line arguments error ret=%d\n", err);
         return -1;
     }
@@ -185,22 +995,26 @@ int main(int argc, char *argv[])
         return -1;
     }
 
-    struct fuse_session* se = 
+    struct fuse_session* se =
         fuse_lowlevel_new(&args, &ll_oper, sizeof(ll_oper), NULL);
     if (se == NULL) {
         fprintf(stderr, "fuse lowlevel new session error\n");
+        fuse_unmount(mountpoint, ch);
         return -1;
     }
 
     if ((err = fuse_set_signal_handlers(se)) != 0) {
         fprintf(stderr, "fuse set signal handlers error ret=%d\n", err);
+        fuse_session_destroy(se);
+        fuse_unmount(mountpoint, ch);
         return -1;
     }
 
-    fprintf(stderr, BFS"fuse_set_signal_handlers success.");
     fuse_session_add_chan(se, ch);
+    printf(BFS"Mount %s%s to %s, %s\n", g_bfs_cluster.c_str(), g_bfs_path.c_str(),
+           mountpoint, multithreaded ? "multithreaded" : "single threaded");
 
-    err = fuse_session_loop(se);
+    err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
 
     fuse_remove_signal_handlers(se);
     fuse_session_remove_chan(ch);
@@ -210,3 +1024,5 @@ int main(int argc, char *argv[])
 
     return err;
 }
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
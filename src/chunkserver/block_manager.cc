@@ -71,7 +71,7 @@ void BlockManager::Stat(std::string* str) {
     str->append("<table class=dataintable>");
     str->append("<tr><td>Path</td><td>Blocks</td><td>Quota</td><td>Size</td>"
                 "<td>BufWrite</td><td>DiskWrite</td><td>Read m/d</td>"
-                "<td>PenBuf</td><td>WritingBlocks</td></tr>");
+                "<td>PenBuf</td><td>WritingBlocks</td><td>Load</td></tr>");
     for (auto it = disks_.begin(); it != disks_.end(); ++it) {
         const DiskStat& stat = it->first;
         int64_t quota = it->second->GetQuota();
@@ -88,6 +88,8 @@ void BlockManager::Stat(std::string* str) {
                     common::NumToString(stat.disk_read_ops) + "</td>");
         str->append("<td>" + common::NumToString(stat.pending_buf));
         str->append("<td>" + common::NumToString(stat.writing_blocks));
+        str->append("<td>" + common::NumToString(it->second->GetLoad()));
+        str->append(it->second->WriteCapped() ? " capped" : "");
     }
     str->append("</table>");
 }
@@ -343,18 +345,56 @@ Block* BlockManager::FindBlock(int64_t block_id) {
     return block;
 }
 
+double BlockManager::DiskLoad() {
+    Disk* disk = PickDisk(0);
+    if (!disk) {
+        return kDiskMaxLoad;
+    }
+    double load = disk->GetLoad();
+    // Every disk is over the write limit
+    if (disk->WriteCapped()) {
+        load = std::max(load, 1.0);
+    }
+    return load;
+}
+
+void BlockManager::GetDiskInfo(::google::protobuf::RepeatedPtrField<DiskInfo>* disks) {
+    for (auto it = disks_.begin(); it != disks_.end(); ++it) {
+        const DiskStat& stat = it->first;
+        Disk* disk = it->second;
+        DiskInfo* info = disks->Add();
+        info->set_path(disk->Path());
+        info->set_quota(disk->GetQuota());
+        info->set_data_size(stat.data_size);
+        info->set_pending_buf(stat.pending_buf);
+        info->set_buf_write_bytes(stat.buf_write_bytes);
+        info->set_disk_write_bytes(stat.disk_write_bytes);
+        info->set_disk_read_ops(stat.disk_read_ops);
+        info->set_load(disk->GetLoad());
+        info->set_write_capped(disk->WriteCapped());
+    }
+}
+
 Disk* BlockManager::PickDisk(int64_t block_id) {
     double min_load = kDiskMaxLoad - 1;
     Disk* target = NULL;
+    double min_capped_load = kDiskMaxLoad - 1;
+    Disk* capped_target = NULL;
     for (auto it = disks_.begin(); it != disks_.end(); ++it) {
         Disk* disk = it->second;
         double load = disk->GetLoad();
-        if (load < min_load) {
+        if (disk->WriteCapped()) {
+            if (load < min_capped_load) {
+                min_capped_load = load;
+                capped_target = disk;
+            }
+        } else if (load < min_load) {
             min_load = load;
             target = disk;
         }
     }
-    return target;
+    // All disks over the write limit, still take the block on the least loaded one
+    return target ? target : capped_target;
 }
 
 int64_t BlockManager::FindSmallest(std::vector<leveldb::Iterator*>& iters, int32_t* idx) {
@@ -13,6 +13,7 @@
 
 #include <common/thread_pool.h>
 #include "proto/status_code.pb.h"
+#include "proto/nameserver.pb.h"
 #include "chunkserver/counter_manager.h"
 
 namespace leveldb {
@@ -48,6 +49,9 @@ public:
 
     DiskStat Stat();
     void Stat(std::string* str);
+    /// Load of the disk PickDisk would choose now
+    double DiskLoad();
+    void GetDiskInfo(::google::protobuf::RepeatedPtrField<DiskInfo>* disks);
 private:
     void CheckStorePath(const std::string& store_path);
     Disk* PickDisk(int64_t block_id);
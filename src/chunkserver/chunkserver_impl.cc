@@ -12,6 +12,8 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
+#include <unistd.h>
+#include <algorithm>
 #include <climits>
 #include <functional>
 
@@ -47,6 +49,7 @@ DECLARE_int32(chunkserver_work_thread_num);
 DECLARE_int32(chunkserver_read_thread_num);
 DECLARE_int32(chunkserver_write_thread_num);
 DECLARE_int32(chunkserver_recover_thread_num);
+DECLARE_int32(chunkserver_recover_window);
 DECLARE_int32(chunkserver_max_pending_buffers);
 DECLARE_int64(chunkserver_max_unfinished_bytes);
 DECLARE_bool(chunkserver_auto_clean);
@@ -81,7 +84,10 @@ ChunkServerImpl::ChunkServerImpl()
      report_id_(0),
      is_first_round_(true),
      first_round_report_start_(-1),
-     service_stop_(false) {
+     service_stop_(false),
+     recover_bandwidth_(0),
+     recover_tokens_(0),
+     recover_refill_time_(common::timer::get_micros()) {
     data_server_addr_ = common::util::GetLocalHostName() + ":" + FLAGS_chunkserver_port;
     params_.set_report_interval(FLAGS_blockreport_interval);
     params_.set_report_size(FLAGS_blockreport_size);
@@ -157,6 +163,9 @@ void ChunkServerImpl::Register() {
     if (response.report_size() != -1) {
         params_.set_report_size(response.report_size());
     }
+    if (response.recover_bandwidth() != -1) {
+        SetRecoverBandwidth(response.recover_bandwidth());
+    }
     int64_t new_version = response.namespace_version();
     if (block_manager_->NamespaceVersion() != new_version) {
         // NameSpace change
@@ -215,6 +224,8 @@ void ChunkServerImpl::SendHeartbeat() {
     request.set_r_qps(c_stat.read_ops);
     request.set_r_speed(c_stat.read_bytes);
     request.set_recover_speed(c_stat.recover_bytes);
+    request.set_disk_load(block_manager_->DiskLoad());
+    block_manager_->GetDiskInfo(request.mutable_disks());
     HeartBeatResponse response;
     if (!nameserver_->SendRequest(&NameServer_Stub::HeartBeat, &request, &response, 15)) {
         LOG(WARNING, "Heart beat fail\n");
@@ -239,6 +250,9 @@ void ChunkServerImpl::SendHeartbeat() {
     if (response.report_size() != -1) {
         params_.set_report_size(response.report_size());
     }
+    if (response.recover_bandwidth() != -1) {
+        SetRecoverBandwidth(response.recover_bandwidth());
+    }
     heartbeat_task_id_ = heartbeat_thread_->DelayTask(FLAGS_heartbeat_interval * 1000,
         std::bind(&ChunkServerImpl::SendHeartbeat, this));
 }
@@ -691,6 +705,76 @@ void ChunkServerImpl::ReadBlock(::google::protobuf::RpcController* controller,
         block->DecRef();
     }
 }
+void ChunkServerImpl::ReadBlockV(::google::protobuf::RpcController* controller,
+                                 const ReadBlockVRequest* request,
+                                 ReadBlockVResponse* response,
+                                 ::google::protobuf::Closure* done) {
+    int64_t block_id = request->block_id();
+    int64_t total_len = 0;
+    std::vector<std::pair<int64_t, int32_t> > ranges;
+    for (int i = 0; i < request->ranges_size(); i++) {
+        const BlockRange& range = request->ranges(i);
+        if (range.len() <= 0 || range.offset() < 0) {
+            total_len = -1;
+            break;
+        }
+        total_len += range.len();
+        ranges.push_back(std::make_pair(range.offset(), range.len()));
+    }
+    if (ranges.empty() || total_len <= 0 || total_len > (64<<20)) {
+        LOG(WARNING, "ReadBlockV #%ld bad parameters, ranges: %d len: %ld",
+            block_id, request->ranges_size(), total_len);
+        response->set_status(kBadParameter);
+        done->Run();
+        return;
+    }
+    if (!response->has_sequence_id()) {
+        response->set_sequence_id(request->sequence_id());
+        response->add_timestamp(common::timer::get_micros());
+        std::function<void ()> task =
+            std::bind(&ChunkServerImpl::ReadBlockV, this, controller, request, response, done);
+        read_thread_pool_->AddTask(task);
+        return;
+    }
+
+    StatusCode status = kOK;
+    int64_t find_start = common::timer::get_micros();
+    Block* block = block_manager_->FindBlock(block_id);
+    if (block == NULL) {
+        status = kCsNotFound;
+        LOG(WARNING, "ReadBlockV not found: #%ld ranges: %lu", block_id, ranges.size());
+    } else {
+        int64_t read_start = common::timer::get_micros();
+        std::vector<std::string> outputs;
+        int64_t len = block->ReadV(ranges, &outputs);
+        int64_t read_end = common::timer::get_micros();
+        if (len >= 0) {
+            for (size_t i = 0; i < outputs.size(); i++) {
+                response->add_databuf()->swap(outputs[i]);
+            }
+            LOG(INFO, "ReadBlockV #%ld ranges: %lu len: %ld return: %ld "
+                      "use %ld %ld %ld %ld %ld",
+                block_id, ranges.size(), total_len, len,
+                (response->timestamp(0) - request->sequence_id()) / 1000, // rpc time
+                (find_start - response->timestamp(0)) / 1000,   // dispatch time
+                (read_start - find_start) / 1000, // find time
+                (read_end - read_start) / 1000,  // read time
+                (read_end - response->timestamp(0)) / 1000);    // service time
+            g_read_ops.Inc();
+            g_read_bytes.Add(len);
+        } else {
+            status = kReadError;
+            LOG(WARNING, "ReadBlockV #%ld fail ranges: %lu len: %ld",
+                block_id, ranges.size(), total_len);
+        }
+    }
+    response->set_status(status);
+    done->Run();
+    if (block) {
+        block->DecRef();
+    }
+}
+
 void ChunkServerImpl::RemoveObsoleteBlocks(std::vector<int64_t> blocks) {
     for (size_t i = 0; i < blocks.size(); i++) {
         StatusCode s = block_manager_->RemoveBlock(blocks[i]);
@@ -763,59 +847,176 @@ StatusCode ChunkServerImpl::WriteRecoverBlock(Block* block, ChunkServer_Stub* ch
     int32_t seq = 0;
     char* buf = new char[read_len];
     int64_t start_recover = common::timer::get_micros();
+    // The first packet creates the block on the target, or tells how far
+    // an earlier push got, so it goes alone
+    int64_t len = block->Read(buf, read_len, offset);
+    g_read_bytes.Add(len);
+    g_read_ops.Inc();
+    if (len < 0) {
+        LOG(WARNING, "[WriteRecoverBlock] #%ld read offset %ld len %d return %d",
+                block->Id(), offset, read_len, len);
+        delete[] buf;
+        return kReadError;
+    }
+    ThrottleRecover(len);
+    WriteBlockRequest request;
+    WriteBlockResponse response;
+    request.set_sequence_id(common::timer::get_micros());
+    request.set_block_id(block->Id());
+    request.set_databuf(buf, len);
+    request.set_is_last(len == 0);
+    request.set_packet_seq(seq);
+    request.set_offset(offset);
+    request.set_recover_version(block->GetVersion());
+    request.set_total_size(block->Size());
+    delete[] buf;
+    bool ret = rpc_client_->SendRequest(chunkserver, &ChunkServer_Stub::WriteBlock,
+                             &request, &response, 60, 1);
+    if (!ret || (response.status() != kOK && response.status() != kBlockExist)) {
+        LOG(WARNING, "[WriteRecoverBlock] #%ld write failed, offset: %ld len: %ld ret: %d, status: %s",
+                block->Id(), offset, len, ret, StatusCode_Name(response.status()).c_str());
+        return kWriteError;
+    }
+    if (response.status() == kOK) {
+        offset += len;
+        g_recover_bytes.Add(len);
+        ++seq;
+        if (len == 0) {
+            return kOK;
+        }
+    } else {
+        offset = response.current_size();
+        seq = response.current_seq() + 1;
+    }
+
+    // Keep a window of packets in flight, reading the next one from disk
+    // while the target writes the previous ones
+    RecoverWindow window;
+    StatusCode status = kServiceStop;
     while (!service_stop_) {
         int32_t now_time = common::timer::now_time();
         if (now_time > cancel_time) {
-            delete[] buf;
             *timeout = true;
-            return kTimeout;
+            status = kTimeout;
+            break;
         }
-        int64_t len = block->Read(buf, read_len, offset);
+        {
+            MutexLock lock(&window.mu);
+            while (window.pending >= FLAGS_chunkserver_recover_window && window.status == kOK) {
+                window.cond.TimeWait(100);
+            }
+            if (window.status != kOK) {
+                status = window.status;
+                break;
+            }
+        }
+        WriteBlockRequest* packet = new WriteBlockRequest();
+        std::string* databuf = packet->mutable_databuf();
+        databuf->resize(read_len);
+        len = block->Read(&(*databuf)[0], read_len, offset);
         g_read_bytes.Add(len);
         g_read_ops.Inc();
         if (len < 0) {
             LOG(WARNING, "[WriteRecoverBlock] #%ld read offset %ld len %d return %d",
                     block->Id(), offset, read_len, len);
-            delete[] buf;
-            return kReadError;
-        }
-        WriteBlockRequest request;
-        WriteBlockResponse response;
-        request.set_sequence_id(common::timer::get_micros());
-        request.set_block_id(block->Id());
-        request.set_databuf(buf, len);
-        request.set_is_last(len == 0);
-        request.set_packet_seq(seq);
-        request.set_offset(offset);
-        request.set_recover_version(block->GetVersion());
-        request.set_total_size(block->Size());
-        bool ret = rpc_client_->SendRequest(chunkserver, &ChunkServer_Stub::WriteBlock,
-                                 &request, &response, 60, 1);
-        if (!ret || (response.status() != kOK && response.status() != kBlockExist)) {
-            LOG(WARNING, "[WriteRecoverBlock] #%ld write failed, offset: %ld len: %ld ret: %d, status: %s",
-                    block->Id(), offset, len, ret, StatusCode_Name(response.status()).c_str());
-            delete[] buf;
-            return kWriteError;
+            delete packet;
+            status = kReadError;
+            break;
         }
-        if (response.status() == kOK) {
-            offset += len;
-            g_recover_bytes.Add(len);
-            ++seq;
-        } else if (response.status() == kBlockExist) {
-            offset = response.current_size();
-            seq = response.current_seq() + 1;
+        databuf->resize(len);
+        ThrottleRecover(len);
+        packet->set_sequence_id(common::timer::get_micros());
+        packet->set_block_id(block->Id());
+        packet->set_is_last(len == 0);
+        packet->set_packet_seq(seq);
+        packet->set_offset(offset);
+        packet->set_recover_version(block->GetVersion());
+        packet->set_total_size(block->Size());
+        {
+            MutexLock lock(&window.mu);
+            ++window.pending;
         }
+        std::function<void (const WriteBlockRequest*, WriteBlockResponse*, bool, int)> callback =
+            std::bind(&ChunkServerImpl::WriteRecoverCallback, this, &window,
+                      std::placeholders::_1, std::placeholders::_2,
+                      std::placeholders::_3, std::placeholders::_4);
+        rpc_client_->AsyncRequest(chunkserver, &ChunkServer_Stub::WriteBlock,
+                                  packet, new WriteBlockResponse(), callback, 60, 1);
+        offset += len;
+        ++seq;
         if (len == 0) {
-            delete[] buf;
-            int64_t end_recover = common::timer::get_micros();
-            LOG(DEBUG, "[WriteRecoverBlock] #%ld finish recover, use %ld ms",
-                    block->Id(), (end_recover - start_recover) / 1000);
-            return kOK;
+            status = kOK;
+            break;
         }
     }
-    LOG(INFO, "[WriteRecoverBlock] #%ld service_stop_", block->Id());
-    delete[] buf;
-    return kServiceStop;
+    // Callbacks use the window, wait for all of them
+    MutexLock lock(&window.mu);
+    while (window.pending > 0) {
+        window.cond.Wait();
+    }
+    if (status == kOK && window.status != kOK) {
+        status = window.status;
+    }
+    if (status == kOK) {
+        int64_t end_recover = common::timer::get_micros();
+        LOG(DEBUG, "[WriteRecoverBlock] #%ld finish recover, use %ld ms",
+                block->Id(), (end_recover - start_recover) / 1000);
+    } else if (status == kServiceStop) {
+        LOG(INFO, "[WriteRecoverBlock] #%ld service_stop_", block->Id());
+    }
+    return status;
+}
+
+void ChunkServerImpl::WriteRecoverCallback(RecoverWindow* window,
+                                           const WriteBlockRequest* request,
+                                           WriteBlockResponse* response,
+                                           bool failed, int error) {
+    if (failed || response->status() != kOK) {
+        LOG(WARNING, "[WriteRecoverBlock] #%ld write failed, seq: %d offset: %ld len: %lu "
+                     "error: %d, status: %s",
+                request->block_id(), request->packet_seq(), request->offset(),
+                request->databuf().size(), error, StatusCode_Name(response->status()).c_str());
+    } else {
+        g_recover_bytes.Add(request->databuf().size());
+    }
+    MutexLock lock(&window->mu);
+    if ((failed || response->status() != kOK) && window->status == kOK) {
+        window->status = kWriteError;
+    }
+    --window->pending;
+    window->cond.Signal();
+    delete request;
+    delete response;
+}
+
+void ChunkServerImpl::SetRecoverBandwidth(int32_t bandwidth) {
+    MutexLock lock(&recover_mu_);
+    recover_bandwidth_ = bandwidth;
+}
+
+void ChunkServerImpl::ThrottleRecover(int64_t bytes) {
+    while (!service_stop_) {
+        int64_t wait_time = 0;
+        {
+            MutexLock lock(&recover_mu_);
+            int32_t bandwidth = recover_bandwidth_;
+            if (bandwidth <= 0) {
+                return;
+            }
+            double rate = bandwidth * 1024.0 * 1024.0;
+            int64_t now = common::timer::get_micros();
+            // Allow a burst of one second at most
+            recover_tokens_ = std::min(recover_tokens_ + rate * (now - recover_refill_time_) / 1000000,
+                                       rate);
+            recover_refill_time_ = now;
+            if (recover_tokens_ > 0) {
+                recover_tokens_ -= bytes;
+                return;
+            }
+            wait_time = static_cast<int64_t>(-recover_tokens_ * 1000000 / rate) + 1;
+        }
+        usleep(std::min(wait_time, 100000L));
+    }
 }
 
 void ChunkServerImpl::GetBlockInfo(::google::protobuf::RpcController* controller,
@@ -11,6 +11,7 @@
 #include "proto/nameserver.pb.h"
 #include "proto/status_code.pb.h"
 
+#include <common/mutex.h>
 #include <common/thread_pool.h>
 
 #include "chunkserver/counter_manager.h"
@@ -32,6 +33,15 @@ class ChunkServer_Stub;
 class Block;
 typedef ChunkserverCounterManager::ChunkserverStat ChunkserverStat;
 
+/// Recover packets in flight for one WriteRecoverBlock
+struct RecoverWindow {
+    Mutex mu;
+    CondVar cond;
+    int32_t pending;
+    StatusCode status;          ///< first failure of a packet
+    RecoverWindow() : cond(&mu), pending(0), status(kOK) {}
+};
+
 class ChunkServerImpl : public ChunkServer {
 public:
     ChunkServerImpl();
@@ -45,6 +55,10 @@ public:
                            const ReadBlockRequest* request,
                            ReadBlockResponse* response,
                            ::google::protobuf::Closure* done);
+    virtual void ReadBlockV(::google::protobuf::RpcController* controller,
+                            const ReadBlockVRequest* request,
+                            ReadBlockVResponse* response,
+                            ::google::protobuf::Closure* done);
     virtual void GetBlockInfo(::google::protobuf::RpcController* controller,
                               const GetBlockInfoRequest* request,
                               GetBlockInfoResponse* response,
@@ -74,6 +88,12 @@ private:
     void PushBlock(const ReplicaInfo& new_replica_info, int32_t cancel_time);
     StatusCode PushBlockProcess(const ReplicaInfo& new_replica_info, int32_t cancel_time);
     StatusCode WriteRecoverBlock(Block* block, ChunkServer_Stub* chunkserver, int32_t cancel_time, bool* timeout);
+    void WriteRecoverCallback(RecoverWindow* window,
+                              const WriteBlockRequest* request,
+                              WriteBlockResponse* response,
+                              bool failed, int error);
+    void ThrottleRecover(int64_t bytes);
+    void SetRecoverBandwidth(int32_t bandwidth);
     void CloseIncompleteBlock(int64_t block_id);
     void StopBlockReport();
     void SendHeartbeat();
@@ -101,6 +121,12 @@ private:
     volatile bool service_stop_;
 
     Params params_;
+    /// Token bucket for recover traffic, refilled at recover_bandwidth_ MB/s.
+    /// The rate comes with heartbeats, so it is kept apart from params_.
+    Mutex recover_mu_;
+    int32_t recover_bandwidth_;
+    double recover_tokens_;
+    int64_t recover_refill_time_;
 };
 
 } // namespace bfs
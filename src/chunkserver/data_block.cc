@@ -10,6 +10,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <functional>
 
 #include <gflags/gflags.h>
@@ -23,6 +24,7 @@
 #include "chunkserver/disk.h"
 
 DECLARE_int32(write_buf_size);
+DECLARE_int32(chunkserver_readv_merge_gap);
 
 namespace baidu {
 namespace bfs {
@@ -254,6 +256,52 @@ int64_t Block::Read(char* buf, int64_t len, int64_t offset) {
     }
     return readlen;
 }
+int64_t Block::ReadV(const std::vector<std::pair<int64_t, int32_t> >& ranges,
+                     std::vector<std::string>* outputs) {
+    outputs->clear();
+    outputs->resize(ranges.size());
+    // Sort by offset, so that the block is read in one pass
+    std::vector<size_t> order(ranges.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&ranges](size_t a, size_t b) {
+        return ranges[a].first < ranges[b].first;
+    });
+    int64_t total = 0;
+    std::vector<char> buf;
+    size_t i = 0;
+    while (i < order.size()) {
+        // Merge the following ranges which overlap or nearly touch this one
+        int64_t start = ranges[order[i]].first;
+        int64_t end = start + ranges[order[i]].second;
+        size_t j = i + 1;
+        while (j < order.size()
+               && ranges[order[j]].first <= end + FLAGS_chunkserver_readv_merge_gap) {
+            end = std::max(end, ranges[order[j]].first + ranges[order[j]].second);
+            ++j;
+        }
+        if (start > Size()) {
+            // Past the end, like Read at the end these ranges get 0 bytes
+            break;
+        }
+        buf.resize(end - start);
+        int64_t len = Read(&buf[0], end - start, start);
+        if (len < 0) {
+            return len;
+        }
+        for (; i < j; i++) {
+            const std::pair<int64_t, int32_t>& range = ranges[order[i]];
+            int64_t pos = range.first - start;
+            int64_t rlen = std::min(static_cast<int64_t>(range.second), len - pos);
+            if (rlen > 0) {
+                (*outputs)[order[i]].assign(&buf[pos], rlen);
+                total += rlen;
+            }
+        }
+    }
+    return total;
+}
 /// Write operation.
 bool Block::Write(int32_t seq, int64_t offset, const char* data,
                   int64_t len, int64_t* add_use) {
@@ -60,6 +60,10 @@ public:
     bool IsFinished() const;
     /// Read operation.
     int64_t Read(char* buf, int64_t len, int64_t offset);
+    /// Vectored read of (offset, len) ranges, adjacent ranges are merged into one read.
+    /// Return total bytes read, ranges past the end get 0 bytes, or the error code of Read.
+    int64_t ReadV(const std::vector<std::pair<int64_t, int32_t> >& ranges,
+                  std::vector<std::string>* outputs);
     /// Write operation.
     bool Write(int32_t seq, int64_t offset, const char* data,
                int64_t len, int64_t* add_use = NULL);
@@ -19,6 +19,7 @@
 DECLARE_int32(disk_io_thread_num);
 DECLARE_int32(chunkserver_disk_buf_size);
 DECLARE_int64(chunkserver_disk_safe_space);
+DECLARE_int32(chunkserver_disk_write_limit);
 
 namespace baidu {
 namespace bfs {
@@ -196,6 +197,14 @@ double Disk::GetLoad() {
     return disk_rate * disk_rate + pending_rate;
 }
 
+bool Disk::WriteCapped() {
+    if (FLAGS_chunkserver_disk_write_limit <= 0) {
+        return false;
+    }
+    DiskStat stat = counter_manager_.GetStat();
+    return stat.buf_write_bytes >= (static_cast<int64_t>(FLAGS_chunkserver_disk_write_limit) << 20);
+}
+
 DiskStat Disk::Stat() {
     counter_manager_.GatherCounters(&counters_);
     DiskStat stat = counter_manager_.GetStat();
@@ -45,6 +45,8 @@ public:
     void AddTask(std::function<void ()> func, bool is_priority);
     int64_t GetQuota();
     double GetLoad();
+    /// Written faster than chunkserver_disk_write_limit in the last period
+    bool WriteCapped();
 
     bool CloseBlock(Block* block);
     bool RemoveBlock(int64_t block_id);
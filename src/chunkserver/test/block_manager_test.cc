@@ -7,6 +7,7 @@
 #include <iostream>
 #include "chunkserver/block_manager.h"
 #include "chunkserver/data_block.h"
+#include "chunkserver/disk.h"
 
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
@@ -14,6 +15,7 @@
 DECLARE_string(namedb_path);
 DECLARE_int32(write_buf_size);
 DECLARE_bool(chunkserver_multi_path_on_one_disk);
+DECLARE_int32(chunkserver_disk_write_limit);
 
 namespace baidu {
 namespace bfs {
@@ -267,6 +269,42 @@ TEST_F(BlockManagerTest, WrongNsVersion) {
     system("rm -rf ./data3");
 }
 
+TEST_F(BlockManagerTest, DiskWriteLimit) {
+    FLAGS_chunkserver_multi_path_on_one_disk = true;
+    std::string store_path = "./data1,./data2,./data3";
+    mkdir("./data1", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    mkdir("./data2", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    mkdir("./data3", S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH);
+    BlockManager block_manager(store_path);
+    bool ret = block_manager.LoadStorage();
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(block_manager.disks_.size(), 3U);
+
+    FLAGS_chunkserver_disk_write_limit = 1;
+    Disk* idle = block_manager.disks_[2].second;
+    for (int i = 0; i < 2; i++) {
+        block_manager.disks_[i].second->counter_manager_.stat_.buf_write_bytes = 10 << 20;
+    }
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(block_manager.PickDisk(i), idle);
+    }
+    ::google::protobuf::RepeatedPtrField<DiskInfo> disks;
+    block_manager.GetDiskInfo(&disks);
+    ASSERT_EQ(disks.size(), 3);
+    ASSERT_TRUE(disks.Get(0).write_capped());
+    ASSERT_FALSE(disks.Get(2).write_capped());
+
+    // All disks capped, writes still go somewhere
+    idle->counter_manager_.stat_.buf_write_bytes = 10 << 20;
+    ASSERT_TRUE(block_manager.PickDisk(0) != NULL);
+    ASSERT_GE(block_manager.DiskLoad(), 1.0);
+    FLAGS_chunkserver_disk_write_limit = 0;
+
+    system("rm -rf ./data1");
+    system("rm -rf ./data2");
+    system("rm -rf ./data3");
+}
+
 }
 }
 
@@ -4,6 +4,17 @@
 //
 // Author: yanshiguang02@baidu.com
 
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include <sofa/pbrpc/pbrpc.h>
+
+#include "rpc/rpc_client.h"
+#include "chunkserver/block_manager.h"
+#include "chunkserver/data_block.h"
+
 #define private public
 #include "chunkserver/chunkserver_impl.h"
 
@@ -12,6 +23,7 @@
 
 DECLARE_string(namedb_path);
 DECLARE_string(block_store_path);
+DECLARE_int32(chunkserver_recover_window);
 
 namespace baidu {
 namespace bfs {
@@ -28,6 +40,182 @@ TEST_F(ChunkserverImplTest, ReadFile) {
     delete cs;
 }
 
+/// Target of a block recover, holds the packets after the first one
+/// until the test completes them
+class FakeRecoverTarget : public ChunkServer {
+public:
+    FakeRecoverTarget() : cond_(&mu_), fail_seq_(-1), max_pending_(0), last_seq_(-1),
+                          got_last_(false), finished_(false), status_(kOK) {}
+    virtual void WriteBlock(::google::protobuf::RpcController* controller,
+                            const WriteBlockRequest* request,
+                            WriteBlockResponse* response,
+                            ::google::protobuf::Closure* done) {
+        MutexLock lock(&mu_);
+        const std::string& databuf = request->databuf();
+        size_t end = request->offset() + databuf.size();
+        if (data_.size() < end) {
+            data_.resize(end);
+        }
+        data_.replace(request->offset(), databuf.size(), databuf);
+        last_seq_ = std::max(last_seq_, request->packet_seq());
+        got_last_ = got_last_ || request->is_last();
+        response->set_status(request->packet_seq() == fail_seq_ ? kWriteError : kOK);
+        if (request->packet_seq() == 0) {
+            done->Run();
+            return;
+        }
+        pending_.push_back(done);
+        max_pending_ = std::max(max_pending_, static_cast<int32_t>(pending_.size()));
+        cond_.Broadcast();
+    }
+    /// Wait for 'num' packets held, or for no more to come
+    void WaitPending(size_t num) {
+        MutexLock lock(&mu_);
+        for (int i = 0; i < 50 && pending_.size() < num && !got_last_ && !finished_; i++) {
+            cond_.TimeWait(100);
+        }
+    }
+    /// Complete the packets held, the last received first
+    void CompleteReversed() {
+        std::vector< ::google::protobuf::Closure*> pending;
+        {
+            MutexLock lock(&mu_);
+            pending.assign(pending_.rbegin(), pending_.rend());
+            pending_.clear();
+        }
+        for (size_t i = 0; i < pending.size(); i++) {
+            pending[i]->Run();
+        }
+    }
+    size_t PendingNum() {
+        MutexLock lock(&mu_);
+        return pending_.size();
+    }
+    /// Result of WriteRecoverBlock
+    void Finish(StatusCode status) {
+        MutexLock lock(&mu_);
+        status_ = status;
+        finished_ = true;
+        cond_.Broadcast();
+    }
+    bool Finished() {
+        MutexLock lock(&mu_);
+        return finished_;
+    }
+public:
+    Mutex mu_;
+    CondVar cond_;
+    std::vector< ::google::protobuf::Closure*> pending_;
+    std::string data_;
+    int32_t fail_seq_;
+    int32_t max_pending_;
+    int32_t last_seq_;
+    bool got_last_;
+    bool finished_;
+    StatusCode status_;
+};
+
+class RecoverTest : public ::testing::Test {
+public:
+    RecoverTest() : rpc_server_(sofa::pbrpc::RpcServerOptions()), recover_pool_(1),
+                    cs_(NULL), block_(NULL), fake_(NULL), target_(NULL), started_(false) {}
+protected:
+    virtual void SetUp() {
+        FLAGS_chunkserver_recover_window = 3;
+        mkdir("./recover_test", 0755);
+        FLAGS_block_store_path = "./recover_test";
+        cs_ = new ChunkServerImpl();
+        // 6 packets and a half
+        for (int i = 0; i < (13 << 19); i++) {
+            block_data_.push_back(static_cast<char>(rand() & 0xff));
+        }
+        StatusCode s;
+        block_ = cs_->block_manager_->CreateBlock(1, &s);
+        ASSERT_EQ(kOK, s);
+        ASSERT_TRUE(block_->Write(0, 0, block_data_.data(), block_data_.size()));
+        block_->SetSliceNum(1);
+        ASSERT_TRUE(cs_->block_manager_->CloseBlock(block_, true));
+        // Owned by rpc_server_
+        fake_ = new FakeRecoverTarget();
+        ASSERT_TRUE(rpc_server_.RegisterService(fake_));
+        ASSERT_TRUE(rpc_server_.Start("127.0.0.1:18827"));
+        ASSERT_TRUE(cs_->rpc_client_->GetStub("127.0.0.1:18827", &target_));
+    }
+    virtual void TearDown() {
+        // A failed assertion may leave packets held
+        while (started_ && !fake_->Finished()) {
+            fake_->WaitPending(1);
+            fake_->CompleteReversed();
+        }
+        recover_pool_.Stop(true);
+        delete target_;
+        rpc_server_.Stop();
+        block_->DecRef();
+        delete cs_;
+        system("rm -rf ./recover_test");
+    }
+    void StartRecover() {
+        started_ = true;
+        recover_pool_.AddTask(std::bind(&RecoverTest::Recover, this));
+    }
+    void Recover() {
+        bool timeout = false;
+        fake_->Finish(cs_->WriteRecoverBlock(block_, target_,
+                                             common::timer::now_time() + 60, &timeout));
+    }
+protected:
+    sofa::pbrpc::RpcServer rpc_server_;
+    ThreadPool recover_pool_;
+    ChunkServerImpl* cs_;
+    Block* block_;
+    std::string block_data_;
+    FakeRecoverTarget* fake_;
+    ChunkServer_Stub* target_;
+    bool started_;
+};
+
+TEST_F(RecoverTest, Window) {
+    StartRecover();
+    while (!fake_->Finished()) {
+        fake_->WaitPending(FLAGS_chunkserver_recover_window);
+        // No more than the window in flight, even given time
+        usleep(100000);
+        ASSERT_LE(fake_->PendingNum(), static_cast<size_t>(FLAGS_chunkserver_recover_window));
+        // Completed out of order
+        fake_->CompleteReversed();
+    }
+    ASSERT_EQ(kOK, fake_->status_);
+    ASSERT_EQ(FLAGS_chunkserver_recover_window, fake_->max_pending_);
+    // 7 packets of data and the last empty one
+    ASSERT_EQ(7, fake_->last_seq_);
+    ASSERT_TRUE(fake_->data_ == block_data_);
+}
+
+TEST_F(RecoverTest, WriteFail) {
+    fake_->fail_seq_ = 2;
+    StartRecover();
+    while (!fake_->Finished()) {
+        fake_->WaitPending(1);
+        fake_->CompleteReversed();
+    }
+    ASSERT_EQ(kWriteError, fake_->status_);
+    // Sending stops once the failure is known
+    ASSERT_LE(fake_->last_seq_, 2 + FLAGS_chunkserver_recover_window);
+    ASSERT_FALSE(fake_->got_last_);
+}
+
+TEST_F(RecoverTest, ReadFail) {
+    StartRecover();
+    fake_->WaitPending(FLAGS_chunkserver_recover_window);
+    ASSERT_EQ(static_cast<size_t>(FLAGS_chunkserver_recover_window), fake_->PendingNum());
+    // The next packet can't be read
+    block_->SetDeleted();
+    fake_->CompleteReversed();
+    recover_pool_.Stop(true);
+    ASSERT_EQ(kReadError, fake_->status_);
+    ASSERT_EQ(FLAGS_chunkserver_recover_window, fake_->last_seq_);
+    ASSERT_EQ(0U, fake_->PendingNum());
+}
 }
 }
 
@@ -102,6 +102,53 @@ TEST_F(DataBlockTest, WriteAndReadBlock) {
     system("rm -rf ./block123");
 }
 
+TEST_F(DataBlockTest, ReadV) {
+    BlockMeta meta;
+    mkdir("./block123", 0755);
+    std::string file_path("./block123");
+    Disk disk(file_path, 1000000);
+    disk.LoadStorage(std::bind(AddBlock, std::placeholders::_1,
+                               std::placeholders::_2, std::placeholders::_3));
+    FileCache file_cache(10);
+    meta.set_block_id(123);
+    meta.set_store_path(file_path);
+    Block* block = new Block(meta, &disk, &file_cache);
+    block->AddRef();
+    std::string write_data("hello world");
+    ASSERT_TRUE(block->Write(0, 0, write_data.data(), write_data.size()));
+    block->SetSliceNum(1);
+    block->Close(true);
+
+    std::vector<std::pair<int64_t, int32_t> > ranges;
+    ranges.push_back(std::make_pair(6, 5));     // "world"
+    ranges.push_back(std::make_pair(0, 5));     // "hello"
+    ranges.push_back(std::make_pair(2, 3));     // "llo", overlaps
+    ranges.push_back(std::make_pair(9, 10));    // "ld", beyond the end
+    std::vector<std::string> outputs;
+    int64_t len = block->ReadV(ranges, &outputs);
+    ASSERT_EQ(len, 15);
+    ASSERT_EQ(outputs.size(), 4U);
+    ASSERT_EQ(outputs[0], "world");
+    ASSERT_EQ(outputs[1], "hello");
+    ASSERT_EQ(outputs[2], "llo");
+    ASSERT_EQ(outputs[3], "ld");
+
+    // Past the end, alone or merged into a run, 0 bytes for the range
+    ranges.clear();
+    ranges.push_back(std::make_pair(100, 5));
+    ASSERT_EQ(block->ReadV(ranges, &outputs), 0);
+    ASSERT_EQ(outputs.size(), 1U);
+    ASSERT_EQ(outputs[0], "");
+
+    ranges.clear();
+    ranges.push_back(std::make_pair(6, 5));
+    ranges.push_back(std::make_pair(12, 5));
+    ASSERT_EQ(block->ReadV(ranges, &outputs), 5);
+    ASSERT_EQ(outputs[0], "world");
+    ASSERT_EQ(outputs[1], "");
+    block->DecRef();
+    system("rm -rf ./block123");
+}
 
 }
 }
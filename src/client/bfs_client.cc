@@ -38,9 +38,12 @@ void print_usage() {
     printf("\t    rmdir <path>... : remove empty directory\n");
     printf("\t    rmr <path>... : remove directory recursively\n");
     printf("\t    du <path>... : count disk usage for path\n");
-    printf("\t    stat : list current stat of the file system\n");
+    printf("\t    setquota <path> <bytes> <files> : limit usage of directory, 0 for no limit\n");
+    printf("\t    quota <path>... : show usage and quota of directory\n");
+    printf("\t    stat [-a|-r] : list current stat of the file system, -r for rpc latency\n");
     printf("\t    ln <src> <dst>: create symlink\n");
     printf("\t    chmod <mode> <path> : change file mode bits\n");
+    printf("\t    ec <path> <data_num> <parity_num> : erasure code cold files of directory\n");
 }
 
 int BfsTouchz(baidu::bfs::FS* fs, int argc, char* argv[]) {
@@ -418,10 +421,27 @@ int BfsChangeReplicaNum(baidu::bfs::FS* fs, int argc, char* argv[]) {
     return 0;
 }
 
+int BfsErasureCode(baidu::bfs::FS* fs, int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage();
+        return 1;
+    }
+    int32_t data_num = atoi(argv[1]);
+    int32_t parity_num = atoi(argv[2]);
+    int32_t ret = fs->ErasureCodeDirectory(argv[0], data_num, parity_num);
+    if (ret != 0) {
+        fprintf(stderr, "Erasure code %s fail: %s\n", argv[0], baidu::bfs::StrError(ret));
+        return 1;
+    }
+    return 0;
+}
+
 int BfsStat(baidu::bfs::FS* fs, int argc, char* argv[]) {
     std::string stat_name("Stat");
     if (argc && 0 == strcmp(argv[0], "-a")) {
         stat_name = "StatAll";
+    } else if (argc && 0 == strcmp(argv[0], "-r")) {
+        stat_name = "RpcStat";
     }
     std::string result;
     int32_t ret = fs->SysStat(stat_name, &result);
@@ -455,6 +475,44 @@ int BfsChmod(baidu::bfs::FS* fs, int argc, char* argv[]) {
     }
     return 0;
 }
+int BfsSetQuota(baidu::bfs::FS* fs, int argc, char* argv[]) {
+    if (argc < 3) {
+        print_usage();
+        return 1;
+    }
+    int64_t space_quota = strtoll(argv[1], NULL, 10);
+    int64_t file_quota = strtoll(argv[2], NULL, 10);
+    if (space_quota < 0 || file_quota < 0) {
+        print_usage();
+        return 1;
+    }
+    int32_t ret = fs->SetQuota(argv[0], space_quota, file_quota);
+    if (ret != 0) {
+        fprintf(stderr, "Set quota of %s fail\n", argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+int BfsQuota(baidu::bfs::FS* fs, int argc, char* argv[]) {
+    if (argc < 1) {
+        print_usage();
+        return 1;
+    }
+    printf("%-16s\t%-16s\t%-12s\t%-12s\tPath\n", "Space", "SpaceQuota", "Files", "FileQuota");
+    for (int i = 0; i < argc; i++) {
+        baidu::bfs::BfsQuotaInfo quota;
+        int32_t ret = fs->GetQuota(argv[i], &quota);
+        if (ret != 0) {
+            fprintf(stderr, "Get quota of %s fail\n", argv[i]);
+            return 1;
+        }
+        printf("%-16ld\t%-16ld\t%-12ld\t%-12ld\t%s\n", quota.space, quota.space_quota,
+               quota.files, quota.file_quota, argv[i]);
+    }
+    return 0;
+}
+
 int BfsLocation(baidu::bfs::FS* fs, int argc, char* argv[]) {
     std::map<int64_t, std::vector<std::string> > locations;
     int32_t ret = fs->GetFileLocation(argv[0], &locations);
@@ -555,8 +613,14 @@ int main(int argc, char* argv[]) {
         ret = BfsRmdir(fs, argc - 2, argv + 2, true);
     } else if (strcmp(argv[1], "change_replica_num") == 0) {
         ret = BfsChangeReplicaNum(fs, argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "ec") == 0) {
+        ret = BfsErasureCode(fs, argc - 2, argv + 2);
     } else if (strcmp(argv[1], "du") == 0) {
         ret = BfsDu(fs, argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "setquota") == 0) {
+        ret = BfsSetQuota(fs, argc - 2, argv + 2);
+    } else if (strcmp(argv[1], "quota") == 0) {
+        ret = BfsQuota(fs, argc - 2, argv + 2);
     } else if (strcmp(argv[1], "stat") == 0) {
         ret = BfsStat(fs, argc - 2, argv + 2);
     } else if (strcmp(argv[1], "chmod") == 0) {
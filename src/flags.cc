@@ -26,21 +26,46 @@ DEFINE_string(nameserver_warninglog, "./wflog", "Warning log file");
 DEFINE_int32(nameserver_start_recover_timeout, 3600, "Nameserver starts recover in second");
 DEFINE_int32(recover_speed, 100, "Max num of block to recover for one chunkserver");
 DEFINE_int32(recover_dest_limit, 5, "Number of recover dest");
+DEFINE_int32(recover_bandwidth, 1024, "Max recover bandwidth of the whole cluster in MB/s, 0 for no limit");
+DEFINE_int32(recover_bandwidth_per_server, 40, "Max recover bandwidth of one chunkserver in MB/s, 0 for no limit");
 DEFINE_int32(hi_recover_timeout, 180, "Recover timeout for high priority blocks");
 DEFINE_int32(lo_recover_timeout, 600, "Recover timeout for low priority blocks");
 DEFINE_bool(clean_redundancy, false, "Clean redundant replica");
+DEFINE_bool(balance_enable, false, "Move replicas from fuller chunkservers to emptier ones");
+DEFINE_double(balance_threshold, 0.1, "Disk usage away from the average that makes a chunkserver balance source or target");
+DEFINE_int32(balance_bandwidth, 100, "Max bandwidth of replica balance, in MB/s");
+DEFINE_int32(balance_max_moving, 1000, "Max num of blocks moved by the balancer at the same time");
+DEFINE_int32(balance_max_moving_per_server, 10, "Max num of blocks moved off one chunkserver at the same time");
 DEFINE_int32(nameserver_report_thread_num, 20, "Threads to handle block report");
 DEFINE_int32(nameserver_work_thread_num, 20, "Work threads num");
 DEFINE_int32(nameserver_read_thread_num, 5, "Read threads num");
 DEFINE_int32(nameserver_heartbeat_thread_num, 5, "Heartbeat handle threads num");
 DEFINE_int32(nameserver_sync_callback_thread_num, 5, "Sync callback thread num");
+DEFINE_int32(nameserver_meta_lane_weight, 1, "Share of work threads for namespace mutations");
+DEFINE_int32(nameserver_block_lane_weight, 2, "Share of work threads for AddBlock/SyncBlock/FinishBlock");
+DEFINE_int32(nameserver_chunkserver_lane_weight, 4, "Share of work threads for chunkserver Register/BlockReceived");
+DEFINE_int32(nameserver_lane_max_pending, 10000, "Max rpcs queued in a client lane, more are rejected with kOverload");
+DEFINE_int32(nameserver_client_max_pending, 2000, "Max rpcs a client host may queue in a lane");
+DEFINE_int32(nameserver_log_group_max_bytes, 1024 * 1024, "Max size of namespace logs replicated as one entry");
+DEFINE_int32(nameserver_log_group_max_delay, 5, "Max time a namespace log waits for the group being replicated, in ms");
 DEFINE_bool(select_chunkserver_by_zone, false, "Select chunkserver by zone");
 DEFINE_bool(select_chunkserver_by_tag, true, "Only choose one of each tag");
+DEFINE_bool(select_chunkserver_by_rack, false, "Spread replicas over two racks, first one local");
 DEFINE_double(select_chunkserver_local_factor, 0.1, "Weighting factors of locality");
+DEFINE_bool(select_chunkserver_by_sample, true, "Select chunkserver by sampling the placement index instead of a full scan");
+DEFINE_int32(select_chunkserver_sample_factor, 2, "Candidates sampled per replica");
+DEFINE_string(chunkserver_load_model, "default", "Chunkserver load model: default, ewma");
+DEFINE_double(load_model_ewma_alpha, 0.3, "Weight of the latest heartbeat in ewma load model");
+DEFINE_int32(load_model_bandwidth, 200, "Chunkserver bandwidth for ewma load model, in MB/s");
+DEFINE_int32(load_snapshot_interval, 200, "Interval to refresh the chunkserver loads seen by placement, in ms");
 DEFINE_int32(blockmapping_bucket_num, 19, "Partation num of blockmapping");
 DEFINE_int32(blockmapping_working_thread_num, 5, "Working thread num of blockmapping");
 DEFINE_int32(block_id_allocation_size, 10000, "Block id allocatoin size");
 DEFINE_bool(check_orphan, false, "Check orphan entry in RebuildBlockMap");
+DEFINE_int32(nameserver_rebuild_thread_num, 8, "Threads to scan the namespace in RebuildBlockMap");
+DEFINE_int32(nameserver_rebuild_batch_size, 1024, "Files handed to blockmapping at a time in RebuildBlockMap");
+DEFINE_int32(nameserver_trash_reap_batch, 1000, "Max entries of trashed directories deleted in one log");
+DEFINE_int32(nameserver_trash_reap_interval, 10, "Pause between two batches of trash reaping, in ms");
 
 // ha
 DEFINE_string(ha_strategy, "master_slave", "[master_slave, raft, none]");
@@ -50,10 +75,14 @@ DEFINE_int32(snapshot_step, 1000, "Number of entries in one package");
 DEFINE_int32(logdb_log_size, 128, "Logdb log size, in MB");
 DEFINE_int32(log_replicate_timeout, 10, "Syncronized log replication timeout, in seconds");
 DEFINE_int32(log_batch_size, 100, "Log number in one package");
+DEFINE_int64(follower_read_max_lag, 1000, "Logs a follower may be behind the leader and still answer bounded stale reads");
+DEFINE_int32(follower_read_max_delay, 10000, "Time since the leader was last heard of for a follower to answer reads, in ms");
+DEFINE_int32(follower_read_index_timeout, 1000, "Time a follower waits to apply the read index of a linearizable read, in ms");
 // ha - master_slave
 DEFINE_string(master_slave_role, "master", "This server's role in master/slave ha strategy");
 DEFINE_int64(master_slave_log_limit, 20000000, "Master will keep at most x log entries");
 DEFINE_int32(master_log_gc_interval, 30 * 60, "Master's logdb gc interval, in seconds");
+DEFINE_int32(master_slave_keepalive_interval, 1000, "Interval of keepalives from master to an idle slave, in ms");
 // ha - raft
 DEFINE_string(raftdb_path,"./raftdb", "Raft log storage path");
 DEFINE_int32(nameserver_election_timeout, 10000, "Nameserver election timeout in ms");
@@ -74,7 +103,9 @@ DEFINE_int32(chunkserver_work_thread_num, 10, "Chunkserver work thread num");
 DEFINE_int32(chunkserver_read_thread_num, 20, "Chunkserver work thread num");
 DEFINE_int32(chunkserver_write_thread_num, 10, "Chunkserver work thread num");
 DEFINE_int32(disk_io_thread_num, 3, "Chunkserver io thread num");
+DEFINE_int32(chunkserver_disk_write_limit, 0, "Max write speed of one disk for new blocks, in MB/s, 0 means no limit");
 DEFINE_int32(chunkserver_recover_thread_num, 10, "Chunkserver work thread num");
+DEFINE_int32(chunkserver_recover_window, 8, "Max packets in flight for one block recover push");
 DEFINE_int32(chunkserver_file_cache_size, 1000, "Chunkserver file cache size");
 DEFINE_int32(chunkserver_use_root_partition, 1, "Should chunkserver use root partition, 0: forbidden");
 DEFINE_bool(chunkserver_multi_path_on_one_disk, false, "Allow multi data path on one disk");
@@ -82,12 +113,24 @@ DEFINE_bool(chunkserver_auto_clean, true, "If namespace version mismatch, chunks
 DEFINE_int32(chunkserver_disk_buf_size, 100, "Base number of buffers which are in the waiting list. Used to computer disk wordload");
 DEFINE_int64(chunkserver_disk_safe_space, 5120, "If space left on a disk is less than this value, the disk will be considered full. In MB");
 DEFINE_int64(chunkserver_total_disk_safe_space, 5120, "If total space left of all disks on a chunkserver is less than this value, the chunkserver will be considered full. In MB");
+DEFINE_int32(chunkserver_readv_merge_gap, 64*1024, "Ranges of ReadBlockV closer than this are merged into one disk read, bytes");
 // SDK
 DEFINE_string(sdk_write_mode, "fanout", "Sdk write strategy, choose from [chains, fanout]");
 DEFINE_int32(sdk_thread_num, 10, "Sdk thread num");
-DEFINE_int32(sdk_file_reada_len, 1024*1024, "Read ahead buffer len");
+DEFINE_int32(sdk_file_reada_len, 1024*1024, "Max read ahead request len");
+DEFINE_int32(sdk_file_reada_max_pending, 8, "Max read ahead requests in flight per file");
 DEFINE_int32(sdk_createblock_retry, 5, "Create block retry times before fail");
 DEFINE_int32(sdk_write_retry_times, 5, "Write retry times before fail");
+DEFINE_bool(sdk_read_hedge, true, "Send a hedged read to another replica when the first one is slow");
+DEFINE_int32(sdk_read_hedge_percentile, 95, "Latency percentile of a chunkserver beyond which a read is hedged");
+DEFINE_int32(sdk_read_hedge_min_delay, 5, "Min delay before sending a hedged read, in ms");
+DEFINE_int32(sdk_read_hedge_default_delay, 50, "Hedged read delay for chunkservers without latency history, in ms");
+DEFINE_int32(sdk_replica_blacklist_errors, 3, "Continuous read errors before a chunkserver is blacklisted");
+DEFINE_int32(sdk_replica_blacklist_time, 30, "Time a chunkserver stays in read blacklist, in seconds");
+DEFINE_bool(sdk_ec_degraded_read, true, "Rebuild data of erasure coded files from their stripe when no replica is readable");
+DEFINE_int32(sdk_ec_cold_days, 30, "Files not changed for this many days are erasure coded");
+DEFINE_int32(sdk_ec_cell_size, 1024*1024, "Bytes encoded at a time when erasure coding a stripe");
+DEFINE_string(sdk_read_consistency, "leader", "Who answers metadata reads, choose from [leader, bounded, linearizable]");
 
 
 /* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -36,7 +36,7 @@ enum DisplayMode {
     kDisplayAll = 0,
     kAliveOnly = 1,
     kDeadOnly = 2,
-    kOverload = 3,
+    kOverloadOnly = 3,
 };
 
 class MetaServerImpl : public MetaServer {
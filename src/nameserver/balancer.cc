@@ -0,0 +1,206 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "nameserver/balancer.h"
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+#include <common/logging.h>
+#include <common/timer.h>
+
+#include "nameserver/block_mapping_manager.h"
+#include "nameserver/chunkserver_manager.h"
+
+DECLARE_bool(balance_enable);
+DECLARE_int32(balance_bandwidth);
+DECLARE_int32(balance_max_moving);
+DECLARE_int32(balance_max_moving_per_server);
+DECLARE_int32(blockreport_interval);
+DECLARE_int32(lo_recover_timeout);
+
+namespace baidu {
+namespace bfs {
+
+Balancer::Balancer(ThreadPool* thread_pool, ChunkServerManager* chunkserver_manager,
+                   BlockMappingManager* block_mapping_manager)
+    : thread_pool_(thread_pool),
+      chunkserver_manager_(chunkserver_manager),
+      block_mapping_manager_(block_mapping_manager),
+      enabled_(FLAGS_balance_enable), next_seq_(0), tokens_(0),
+      last_refill_(common::timer::get_micros()),
+      finished_(0), failed_(0), moved_bytes_(0) {
+}
+
+void Balancer::Start() {
+    MutexLock lock(&mu_);
+    LOG(INFO, "Balancer start");
+    enabled_ = true;
+}
+
+void Balancer::Stop() {
+    MutexLock lock(&mu_);
+    LOG(INFO, "Balancer stop, %lu blocks still moving", moves_.size());
+    enabled_ = false;
+}
+
+void Balancer::RefillTokens() {
+    mu_.AssertHeld();
+    int64_t now = common::timer::get_micros();
+    double bandwidth = FLAGS_balance_bandwidth * 1024.0 * 1024.0;
+    tokens_ += bandwidth * (now - last_refill_) / 1000000;
+    // Sources are visited once per block report, don't save up for longer
+    tokens_ = std::min(tokens_, bandwidth * FLAGS_blockreport_interval);
+    last_refill_ = now;
+}
+
+void Balancer::PickBalanceBlocks(int32_t cs_id,
+                                 std::vector<std::pair<int64_t, std::string> >* moves) {
+    int32_t quota = 0;
+    int64_t start = 0;
+    {
+        MutexLock lock(&mu_, "PickBalanceBlocks 1", 10);
+        if (!enabled_) {
+            return;
+        }
+        RefillTokens();
+        quota = std::min(FLAGS_balance_max_moving_per_server - moving_num_[cs_id],
+                         FLAGS_balance_max_moving - static_cast<int32_t>(moves_.size()));
+        if (quota <= 0 || tokens_ <= 0) {
+            return;
+        }
+        start = cursor_[cs_id];
+    }
+    if (!chunkserver_manager_->IsBalanceSource(cs_id)) {
+        return;
+    }
+    // Look at a few more blocks than needed, some are recovering or already moving
+    std::vector<int64_t> blocks;
+    int64_t next = chunkserver_manager_->ListBlocks(cs_id, start, quota * 4, &blocks);
+    for (size_t i = 0; i < blocks.size() && quota > 0; i++) {
+        NSBlock nsblock;
+        if (!block_mapping_manager_->GetBlock(blocks[i], &nsblock)) {
+            continue;
+        }
+        if (nsblock.recover_stat != kNotInRecover || nsblock.block_size <= 0
+            || nsblock.replica.size() != nsblock.expect_replica_num
+            || nsblock.replica.find(cs_id) == nsblock.replica.end()) {
+            continue;
+        }
+        int32_t dest = -1;
+        std::string dest_addr;
+        if (!chunkserver_manager_->GetBalanceTarget(cs_id, nsblock.replica, &dest, &dest_addr)) {
+            LOG(INFO, "No balance target for #%ld from C%d", blocks[i], cs_id);
+            break;
+        }
+        MutexLock lock(&mu_, "PickBalanceBlocks 2", 10);
+        if (tokens_ <= 0) {
+            break;
+        }
+        if (moves_.find(blocks[i]) != moves_.end()) {
+            continue;
+        }
+        Move move = {++next_seq_, cs_id, dest, nsblock.block_size};
+        moves_[blocks[i]] = move;
+        ++moving_num_[cs_id];
+        tokens_ -= nsblock.block_size;
+        --quota;
+        moves->push_back(std::make_pair(blocks[i], dest_addr));
+        LOG(INFO, "Balance #%ld %ld from C%d to C%d", blocks[i], nsblock.block_size, cs_id, dest);
+        thread_pool_->DelayTask(FLAGS_lo_recover_timeout * 2000,
+            std::bind(&Balancer::CheckTimeout, this, blocks[i], move.seq));
+    }
+    MutexLock lock(&mu_);
+    cursor_[cs_id] = next;
+}
+
+bool Balancer::ProcessPushedBlock(int32_t cs_id, int64_t block_id, StatusCode status) {
+    int64_t seq = 0;
+    {
+        MutexLock lock(&mu_);
+        MoveMap::iterator it = moves_.find(block_id);
+        if (it == moves_.end() || it->second.src != cs_id) {
+            return false;
+        }
+        if (status != kOK) {
+            LOG(INFO, "Balance #%ld from C%d fail: %s",
+                block_id, cs_id, StatusCode_Name(status).c_str());
+            ++failed_;
+            EraseMove(it);
+            return true;
+        }
+        seq = it->second.seq;
+    }
+    FinishMove(block_id, seq);
+    return true;
+}
+
+void Balancer::FinishMove(int64_t block_id, int64_t seq) {
+    MutexLock lock(&mu_);
+    MoveMap::iterator it = moves_.find(block_id);
+    if (it == moves_.end() || it->second.seq != seq) {
+        return;
+    }
+    const Move& move = it->second;
+    if (!block_mapping_manager_->RemoveRedundantReplica(block_id, move.src, move.dest)) {
+        // The new replica has not been reported yet, CheckTimeout gives up in the end
+        thread_pool_->DelayTask(1000, std::bind(&Balancer::FinishMove, this, block_id, seq));
+        return;
+    }
+    chunkserver_manager_->RemoveBlock(move.src, block_id);
+    obsolete_[move.src].insert(block_id);
+    ++finished_;
+    moved_bytes_ += move.size;
+    LOG(INFO, "Balance #%ld from C%d to C%d done", block_id, move.src, move.dest);
+    EraseMove(it);
+}
+
+void Balancer::CheckTimeout(int64_t block_id, int64_t seq) {
+    MutexLock lock(&mu_);
+    MoveMap::iterator it = moves_.find(block_id);
+    if (it == moves_.end() || it->second.seq != seq) {
+        return;
+    }
+    LOG(WARNING, "Balance #%ld from C%d to C%d timeout",
+        block_id, it->second.src, it->second.dest);
+    ++failed_;
+    EraseMove(it);
+}
+
+void Balancer::EraseMove(MoveMap::iterator it) {
+    mu_.AssertHeld();
+    if (--moving_num_[it->second.src] <= 0) {
+        moving_num_.erase(it->second.src);
+    }
+    moves_.erase(it);
+}
+
+void Balancer::DropReplica(int32_t cs_id, int64_t block_id) {
+    MutexLock lock(&mu_);
+    obsolete_[cs_id].insert(block_id);
+}
+
+void Balancer::GetObsoleteBlocks(int32_t cs_id, std::set<int64_t>* blocks) {
+    MutexLock lock(&mu_);
+    std::map<int32_t, std::set<int64_t> >::iterator it = obsolete_.find(cs_id);
+    if (it == obsolete_.end()) {
+        return;
+    }
+    std::swap(*blocks, it->second);
+    obsolete_.erase(it);
+}
+
+void Balancer::GetStat(BalanceStat* stat) {
+    MutexLock lock(&mu_);
+    stat->enabled = enabled_;
+    stat->moving = moves_.size();
+    stat->finished = finished_;
+    stat->failed = failed_;
+    stat->moved_bytes = moved_bytes_;
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,85 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef  BFS_NAMESERVER_BALANCER_H_
+#define  BFS_NAMESERVER_BALANCER_H_
+
+#include <stdint.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <common/mutex.h>
+#include <common/thread_pool.h>
+#include "proto/status_code.pb.h"
+
+namespace baidu {
+namespace bfs {
+
+class ChunkServerManager;
+class BlockMappingManager;
+
+struct BalanceStat {
+    bool enabled;
+    int32_t moving;
+    int64_t finished;
+    int64_t failed;
+    int64_t moved_bytes;
+};
+
+/// Moves replicas off chunkservers far above the average disk usage.
+/// A move is a recover push from the source to an emptier server, the
+/// source replica is dropped once the new one is reported.
+class Balancer {
+public:
+    Balancer(ThreadPool* thread_pool, ChunkServerManager* chunkserver_manager,
+             BlockMappingManager* block_mapping_manager);
+    void Start();
+    void Stop();
+    /// Blocks cs_id should push away, as block id -> target address
+    void PickBalanceBlocks(int32_t cs_id, std::vector<std::pair<int64_t, std::string> >* moves);
+    /// Returns false if block_id is not moved off cs_id by the balancer
+    bool ProcessPushedBlock(int32_t cs_id, int64_t block_id, StatusCode status);
+    /// Replica of block_id removed from cs_id outside of a move, deleted like moved ones
+    void DropReplica(int32_t cs_id, int64_t block_id);
+    /// Replicas dropped from cs_id by finished moves, to be deleted by the chunkserver
+    void GetObsoleteBlocks(int32_t cs_id, std::set<int64_t>* blocks);
+    void GetStat(BalanceStat* stat);
+private:
+    struct Move {
+        int64_t seq;
+        int32_t src;
+        int32_t dest;
+        int64_t size;
+    };
+    typedef std::map<int64_t, Move> MoveMap;
+    void FinishMove(int64_t block_id, int64_t seq);
+    void CheckTimeout(int64_t block_id, int64_t seq);
+    void EraseMove(MoveMap::iterator it);
+    void RefillTokens();
+private:
+    Mutex mu_;
+    ThreadPool* thread_pool_;
+    ChunkServerManager* chunkserver_manager_;
+    BlockMappingManager* block_mapping_manager_;
+    bool enabled_;
+    MoveMap moves_;
+    int64_t next_seq_;
+    std::map<int32_t, int32_t> moving_num_;             ///< cs id -> moves off it
+    std::map<int32_t, int64_t> cursor_;                 ///< cs id -> next block to check
+    std::map<int32_t, std::set<int64_t> > obsolete_;
+    double tokens_;                                     ///< bytes allowed to move
+    int64_t last_refill_;
+    int64_t finished_;
+    int64_t failed_;
+    int64_t moved_bytes_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_NAMESERVER_BALANCER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -104,28 +104,40 @@ void BlockMapping::AddBlock(int64_t block_id, int32_t replica,
 
 void BlockMapping::RebuildBlock(int64_t block_id, int32_t replica,
                                 int64_t version, int64_t size) {
-    NSBlock* nsblock = NULL;
-    nsblock = new NSBlock(block_id, replica, version, size);
-    if (size) {
-        nsblock->recover_stat = kLost;
-        lost_blocks_.insert(block_id);
-    } else {
-        nsblock->recover_stat = kBlockWriting;
-    }
+    std::vector<NSBlock*> blocks(1, new NSBlock(block_id, replica, version, size));
+    RebuildBlocks(blocks);
+}
 
-    if (version < 0) {
-        LOG(INFO, "Rebuild writing block #%ld V%ld %ld", block_id, version, size);
-    } else {
-        LOG(DEBUG, "Rebuild block #%ld V%ld %ld", block_id, version, size);
+void BlockMapping::RebuildBlocks(const std::vector<NSBlock*>& blocks) {
+    for (size_t i = 0; i < blocks.size(); i++) {
+        NSBlock* nsblock = blocks[i];
+        if (nsblock->block_size) {
+            nsblock->recover_stat = kLost;
+        } else {
+            nsblock->recover_stat = kBlockWriting;
+        }
+        if (nsblock->version < 0) {
+            LOG(INFO, "Rebuild writing block #%ld V%ld %ld",
+                nsblock->id, nsblock->version, nsblock->block_size);
+        } else {
+            LOG(DEBUG, "Rebuild block #%ld V%ld %ld",
+                nsblock->id, nsblock->version, nsblock->block_size);
+        }
     }
 
-    g_blocks_num.Inc();
+    g_blocks_num.Add(blocks.size());
     MutexLock lock(&mu_);
     common::timer::TimeChecker insert_time;
-    std::pair<NSBlockMap::iterator, bool> ret =
-        block_map_.insert(std::make_pair(block_id, nsblock));
-    assert(ret.second == true);
-    insert_time.Check(10 * 1000, "[RebuildBlock] InsertToBlockMapping");
+    for (size_t i = 0; i < blocks.size(); i++) {
+        NSBlock* nsblock = blocks[i];
+        if (nsblock->recover_stat == kLost) {
+            lost_blocks_.insert(nsblock->id);
+        }
+        std::pair<NSBlockMap::iterator, bool> ret =
+            block_map_.insert(std::make_pair(nsblock->id, nsblock));
+        assert(ret.second == true);
+    }
+    insert_time.Check(10 * 1000, "[RebuildBlocks] InsertToBlockMapping");
 }
 
 bool BlockMapping::UpdateWritingBlock(NSBlock* nsblock,
@@ -636,7 +648,7 @@ void BlockMapping::DealWithDeadBlock(int32_t cs_id, int64_t block_id) {
     DealWithDeadBlockInternal(cs_id, block_id);
 }
 
-void BlockMapping::PickRecoverBlocks(int32_t cs_id, int32_t block_num,
+void BlockMapping::PickRecoverBlocks(int32_t cs_id, int32_t block_num, int64_t* byte_quota,
                                      std::vector<std::pair<int64_t, std::set<int32_t> > >* recover_blocks,
                                      RecoverPri pri) {
     MutexLock lock(&mu_);
@@ -653,7 +665,8 @@ void BlockMapping::PickRecoverBlocks(int32_t cs_id, int32_t block_num,
     std::set<int64_t>::iterator it = target_set->begin();
     // leave 3 seconds buffer
     int32_t timeout = 3 + (pri == kHigh ? FLAGS_hi_recover_timeout : FLAGS_lo_recover_timeout);
-    while (static_cast<int>(recover_blocks->size()) < block_num && it != target_set->end()) {
+    while (static_cast<int>(recover_blocks->size()) < block_num && *byte_quota > 0
+           && it != target_set->end()) {
         NSBlock* cur_block = NULL;
         if (!GetBlockPtr(*it, &cur_block)) { // block is removed
             LOG(DEBUG, "PickRecoverBlocks for C%d can't find block: #%ld ", cs_id, *it);
@@ -687,6 +700,7 @@ void BlockMapping::PickRecoverBlocks(int32_t cs_id, int32_t block_num,
         all_replica.insert(cur_block->incomplete_replica.begin(),
                            cur_block->incomplete_replica.end());
         recover_blocks->push_back(std::make_pair(block_id, all_replica));
+        *byte_quota -= cur_block->block_size;
         check_set->insert(block_id);
         assert(cur_block->recover_stat == kHiRecover || cur_block->recover_stat == kLoRecover);
         cur_block->recover_stat = kCheck;
@@ -969,5 +983,24 @@ void BlockMapping::MarkIncomplete(int64_t block_id) {
     }
 }
 
+bool BlockMapping::RemoveRedundantReplica(int64_t block_id, int32_t cs_id, int32_t keep_id) {
+    MutexLock lock(&mu_);
+    NSBlock* block = NULL;
+    if (!GetBlockPtr(block_id, &block)) {
+        return false;
+    }
+    std::set<int32_t>& replica = block->replica;
+    if (block->recover_stat != kNotInRecover
+        || replica.size() <= block->expect_replica_num
+        || replica.find(cs_id) == replica.end()
+        || replica.find(keep_id) == replica.end()) {
+        return false;
+    }
+    replica.erase(cs_id);
+    LOG(INFO, "Remove redundant replica #%ld C%d, keep C%d R%lu",
+        block_id, cs_id, keep_id, replica.size());
+    return true;
+}
+
 } // namespace bfs
 } // namespace baidu
@@ -65,6 +65,8 @@ public:
                   const std::vector<int32_t>& init_replicas);
     void RebuildBlock(int64_t block_id, int32_t replica,
                       int64_t version, int64_t size);
+    /// Take over blocks created by NSBlock(id, replica, version, size), one lock for all
+    void RebuildBlocks(const std::vector<NSBlock*>& blocks);
     bool UpdateBlockInfo(int64_t block_id, int32_t server_id, int64_t block_size,
                          int64_t block_version);
     void RemoveBlocksForFile(const FileInfo& file_info, std::map<int64_t, std::set<int32_t> >* blocks);
@@ -72,7 +74,7 @@ public:
     void DealWithDeadNode(int32_t cs_id, const std::set<int64_t>& blocks);
     void DealWithDeadBlock(int32_t cs_id, int64_t block_id);
     StatusCode CheckBlockVersion(int64_t block_id, int64_t version);
-    void PickRecoverBlocks(int32_t cs_id, int32_t block_num,
+    void PickRecoverBlocks(int32_t cs_id, int32_t block_num, int64_t* byte_quota,
                            std::vector<std::pair<int64_t, std::set<int32_t> > >* recover_blocks,
                            RecoverPri pri);
     void ProcessRecoveredBlock(int32_t cs_id, int64_t block_id, StatusCode status);
@@ -81,6 +83,8 @@ public:
     void ListRecover(RecoverBlockSet* blocks);
     int32_t GetCheckNum();
     void MarkIncomplete(int64_t block_id);
+    /// Drop the replica on cs_id once keep_id holds the block and it is over replicated
+    bool RemoveRedundantReplica(int64_t block_id, int32_t cs_id, int32_t keep_id);
 private:
     void DealWithDeadBlockInternal(int32_t cs_id, int64_t block_id);
     typedef std::map<int32_t, std::set<int64_t> > CheckList;
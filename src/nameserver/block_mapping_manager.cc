@@ -6,6 +6,7 @@
 
 #include <stdlib.h>
 #include <time.h>
+#include <algorithm>
 
 #include <common/counter.h>
 #include <common/string_util.h>
@@ -62,6 +63,23 @@ void BlockMappingManager::RebuildBlock(int64_t block_id, int32_t replica,
     block_mapping_[bucket_offset]->RebuildBlock(block_id, replica, version, size);
 }
 
+void BlockMappingManager::RebuildBlocks(const std::vector<FileInfo>& files) {
+    std::vector<std::vector<NSBlock*> > blocks_array(block_mapping_.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        const FileInfo& file_info = files[i];
+        for (int j = 0; j < file_info.blocks_size(); j++) {
+            int64_t block_id = file_info.blocks(j);
+            blocks_array[GetBucketOffset(block_id)].push_back(
+                new NSBlock(block_id, file_info.replicas(), file_info.version(), file_info.size()));
+        }
+    }
+    for (size_t i = 0; i < blocks_array.size(); i++) {
+        if (!blocks_array[i].empty()) {
+            block_mapping_[i]->RebuildBlocks(blocks_array[i]);
+        }
+    }
+}
+
 bool BlockMappingManager::UpdateBlockInfo(int64_t block_id, int32_t server_id, int64_t block_size,
                      int64_t block_version) {
     int32_t bucket_offset = GetBucketOffset(block_id);
@@ -103,25 +121,39 @@ StatusCode BlockMappingManager::CheckBlockVersion(int64_t block_id, int64_t vers
     return block_mapping_[bucket_offset]->CheckBlockVersion(block_id, version);
 }
 
-void BlockMappingManager::PickRecoverBlocks(int32_t cs_id, int32_t block_num,
+int64_t BlockMappingManager::PickRecoverBlocks(int32_t cs_id, int32_t block_num,
+                       int64_t hi_bytes, int64_t lo_bytes,
                        std::vector<std::pair<int64_t, std::set<int32_t> > >* recover_blocks,
                        int32_t* hi_num, bool hi_only) {
+    int64_t quota = hi_bytes;
     int start_bucket = rand() % blockmapping_bucket_num_;
-    for (int i = 0; i < blockmapping_bucket_num_ && (size_t)block_num > recover_blocks->size(); i++) {
+    for (int i = 0; i < blockmapping_bucket_num_ && (size_t)block_num > recover_blocks->size()
+            && quota > 0; i++) {
         block_mapping_[start_bucket % blockmapping_bucket_num_]->
-            PickRecoverBlocks(cs_id, block_num - recover_blocks->size(), recover_blocks, kHigh);
+            PickRecoverBlocks(cs_id, block_num - recover_blocks->size(), &quota,
+                              recover_blocks, kHigh);
         ++start_bucket;
     }
     *(hi_num) += recover_blocks->size();
+    int64_t hi_picked = hi_bytes - quota;
     if (hi_only) {
-        return;
+        return hi_picked;
     }
+    // Blocks with a single replica left may use up the budget of the others
+    quota = std::min(quota, lo_bytes - hi_picked);
+    if (quota <= 0) {
+        return hi_picked;
+    }
+    int64_t lo_quota = quota;
     start_bucket = rand() % blockmapping_bucket_num_;
-    for (int i = 0; i < blockmapping_bucket_num_ && (size_t)block_num > recover_blocks->size(); i++) {
+    for (int i = 0; i < blockmapping_bucket_num_ && (size_t)block_num > recover_blocks->size()
+            && quota > 0; i++) {
         block_mapping_[start_bucket % blockmapping_bucket_num_]->
-            PickRecoverBlocks(cs_id, block_num - recover_blocks->size(), recover_blocks, kLow);
+            PickRecoverBlocks(cs_id, block_num - recover_blocks->size(), &quota,
+                              recover_blocks, kLow);
         ++start_bucket;
     }
+    return hi_picked + lo_quota - quota;
 }
 
 void BlockMappingManager::ProcessRecoveredBlock(int32_t cs_id, int64_t block_id, StatusCode status) {
@@ -159,6 +191,12 @@ void BlockMappingManager::MarkIncomplete(int64_t block_id) {
     block_mapping_[bucket_offset]->MarkIncomplete(block_id);
 }
 
+bool BlockMappingManager::RemoveRedundantReplica(int64_t block_id, int32_t cs_id,
+                                                 int32_t keep_id) {
+    int32_t bucket_offset = GetBucketOffset(block_id);
+    return block_mapping_[bucket_offset]->RemoveRedundantReplica(block_id, cs_id, keep_id);
+}
+
 bool BlockMappingManager::CheckBlocksClosed(const std::vector<int64_t>& blocks) {
     return true;
 }
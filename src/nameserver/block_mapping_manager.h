@@ -24,6 +24,8 @@ public :
                   const std::vector<int32_t>& init_replicas);
     void RebuildBlock(int64_t block_id, int32_t replica,
                      int64_t version, int64_t size);
+    /// Rebuild the blocks of 'files', grouped by bucket
+    void RebuildBlocks(const std::vector<FileInfo>& files);
     bool UpdateBlockInfo(int64_t block_id, int32_t server_id, int64_t block_size,
                          int64_t block_version);
     void RemoveBlocksForFile(const FileInfo& file_info, std::map<int64_t, std::set<int32_t> >* blocks);
@@ -31,15 +33,18 @@ public :
     void DealWithDeadNode(int32_t cs_id, const std::set<int64_t>& blocks);
     void DealWithDeadBlock(int32_t cs_id, int64_t block_id);
     StatusCode CheckBlockVersion(int64_t block_id, int64_t version);
-    void PickRecoverBlocks(int32_t cs_id, int32_t block_num,
-                           std::vector<std::pair<int64_t, std::set<int32_t> > >* recover_blocks,
-                           int32_t* hi_num, bool hi_only);
+    /// Pick at most block_num blocks, high priority ones up to hi_bytes and all of them
+    /// up to lo_bytes, return the bytes picked
+    int64_t PickRecoverBlocks(int32_t cs_id, int32_t block_num, int64_t hi_bytes, int64_t lo_bytes,
+                              std::vector<std::pair<int64_t, std::set<int32_t> > >* recover_blocks,
+                              int32_t* hi_num, bool hi_only);
     void ProcessRecoveredBlock(int32_t cs_id, int64_t block_id, StatusCode status);
     void GetCloseBlocks(int32_t cs_id, google::protobuf::RepeatedField<int64_t>* close_blocks);
     void GetStat(int32_t cs_id, RecoverBlockNum* recover_num);
     void GetRecoverNum(int32_t bucket_id, RecoverBlockNum* recover_num);
     void ListRecover(RecoverBlockSet* recover_blocks);
     void MarkIncomplete(int64_t block_id);
+    bool RemoveRedundantReplica(int64_t block_id, int32_t cs_id, int32_t keep_id);
     bool CheckBlocksClosed(const std::vector<int64_t>& blocks);
 private:
     int32_t GetBucketOffset(int64_t block_id);
@@ -11,20 +11,27 @@
 #include <common/string_util.h>
 #include <common/util.h>
 #include "nameserver/block_mapping_manager.h"
+#include "nameserver/load_model.h"
 #include "nameserver/location_provider.h"
 
 DECLARE_int32(keepalive_timeout);
-DECLARE_int32(chunkserver_max_pending_buffers);
 DECLARE_int32(recover_speed);
+DECLARE_int32(recover_bandwidth);
+DECLARE_int32(recover_bandwidth_per_server);
 DECLARE_int32(recover_dest_limit);
 DECLARE_int32(heartbeat_interval);
 DECLARE_bool(select_chunkserver_by_zone);
 DECLARE_bool(select_chunkserver_by_tag);
+DECLARE_bool(select_chunkserver_by_rack);
 DECLARE_double(select_chunkserver_local_factor);
 DECLARE_int32(blockreport_interval);
 DECLARE_int32(blockreport_size);
 DECLARE_int32(expect_chunkserver_num);
-DECLARE_int64(chunkserver_total_disk_safe_space);
+DECLARE_string(chunkserver_load_model);
+DECLARE_bool(select_chunkserver_by_sample);
+DECLARE_int32(select_chunkserver_sample_factor);
+DECLARE_double(balance_threshold);
+DECLARE_int32(load_snapshot_interval);
 
 namespace baidu {
 namespace bfs {
@@ -67,6 +74,16 @@ void Blocks::MoveNew() {
     std::swap(tmp, new_blocks_);
 }
 
+int64_t Blocks::List(int64_t start, int32_t num, std::vector<int64_t>* blocks) {
+    MutexLock lock(&block_mu_);
+    std::set<int64_t>::iterator it = blocks_.lower_bound(start);
+    for (; it != blocks_.end() && static_cast<int32_t>(blocks->size()) < num; ++it) {
+        blocks->push_back(*it);
+    }
+    // Start over from the first block at the end
+    return it == blocks_.end() ? 0 : *it;
+}
+
 int64_t Blocks::CheckLost(int64_t report_id, const std::set<int64_t>& blocks,
                           int64_t start, int64_t end, std::vector<int64_t>* lost) {
     LOG(INFO, "Check block begin. C%ld id %ld blocksize %u newsize %u",
@@ -107,23 +124,42 @@ int64_t Blocks::CheckLost(int64_t report_id, const std::set<int64_t>& blocks,
 ChunkServerManager::ChunkServerManager(ThreadPool* thread_pool, BlockMappingManager* block_mapping_manager)
     : thread_pool_(thread_pool),
       block_mapping_manager_(block_mapping_manager),
+      dead_check_time_(common::timer::now_time()),
+      snapshot_(new LoadSnapshot),
       chunkserver_num_(0),
-      next_chunkserver_id_(1) {
+      next_chunkserver_id_(1),
+      recover_tokens_(0),
+      last_recover_refill_(common::timer::get_micros()) {
     memset(&stats_, 0, sizeof(stats_));
-    thread_pool_->AddTask(std::bind(&ChunkServerManager::DeadCheck, this));
-    thread_pool_->AddTask(std::bind(&ChunkServerManager::LogStats, this));
     localhostname_ = common::util::GetLocalHostName();
     localzone_ = LocationProvider(localhostname_, "").GetZone();
     params_.set_report_interval(FLAGS_blockreport_interval);
     params_.set_report_size(FLAGS_blockreport_size);
     params_.set_recover_size(FLAGS_recover_speed);
     params_.set_keepalive_timeout(FLAGS_keepalive_timeout);
+    params_.set_recover_bandwidth(FLAGS_recover_bandwidth);
+    params_.set_recover_bandwidth_per_server(FLAGS_recover_bandwidth_per_server);
+    snapshot_->params = params_;
+    load_model_ = LoadModel::NewLoadModel(FLAGS_chunkserver_load_model);
+    if (load_model_ == NULL) {
+        LOG(WARNING, "Unknown load model %s, use default",
+            FLAGS_chunkserver_load_model.c_str());
+        load_model_ = new DefaultLoadModel();
+    }
+    thread_pool_->AddTask(std::bind(&ChunkServerManager::DeadCheck, this));
+    thread_pool_->AddTask(std::bind(&ChunkServerManager::LogStats, this));
+    thread_pool_->AddTask(std::bind(&ChunkServerManager::RefreshSnapshot, this));
     LOG(INFO, "Localhost: %s, localzone: %s",
         localhostname_.c_str(), localzone_.c_str());
 }
 
+ChunkServerManager::~ChunkServerManager() {
+    delete load_model_;
+}
+
 void ChunkServerManager::CleanChunkServer(ChunkServerInfo* cs, const std::string& reason) {
     int32_t id = cs->id();
+    Mutex* shard_mu = ShardMutex(id);
     MutexLock lock(&mu_, "CleanChunkServer", 10);
     chunkserver_num_--;
     auto it = block_map_.find(id);
@@ -132,15 +168,20 @@ void ChunkServerManager::CleanChunkServer(ChunkServerInfo* cs, const std::string
     it->second->CleanUp(&blocks);
     LOG(INFO, "Remove ChunkServer C%d %s %s, cs_num=%d",
             cs->id(), cs->ipaddress().c_str(), reason.c_str(), chunkserver_num_);
-    cs->set_status(kCsCleaning);
+    {
+        MutexLock shard_lock(shard_mu);
+        cs->set_status(kCsCleaning);
+    }
     mu_.Unlock();
     block_mapping_manager_->DealWithDeadNode(id, blocks);
     mu_.Lock("CleanChunkServerRelock", 10);
+    MutexLock shard_lock(shard_mu);
     cs->set_w_qps(0);
     cs->set_w_speed(0);
     cs->set_r_qps(0);
     cs->set_r_speed(0);
     cs->set_recover_speed(0);
+    load_model_->RemoveChunkServer(id);
     if (std::find(chunkservers_to_offline_.begin(),
                   chunkservers_to_offline_.end(),
                   cs->ipaddress()) == chunkservers_to_offline_.end()) {
@@ -160,68 +201,98 @@ bool ChunkServerManager::KickChunkServer(int32_t cs_id) {
     if (!GetChunkServerPtr(cs_id, &cs)) {
         return false;
     }
+    MutexLock shard_lock(ShardMutex(cs_id));
     cs->set_kick(true);
     return true;
 }
 bool ChunkServerManager::RemoveChunkServer(const std::string& addr) {
-    MutexLock lock(&mu_, "RemoveChunkServer", 10);
-    std::map<std::string, int32_t>::iterator it = address_map_.find(addr);
-    if (it == address_map_.end()) {
-        return false;
-    }
-    ChunkServerInfo* cs_info = NULL;
-    bool ret = GetChunkServerPtr(it->second, &cs_info);
-    assert(ret);
-    if (cs_info->status() == kCsActive) {
+    {
+        MutexLock lock(&mu_, "RemoveChunkServer", 10);
+        std::map<std::string, int32_t>::iterator it = address_map_.find(addr);
+        if (it == address_map_.end()) {
+            return false;
+        }
+        ChunkServerInfo* cs_info = NULL;
+        bool ret = GetChunkServerPtr(it->second, &cs_info);
+        assert(ret);
+        MutexLock shard_lock(ShardMutex(cs_info->id()));
+        if (cs_info->status() != kCsActive) {
+            return true;
+        }
         cs_info->set_status(kCsWaitClean);
         std::function<void ()> task =
             std::bind(&ChunkServerManager::CleanChunkServer,
                         this, cs_info, std::string("Dead"));
         thread_pool_->AddTask(task);
     }
+    RebuildSnapshot();
     return true;
 }
 
 void ChunkServerManager::DeadCheck() {
     int32_t now_time = common::timer::now_time();
-
-    MutexLock lock(&mu_, "DeadCheck", 10);
-    std::map<int32_t, std::set<ChunkServerInfo*> >::iterator it = heartbeat_list_.begin();
-
-    while (it != heartbeat_list_.end()
-           && it->first + params_.keepalive_timeout() <= now_time) {
-        std::set<ChunkServerInfo*>::iterator node = it->second.begin();
-        while (node != it->second.end()) {
-            ChunkServerInfo* cs = *node;
-            it->second.erase(node++);
-            LOG(INFO, "[DeadCheck] ChunkServer dead C%d %s, cs_num=%d",
-                cs->id(), cs->ipaddress().c_str(), chunkserver_num_);
-            cs->set_is_dead(true);
-            if (cs->status() == kCsActive || cs->status() == kCsReadonly) {
-                cs->set_status(kCsWaitClean);
-                std::function<void ()> task =
-                    std::bind(&ChunkServerManager::CleanChunkServer,
-                                this, cs, std::string("Dead"));
-                thread_pool_->AddTask(task);
-            } else {
-                LOG(INFO, "[DeadCheck] ChunkServer C%d %s is being clean",
-                    cs->id(), cs->ipaddress().c_str());
+    bool changed = false;
+    {
+        MutexLock lock(&mu_, "DeadCheck", 10);
+        for (; dead_check_time_ <= now_time; ++dead_check_time_) {
+            std::vector<std::pair<int32_t, int32_t> >& slot =
+                dead_check_wheel_[dead_check_time_ % kDeadCheckSlotNum];
+            // Entries of a later round stay in the slot
+            std::vector<std::pair<int32_t, int32_t> > due, later;
+            for (size_t i = 0; i < slot.size(); i++) {
+                if (slot[i].first <= dead_check_time_) {
+                    due.push_back(slot[i]);
+                } else {
+                    later.push_back(slot[i]);
+                }
+            }
+            slot.swap(later);
+            for (size_t i = 0; i < due.size(); i++) {
+                ChunkServerInfo* cs = NULL;
+                if (!GetChunkServerPtr(due[i].second, &cs)) {
+                    continue;
+                }
+                MutexLock shard_lock(ShardMutex(cs->id()));
+                if (cs->is_dead()) {
+                    continue;
+                }
+                int32_t deadline = cs->last_heartbeat() + params_.keepalive_timeout();
+                if (deadline > now_time) {
+                    ScheduleDeadCheck(cs->id(), deadline);
+                    continue;
+                }
+                LOG(INFO, "[DeadCheck] ChunkServer dead C%d %s, cs_num=%d",
+                    cs->id(), cs->ipaddress().c_str(), chunkserver_num_);
+                cs->set_is_dead(true);
+                changed = true;
+                if (cs->status() == kCsActive || cs->status() == kCsReadonly) {
+                    cs->set_status(kCsWaitClean);
+                    std::function<void ()> task =
+                        std::bind(&ChunkServerManager::CleanChunkServer,
+                                    this, cs, std::string("Dead"));
+                    thread_pool_->AddTask(task);
+                } else {
+                    LOG(INFO, "[DeadCheck] ChunkServer C%d %s is being clean",
+                        cs->id(), cs->ipaddress().c_str());
+                }
             }
         }
-        assert(it->second.empty());
-        heartbeat_list_.erase(it);
-        it = heartbeat_list_.begin();
     }
-    int idle_time = 5;
-    if (it != heartbeat_list_.end()) {
-        idle_time = it->first + params_.keepalive_timeout() - now_time;
-        // LOG(INFO, "it->first= %d, now_time= %d\n", it->first, now_time);
-        if (idle_time > 5) {
-            idle_time = 5;
-        }
+    // Take the dead ones off placement at once
+    if (changed) {
+        RebuildSnapshot();
     }
-    thread_pool_->DelayTask(idle_time * 1000,
-                           std::bind(&ChunkServerManager::DeadCheck, this));
+    thread_pool_->DelayTask(1000, std::bind(&ChunkServerManager::DeadCheck, this));
+}
+
+void ChunkServerManager::ScheduleDeadCheck(int32_t cs_id, int32_t due_time) {
+    mu_.AssertHeld();
+    due_time = std::max(due_time, dead_check_time_);
+    dead_check_wheel_[due_time % kDeadCheckSlotNum].push_back(std::make_pair(due_time, cs_id));
+}
+
+Mutex* ChunkServerManager::ShardMutex(int32_t cs_id) {
+    return &heartbeat_shards_[cs_id % kHeartBeatShardNum].mu;
 }
 
 bool ChunkServerManager::HandleRegister(const std::string& ip,
@@ -259,6 +330,7 @@ bool ChunkServerManager::HandleRegister(const std::string& ip,
     response->set_chunkserver_id(cs_id);
     response->set_report_interval(FLAGS_blockreport_interval);
     response->set_report_size(FLAGS_blockreport_size);
+    response->set_recover_bandwidth(params_.recover_bandwidth_per_server());
     response->set_status(status);
     return chunkserver_num_ >= FLAGS_expect_chunkserver_num;
 }
@@ -266,8 +338,22 @@ bool ChunkServerManager::HandleRegister(const std::string& ip,
 void ChunkServerManager::HandleHeartBeat(const HeartBeatRequest* request, HeartBeatResponse* response) {
     int32_t id = request->chunkserver_id();
     const std::string& address = request->chunkserver_addr();
-    int cs_id = GetChunkServerId(address);
-    if (id == -1 || cs_id != id) {
+    std::shared_ptr<LoadSnapshot> snapshot = GetSnapshot();
+    ChunkServerInfo* info = NULL;
+    if (id > 0) {
+        HeartBeatShard& shard = heartbeat_shards_[id % kHeartBeatShardNum];
+        MutexLock lock(&shard.mu, "HandleHeartBeat", 10);
+        ServerMap::iterator it = shard.servers.find(id);
+        if (it != shard.servers.end() && it->second->address() == address) {
+            info = it->second;
+            if (!info->is_dead()) {
+                response->set_status(kOK);
+                UpdateHeartBeat(info, request, response, snapshot->params);
+                return;
+            }
+        }
+    }
+    if (info == NULL) {
         //reconnect after DeadCheck()
         LOG(INFO, "HandleHeartBeat unknown chunkserver %s with namespace version %ld",
             address.c_str(), request->namespace_version());
@@ -276,28 +362,27 @@ void ChunkServerManager::HandleHeartBeat(const HeartBeatRequest* request, HeartB
     }
     response->set_status(kOK);
 
+    // A dead server coming back changes membership, which needs mu_
     MutexLock lock(&mu_, "HandleHeartBeat", 10);
-    ChunkServerInfo* info = NULL;
-    bool ret = GetChunkServerPtr(id, &info);
-    assert(ret && info);
-    if (!info->is_dead()) {
-        assert(heartbeat_list_.find(info->last_heartbeat()) != heartbeat_list_.end());
-        heartbeat_list_[info->last_heartbeat()].erase(info);
-        if (heartbeat_list_[info->last_heartbeat()].empty()) {
-            heartbeat_list_.erase(info->last_heartbeat());
-        }
-    } else if (info->status() == kCsOffLine) {
-        LOG(INFO, "Dead chunkserver revival C%d %s", cs_id, address.c_str());
-        assert(heartbeat_list_.find(info->last_heartbeat()) == heartbeat_list_.end());
+    MutexLock shard_lock(ShardMutex(id));
+    if (info->is_dead()) {
+        if (info->status() != kCsOffLine) {
+            return;
+        }
+        LOG(INFO, "Dead chunkserver revival C%d %s", id, address.c_str());
         char buf[20];
         common::timer::now_time_str(buf, 20, common::timer::kMin);
         info->set_start_time(std::string(buf));
         info->set_is_dead(false);
         info->set_status(kCsActive);
         chunkserver_num_++;
-    } else {
-        return;
+        ScheduleDeadCheck(id, common::timer::now_time() + params_.keepalive_timeout());
     }
+    UpdateHeartBeat(info, request, response, params_);
+}
+
+void ChunkServerManager::UpdateHeartBeat(ChunkServerInfo* info, const HeartBeatRequest* request,
+                                         HeartBeatResponse* response, const Params& params) {
     info->set_data_size(request->data_size());
     info->set_block_num(request->block_num());
     info->set_buffers(request->buffers());
@@ -308,16 +393,16 @@ void ChunkServerManager::HandleHeartBeat(const HeartBeatRequest* request, HeartB
     info->set_r_qps(request->r_qps());
     info->set_r_speed(request->r_speed());
     info->set_recover_speed(request->recover_speed());
-    int32_t now_time = common::timer::now_time();
-    heartbeat_list_[now_time].insert(info);
-    info->set_last_heartbeat(now_time);
+    info->mutable_disks()->CopyFrom(request->disks());
+    info->set_last_heartbeat(common::timer::now_time());
     if (info->kick()) {
         response->set_kick(true);
     } else {
-        info->set_load(GetChunkServerLoad(info));
+        info->set_load(load_model_->UpdateLoad(*info, *request));
     }
-    response->set_report_interval(params_.report_interval());
-    response->set_report_size(params_.report_size());
+    response->set_report_interval(params.report_interval());
+    response->set_report_size(params.report_size());
+    response->set_recover_bandwidth(params.recover_bandwidth_per_server());
 }
 
 void ChunkServerManager::ListChunkServers(::google::protobuf::RepeatedPtrField<ChunkServerInfo>* chunkservers) {
@@ -326,26 +411,62 @@ void ChunkServerManager::ListChunkServers(::google::protobuf::RepeatedPtrField<C
             it != chunkservers_.end(); ++it) {
         ChunkServerInfo* src = it->second;
         ChunkServerInfo* dst = chunkservers->Add();
+        MutexLock shard_lock(ShardMutex(src->id()));
         dst->CopyFrom(*src);
     }
 }
 
-double ChunkServerManager::GetChunkServerLoad(ChunkServerInfo* cs) {
-    double max_pending = FLAGS_chunkserver_max_pending_buffers * 0.8;
-    double pending_score = cs->buffers() / max_pending;
-    double data_score = cs->data_size() * 1.0 / cs->disk_quota();
-    int64_t space_left = cs->disk_quota() - cs->data_size();
-
-    if (data_score > 0.95 || pending_score > 1.0
-            || space_left < (FLAGS_chunkserver_total_disk_safe_space << 20)) {
-        return 1.0;
+void ChunkServerManager::RebuildSnapshot() {
+    MutexLock rebuild_lock(&rebuild_mu_);
+    std::shared_ptr<LoadSnapshot> snapshot(new LoadSnapshot);
+    {
+        MutexLock lock(&mu_, "RebuildSnapshot", 10);
+        snapshot->params = params_;
+        snapshot->servers.reserve(chunkservers_.size());
+    }
+    for (int32_t i = 0; i < kHeartBeatShardNum; i++) {
+        HeartBeatShard& shard = heartbeat_shards_[i];
+        MutexLock lock(&shard.mu);
+        for (ServerMap::iterator it = shard.servers.begin(); it != shard.servers.end(); ++it) {
+            snapshot->servers.push_back(*it->second);
+            snapshot->servers.back().clear_disks();
+        }
     }
-    return (data_score * data_score + pending_score) / 2;
+    for (size_t i = 0; i < snapshot->servers.size(); i++) {
+        ChunkServerInfo* cs = &snapshot->servers[i];
+        snapshot->index[cs->id()] = cs;
+        snapshot->address_map[cs->address()] = cs;
+        if (!cs->is_dead()) {
+            snapshot->alive.push_back(cs);
+        }
+        if (IsWritable(cs)) {
+            snapshot->placement.push_back(cs);
+            snapshot->racks[cs->rack()].push_back(cs);
+        }
+    }
+    MutexLock lock(&snapshot_mu_);
+    snapshot_.swap(snapshot);
+}
+
+void ChunkServerManager::RefreshSnapshot() {
+    RebuildSnapshot();
+    thread_pool_->DelayTask(FLAGS_load_snapshot_interval,
+                            std::bind(&ChunkServerManager::RefreshSnapshot, this));
+}
+
+std::shared_ptr<LoadSnapshot> ChunkServerManager::GetSnapshot() {
+    MutexLock lock(&snapshot_mu_);
+    return snapshot_;
+}
+
+bool ChunkServerManager::IsWritable(const ChunkServerInfo* cs) {
+    return !cs->is_dead()
+           && cs->status() == kCsActive
+           && cs->load() <= kChunkServerLoadMax;
 }
 
 void ChunkServerManager::RandomSelect(std::vector<std::pair<double, ChunkServerInfo*> >* loads,
                                       int num) {
-    mu_.Unlock();
     std::sort(loads->begin(), loads->end());
     // Add random factor
     int scope = loads->size() - (loads->size() % num);
@@ -357,62 +478,53 @@ void ChunkServerManager::RandomSelect(std::vector<std::pair<double, ChunkServerI
             std::swap((*loads)[i % num], (*loads)[i]);
         }
     }
-    mu_.Lock();
 }
 
 bool ChunkServerManager::GetChunkServerChains(int num,
                           std::vector<std::pair<int32_t,std::string> >* chains,
-                          const std::string& client_address) {
-    MutexLock lock(&mu_, "GetChunkServerChains", 10);
-    if (num > chunkserver_num_) {
-        LOG(INFO, "not enough alive chunkservers [%ld] for GetChunkServerChains [%d]\n",
-            chunkserver_num_, num);
+                          const std::string& client_address,
+                          const std::set<int32_t>& exclude) {
+    std::shared_ptr<LoadSnapshot> snapshot = GetSnapshot();
+    int32_t alive_num = snapshot->alive.size();
+    if (num > alive_num) {
+        LOG(INFO, "not enough alive chunkservers [%d] for GetChunkServerChains [%d]\n",
+            alive_num, num);
         return false;
     }
     ChunkServerInfo* local_cs = NULL;
     //first take local cs of client
-    std::map<std::string, int32_t>::iterator client_it = address_map_.lower_bound(client_address);
-    if (client_it != address_map_.end()) {
+    std::map<std::string, ChunkServerInfo*>::const_iterator client_it =
+        snapshot->address_map.lower_bound(client_address);
+    if (client_it != snapshot->address_map.end()) {
         std::string tmp_address(client_it->first, 0, client_it->first.find_last_of(':'));
         if (tmp_address == client_address) {
-            ChunkServerInfo* cs = NULL;
-            if (GetChunkServerPtr(client_it->second, &cs) &&
-                !cs->is_dead() &&
-                !(cs->status() == kCsReadonly)) {
+            ChunkServerInfo* cs = client_it->second;
+            if (!cs->is_dead() && !(cs->status() == kCsReadonly)
+                && exclude.find(cs->id()) == exclude.end()) {
                 local_cs = cs;
             }
         }
     }
-    std::map<int32_t, std::set<ChunkServerInfo*> >::iterator it = heartbeat_list_.begin();
     std::vector<std::pair<double, ChunkServerInfo*> > loads;
-
-    for (; it != heartbeat_list_.end(); ++it) {
-        std::set<ChunkServerInfo*>& set = it->second;
-        for (std::set<ChunkServerInfo*>::iterator sit = set.begin();
-             sit != set.end(); ++sit) {
-            ChunkServerInfo* cs = *sit;
-            if (cs->status() == kCsReadonly) {
-                LOG(DEBUG, "Alloc ignore Chunkserver %s: is in offline progress", cs->ipaddress().c_str());
-                continue;
-            }
-            double load = cs->load();
-            if (load <= kChunkServerLoadMax) {
-                double local_factor =
-                    (cs == local_cs ? FLAGS_select_chunkserver_local_factor : 0) ;
-                loads.push_back(std::make_pair(load - local_factor, cs));
-            } else {
-                LOG(DEBUG, "Alloc ignore: ChunkServer %s data %ld/%ld buffer %d",
-                    cs->ipaddress().c_str(), cs->data_size(),
-                    cs->disk_quota(), cs->buffers());
-            }
+    // Sampling can't guarantee a remote zone replica, scan all for that,
+    // nor can it skip the excluded ones
+    bool sampled = FLAGS_select_chunkserver_by_sample
+                   && !FLAGS_select_chunkserver_by_zone
+                   && exclude.empty()
+                   && SampleChunkServers(*snapshot, num, local_cs, &loads);
+    if (!sampled) {
+        loads.clear();
+        ScanChunkServers(*snapshot, local_cs, &loads);
+        if (!exclude.empty()) {
+            ExcludeChunkServers(*snapshot, exclude, num, &loads);
         }
+        if ((int)loads.size() < num) {
+            LOG(DEBUG, "Only %lu chunkserver of %d is not over overladen, GetChunkServerChains(%d) return false",
+                loads.size(), alive_num, num);
+            return false;
+        }
+        RandomSelect(&loads, num);
     }
-    if ((int)loads.size() < num) {
-        LOG(DEBUG, "Only %ld chunkserver of %d is not over overladen, GetChunkServerChains(%d) return false",
-            loads.size(), chunkserver_num_, num);
-        return false;
-    }
-    RandomSelect(&loads, num);
 
     if (FLAGS_select_chunkserver_by_zone) {
         int count = SelectChunkServerByZone(num, loads, chains);
@@ -420,6 +532,12 @@ bool ChunkServerManager::GetChunkServerChains(int num,
             LOG(WARNING, "SelectChunkServerByZone(%d) return %d", num, count);
             return false;
         }
+    } else if (FLAGS_select_chunkserver_by_rack) {
+        int count = SelectChunkServerByRack(*snapshot, num, local_cs, loads, exclude, chains);
+        if (count < num) {
+            LOG(WARNING, "SelectChunkServerByRack(%d) return %d", num, count);
+            return false;
+        }
     } else {
         for (int i = 0; i < num; ++i) {
             ChunkServerInfo* cs = loads[i].second;
@@ -429,60 +547,148 @@ bool ChunkServerManager::GetChunkServerChains(int num,
     return true;
 }
 
+void ChunkServerManager::ScanChunkServers(const LoadSnapshot& snapshot, ChunkServerInfo* local_cs,
+                          std::vector<std::pair<double, ChunkServerInfo*> >* loads) {
+    for (size_t i = 0; i < snapshot.alive.size(); i++) {
+        ChunkServerInfo* cs = snapshot.alive[i];
+        if (cs->status() == kCsReadonly) {
+            LOG(DEBUG, "Alloc ignore Chunkserver %s: is in offline progress", cs->ipaddress().c_str());
+            continue;
+        }
+        double load = cs->load();
+        if (load <= kChunkServerLoadMax) {
+            double local_factor =
+                (cs == local_cs ? FLAGS_select_chunkserver_local_factor : 0) ;
+            loads->push_back(std::make_pair(load - local_factor, cs));
+        } else {
+            LOG(DEBUG, "Alloc ignore: ChunkServer %s data %ld/%ld buffer %d",
+                cs->ipaddress().c_str(), cs->data_size(),
+                cs->disk_quota(), cs->buffers());
+        }
+    }
+}
+
+void ChunkServerManager::ExcludeChunkServers(const LoadSnapshot& snapshot,
+                          const std::set<int32_t>& exclude, int num,
+                          std::vector<std::pair<double, ChunkServerInfo*> >* loads) {
+    std::set<std::string> racks;
+    if (FLAGS_select_chunkserver_by_rack) {
+        for (std::set<int32_t>::const_iterator it = exclude.begin(); it != exclude.end(); ++it) {
+            std::unordered_map<int32_t, ChunkServerInfo*>::const_iterator cs_it =
+                snapshot.index.find(*it);
+            if (cs_it != snapshot.index.end()) {
+                racks.insert(cs_it->second->rack());
+            }
+        }
+    }
+    std::vector<std::pair<double, ChunkServerInfo*> > by_id;
+    std::vector<std::pair<double, ChunkServerInfo*> > by_rack;
+    for (size_t i = 0; i < loads->size(); i++) {
+        ChunkServerInfo* cs = (*loads)[i].second;
+        if (exclude.find(cs->id()) != exclude.end()) {
+            continue;
+        }
+        by_id.push_back((*loads)[i]);
+        if (racks.find(cs->rack()) == racks.end()) {
+            by_rack.push_back((*loads)[i]);
+        }
+    }
+    // Too few racks left, distinct chunkservers are the best to be had
+    if (static_cast<int>(by_rack.size()) >= num) {
+        loads->swap(by_rack);
+    } else {
+        LOG(DEBUG, "Only %lu chunkservers outside racks of %lu excluded, place by id",
+            by_rack.size(), exclude.size());
+        loads->swap(by_id);
+    }
+}
+
+bool ChunkServerManager::SampleChunkServers(const LoadSnapshot& snapshot, int num,
+                          ChunkServerInfo* local_cs,
+                          std::vector<std::pair<double, ChunkServerInfo*> >* loads) {
+    const std::vector<ChunkServerInfo*>& placement = snapshot.placement;
+    int total = placement.size();
+    // Pick candidates by power of two choices, small clusters just scan
+    int want = num * FLAGS_select_chunkserver_sample_factor;
+    if (total <= want * 2) {
+        return false;
+    }
+    std::set<ChunkServerInfo*> picked;
+    if (local_cs && IsWritable(local_cs)) {
+        loads->push_back(std::make_pair(local_cs->load() - FLAGS_select_chunkserver_local_factor,
+                                        local_cs));
+        picked.insert(local_cs);
+    }
+    for (int i = 0; i < want * 4 && static_cast<int>(loads->size()) < want; i++) {
+        ChunkServerInfo* a = placement[rand() % total];
+        ChunkServerInfo* b = placement[rand() % total];
+        ChunkServerInfo* cs = b->load() < a->load() ? b : a;
+        if (!picked.insert(cs).second) {
+            continue;
+        }
+        loads->push_back(std::make_pair(cs->load(), cs));
+    }
+    if (static_cast<int>(loads->size()) < num) {
+        return false;
+    }
+    std::sort(loads->begin(), loads->end());
+    return true;
+}
+
 bool ChunkServerManager::GetRecoverChains(const std::set<int32_t>& replica,
                                           std::vector<std::string>* chains) {
-    mu_.AssertHeld();
-    std::map<int32_t, std::set<ChunkServerInfo*> >::iterator it = heartbeat_list_.begin();
+    std::shared_ptr<LoadSnapshot> snapshot = GetSnapshot();
     std::vector<std::pair<double, ChunkServerInfo*> > loads;
 
     std::set<std::string> tag_set;
-    if (FLAGS_select_chunkserver_by_tag) {
-        for (std::set<int32_t>::const_iterator it = replica.begin();
-             it != replica.end(); ++it) {
-            ChunkServerInfo* rep_cs = NULL;
-            if (!GetChunkServerPtr(*it, &rep_cs) || rep_cs->tag().empty()) {
-                continue;
-            }
+    std::set<std::string> rack_set;
+    for (std::set<int32_t>::const_iterator it = replica.begin();
+         it != replica.end(); ++it) {
+        std::unordered_map<int32_t, ChunkServerInfo*>::const_iterator rep_it =
+            snapshot->index.find(*it);
+        if (rep_it == snapshot->index.end()) {
+            continue;
+        }
+        ChunkServerInfo* rep_cs = rep_it->second;
+        rack_set.insert(rep_cs->rack());
+        if (FLAGS_select_chunkserver_by_tag && !rep_cs->tag().empty()) {
             tag_set.insert(rep_cs->tag());
-            ///TODO: has_remote?
         }
+        ///TODO: has_remote?
     }
     ChunkServerInfo* remote_cs = NULL;
-    for (; it != heartbeat_list_.end(); ++it) {
-        std::set<ChunkServerInfo*>& set = it->second;
-        for (std::set<ChunkServerInfo*>::iterator sit = set.begin(); sit != set.end(); ++sit) {
-            ChunkServerInfo* cs = *sit;
-            if (replica.find(cs->id()) != replica.end()) {
-                LOG(INFO, "GetRecoverChains has C%d ", cs->id());
-                continue;
-            } else if (FLAGS_select_chunkserver_by_tag
-                       && !cs->tag().empty()
-                       && !tag_set.insert(cs->tag()).second) {
-                continue;
-            } else if (cs->zone() != localzone_) {
-                if (!remote_cs) {
-                    remote_cs = cs;
-                }
-                LOG(DEBUG, "Remote zone server C%d ignore PickRecoverBlocks", cs->id());
-                continue;
-            } else if (cs->status() == kCsReadonly) {
-                LOG(DEBUG, "C%d is in offline progress, igore", cs->id());
-                continue;
-            }
-            double load = cs->load();
-            if (load <= kChunkServerLoadMax) {
-                loads.push_back(std::make_pair(load, cs));
-            } else {
-                LOG(DEBUG, "Recover alloc ignore: ChunkServer %s data %ld/%ld buffer %d",
-                    cs->ipaddress().c_str(), cs->data_size(),
-                    cs->disk_quota(), cs->buffers());
+    for (size_t i = 0; i < snapshot->alive.size(); i++) {
+        ChunkServerInfo* cs = snapshot->alive[i];
+        if (replica.find(cs->id()) != replica.end()) {
+            LOG(INFO, "GetRecoverChains has C%d ", cs->id());
+            continue;
+        } else if (FLAGS_select_chunkserver_by_tag
+                   && !cs->tag().empty()
+                   && !tag_set.insert(cs->tag()).second) {
+            continue;
+        } else if (cs->zone() != localzone_) {
+            if (!remote_cs) {
+                remote_cs = cs;
             }
+            LOG(DEBUG, "Remote zone server C%d ignore PickRecoverBlocks", cs->id());
+            continue;
+        } else if (cs->status() == kCsReadonly) {
+            LOG(DEBUG, "C%d is in offline progress, igore", cs->id());
+            continue;
+        }
+        double load = cs->load();
+        if (load <= kChunkServerLoadMax) {
+            loads.push_back(std::make_pair(load, cs));
+        } else {
+            LOG(DEBUG, "Recover alloc ignore: ChunkServer %s data %ld/%ld buffer %d",
+                cs->ipaddress().c_str(), cs->data_size(),
+                cs->disk_quota(), cs->buffers());
         }
     }
     if (loads.empty()) {
         if (remote_cs) {
-            double load = GetChunkServerLoad(remote_cs);
-            if (load != kChunkServerLoadMax) {
+            double load = remote_cs->load();
+            if (load <= kChunkServerLoadMax) {
                 LOG(INFO, "Recover to remote zone C%d ", remote_cs->id());
                 loads.push_back(std::make_pair(load, remote_cs));
             }
@@ -493,12 +699,23 @@ bool ChunkServerManager::GetRecoverChains(const std::set<int32_t>& replica,
         }
     }
     RandomSelect(&loads, FLAGS_recover_dest_limit);
+    if (FLAGS_select_chunkserver_by_rack && rack_set.size() == 1) {
+        // All the living replicas share one rack, recover to another rack first
+        std::stable_partition(loads.begin(), loads.end(),
+                              std::bind(&ChunkServerManager::NotInRack, std::placeholders::_1,
+                                        *rack_set.begin()));
+    }
     for (int i = 0; i < static_cast<int>(loads.size()) && i < FLAGS_recover_dest_limit; ++i) {
         ChunkServerInfo* cs = loads[i].second;
         chains->push_back(cs->ipaddress());
     }
     return true;
 }
+bool ChunkServerManager::NotInRack(const std::pair<double, ChunkServerInfo*>& load,
+                                   const std::string& rack) {
+    return load.second->rack() != rack;
+}
+
 int ChunkServerManager::SelectChunkServerByZone(int num,
         const std::vector<std::pair<double, ChunkServerInfo*> >& loads,
         std::vector<std::pair<int32_t,std::string> >* chains) {
@@ -533,12 +750,120 @@ int ChunkServerManager::SelectChunkServerByZone(int num,
     return chains->size();
 }
 
+/// Lowest load candidate not picked yet, optionally off the given rack
+static ChunkServerInfo* PickCandidate(
+        const std::vector<std::pair<double, ChunkServerInfo*> >& loads,
+        const std::set<ChunkServerInfo*>& picked, const std::string* avoid_rack) {
+    for (size_t i = 0; i < loads.size(); i++) {
+        ChunkServerInfo* cs = loads[i].second;
+        if (picked.find(cs) == picked.end()
+            && (avoid_rack == NULL || cs->rack() != *avoid_rack)) {
+            return cs;
+        }
+    }
+    return NULL;
+}
+
+int ChunkServerManager::SelectChunkServerByRack(const LoadSnapshot& snapshot, int num,
+        ChunkServerInfo* local_cs,
+        const std::vector<std::pair<double, ChunkServerInfo*> >& loads,
+        const std::set<int32_t>& exclude,
+        std::vector<std::pair<int32_t,std::string> >* chains) {
+    std::vector<ChunkServerInfo*> selected;
+    std::set<ChunkServerInfo*> picked;
+    // Excluded ones are gone from loads, keep rack sampling off them too
+    for (std::set<int32_t>::const_iterator it = exclude.begin(); it != exclude.end(); ++it) {
+        std::unordered_map<int32_t, ChunkServerInfo*>::const_iterator cs_it =
+            snapshot.index.find(*it);
+        if (cs_it != snapshot.index.end()) {
+            picked.insert(cs_it->second);
+        }
+    }
+    // First replica on the writer
+    ChunkServerInfo* first = local_cs;
+    if (!local_cs || !IsWritable(local_cs)) {
+        first = PickCandidate(loads, picked, NULL);
+    }
+    if (first) {
+        selected.push_back(first);
+        picked.insert(first);
+    }
+    // Second on a remote rack
+    if (num > 1 && !selected.empty()) {
+        ChunkServerInfo* cs = PickCandidate(loads, picked, &selected[0]->rack());
+        if (cs == NULL) {
+            cs = PickCandidate(loads, picked, NULL);
+        }
+        if (cs) {
+            selected.push_back(cs);
+            picked.insert(cs);
+        }
+    }
+    // Third beside the second, so only one copy crosses racks
+    if (num > 2 && selected.size() == 2) {
+        ChunkServerInfo* cs = NULL;
+        if (selected[1]->rack() != selected[0]->rack()) {
+            cs = SampleInRack(snapshot, selected[1]->rack(), picked);
+        }
+        if (cs == NULL) {
+            cs = PickCandidate(loads, picked, NULL);
+        }
+        if (cs) {
+            selected.push_back(cs);
+            picked.insert(cs);
+        }
+    }
+    while (static_cast<int>(selected.size()) < num) {
+        ChunkServerInfo* cs = PickCandidate(loads, picked, NULL);
+        if (cs == NULL) {
+            break;
+        }
+        selected.push_back(cs);
+        picked.insert(cs);
+    }
+    for (size_t i = 0; i < selected.size(); i++) {
+        ChunkServerInfo* cs = selected[i];
+        LOG(DEBUG, "Rack %s C%d ", cs->rack().c_str(), cs->id());
+        chains->push_back(std::make_pair(cs->id(), cs->ipaddress()));
+    }
+    return chains->size();
+}
+
+ChunkServerInfo* ChunkServerManager::SampleInRack(const LoadSnapshot& snapshot,
+                                                  const std::string& rack,
+                                                  const std::set<ChunkServerInfo*>& excluded) {
+    std::unordered_map<std::string, std::vector<ChunkServerInfo*> >::const_iterator it =
+        snapshot.racks.find(rack);
+    if (it == snapshot.racks.end()) {
+        return NULL;
+    }
+    const std::vector<ChunkServerInfo*>& servers = it->second;
+    ChunkServerInfo* best = NULL;
+    // Power of two choices, retry a few times to skip the excluded ones
+    for (int i = 0; i < 8; i++) {
+        ChunkServerInfo* cs = servers[rand() % servers.size()];
+        if (excluded.find(cs) != excluded.end()) {
+            continue;
+        }
+        if (best == NULL) {
+            best = cs;
+        } else {
+            if (cs->load() < best->load()) {
+                best = cs;
+            }
+            break;
+        }
+    }
+    return best;
+}
+
 bool ChunkServerManager::UpdateChunkServer(int cs_id, const std::string& tag, int64_t quota) {
     mu_.AssertHeld();
     ChunkServerInfo* info = NULL;
     if (!GetChunkServerPtr(cs_id, &info)) {
         return false;
     }
+    MutexLock shard_lock(ShardMutex(cs_id));
     char buf[20];
     common::timer::now_time_str(buf, 20, common::timer::kMin);
     info->set_start_time(std::string(buf));
@@ -550,10 +875,10 @@ bool ChunkServerManager::UpdateChunkServer(int cs_id, const std::string& tag, in
     info->set_kick(false);
     if (info->is_dead()) {
         int32_t now_time = common::timer::now_time();
-        heartbeat_list_[now_time].insert(info);
         info->set_last_heartbeat(now_time);
         info->set_is_dead(false);
         chunkserver_num_ ++;
+        ScheduleDeadCheck(cs_id, now_time + params_.keepalive_timeout());
     }
     return true;
 }
@@ -589,11 +914,15 @@ int32_t ChunkServerManager::AddChunkServer(const std::string& address,
     LOG(INFO, "New ChunkServerInfo C%d %s %s %s %s",
         id, address.c_str(), info->zone().c_str(),
         info->datacenter().c_str(), info->rack().c_str());
-    chunkservers_[id] = info;
-    address_map_[address] = id;
     int32_t now_time = common::timer::now_time();
-    heartbeat_list_[now_time].insert(info);
     info->set_last_heartbeat(now_time);
+    chunkservers_[id] = info;
+    address_map_[address] = id;
+    {
+        MutexLock shard_lock(ShardMutex(id));
+        heartbeat_shards_[id % kHeartBeatShardNum].servers[id] = info;
+    }
+    ScheduleDeadCheck(id, now_time + params_.keepalive_timeout());
     ++chunkserver_num_;
     Blocks* blocks = new Blocks(id);
     block_map_.insert(std::make_pair(id, blocks));
@@ -609,6 +938,20 @@ std::string ChunkServerManager::GetChunkServerAddr(int32_t id) {
     return "";
 }
 
+bool ChunkServerManager::GetChunkServerLocation(int32_t id, ChunkServerInfo* location) {
+    MutexLock lock(&mu_, "GetChunkServerLocation", 10);
+    ChunkServerInfo* cs = NULL;
+    if (!GetChunkServerPtr(id, &cs) || cs->is_dead()) {
+        return false;
+    }
+    location->set_id(id);
+    location->set_address(cs->ipaddress());
+    location->set_zone(cs->zone());
+    location->set_datacenter(cs->datacenter());
+    location->set_rack(cs->rack());
+    return true;
+}
+
 int32_t ChunkServerManager::GetChunkServerId(const std::string& addr) {
     MutexLock lock(&mu_, "GetChunkServerId", 10);
     std::map<std::string, int32_t>::iterator it = address_map_.find(addr);
@@ -641,10 +984,18 @@ void ChunkServerManager::SetParam(const Params& p) {
     if (p.keepalive_timeout() != -1) {
         params_.set_keepalive_timeout(p.keepalive_timeout());
     }
+    if (p.recover_bandwidth() != -1) {
+        params_.set_recover_bandwidth(p.recover_bandwidth());
+    }
+    if (p.recover_bandwidth_per_server() != -1) {
+        params_.set_recover_bandwidth_per_server(p.recover_bandwidth_per_server());
+    }
     LOG(INFO, "SetParam to report_interval = %d report_size = %d "
-              "recover_size = %d keepalive_timeout = %d",
+              "recover_size = %d keepalive_timeout = %d "
+              "recover_bandwidth = %d recover_bandwidth_per_server = %d",
             params_.report_interval(), params_.report_size(),
-            params_.recover_size(), params_.keepalive_timeout());
+            params_.recover_size(), params_.keepalive_timeout(),
+            params_.recover_bandwidth(), params_.recover_bandwidth_per_server());
 }
 
 Params ChunkServerManager::GetParam() {
@@ -663,20 +1014,36 @@ void ChunkServerManager::RemoveBlock(int32_t id, int64_t block_id) {
 void ChunkServerManager::PickRecoverBlocks(int cs_id, RecoverVec* recover_blocks,
                                            int* hi_num, bool hi_only) {
     ChunkServerInfo* cs = NULL;
+    int32_t quota = 0;
+    int64_t hi_bytes = 0, lo_bytes = 0;
     {
         MutexLock lock(&mu_, "PickRecoverBlocks 1", 10);
         if (!GetChunkServerPtr(cs_id, &cs)) {
             return;
         }
+        {
+            MutexLock shard_lock(ShardMutex(cs_id));
+            quota = params_.recover_size() - cs->pending_recover();
+        }
+        // A server busy serving reads and writes is a poor recover source,
+        // leave most blocks to the other replicas
+        double busy = load_model_->GetBusyRatio(cs_id);
+        if (quota > 0 && busy > 0) {
+            quota = std::max(1, static_cast<int32_t>(quota * (1 - busy)));
+        }
+        GetRecoverBytes(&hi_bytes, &lo_bytes);
     }
     std::vector<std::pair<int64_t, std::set<int32_t> > > blocks;
     int64_t before_pick = common::timer::get_micros();
-    block_mapping_manager_->PickRecoverBlocks(cs_id, params_.recover_size() - cs->pending_recover(),
-                                              &blocks, hi_num, hi_only);
+    int64_t picked_bytes = block_mapping_manager_->PickRecoverBlocks(cs_id, quota,
+                                hi_bytes, lo_bytes, &blocks, hi_num, hi_only);
+    {
+        MutexLock lock(&mu_, "PickRecoverBlocks 2", 10);
+        recover_tokens_ -= picked_bytes;
+    }
     int64_t before_get_recover_chain = common::timer::get_micros();
     for (std::vector<std::pair<int64_t, std::set<int32_t> > >::iterator it = blocks.begin();
          it != blocks.end(); ++it) {
-        MutexLock lock(&mu_);
         recover_blocks->push_back(std::make_pair((*it).first, std::vector<std::string>()));
         if (GetRecoverChains((*it).second, &(recover_blocks->back().second))) {
             //
@@ -699,6 +1066,34 @@ void ChunkServerManager::PickRecoverBlocks(int cs_id, RecoverVec* recover_blocks
     }
 }
 
+void ChunkServerManager::GetRecoverBytes(int64_t* hi_bytes, int64_t* lo_bytes) {
+    mu_.AssertHeld();
+    const int64_t kNoLimit = 1LL << 50;
+    // A server is asked for blocks once per block report
+    int64_t interval = std::max(params_.report_interval(), 1);
+    int64_t per_server = kNoLimit;
+    if (params_.recover_bandwidth_per_server() > 0) {
+        per_server = (params_.recover_bandwidth_per_server() * interval) << 20;
+    }
+    if (params_.recover_bandwidth() <= 0) {
+        recover_tokens_ = 0;
+        *hi_bytes = *lo_bytes = per_server;
+        return;
+    }
+    int64_t now = common::timer::get_micros();
+    double bandwidth = params_.recover_bandwidth() * 1024.0 * 1024.0;
+    recover_tokens_ += bandwidth * (now - last_recover_refill_) / 1000000;
+    recover_tokens_ = std::min(recover_tokens_, bandwidth * interval);
+    last_recover_refill_ = now;
+    // Blocks left with one replica may run the cluster budget up to one interval
+    // into debt, so they don't queue behind the others but the cluster rate
+    // still holds over time; the others wait for the budget
+    double burst = bandwidth * interval;
+    *hi_bytes = std::min(per_server,
+                         static_cast<int64_t>(std::max(recover_tokens_ + burst, 0.0)));
+    *lo_bytes = std::min(per_server, static_cast<int64_t>(recover_tokens_));
+}
+
 void ChunkServerManager::GetStat(int32_t* w_qps, int64_t* w_speed,
                                  int32_t* r_qps, int64_t* r_speed, int64_t* recover_speed) {
     if (w_qps) *w_qps = stats_.w_qps;
@@ -722,18 +1117,21 @@ void ChunkServerManager::LogStats() {
     int32_t w_qps = 0, r_qps = 0;
     int64_t w_speed = 0, r_speed = 0, recover_speed = 0;
     int32_t overload = 0;
-    {
-        MutexLock lock(&mu_);
-        for (ServerMap::iterator it = chunkservers_.begin(); it != chunkservers_.end(); ++it) {
-            ChunkServerInfo* cs = it->second;
-            w_qps += cs->w_qps();
-            w_speed += cs->w_speed();
-            r_qps += cs->r_qps();
-            r_speed += cs->r_speed();
-            recover_speed += cs->recover_speed();
-            if (cs->load() > kChunkServerLoadMax) {
-                ++overload;
-            }
+    int64_t data_size = 0, disk_quota = 0;
+    std::shared_ptr<LoadSnapshot> snapshot = GetSnapshot();
+    for (size_t i = 0; i < snapshot->servers.size(); i++) {
+        const ChunkServerInfo& cs = snapshot->servers[i];
+        if (!cs.is_dead()) {
+            data_size += cs.data_size();
+            disk_quota += cs.disk_quota();
+        }
+        w_qps += cs.w_qps();
+        w_speed += cs.w_speed();
+        r_qps += cs.r_qps();
+        r_speed += cs.r_speed();
+        recover_speed += cs.recover_speed();
+        if (cs.load() > kChunkServerLoadMax) {
+            ++overload;
         }
     }
     stats_.w_qps = w_qps;
@@ -741,14 +1139,77 @@ void ChunkServerManager::LogStats() {
     stats_.r_qps = r_qps;
     stats_.r_speed = r_speed;
     stats_.recover_speed = recover_speed;
-    LOG(INFO, "[LogStats] w_qps=%d w_speed=%s r_qps=%d r_speed=%s recover_speed=%s overload=%d",
+    stats_.avg_usage = disk_quota > 0 ? data_size * 1.0 / disk_quota : 0;
+    LOG(INFO, "[LogStats] w_qps=%d w_speed=%s r_qps=%d r_speed=%s recover_speed=%s overload=%d "
+               "avg_usage=%.3f",
                w_qps, common::HumanReadableString(w_speed).c_str(), r_qps,
                common::HumanReadableString(r_speed).c_str(),
-               common::HumanReadableString(recover_speed).c_str(), overload);
+               common::HumanReadableString(recover_speed).c_str(), overload, stats_.avg_usage);
     thread_pool_->DelayTask(FLAGS_heartbeat_interval * 1000,
                            std::bind(&ChunkServerManager::LogStats, this));
 }
 
+double ChunkServerManager::DiskUsage(const ChunkServerInfo* cs) {
+    return cs->disk_quota() > 0 ? cs->data_size() * 1.0 / cs->disk_quota() : 1.0;
+}
+
+bool ChunkServerManager::IsBalanceSource(int32_t cs_id) {
+    std::shared_ptr<LoadSnapshot> snapshot = GetSnapshot();
+    std::unordered_map<int32_t, ChunkServerInfo*>::const_iterator it = snapshot->index.find(cs_id);
+    if (it == snapshot->index.end()) {
+        return false;
+    }
+    const ChunkServerInfo* cs = it->second;
+    if (cs->is_dead() || cs->status() != kCsActive) {
+        return false;
+    }
+    return DiskUsage(cs) > stats_.avg_usage + FLAGS_balance_threshold;
+}
+
+bool ChunkServerManager::GetBalanceTarget(int32_t src_id, const std::set<int32_t>& replica,
+                                          int32_t* target_id, std::string* target_addr) {
+    std::shared_ptr<LoadSnapshot> snapshot = GetSnapshot();
+    const std::vector<ChunkServerInfo*>& placement = snapshot->placement;
+    std::unordered_map<int32_t, ChunkServerInfo*>::const_iterator src_it =
+        snapshot->index.find(src_id);
+    if (src_it == snapshot->index.end() || placement.empty()) {
+        return false;
+    }
+    const ChunkServerInfo* src = src_it->second;
+    // Racks of the replicas that stay, the move must not lose rack spread
+    std::set<std::string> racks;
+    for (std::set<int32_t>::const_iterator it = replica.begin(); it != replica.end(); ++it) {
+        std::unordered_map<int32_t, ChunkServerInfo*>::const_iterator cs_it =
+            snapshot->index.find(*it);
+        if (*it != src_id && cs_it != snapshot->index.end()) {
+            racks.insert(cs_it->second->rack());
+        }
+    }
+    bool src_rack_shared = racks.find(src->rack()) != racks.end();
+    double limit = stats_.avg_usage - FLAGS_balance_threshold;
+    ChunkServerInfo* target = NULL;
+    int32_t sample_num = std::min(static_cast<int32_t>(placement.size()), 20);
+    for (int32_t i = 0; i < sample_num; i++) {
+        ChunkServerInfo* cs = placement[rand() % placement.size()];
+        if (replica.find(cs->id()) != replica.end() || DiskUsage(cs) > limit) {
+            continue;
+        }
+        if (FLAGS_select_chunkserver_by_rack && !src_rack_shared
+            && racks.find(cs->rack()) != racks.end()) {
+            continue;
+        }
+        if (target == NULL || DiskUsage(cs) < DiskUsage(target)) {
+            target = cs;
+        }
+    }
+    if (target == NULL) {
+        return false;
+    }
+    *target_id = target->id();
+    *target_addr = target->ipaddress();
+    return true;
+}
+
 void ChunkServerManager::MarkChunkServerReadonly(const std::string& chunkserver_address) {
     mu_.AssertHeld();
     std::map<std::string, int32_t>::iterator it = address_map_.find(chunkserver_address);
@@ -758,6 +1219,7 @@ void ChunkServerManager::MarkChunkServerReadonly(const std::string& chunkserver_
     }
     int32_t cs_id = it->second;
     ChunkServerInfo* cs_info = chunkservers_[cs_id];
+    MutexLock shard_lock(ShardMutex(cs_id));
     if (cs_info->status() == kCsActive) {
         cs_info->set_status(kCsReadonly);
         LOG(INFO, "Mark C%d readonly", cs_id);
@@ -766,14 +1228,18 @@ void ChunkServerManager::MarkChunkServerReadonly(const std::string& chunkserver_
 
 StatusCode ChunkServerManager::ShutdownChunkServer(const::google::protobuf::RepeatedPtrField<std::string>&
                                                   chunkserver_address) {
-    MutexLock lock(&mu_);
-    //if (!chunkservers_to_offline_.empty()) {
-    //    return kInShutdownProgress;
-    //}
-    for (int i = 0; i < chunkserver_address.size(); i++) {
-        chunkservers_to_offline_.push_back(chunkserver_address.Get(i));
-        MarkChunkServerReadonly(chunkservers_to_offline_.back());
+    {
+        MutexLock lock(&mu_);
+        //if (!chunkservers_to_offline_.empty()) {
+        //    return kInShutdownProgress;
+        //}
+        for (int i = 0; i < chunkserver_address.size(); i++) {
+            chunkservers_to_offline_.push_back(chunkserver_address.Get(i));
+            MarkChunkServerReadonly(chunkservers_to_offline_.back());
+        }
     }
+    // Stop placing new blocks there at once
+    RebuildSnapshot();
     //TODO: Add kick chunkserver task
     return kOK;
 }
@@ -792,6 +1258,15 @@ Blocks* ChunkServerManager::GetBlockMap(int32_t cs_id) {
     return it->second;
 }
 
+int64_t ChunkServerManager::ListBlocks(int32_t cs_id, int64_t start, int32_t num,
+                                       std::vector<int64_t>* blocks) {
+    Blocks* cs_blocks = GetBlockMap(cs_id);
+    if (!cs_blocks) {
+        return 0;
+    }
+    return cs_blocks->List(start, num, blocks);
+}
+
 int64_t ChunkServerManager::AddBlockWithCheck(int32_t id, const std::set<int64_t>& blocks,
                                               int64_t start, int64_t end,
                                               std::vector<int64_t>* lost, int64_t report_id) {
@@ -4,6 +4,7 @@
 
 #include <set>
 #include <map>
+#include <memory>
 #include <unordered_map>
 #include <functional>
 
@@ -17,6 +18,7 @@ namespace bfs {
 const double kChunkServerLoadMax = 0.999999;
 
 class BlockMappingManager;
+class LoadModel;
 typedef  std::vector<std::pair<int64_t, std::vector<std::string> > > RecoverVec;
 
 class Blocks {
@@ -27,6 +29,7 @@ public:
     void Remove(int64_t block_id);
     void CleanUp(std::set<int64_t>* blocks);
     void MoveNew();
+    int64_t List(int64_t start, int32_t num, std::vector<int64_t>* blocks);
     int64_t CheckLost(int64_t report_id, const std::set<int64_t>& blocks,
                       int64_t start, int64_t end, std::vector<int64_t>* lost);
 private:
@@ -38,6 +41,18 @@ private:
     int32_t cs_id_;                 // for debug msg
 };
 
+/// Chunkservers as placement sees them, built by RebuildSnapshot and
+/// read only once published, so placement runs without mu_
+struct LoadSnapshot {
+    std::vector<ChunkServerInfo> servers;   ///< copies of all chunkservers, without disks
+    std::unordered_map<int32_t, ChunkServerInfo*> index;    ///< cs id -> servers
+    std::map<std::string, ChunkServerInfo*> address_map;
+    std::vector<ChunkServerInfo*> alive;
+    std::vector<ChunkServerInfo*> placement;                ///< writable ones
+    std::unordered_map<std::string, std::vector<ChunkServerInfo*> > racks;  ///< writable by rack
+    Params params;
+};
+
 class ChunkServerManager {
 public:
     struct Stats {
@@ -46,15 +61,20 @@ public:
         int32_t r_qps;
         int64_t r_speed;
         int64_t recover_speed;
+        double avg_usage;       ///< data_size / disk_quota of all living servers
     };
     ChunkServerManager(ThreadPool* thread_pool, BlockMappingManager* block_mapping_manager);
+    ~ChunkServerManager();
     bool HandleRegister(const std::string& ip,
                         const RegisterRequest* request,
                         RegisterResponse* response);
     void HandleHeartBeat(const HeartBeatRequest* request, HeartBeatResponse* response);
     void ListChunkServers(::google::protobuf::RepeatedPtrField<ChunkServerInfo>* chunkservers);
+    /// Pick num chunkservers for a new block, none of them in 'exclude' and,
+    /// with rack placement, none in their racks while enough others are left
     bool GetChunkServerChains(int num, std::vector<std::pair<int32_t,std::string> >* chains,
-                              const std::string& client_address);
+                              const std::string& client_address,
+                              const std::set<int32_t>& exclude = std::set<int32_t>());
     bool GetRecoverChains(const std::set<int32_t>& replica, std::vector<std::string>* chains);
     int32_t AddChunkServer(const std::string& address, const std::string& ip,
                            const std::string& tag, int64_t quota);
@@ -62,6 +82,7 @@ public:
     bool UpdateChunkServer(int cs_id, const std::string& tag, int64_t quota);
     bool RemoveChunkServer(const std::string& address);
     std::string GetChunkServerAddr(int32_t id);
+    bool GetChunkServerLocation(int32_t id, ChunkServerInfo* location);
     int32_t GetChunkServerId(const std::string& address);
     void AddBlock(int32_t id, int64_t block_id);
     void RemoveBlock(int32_t id, int64_t block_id);
@@ -75,27 +96,72 @@ public:
                               std::vector<int64_t>* lost, int64_t report_id);
     void SetParam(const Params& p);
     Params GetParam();
+    int64_t ListBlocks(int32_t cs_id, int64_t start, int32_t num, std::vector<int64_t>* blocks);
+    bool IsBalanceSource(int32_t cs_id);
+    bool GetBalanceTarget(int32_t src_id, const std::set<int32_t>& replica,
+                          int32_t* target_id, std::string* target_addr);
+    /// Publish the current loads to placement
+    void RebuildSnapshot();
 private:
-    double GetChunkServerLoad(ChunkServerInfo* cs);
     void DeadCheck();
+    void ScheduleDeadCheck(int32_t cs_id, int32_t due_time);
+    Mutex* ShardMutex(int32_t cs_id);
+    void UpdateHeartBeat(ChunkServerInfo* info, const HeartBeatRequest* request,
+                         HeartBeatResponse* response, const Params& params);
+    std::shared_ptr<LoadSnapshot> GetSnapshot();
+    void RefreshSnapshot();
+    static bool IsWritable(const ChunkServerInfo* cs);
     void RandomSelect(std::vector<std::pair<double, ChunkServerInfo*> >* loads, int num);
     bool GetChunkServerPtr(int32_t cs_id, ChunkServerInfo** cs);
     void LogStats();
+    void GetRecoverBytes(int64_t* hi_bytes, int64_t* lo_bytes);
+    static double DiskUsage(const ChunkServerInfo* cs);
     int SelectChunkServerByZone(int num,
         const std::vector<std::pair<double, ChunkServerInfo*> >& loads,
         std::vector<std::pair<int32_t,std::string> >* chains);
+    int SelectChunkServerByRack(const LoadSnapshot& snapshot, int num, ChunkServerInfo* local_cs,
+        const std::vector<std::pair<double, ChunkServerInfo*> >& loads,
+        const std::set<int32_t>& exclude,
+        std::vector<std::pair<int32_t,std::string> >* chains);
+    static bool NotInRack(const std::pair<double, ChunkServerInfo*>& load,
+                          const std::string& rack);
+    ChunkServerInfo* SampleInRack(const LoadSnapshot& snapshot, const std::string& rack,
+                                  const std::set<ChunkServerInfo*>& excluded);
     void MarkChunkServerReadonly(const std::string& chunkserver_address);
     Blocks* GetBlockMap(int32_t cs_id);
+    bool SampleChunkServers(const LoadSnapshot& snapshot, int num, ChunkServerInfo* local_cs,
+                            std::vector<std::pair<double, ChunkServerInfo*> >* loads);
+    void ScanChunkServers(const LoadSnapshot& snapshot, ChunkServerInfo* local_cs,
+                          std::vector<std::pair<double, ChunkServerInfo*> >* loads);
+    void ExcludeChunkServers(const LoadSnapshot& snapshot, const std::set<int32_t>& exclude,
+                             int num, std::vector<std::pair<double, ChunkServerInfo*> >* loads);
 private:
     ThreadPool* thread_pool_;
     BlockMappingManager* block_mapping_manager_;
-    Mutex mu_;      /// chunkserver_s list mutext;
+    /// Guards the chunkserver list and membership: status and is_dead are
+    /// written with both mu_ and the shard lock of the server held
+    Mutex mu_;
     Stats stats_;
     typedef std::unordered_map<int32_t, ChunkServerInfo*> ServerMap;
     ServerMap chunkservers_;
     std::map<std::string, int32_t> address_map_;
-    std::map<int32_t, std::set<ChunkServerInfo*> > heartbeat_list_;
+    /// Heartbeats only take the shard lock of the server, which guards
+    /// the ChunkServerInfo fields they update
+    struct HeartBeatShard {
+        Mutex mu;
+        ServerMap servers;
+    };
+    static const int32_t kHeartBeatShardNum = 64;
+    HeartBeatShard heartbeat_shards_[kHeartBeatShardNum];
+    /// Timer wheel of one second slots holding (due time, cs id), a server is
+    /// checked when due and put back at last_heartbeat + keepalive_timeout
+    static const int32_t kDeadCheckSlotNum = 64;
+    std::vector<std::pair<int32_t, int32_t> > dead_check_wheel_[kDeadCheckSlotNum];
+    int32_t dead_check_time_;       ///< next second to check
     std::unordered_map<int32_t, Blocks*> block_map_;
+    Mutex rebuild_mu_;              ///< one snapshot rebuild at a time
+    Mutex snapshot_mu_;             ///< only guards swapping snapshot_
+    std::shared_ptr<LoadSnapshot> snapshot_;
     int32_t chunkserver_num_;
     int32_t next_chunkserver_id_;
 
@@ -106,6 +172,10 @@ private:
 
     // for chunkserver
     Params params_;
+    /// Bytes the cluster may still recover, refilled at params_.recover_bandwidth
+    double recover_tokens_;
+    int64_t last_recover_refill_;
+    LoadModel* load_model_;
 };
 
 
@@ -5,8 +5,12 @@
 
 #include "nameserver/file_lock.h"
 
+#include <algorithm>
+
 #include <common/logging.h>
 
+#include "nameserver/rpc_stats.h"
+
 namespace baidu {
 namespace bfs {
 
@@ -14,12 +18,14 @@ FileLockManager* WriteLock::file_lock_manager_ = NULL;
 FileLockManager* ReadLock::file_lock_manager_ = NULL;
 
 WriteLock::WriteLock(const std::string& file_path) {
+    RpcStageTimer timer(kRpcLock);
     file_path_.push_back(file_path);
     file_lock_manager_->WriteLock(file_path);
 }
 
 WriteLock::WriteLock(const std::string& file_path_a,
                      const std::string& file_path_b) {
+    RpcStageTimer timer(kRpcLock);
     int r = strcmp(file_path_a.c_str(), file_path_b.c_str());
     if (r == 0) {
         file_path_.push_back(file_path_a);
@@ -37,12 +43,18 @@ WriteLock::WriteLock(const std::string& file_path_a,
     }
 }
 
+WriteLock::WriteLock(const std::vector<std::string>& file_paths) : file_path_(file_paths) {
+    RpcStageTimer timer(kRpcLock);
+    std::sort(file_path_.begin(), file_path_.end());
+    file_path_.erase(std::unique(file_path_.begin(), file_path_.end()), file_path_.end());
+    for (size_t i = 0; i < file_path_.size(); i++) {
+        file_lock_manager_->WriteLock(file_path_[i]);
+    }
+}
+
 WriteLock::~WriteLock() {
-    if (file_path_.size() == 1) {
-        file_lock_manager_->Unlock(file_path_[0]);
-    } else {
-        file_lock_manager_->Unlock(file_path_[1]);
-        file_lock_manager_->Unlock(file_path_[0]);
+    for (size_t i = file_path_.size(); i > 0; i--) {
+        file_lock_manager_->Unlock(file_path_[i - 1]);
     }
 }
 
@@ -51,12 +63,24 @@ void WriteLock::SetFileLockManager(FileLockManager* file_lock_manager) {
 }
 
 ReadLock::ReadLock(const std::string& file_path) {
-    file_path_ = file_path;
+    RpcStageTimer timer(kRpcLock);
+    file_path_.push_back(file_path);
     file_lock_manager_->ReadLock(file_path);
 }
 
+ReadLock::ReadLock(const std::vector<std::string>& file_paths) : file_path_(file_paths) {
+    RpcStageTimer timer(kRpcLock);
+    std::sort(file_path_.begin(), file_path_.end());
+    file_path_.erase(std::unique(file_path_.begin(), file_path_.end()), file_path_.end());
+    for (size_t i = 0; i < file_path_.size(); i++) {
+        file_lock_manager_->ReadLock(file_path_[i]);
+    }
+}
+
 ReadLock::~ReadLock() {
-    file_lock_manager_->Unlock(file_path_);
+    for (size_t i = file_path_.size(); i > 0; i--) {
+        file_lock_manager_->Unlock(file_path_[i - 1]);
+    }
 }
 
 void ReadLock::SetFileLockManager(FileLockManager* file_lock_manager) {
@@ -26,6 +26,8 @@ public:
     WriteLock(const std::string& file_path);
     WriteLock(const std::string& file_path_a,
               const std::string& file_path_b);
+    /// Lock all of 'file_paths' in path order, none may be an ancestor of another
+    WriteLock(const std::vector<std::string>& file_paths);
     ~WriteLock();
     static void SetFileLockManager(FileLockManager* file_lock_manager);
 private:
@@ -37,12 +39,14 @@ private:
 class ReadLock : public Lock {
 public:
     ReadLock(const std::string& file_path);
+    /// Lock all of 'file_paths' in path order
+    ReadLock(const std::vector<std::string>& file_paths);
     ~ReadLock();
     static void SetFileLockManager(FileLockManager* file_lock_manager);
 private:
     // will be initialized in NameServerImpl's constructor
     static FileLockManager* file_lock_manager_;
-    std::string file_path_;
+    std::vector<std::string> file_path_;
 };
 
 typedef std::shared_ptr<Lock> FileLockGuard;
@@ -9,13 +9,11 @@
 #include <string.h>
 #include <assert.h>
 
-#include <common/string_util.h>
-#include <common/hash.h>
-
 namespace baidu {
 namespace bfs {
 
-FileLockManager::FileLockManager(int bucket_num) {
+FileLockManager::FileLockManager(int bucket_num, int max_idle_per_bucket)
+    : max_idle_per_bucket_(max_idle_per_bucket) {
     locks_.reserve(bucket_num);
     for (int i = 0; i < bucket_num; i++) {
         locks_.push_back(new LockBucket);
@@ -23,83 +21,99 @@ FileLockManager::FileLockManager(int bucket_num) {
 }
 
 FileLockManager::~FileLockManager() {
+    for (size_t i = 0; i < locks_.size(); i++) {
+        LockBucket* bucket = locks_[i];
+        for (auto it = bucket->lock_map.begin(); it != bucket->lock_map.end(); ++it) {
+            delete it->second;
+        }
+        delete bucket;
+    }
+}
 
+/// "//home//dir1/" becomes "/home/dir1" with prefixes "/home" and "/home/dir1",
+/// hashed by FNV-1a along the way
+void FileLockManager::SplitPath(const std::string& file_path, PathView* view) {
+    const uint64_t kPrime = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL;
+    view->path.reserve(file_path.size() + 1);
+    size_t i = 0;
+    while (i < file_path.size()) {
+        if (file_path[i] == '/') {
+            ++i;
+            continue;
+        }
+        view->path.push_back('/');
+        hash = (hash ^ '/') * kPrime;
+        for (; i < file_path.size() && file_path[i] != '/'; i++) {
+            view->path.push_back(file_path[i]);
+            hash = (hash ^ static_cast<uint8_t>(file_path[i])) * kPrime;
+        }
+        view->prefixes.push_back(std::make_pair(view->path.size(), hash));
+    }
 }
 
-int FileLockManager::GetBucketOffset(const std::string& path) {
-    return common::Hash(path.c_str(), path.size(), 0) % locks_.size();
+FileLockManager::LockBucket* FileLockManager::GetBucket(uint64_t hash) {
+    return locks_[hash % locks_.size()];
 }
 
 void FileLockManager::ReadLock(const std::string& file_path) {
     LOG(DEBUG, "Try get read lock for %s", file_path.c_str());
-    std::vector<std::string> paths;
-    common::SplitString(file_path, "/", &paths);
-    // first lock "/"
-    LockInternal("/", kRead);
-    std::string cur_path;
-    for (size_t i = 0; i < paths.size(); i++) {
-        cur_path += ("/" + paths[i]);
-        LockInternal(cur_path, kRead);
+    PathView view;
+    SplitPath(file_path, &view);
+    root_lock_.ReadLock();
+    for (size_t i = 0; i < view.prefixes.size(); i++) {
+        LockInternal(view, i, kRead);
     }
 }
 
 void FileLockManager::WriteLock(const std::string& file_path) {
     LOG(DEBUG, "Try get write lock for %s", file_path.c_str());
-    std::vector<std::string> paths;
-    common::SplitString(file_path, "/", &paths);
-    // first lock "/"
-    if (paths.size() == 0) {
-        LockInternal("/", kWrite);
+    PathView view;
+    SplitPath(file_path, &view);
+    if (view.prefixes.empty()) {
+        root_lock_.WriteLock();
         return;
     }
-    LockInternal("/", kRead);
-    std::string cur_path;
-    for (size_t i = 0; i < paths.size() - 1; i++) {
-        cur_path += ("/" + paths[i]);
-        LockInternal(cur_path, kRead);
+    root_lock_.ReadLock();
+    for (size_t i = 0; i < view.prefixes.size() - 1; i++) {
+        LockInternal(view, i, kRead);
     }
-    cur_path += ("/" + paths.back());
-    LockInternal(cur_path, kWrite);
+    LockInternal(view, view.prefixes.size() - 1, kWrite);
 }
 
 void FileLockManager::Unlock(const std::string& file_path) {
-    /// TODO maybe use NormalizePath is better
-    std::vector<std::string> paths;
-    common::SplitString(file_path, "/", &paths);
-    std::string path;
-    for (size_t i = 0; i < paths.size(); i++) {
-        path += ("/" + paths[i]);
-    }
     LOG(DEBUG, "Release file lock for %s", file_path.c_str());
-    std::string cur_path = path;
-    for (size_t i = 0; i < paths.size() ; i++) {
-        UnlockInternal(cur_path);
-        cur_path.resize(cur_path.find_last_of('/'));
+    PathView view;
+    SplitPath(file_path, &view);
+    for (size_t i = view.prefixes.size(); i > 0; i--) {
+        UnlockInternal(view, i - 1);
     }
     // last unlock "/"
-    UnlockInternal("/");
+    root_lock_.Unlock();
 }
 
-void FileLockManager::LockInternal(const std::string& path,
-                                     LockType lock_type) {
+void FileLockManager::LockInternal(const PathView& view, size_t depth, LockType lock_type) {
+    size_t len = view.prefixes[depth].first;
+    uint64_t hash = view.prefixes[depth].second;
+    LockBucket* lock_bucket = GetBucket(hash);
     LockEntry* entry = NULL;
-
-    int bucket_offset = GetBucketOffset(path);
-    LockBucket* lock_bucket = locks_[bucket_offset];
-
     {
         MutexLock lock(&(lock_bucket->mu));
-        auto it = lock_bucket->lock_map.find(path);
-        if (it == lock_bucket->lock_map.end()) {
+        auto range = lock_bucket->lock_map.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            const std::string& path = it->second->path;
+            if (path.size() == len && memcmp(path.data(), view.path.data(), len) == 0) {
+                entry = it->second;
+                break;
+            }
+        }
+        if (entry == NULL) {
             entry = new LockEntry();
-            // hold a ref for lock_map_
-            entry->ref_.Inc();
-            lock_bucket->lock_map.insert(std::make_pair(path, entry));
-        } else {
-            entry = it->second;
+            entry->path.assign(view.path, 0, len);
+            lock_bucket->lock_map.insert(std::make_pair(hash, entry));
         }
-        // inc ref_ first to prevent deconstruct
-        entry->ref_.Inc();
+        // inc ref first to prevent deconstruct
+        ++entry->ref;
     }
 
     if (lock_type == kRead) {
@@ -111,19 +125,26 @@ void FileLockManager::LockInternal(const std::string& path,
     }
 }
 
-void FileLockManager::UnlockInternal(const std::string& path) {
-    int bucket_offset = GetBucketOffset(path);
-    LockBucket* lock_bucket = locks_[bucket_offset];
+void FileLockManager::UnlockInternal(const PathView& view, size_t depth) {
+    size_t len = view.prefixes[depth].first;
+    uint64_t hash = view.prefixes[depth].second;
+    LockBucket* lock_bucket = GetBucket(hash);
 
     MutexLock lock(&(lock_bucket->mu));
-    auto it = lock_bucket->lock_map.find(path);
-    assert(it != lock_bucket->lock_map.end());
+    auto range = lock_bucket->lock_map.equal_range(hash);
+    auto it = range.first;
+    for (; it != range.second; ++it) {
+        const std::string& path = it->second->path;
+        if (path.size() == len && memcmp(path.data(), view.path.data(), len) == 0) {
+            break;
+        }
+    }
+    assert(it != range.second);
     LockEntry* entry = it->second;
     // release lock
     entry->rw_lock_.Unlock();
-    if (entry->ref_.Dec() == 1) {
-        // we are the last holder
-        /// TODO maybe don't need to deconstruct immediately
+    if (--entry->ref == 0 && lock_bucket->lock_map.size() > max_idle_per_bucket_) {
+        // we are the last holder and the bucket keeps enough idle entries
         delete entry;
         lock_bucket->lock_map.erase(it);
     }
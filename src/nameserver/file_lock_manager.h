@@ -6,8 +6,10 @@
 #ifndef  BFS_FILE_LOCK_MANAGER_H_
 #define  BFS_FILE_LOCK_MANAGER_H_
 
+#include <stdint.h>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <common/rw_lock.h>
@@ -18,9 +20,12 @@
 namespace baidu {
 namespace bfs {
 
+/// Locks a path and read locks all its ancestors.
+/// "/" has its own lock outside the buckets, other entries stay in their
+/// bucket while idle, so locking a hot directory allocates nothing.
 class FileLockManager {
 public:
-    FileLockManager(int bucket_num = 19);
+    FileLockManager(int bucket_num = 19, int max_idle_per_bucket = 1024);
     ~FileLockManager();
     void ReadLock(const std::string& file_path);
     void WriteLock(const std::string& file_path);
@@ -31,18 +36,30 @@ private:
         kWrite
     };
     struct LockEntry {
-        common::Counter ref_;
+        std::string path;
+        // holders and waiters, guarded by the bucket mutex
+        int32_t ref;
         common::RWLock rw_lock_;
+        LockEntry() : ref(0) {}
     };
     struct LockBucket {
         Mutex mu;
-        std::unordered_map<std::string, LockEntry*> lock_map;
+        std::unordered_multimap<uint64_t, LockEntry*> lock_map;
     };
-    void LockInternal(const std::string& path, LockType lock_type);
-    void UnlockInternal(const std::string& path);
-    int GetBucketOffset(const std::string& path);
+    /// A normalized path split once, with the length and hash of each
+    /// prefix from "/a" to the path itself
+    struct PathView {
+        std::string path;
+        std::vector<std::pair<size_t, uint64_t> > prefixes;
+    };
+    static void SplitPath(const std::string& file_path, PathView* view);
+    void LockInternal(const PathView& view, size_t depth, LockType lock_type);
+    void UnlockInternal(const PathView& view, size_t depth);
+    LockBucket* GetBucket(uint64_t hash);
 private:
     std::vector<LockBucket*> locks_;
+    common::RWLock root_lock_;
+    size_t max_idle_per_bucket_;
 };
 
 } // namespace bfs
@@ -0,0 +1,124 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "nameserver/load_model.h"
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+
+DECLARE_int32(chunkserver_max_pending_buffers);
+DECLARE_int64(chunkserver_total_disk_safe_space);
+DECLARE_double(load_model_ewma_alpha);
+DECLARE_int32(load_model_bandwidth);
+
+namespace baidu {
+namespace bfs {
+
+LoadModel* LoadModel::NewLoadModel(const std::string& name) {
+    if (name == "default") {
+        return new DefaultLoadModel();
+    } else if (name == "ewma") {
+        return new EwmaLoadModel();
+    }
+    return NULL;
+}
+
+/// Disk nearly full or too many buffers pending, take no new blocks
+static bool IsOverloaded(const ChunkServerInfo& cs, int32_t buffers) {
+    double max_pending = FLAGS_chunkserver_max_pending_buffers * 0.8;
+    double data_score = cs.data_size() * 1.0 / cs.disk_quota();
+    int64_t space_left = cs.disk_quota() - cs.data_size();
+    if (data_score > 0.95 || buffers / max_pending > 1.0
+            || space_left < (FLAGS_chunkserver_total_disk_safe_space << 20)) {
+        return true;
+    }
+    // Free space on a disk that is full is of no use for new blocks
+    for (int i = 0; i < cs.disks_size(); i++) {
+        const DiskInfo& disk = cs.disks(i);
+        if (disk.data_size() < disk.quota() * 0.98) {
+            return false;
+        }
+    }
+    return cs.disks_size() > 0;
+}
+
+/// Share of disks over the write rate limit
+static double CappedRatio(const ChunkServerInfo& cs) {
+    if (cs.disks_size() == 0) {
+        return 0;
+    }
+    int capped = 0;
+    for (int i = 0; i < cs.disks_size(); i++) {
+        if (cs.disks(i).write_capped()) {
+            ++capped;
+        }
+    }
+    return capped * 1.0 / cs.disks_size();
+}
+
+double DefaultLoadModel::UpdateLoad(const ChunkServerInfo& cs,
+                                    const HeartBeatRequest& request) {
+    if (IsOverloaded(cs, request.buffers())) {
+        return 1.0;
+    }
+    double max_pending = FLAGS_chunkserver_max_pending_buffers * 0.8;
+    double pending_score = request.buffers() / max_pending;
+    double data_score = cs.data_size() * 1.0 / cs.disk_quota();
+    return (data_score * data_score + pending_score) / 2;
+}
+
+double DefaultLoadModel::GetBusyRatio(int32_t cs_id) {
+    return 0;
+}
+
+void DefaultLoadModel::RemoveChunkServer(int32_t cs_id) {
+}
+
+double EwmaLoadModel::UpdateLoad(const ChunkServerInfo& cs,
+                                 const HeartBeatRequest& request) {
+    double traffic = request.w_speed() + request.r_speed() + request.recover_speed();
+    double disk_load = std::max(std::min(request.disk_load(), 1.0), CappedRatio(cs));
+    MutexLock lock(&mu_);
+    std::unordered_map<int32_t, Smoothed>::iterator it = stats_.find(cs.id());
+    if (it == stats_.end()) {
+        Smoothed init = {static_cast<double>(request.buffers()), traffic, disk_load, 0};
+        it = stats_.insert(std::make_pair(cs.id(), init)).first;
+    } else {
+        double alpha = FLAGS_load_model_ewma_alpha;
+        Smoothed& s = it->second;
+        s.buffers = alpha * request.buffers() + (1 - alpha) * s.buffers;
+        s.traffic = alpha * traffic + (1 - alpha) * s.traffic;
+        s.disk_load = alpha * disk_load + (1 - alpha) * s.disk_load;
+    }
+    Smoothed& s = it->second;
+    s.busy = std::min(s.traffic / (FLAGS_load_model_bandwidth * 1024.0 * 1024.0), 1.0);
+    // Hard limits use the raw values, a full disk can't wait for the average
+    if (IsOverloaded(cs, request.buffers())) {
+        return 1.0;
+    }
+    double max_pending = FLAGS_chunkserver_max_pending_buffers * 0.8;
+    double pending_score = std::min(s.buffers / max_pending, 1.0);
+    double data_score = cs.data_size() * 1.0 / cs.disk_quota();
+    return (data_score * data_score + pending_score + s.busy + s.disk_load) / 4;
+}
+
+double EwmaLoadModel::GetBusyRatio(int32_t cs_id) {
+    MutexLock lock(&mu_);
+    std::unordered_map<int32_t, Smoothed>::iterator it = stats_.find(cs_id);
+    if (it == stats_.end()) {
+        return 0;
+    }
+    return it->second.busy;
+}
+
+void EwmaLoadModel::RemoveChunkServer(int32_t cs_id) {
+    MutexLock lock(&mu_);
+    stats_.erase(cs_id);
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
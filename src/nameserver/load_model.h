@@ -0,0 +1,64 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef  BFS_NAMESERVER_LOAD_MODEL_H_
+#define  BFS_NAMESERVER_LOAD_MODEL_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+#include <common/mutex.h>
+#include "proto/nameserver.pb.h"
+
+namespace baidu {
+namespace bfs {
+
+/// Turns chunkserver heartbeats into a load score. Heartbeats of
+/// different chunkservers call in at the same time.
+class LoadModel {
+public:
+    virtual ~LoadModel() {}
+    /// Fold in a heartbeat of cs, return the placement load in [0, 1],
+    /// above kChunkServerLoadMax means no new blocks.
+    virtual double UpdateLoad(const ChunkServerInfo& cs, const HeartBeatRequest& request) = 0;
+    /// Share of cs bandwidth used by serving traffic in [0, 1]
+    virtual double GetBusyRatio(int32_t cs_id) = 0;
+    /// Forget what was kept of a removed chunkserver
+    virtual void RemoveChunkServer(int32_t cs_id) = 0;
+    /// "default" or "ewma", NULL for unknown name
+    static LoadModel* NewLoadModel(const std::string& name);
+};
+
+/// Disk usage and pending buffers of the last heartbeat
+class DefaultLoadModel : public LoadModel {
+public:
+    virtual double UpdateLoad(const ChunkServerInfo& cs, const HeartBeatRequest& request);
+    virtual double GetBusyRatio(int32_t cs_id);
+    virtual void RemoveChunkServer(int32_t cs_id);
+};
+
+/// Also weighs read/write/recover bandwidth and disk queues, smoothed by EWMA
+class EwmaLoadModel : public LoadModel {
+public:
+    virtual double UpdateLoad(const ChunkServerInfo& cs, const HeartBeatRequest& request);
+    virtual double GetBusyRatio(int32_t cs_id);
+    virtual void RemoveChunkServer(int32_t cs_id);
+private:
+    struct Smoothed {
+        double buffers;
+        double traffic;         ///< read + write + recover bytes per second
+        double disk_load;
+        double busy;
+    };
+    Mutex mu_;
+    std::unordered_map<int32_t, Smoothed> stats_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_NAMESERVER_LOAD_MODEL_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
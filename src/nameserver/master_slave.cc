@@ -4,6 +4,7 @@
 //
 
 #include <sys/stat.h>
+#include <algorithm>
 #include <common/string_util.h>
 #include <common/logging.h>
 #include <common/timer.h>
@@ -22,6 +23,7 @@ DECLARE_int32(master_log_gc_interval);
 DECLARE_int32(logdb_log_size);
 DECLARE_int32(log_replicate_timeout);
 DECLARE_int32(log_batch_size);
+DECLARE_int32(master_slave_keepalive_interval);
 
 namespace baidu {
 namespace bfs {
@@ -31,7 +33,8 @@ const std::string kLogPrefix = "\033[32m[Sync]\033[0m";
 MasterSlaveImpl::MasterSlaveImpl() : slave_stub_(NULL), exiting_(false), master_only_(false),
                                      cond_(&mu_), log_done_(&mu_), term_(0), current_idx_(-1),
                                      applied_idx_(-1), sync_idx_(-1), gc_idx_(-1),
-                                     slave_snapshot_seq_(0) {
+                                     slave_snapshot_seq_(0), leader_index_(-1),
+                                     last_contact_(0), readable_(true) {
     std::vector<std::string> nodes;
     common::SplitString(FLAGS_nameserver_nodes, ",", &nodes);
     std::string this_server = nodes[FLAGS_node_index];
@@ -236,6 +239,11 @@ void MasterSlaveImpl::AppendLog(::google::protobuf::RpcController* controller,
         return;
     }
     if (request->index() == -1) {
+        if (request->has_leader_index() && request->term() == term_) {
+            MutexLock lock(&mu_);
+            leader_index_ = request->leader_index();
+            last_contact_ = common::timer::get_micros();
+        }
         response->set_success(true);
         done->Run();
         return;
@@ -245,6 +253,10 @@ void MasterSlaveImpl::AppendLog(::google::protobuf::RpcController* controller,
     if (term_ != request->term()) {
         LOG(INFO, "%s master term %ld slave term %ld, cleanup namespace",
             kLogPrefix.c_str(), request->term(), term_);
+        {
+            MutexLock lock(&mu_);
+            readable_ = false;
+        }
         erase_callback_();
         LOG(INFO, "%s cleanup namespace done", kLogPrefix.c_str());
         term_ = request->term();
@@ -279,6 +291,12 @@ void MasterSlaveImpl::AppendLog(::google::protobuf::RpcController* controller,
     }
     mu_.Lock();
     current_idx_ += request->log_data_size();
+    leader_index_ = std::max(request->leader_index(), current_idx_);
+    last_contact_ = common::timer::get_micros();
+    if (request->index() == 0) {
+        // the whole log is replayed
+        readable_ = true;
+    }
     mu_.Unlock();
     response->set_success(true);
     done->Run();
@@ -301,6 +319,10 @@ void MasterSlaveImpl::Snapshot(::google::protobuf::RpcController* controller,
     if (term_ != request->term()) {
         LOG(INFO, "%s master term %ld slave term %ld, cleanup namespace",
             kLogPrefix.c_str(), request->term(), term_);
+        {
+            MutexLock lock(&mu_);
+            readable_ = false;
+        }
         erase_callback_();
         LOG(INFO, "%s cleanup namespace done", kLogPrefix.c_str());
         term_ = request->term();
@@ -317,6 +339,10 @@ void MasterSlaveImpl::Snapshot(::google::protobuf::RpcController* controller,
     LOG(INFO, "%s Got snapshot seq %ld", kLogPrefix.c_str(), seq);
     if (seq == 0) {
         LOG(INFO, "%s Start to clean up the old namespace...", kLogPrefix.c_str());
+        {
+            MutexLock lock(&mu_);
+            readable_ = false;
+        }
         erase_callback_();
         LOG(INFO, "%s Done clean up the old namespace...", kLogPrefix.c_str());
         term_ = request->term();
@@ -333,7 +359,11 @@ void MasterSlaveImpl::Snapshot(::google::protobuf::RpcController* controller,
     }
     const std::string& data = request->data();
     if (data.empty()) {
+        MutexLock lock(&mu_);
         current_idx_ = request->index();
+        leader_index_ = std::max(leader_index_, current_idx_);
+        last_contact_ = common::timer::get_micros();
+        readable_ = true;
         response->set_success(true);
         LOG(INFO, "%s Receive snapshot complete seq = %ld", kLogPrefix.c_str(), seq);
         done->Run();
@@ -350,7 +380,13 @@ void MasterSlaveImpl::BackgroundLog() {
         MutexLock lock(&mu_);
         while (!exiting_ && sync_idx_ == current_idx_) {
             LOG(DEBUG, "%s BackgroundLog waiting...", kLogPrefix.c_str());
-            cond_.Wait();
+            if (!cond_.TimeWait(FLAGS_master_slave_keepalive_interval)
+                && !exiting_ && sync_idx_ == current_idx_) {
+                // let an idle slave know it is up to date
+                mu_.Unlock();
+                SendKeepAlive();
+                mu_.Lock();
+            }
         }
         if (exiting_) {
             return;
@@ -385,6 +421,7 @@ void MasterSlaveImpl::ReplicateLog() {
         master_slave::AppendLogResponse response;
         request.set_index(sync_idx_ + 1);
         request.set_term(term_);
+        request.set_leader_index(current_idx_);
         std::string entry;
         for (int i = 0; i < FLAGS_log_batch_size; ++i) {
             StatusCode s = logdb_->Read(sync_idx_ + 1 + i, &entry);
@@ -442,6 +479,19 @@ void MasterSlaveImpl::EmptyLog() {
     LOG(INFO, "%s Slave re-connected", kLogPrefix.c_str());
 }
 
+void MasterSlaveImpl::SendKeepAlive() {
+    master_slave::AppendLogRequest request;
+    master_slave::AppendLogResponse response;
+    request.set_index(-1);
+    request.set_term(term_);
+    request.set_leader_index(current_idx_);
+    if (!rpc_client_->SendRequest(slave_stub_,
+                                  &master_slave::MasterSlave_Stub::AppendLog,
+                                  &request, &response, 1, 1)) {
+        LOG(DEBUG, "%s Keepalive to slave failed", kLogPrefix.c_str());
+    }
+}
+
 bool MasterSlaveImpl::SendSnapshot() {
     int64_t current_index = current_idx_ - 1; // minus one to make sure slave does not get one entry short
     bool ret = false;
@@ -553,6 +603,27 @@ std::string MasterSlaveImpl::GetStatus() {
     }
 }
 
+int64_t MasterSlaveImpl::GetAppliedIndex() {
+    MutexLock lock(&mu_);
+    return current_idx_;
+}
+
+int64_t MasterSlaveImpl::GetLeaderLag(int32_t max_delay_ms) {
+    MutexLock lock(&mu_);
+    if (IsLeader()) {
+        return 0;
+    }
+    if (!readable_ || last_contact_ + max_delay_ms * 1000L < common::timer::get_micros()) {
+        return -1;
+    }
+    return std::max(leader_index_ - current_idx_, 0L);
+}
+
+bool MasterSlaveImpl::GetReadIndex(int64_t* read_index) {
+    // Master holds no lease, a slave can not tell it is reading the latest
+    return false;
+}
+
 void MasterSlaveImpl::CleanupLogdb() {
     delete logdb_;
     StatusCode s = LogDB::DestroyDB("./logdb");
@@ -43,10 +43,14 @@ public:
                   ::google::protobuf::Closure* done);
 
     std::string GetStatus();
+    virtual int64_t GetAppliedIndex();
+    virtual int64_t GetLeaderLag(int32_t max_delay_ms);
+    virtual bool GetReadIndex(int64_t* read_index);
 private:
     void BackgroundLog();
     void ReplicateLog();
     void EmptyLog();
+    void SendKeepAlive();
     bool SendSnapshot();
     void LogStatus();
     void ProcessCallback(int64_t index, bool timeout_check);
@@ -80,6 +84,9 @@ private:
     int64_t gc_idx_;        // smallest index in logdb should be gc_idx + 1
 
     int64_t slave_snapshot_seq_;
+    int64_t leader_index_;  // master's current_idx_ last seen by slave
+    int64_t last_contact_;  // time slave last heard of master
+    bool readable_;         // slave namespace is not half erased or half loaded
 
     std::map<int64_t, std::function<void (bool)> > callbacks_;
 };
@@ -6,18 +6,21 @@
 
 #include "nameserver_impl.h"
 
+#include <algorithm>
 #include <set>
 #include <map>
 #include <sstream>
 #include <cstdlib>
 
 #include <gflags/gflags.h>
+#include <google/protobuf/descriptor.h>
 #include <sofa/pbrpc/pbrpc.h>
 
 #include <common/counter.h>
 #include <common/logging.h>
 #include <common/string_util.h>
 
+#include "nameserver/balancer.h"
 #include "nameserver/block_mapping_manager.h"
 
 #include "nameserver/sync.h"
@@ -25,6 +28,9 @@
 #include "nameserver/namespace.h"
 #include "nameserver/file_lock_manager.h"
 #include "nameserver/file_lock.h"
+#include "nameserver/location_provider.h"
+#include "nameserver/rpc_scheduler.h"
+#include "nameserver/rpc_stats.h"
 
 #include "proto/status_code.pb.h"
 
@@ -36,12 +42,23 @@ DECLARE_int32(nameserver_work_thread_num);
 DECLARE_int32(nameserver_read_thread_num);
 DECLARE_int32(nameserver_heartbeat_thread_num);
 DECLARE_int32(nameserver_sync_callback_thread_num);
+DECLARE_int32(nameserver_meta_lane_weight);
+DECLARE_int32(nameserver_block_lane_weight);
+DECLARE_int32(nameserver_chunkserver_lane_weight);
+DECLARE_int32(nameserver_lane_max_pending);
+DECLARE_int32(nameserver_client_max_pending);
+DECLARE_int32(nameserver_trash_reap_batch);
+DECLARE_int32(nameserver_trash_reap_interval);
 DECLARE_int32(blockmapping_bucket_num);
 DECLARE_int32(hi_recover_timeout);
 DECLARE_int32(lo_recover_timeout);
 DECLARE_int32(block_report_timeout);
 DECLARE_bool(clean_redundancy);
 DECLARE_int32(log_replicate_timeout);
+DECLARE_int64(follower_read_max_lag);
+DECLARE_int32(follower_read_max_delay);
+DECLARE_int32(nameserver_log_group_max_bytes);
+DECLARE_int32(nameserver_log_group_max_delay);
 
 namespace baidu {
 namespace bfs {
@@ -54,21 +71,49 @@ common::Counter g_unlink;
 common::Counter g_create_file;
 common::Counter g_list_dir;
 common::Counter g_report_blocks;
+common::Counter g_follower_read;
+common::Counter g_log_group;
+common::Counter g_log_group_ops;
+common::Counter g_rpc_overload;
+common::Counter g_trash_reaped;
 extern common::Counter g_blocks_num;
 
+/// Setter of the log index a write response reports to its client
+template <class Response>
+static std::function<void (int64_t)> LogIndexSetter(Response* response) {
+    return std::bind(&Response::set_log_index, response, std::placeholders::_1);
+}
+
 NameServerImpl::NameServerImpl(Sync* sync) :
     sync_callback_thread_pool_(NULL),
     readonly_(true),
     recover_timeout_(FLAGS_nameserver_start_recover_timeout),
-    recover_mode_(kStopRecover), sync_(sync) {
+    recover_mode_(kStopRecover), sync_(sync),
+    is_leader_(false), safe_mode_(false),
+    pending_bytes_(0), group_seq_(0), logging_groups_(0) {
     block_mapping_manager_ = new BlockMappingManager(FLAGS_blockmapping_bucket_num);
     report_thread_pool_ = new common::ThreadPool(FLAGS_nameserver_report_thread_num);
     read_thread_pool_ = new common::ThreadPool(FLAGS_nameserver_read_thread_num);
     work_thread_pool_ = new common::ThreadPool(FLAGS_nameserver_work_thread_num);
     heartbeat_thread_pool_ = new common::ThreadPool(FLAGS_nameserver_heartbeat_thread_num);
     chunkserver_manager_ = new ChunkServerManager(work_thread_pool_, block_mapping_manager_);
+    balancer_ = new Balancer(work_thread_pool_, chunkserver_manager_, block_mapping_manager_);
     namespace_ = new NameSpace(false);
     file_lock_manager_ = new FileLockManager;
+    rpc_stats_ = new RpcStats(NameServer::descriptor());
+    rpc_scheduler_ = new RpcScheduler();
+    rpc_scheduler_->SetLane(kLaneRead, read_thread_pool_, 1, FLAGS_nameserver_lane_max_pending);
+    rpc_scheduler_->SetLane(kLaneMeta, work_thread_pool_, FLAGS_nameserver_meta_lane_weight,
+                            FLAGS_nameserver_lane_max_pending);
+    rpc_scheduler_->SetLane(kLaneBlock, work_thread_pool_, FLAGS_nameserver_block_lane_weight,
+                            FLAGS_nameserver_lane_max_pending);
+    // Never turn chunkserver rpcs away, a dead chunkserver costs more and
+    // BlockReceived/PushBlockReport are not retried on kOverload
+    rpc_scheduler_->SetLane(kLaneChunkServer, work_thread_pool_,
+                            FLAGS_nameserver_chunkserver_lane_weight, 0);
+    rpc_scheduler_->SetLane(kLaneHeartBeat, heartbeat_thread_pool_, 1, 0);
+    rpc_scheduler_->SetLane(kLaneBlockReport, report_thread_pool_, 1, 0);
+    rpc_scheduler_->SetClientMaxPending(FLAGS_nameserver_client_max_pending);
     WriteLock::SetFileLockManager(file_lock_manager_);
     ReadLock::SetFileLockManager(file_lock_manager_);
     if (sync_) {
@@ -76,7 +121,7 @@ NameServerImpl::NameServerImpl(Sync* sync) :
                                           std::placeholders::_1),
                                 std::bind(&NameSpace::TailSnapshot, namespace_,
                                           std::placeholders::_1, std::placeholders::_2),
-                                std::bind(&NameSpace::EraseNamespace, namespace_));
+                                std::bind(&NameServerImpl::EraseNamespace, this));
         sync_->Init(callbacks);
     } else {
         sync_callback_thread_pool_ =
@@ -93,17 +138,19 @@ NameServerImpl::~NameServerImpl() {
 void NameServerImpl::CheckLeader() {
     if (!sync_ || sync_->IsLeader()) {
         LOG(INFO, "Leader nameserver, rebuild block map.");
+        {
+            // Groups sent in an earlier term may never call back
+            MutexLock lock(&log_mu_);
+            logging_groups_ = 0;
+        }
         NameServerLog log;
-        std::function<void (const FileInfo&)> task =
-            std::bind(&NameServerImpl::RebuildBlockMapCallback, this, std::placeholders::_1);
-        namespace_->Activate(task, &log);
+        namespace_->Activate(&log);
         if (!LogRemote(log, std::function<void (bool)>())) {
             LOG(FATAL, "LogRemote namespace update fail");
         }
-        recover_timeout_ = FLAGS_nameserver_start_recover_timeout;
-        start_time_ = common::timer::get_micros();
-        work_thread_pool_->DelayTask(1000, std::bind(&NameServerImpl::CheckRecoverMode, this));
-        is_leader_ = true;
+        // Serve metadata reads while the block map is rebuilding
+        safe_mode_ = true;
+        work_thread_pool_->AddTask(std::bind(&NameServerImpl::RebuildBlockMap, this));
     } else {
         is_leader_ = false;
         work_thread_pool_->DelayTask(100, std::bind(&NameServerImpl::CheckLeader, this));
@@ -111,6 +158,54 @@ void NameServerImpl::CheckLeader() {
     }
 }
 
+void NameServerImpl::RebuildBlockMap() {
+    int64_t start = common::timer::get_micros();
+    NameServerLog log;
+    NameSpace::RebuildCallback callback =
+        std::bind(&NameServerImpl::RebuildBlockMapCallback, this, std::placeholders::_1);
+    namespace_->RebuildBlockMap(callback, &log);
+    if (!LogRemote(log, std::function<void (bool)>())) {
+        LOG(FATAL, "LogRemote namespace update fail");
+    }
+    LOG(INFO, "Block map rebuilt in %ld ms, leave safe mode",
+        (common::timer::get_micros() - start) / 1000);
+    recover_timeout_ = FLAGS_nameserver_start_recover_timeout;
+    start_time_ = common::timer::get_micros();
+    work_thread_pool_->DelayTask(1000, std::bind(&NameServerImpl::CheckRecoverMode, this));
+    is_leader_ = true;
+    safe_mode_ = false;
+    // Go on with directories trashed under an earlier leader
+    work_thread_pool_->AddTask(std::bind(&NameServerImpl::ReapTrash, this));
+}
+
+void NameServerImpl::ReapTrash() {
+    if (!is_leader_) {
+        return;
+    }
+    NameServerLog log;
+    std::vector<FileInfo>* removed = new std::vector<FileInfo>;
+    if (!namespace_->ReapTrash(FLAGS_nameserver_trash_reap_batch, removed, &log)) {
+        delete removed;
+        work_thread_pool_->DelayTask(1000, std::bind(&NameServerImpl::ReapTrash, this));
+        return;
+    }
+    LogRemote(log, std::bind(&NameServerImpl::ReapTrashCallback, this,
+                             removed, std::placeholders::_1));
+}
+
+void NameServerImpl::ReapTrashCallback(std::vector<FileInfo>* removed, bool ret) {
+    if (!ret) {
+        LOG(FATAL, "SyncLog fail");
+    }
+    for (uint32_t i = 0; i < removed->size(); i++) {
+        block_mapping_manager_->RemoveBlocksForFile((*removed)[i], NULL);
+    }
+    g_trash_reaped.Add(removed->size());
+    delete removed;
+    work_thread_pool_->DelayTask(FLAGS_nameserver_trash_reap_interval,
+                                 std::bind(&NameServerImpl::ReapTrash, this));
+}
+
 void NameServerImpl::CheckRecoverMode() {
     int now_time = (common::timer::get_micros() - start_time_) / 1000000;
     int recover_timeout = recover_timeout_;
@@ -127,6 +222,36 @@ void NameServerImpl::CheckRecoverMode() {
     work_thread_pool_->DelayTask(1000, std::bind(&NameServerImpl::CheckRecoverMode, this));
 }
 
+bool NameServerImpl::CheckFollowerRead(ReadConsistency consistency, int64_t min_log_index) {
+    if (!sync_ || consistency == kReadLeader) {
+        return false;
+    }
+    if (consistency == kReadLinearizable) {
+        int64_t read_index = 0;
+        if (!sync_->GetReadIndex(&read_index)) {
+            return false;
+        }
+    } else {
+        int64_t lag = sync_->GetLeaderLag(FLAGS_follower_read_max_delay);
+        if (lag < 0 || lag > FLAGS_follower_read_max_lag) {
+            LOG(DEBUG, "Follower read rejected, lag %ld", lag);
+            return false;
+        }
+    }
+    // Don't go back behind what the client has seen
+    if (sync_->GetAppliedIndex() < min_log_index) {
+        return false;
+    }
+    g_follower_read.Inc();
+    return true;
+}
+
+void NameServerImpl::EraseNamespace() {
+    // Follower reads hold read locks on their paths, wait for them to finish
+    FileLockGuard lock_guard(new WriteLock("/"));
+    namespace_->EraseNamespace();
+}
+
 void NameServerImpl::LeaveReadOnly() {
     LOG(INFO, "Nameserver leave read only");
     if (readonly_) {
@@ -136,12 +261,13 @@ void NameServerImpl::LeaveReadOnly() {
 
 void NameServerImpl::LogStatus() {
     LOG(INFO, "[Status] create %ld list %ld get_loc %ld add_block %ld "
-              "unlink %ld report %ld %ld heartbeat %ld read_pending %ld "
-              "work_pending %ld report_pending %ld",
+              "unlink %ld report %ld %ld heartbeat %ld follower_read %ld log_group %ld %ld "
+              "overload %ld trash_reaped %ld read_pending %ld work_pending %ld report_pending %ld",
         g_create_file.Clear(), g_list_dir.Clear(), g_get_location.Clear(),
         g_add_block.Clear(), g_unlink.Clear(), g_block_report.Clear(),
-        g_report_blocks.Clear(), g_heart_beat.Clear(),
-        read_thread_pool_->PendingNum(),
+        g_report_blocks.Clear(), g_heart_beat.Clear(), g_follower_read.Clear(),
+        g_log_group.Clear(), g_log_group_ops.Clear(), g_rpc_overload.Clear(),
+        g_trash_reaped.Clear(), read_thread_pool_->PendingNum(),
         work_thread_pool_->PendingNum(), report_thread_pool_->PendingNum());
     work_thread_pool_->DelayTask(1000, std::bind(&NameServerImpl::LogStatus, this));
 }
@@ -276,12 +402,22 @@ void NameServerImpl::BlockReport(::google::protobuf::RpcController* controller,
         return;
     }
     int64_t before_update = common::timer::get_micros();
+    // Replicas dropped by balance moves or ChangeReplicaNum, don't let the report add them back
+    std::set<int64_t> balanced_blocks;
+    balancer_->GetObsoleteBlocks(cs_id, &balanced_blocks);
+    for (std::set<int64_t>::iterator it = balanced_blocks.begin();
+         it != balanced_blocks.end(); ++it) {
+        response->add_obsolete_blocks(*it);
+    }
     std::set<int64_t> insert_blocks;
     for (int i = 0; i < blocks.size(); i++) {
         g_report_blocks.Inc();
         const ReportBlockInfo& block =  blocks.Get(i);
         int64_t cur_block_id = block.block_id();
         int64_t cur_block_size = block.block_size();
+        if (balanced_blocks.find(cur_block_id) != balanced_blocks.end()) {
+            continue;
+        }
 
         // update block -> cs
         int64_t block_version = block.version();
@@ -331,6 +467,18 @@ void NameServerImpl::BlockReport(::google::protobuf::RpcController* controller,
         LOG(INFO, "Response to C%d %s new_replicas_size= %d",
             cs_id, request->chunkserver_addr().c_str(), response->new_replicas_size());
     }
+    // balance replica, only when there is nothing urgent to recover
+    if (recover_mode_ == kRecoverAll) {
+        std::vector<std::pair<int64_t, std::string> > moves;
+        balancer_->PickBalanceBlocks(cs_id, &moves);
+        for (size_t i = 0; i < moves.size(); i++) {
+            ReplicaInfo* rep = response->add_new_replicas();
+            rep->set_block_id(moves[i].first);
+            rep->set_priority(false);
+            rep->add_chunkserver_address(moves[i].second);
+            rep->set_recover_timeout(FLAGS_lo_recover_timeout);
+        }
+    }
     block_mapping_manager_->GetCloseBlocks(cs_id, response->mutable_close_blocks());
     int64_t end_report = common::timer::get_micros();
     static __thread int64_t last_warning = 0;
@@ -360,8 +508,11 @@ void NameServerImpl::PushBlockReport(::google::protobuf::RpcController* controll
     response->set_status(kOK);
     int32_t cs_id = request->chunkserver_id();
     for (int i = 0; i < request->blocks_size(); i++) {
-        block_mapping_manager_->ProcessRecoveredBlock(cs_id, request->blocks(i),
-            request->status_size() > i ? request->status(i) : kOK);
+        StatusCode status = request->status_size() > i ? request->status(i) : kOK;
+        if (balancer_->ProcessPushedBlock(cs_id, request->blocks(i), status)) {
+            continue;
+        }
+        block_mapping_manager_->ProcessRecoveredBlock(cs_id, request->blocks(i), status);
     }
     done->Run();
 }
@@ -371,7 +522,7 @@ void NameServerImpl::CreateFile(::google::protobuf::RpcController* controller,
                                 CreateFileResponse* response,
                                 ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -400,7 +551,7 @@ void NameServerImpl::CreateFile(::google::protobuf::RpcController* controller,
         return;
     }
     LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                               controller, request, response, done,
+                               controller, LogIndexSetter(response), done,
                                (std::vector<FileInfo>*)NULL, file_lock,
                                std::placeholders::_1));
 }
@@ -413,32 +564,100 @@ bool NameServerImpl::LogRemote(const NameServerLog& log,
         }
         return true;
     }
+    if (!callback) {
+        // Only used around leader changes, logs already collected go first
+        {
+            MutexLock lock(&log_mu_);
+            FlushLogGroup();
+        }
+        std::string logstr;
+        if (!log.SerializeToString(&logstr)) {
+            LOG(FATAL, "Serialize log fail");
+        }
+        return sync_->Log(logstr, FLAGS_log_replicate_timeout * 1000);
+    }
+    callback = rpc_stats_->TimeSync(callback);
+    MutexLock lock(&log_mu_);
+    for (int i = 0; i < log.entries_size(); i++) {
+        pending_log_.add_entries()->CopyFrom(log.entries(i));
+    }
+    pending_bytes_ += log.ByteSize();
+    pending_callbacks_.push_back(callback);
+    if (logging_groups_ <= 0 || pending_bytes_ >= FLAGS_nameserver_log_group_max_bytes) {
+        FlushLogGroup();
+    } else if (pending_callbacks_.size() == 1) {
+        work_thread_pool_->DelayTask(FLAGS_nameserver_log_group_max_delay,
+            std::bind(&NameServerImpl::FlushLogGroupTimeout, this, group_seq_));
+    }
+    return true;
+}
+
+void NameServerImpl::FlushLogGroup() {
+    log_mu_.AssertHeld();
+    if (pending_callbacks_.empty()) {
+        return;
+    }
     std::string logstr;
-    if (!log.SerializeToString(&logstr)) {
+    if (!pending_log_.SerializeToString(&logstr)) {
         LOG(FATAL, "Serialize log fail");
     }
-    if (callback) {
-        sync_->Log(logstr, callback);
-        return true;
-    } else {
-        return sync_->Log(logstr, FLAGS_log_replicate_timeout * 1000);
+    std::vector<std::function<void (bool)> >* callbacks =
+        new std::vector<std::function<void (bool)> >;
+    callbacks->swap(pending_callbacks_);
+    pending_log_.Clear();
+    pending_bytes_ = 0;
+    ++group_seq_;
+    ++logging_groups_;
+    g_log_group.Inc();
+    g_log_group_ops.Add(callbacks->size());
+    LOG(DEBUG, "Log group %ld with %lu ops, %lu bytes",
+        group_seq_, callbacks->size(), logstr.size());
+    // Called with log_mu_ held, so groups reach sync_ in the order they were collected
+    sync_->Log(logstr, std::bind(&NameServerImpl::LogGroupCallback, this,
+                                 callbacks, std::placeholders::_1));
+}
+
+void NameServerImpl::FlushLogGroupTimeout(int64_t group_seq) {
+    MutexLock lock(&log_mu_);
+    if (group_seq == group_seq_) {
+        FlushLogGroup();
+    }
+}
+
+void NameServerImpl::LogGroupCallback(std::vector<std::function<void (bool)> >* callbacks,
+                                      bool ret) {
+    {
+        MutexLock lock(&log_mu_);
+        if (--logging_groups_ <= 0) {
+            FlushLogGroup();
+        }
     }
+    for (size_t i = 0; i < callbacks->size(); i++) {
+        (*callbacks)[i](ret);
+    }
+    delete callbacks;
 }
 
 void NameServerImpl::SyncLogCallback(::google::protobuf::RpcController* controller,
-                                     const ::google::protobuf::Message* request,
-                                     ::google::protobuf::Message* response,
+                                     std::function<void (int64_t)> set_log_index,
                                      ::google::protobuf::Closure* done,
                                      std::vector<FileInfo>* removed,
                                      FileLockGuard file_lock,
                                      bool ret) {
     if (!ret) {
         controller->SetFailed("SyncLogFail");
-    } else if (removed) {
-        for (uint32_t i = 0; i < removed->size(); i++) {
-            block_mapping_manager_->RemoveBlocksForFile((*removed)[i], NULL);
+    } else {
+        if (removed) {
+            for (uint32_t i = 0; i < removed->size(); i++) {
+                block_mapping_manager_->RemoveBlocksForFile((*removed)[i], NULL);
+            }
+            delete removed;
+        }
+        // The applied index covers this write now, a client that asks
+        // followers for at least this index reads its own write
+        if (sync_ && set_log_index) {
+            set_log_index(sync_->GetAppliedIndex());
         }
-        delete removed;
     }
     done->Run();
     if (!ret) {
@@ -451,7 +670,7 @@ void NameServerImpl::AddBlock(::google::protobuf::RpcController* controller,
                               AddBlockResponse* response,
                               ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -485,12 +704,22 @@ void NameServerImpl::AddBlock(::google::protobuf::RpcController* controller,
         }
         file_info.clear_blocks();
     }
+    StatusCode quota_status = namespace_->CheckQuota(file_info.parent_entry_id(), 1, 0);
+    if (quota_status != kOK) {
+        LOG(INFO, "AddBlock for %s fail: %s", path.c_str(), StatusCode_Name(quota_status).c_str());
+        response->set_status(quota_status);
+        done->Run();
+        return;
+    }
     /// replica num
     int replica_num = file_info.replicas();
     /// check lease for write
     std::vector<std::pair<int32_t, std::string> > chains;
+    std::set<int32_t> exclude(request->exclude_chunkservers().begin(),
+                              request->exclude_chunkservers().end());
     common::timer::TimeChecker add_block_timer;
-    if (chunkserver_manager_->GetChunkServerChains(replica_num, &chains, request->client_address())) {
+    if (chunkserver_manager_->GetChunkServerChains(replica_num, &chains,
+                                                   request->client_address(), exclude)) {
         add_block_timer.Check(50 * 1000, "GetChunkServerChains");
         int64_t new_block_id = namespace_->GetNewBlockId();
         LOG(INFO, "[AddBlock] new block for %s #%ld R%d %s",
@@ -525,7 +754,7 @@ void NameServerImpl::AddBlock(::google::protobuf::RpcController* controller,
         block->set_block_id(new_block_id);
         response->set_status(kOK);
         LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                                   controller, request, response, done,
+                                   controller, std::function<void (int64_t)>(), done,
                                    (std::vector<FileInfo>*)NULL,
                                    file_lock_guard, std::placeholders::_1));
     } else {
@@ -540,7 +769,7 @@ void NameServerImpl::SyncBlock(::google::protobuf::RpcController* controller,
                                SyncBlockResponse* response,
                                ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -573,7 +802,7 @@ void NameServerImpl::SyncBlock(::google::protobuf::RpcController* controller,
     }
     response->set_status(kOK);
     LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                               controller, request, response, done,
+                               controller, LogIndexSetter(response), done,
                                (std::vector<FileInfo>*)NULL,
                                file_lock_guard,
                                std::placeholders::_1));
@@ -597,7 +826,7 @@ void NameServerImpl::FinishBlock(::google::protobuf::RpcController* controller,
                                  FinishBlockResponse* response,
                                  ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -646,7 +875,7 @@ void NameServerImpl::FinishBlock(::google::protobuf::RpcController* controller,
     } else {
         LOG(INFO, "FinishBlock #%ld %s", block_id, file_name.c_str());
         LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                                   controller, request, response, done,
+                                   controller, LogIndexSetter(response), done,
                                    (std::vector<FileInfo>*)NULL,
                                    file_lock_guard,
                                    std::placeholders::_1));
@@ -658,7 +887,7 @@ void NameServerImpl::GetFileLocation(::google::protobuf::RpcController* controll
                                      FileLocationResponse* response,
                                      ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -676,54 +905,77 @@ void NameServerImpl::GetFileLocation(::google::protobuf::RpcController* controll
             request->file_name().c_str());
         response->set_status(kNsNotFound);
     } else {
-        for (int i = 0; i < info.blocks_size(); i++) {
-            int64_t block_id = info.blocks(i);
-            std::vector<int32_t> replica;
-            int64_t block_size = 0;
-            RecoverStat rs;
-            if (!block_mapping_manager_->GetLocatedBlock(block_id, &replica, &block_size, &rs)) {
-                LOG(WARNING, "GetFileLocation GetBlockReplica fail #%ld ", block_id);
-                break;
-            }
-            LocatedBlock* lcblock = response->add_blocks();
-            lcblock->set_block_id(block_id);
-            lcblock->set_block_size(block_size);
-            lcblock->set_status(rs);
-            for (uint32_t i = 0; i < replica.size(); i++) {
-                int32_t server_id = replica[i];
-                std::string addr = chunkserver_manager_->GetChunkServerAddr(server_id);
-                if (addr == "") {
-                    LOG(WARNING, "GetChunkServerAddr from id: C%d fail.", server_id);
-                    continue;
-                }
-                LOG(INFO, "return server C%d %s for #%ld ", server_id, addr.c_str(), block_id);
-                ChunkServerInfo* cs_info = lcblock->add_chains();
-                cs_info->set_address(addr);
-            }
-            LOG(INFO, "NameServerImpl::GetFileLocation: %s return #%ld R%lu",
-                request->file_name().c_str(), block_id, replica.size());
-        }
+        GetLocatedBlocks(path, info, response->mutable_blocks());
+        sofa::pbrpc::RpcController* sofa_cntl =
+            reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
+        std::string client_ip = sofa_cntl->RemoteAddress();
+        client_ip = client_ip.substr(0, client_ip.find(':'));
+        response->set_client_ip(client_ip);
+        response->set_client_rack(LocationProvider("", client_ip).GetRack());
         // success if file exist
         response->set_status(kOK);
     }
     done->Run();
 }
 
+void NameServerImpl::GetLocatedBlocks(const std::string& path, const FileInfo& info,
+        ::google::protobuf::RepeatedPtrField<LocatedBlock>* blocks) {
+    for (int i = 0; i < info.blocks_size(); i++) {
+        int64_t block_id = info.blocks(i);
+        std::vector<int32_t> replica;
+        int64_t block_size = 0;
+        RecoverStat rs;
+        if (!block_mapping_manager_->GetLocatedBlock(block_id, &replica, &block_size, &rs)) {
+            LOG(WARNING, "GetFileLocation GetBlockReplica fail #%ld ", block_id);
+            break;
+        }
+        LocatedBlock* lcblock = blocks->Add();
+        lcblock->set_block_id(block_id);
+        lcblock->set_block_size(block_size);
+        lcblock->set_status(rs);
+        for (uint32_t i = 0; i < replica.size(); i++) {
+            int32_t server_id = replica[i];
+            ChunkServerInfo location;
+            if (!chunkserver_manager_->GetChunkServerLocation(server_id, &location)) {
+                LOG(WARNING, "GetChunkServerLocation from id: C%d fail.", server_id);
+                continue;
+            }
+            LOG(INFO, "return server C%d %s for #%ld ",
+                server_id, location.address().c_str(), block_id);
+            lcblock->add_chains()->Swap(&location);
+        }
+        LOG(INFO, "NameServerImpl::GetFileLocation: %s return #%ld R%lu",
+            path.c_str(), block_id, replica.size());
+    }
+}
+
 void NameServerImpl::ListDirectory(::google::protobuf::RpcController* controller,
                                    const ListDirectoryRequest* request,
                                    ListDirectoryResponse* response,
                                    ::google::protobuf::Closure* done) {
-    if (!is_leader_) {
+    // A follower answers from the namespace it tails, if fresh enough for the client
+    bool follower_read = !is_leader_ && !safe_mode_;
+    if (follower_read
+        && !CheckFollowerRead(request->consistency(), request->min_log_index())) {
         response->set_status(kIsFollower);
         done->Run();
         return;
     }
+    if (sync_) {
+        response->set_log_index(sync_->GetAppliedIndex());
+    }
     g_list_dir.Inc();
     response->set_sequence_id(request->sequence_id());
     std::string path = NameSpace::NormalizePath(request->path());
+    FileLockGuard lock_guard(follower_read ? new ReadLock(path) : NULL);
     common::timer::AutoTimer at(100, "ListDirectory", path.c_str());
 
-    StatusCode status = namespace_->ListDirectory(path, response->mutable_files());
+    StatusCode status = kOK;
+    if (request->has_entry_id()) {
+        status = namespace_->ListDirectory(request->entry_id(), response->mutable_files());
+    } else {
+        status = namespace_->ListDirectory(path, response->mutable_files());
+    }
     for (int i = 0; i < response->files_size(); i++) {
         FileInfo* file = response->mutable_files(i);
         if ((file->type() & (1 << 9)) == 0) {
@@ -739,13 +991,19 @@ void NameServerImpl::Stat(::google::protobuf::RpcController* controller,
                           const StatRequest* request,
                           StatResponse* response,
                           ::google::protobuf::Closure* done) {
-    if (!is_leader_) {
+    bool follower_read = !is_leader_ && !safe_mode_;
+    if (follower_read
+        && !CheckFollowerRead(request->consistency(), request->min_log_index())) {
         response->set_status(kIsFollower);
         done->Run();
         return;
     }
+    if (sync_) {
+        response->set_log_index(sync_->GetAppliedIndex());
+    }
     response->set_sequence_id(request->sequence_id());
     std::string path = NameSpace::NormalizePath(request->path());
+    FileLockGuard lock_guard(follower_read ? new ReadLock(path) : NULL);
     LOG(INFO, "Stat: %s\n", path.c_str());
 
     FileInfo info;
@@ -765,12 +1023,182 @@ void NameServerImpl::Stat(::google::protobuf::RpcController* controller,
     done->Run();
 }
 
+void NameServerImpl::Lookup(::google::protobuf::RpcController* controller,
+                            const LookupRequest* request,
+                            LookupResponse* response,
+                            ::google::protobuf::Closure* done) {
+    bool follower_read = !is_leader_ && !safe_mode_;
+    if (follower_read
+        && !CheckFollowerRead(request->consistency(), request->min_log_index())) {
+        response->set_status(kIsFollower);
+        done->Run();
+        return;
+    }
+    if (sync_) {
+        response->set_log_index(sync_->GetAppliedIndex());
+    }
+    response->set_sequence_id(request->sequence_id());
+    // One key read, no path to lock
+    FileInfo* info = response->mutable_file_info();
+    StatusCode status = namespace_->Lookup(request->parent_entry_id(), request->name(), info);
+    if (status == kOK && (info->type() & (1 << 9)) == 0) {
+        SetActualFileSize(info);
+    }
+    LOG(DEBUG, "Lookup E%ld %s return %s", request->parent_entry_id(),
+        request->name().c_str(), StatusCode_Name(status).c_str());
+    response->set_status(status);
+    done->Run();
+}
+
+void NameServerImpl::BatchStat(::google::protobuf::RpcController* controller,
+                               const BatchStatRequest* request,
+                               BatchStatResponse* response,
+                               ::google::protobuf::Closure* done) {
+    bool follower_read = !is_leader_ && !safe_mode_;
+    if (follower_read
+        && !CheckFollowerRead(request->consistency(), request->min_log_index())) {
+        response->set_status(kIsFollower);
+        done->Run();
+        return;
+    }
+    if (sync_) {
+        response->set_log_index(sync_->GetAppliedIndex());
+    }
+    response->set_sequence_id(request->sequence_id());
+    std::vector<std::string> paths;
+    for (int i = 0; i < request->paths_size(); i++) {
+        paths.push_back(NameSpace::NormalizePath(request->paths(i)));
+    }
+    // One lock for the whole batch, so the cached directories stay valid
+    FileLockGuard lock_guard(new ReadLock(paths));
+    common::timer::AutoTimer at(100, "BatchStat", paths.empty() ? "" : paths[0].c_str());
+    NameSpace::DirCache dir_cache;
+    for (size_t i = 0; i < paths.size(); i++) {
+        StatResponse* stat = response->add_stats();
+        FileInfo* info = stat->mutable_file_info();
+        if (namespace_->GetFileInfo(paths[i], info, &dir_cache)) {
+            if ((info->type() & (1 << 9)) == 0) {
+                SetActualFileSize(info);
+            }
+            stat->set_status(kOK);
+        } else {
+            stat->clear_file_info();
+            stat->set_status(kNsNotFound);
+        }
+    }
+    LOG(INFO, "BatchStat %lu files", paths.size());
+    response->set_status(kOK);
+    done->Run();
+}
+
+void NameServerImpl::BatchGetFileLocation(::google::protobuf::RpcController* controller,
+                                          const BatchFileLocationRequest* request,
+                                          BatchFileLocationResponse* response,
+                                          ::google::protobuf::Closure* done) {
+    if (!is_leader_) {
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
+        done->Run();
+        return;
+    }
+    response->set_sequence_id(request->sequence_id());
+    std::vector<std::string> paths;
+    for (int i = 0; i < request->file_names_size(); i++) {
+        paths.push_back(NameSpace::NormalizePath(request->file_names(i)));
+    }
+    g_get_location.Add(paths.size());
+    FileLockGuard lock_guard(new ReadLock(paths));
+    NameSpace::DirCache dir_cache;
+    for (size_t i = 0; i < paths.size(); i++) {
+        FileLocationResponse* location = response->add_locations();
+        FileInfo info;
+        if (!namespace_->GetFileInfo(paths[i], &info, &dir_cache)) {
+            LOG(INFO, "BatchGetFileLocation: NotFound: %s", paths[i].c_str());
+            location->set_status(kNsNotFound);
+            continue;
+        }
+        GetLocatedBlocks(paths[i], info, location->mutable_blocks());
+        location->set_status(kOK);
+    }
+    sofa::pbrpc::RpcController* sofa_cntl =
+        reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
+    std::string client_ip = sofa_cntl->RemoteAddress();
+    client_ip = client_ip.substr(0, client_ip.find(':'));
+    response->set_client_ip(client_ip);
+    response->set_client_rack(LocationProvider("", client_ip).GetRack());
+    response->set_status(kOK);
+    done->Run();
+}
+
+void NameServerImpl::BatchCreateFile(::google::protobuf::RpcController* controller,
+                                     const BatchCreateFileRequest* request,
+                                     BatchCreateFileResponse* response,
+                                     ::google::protobuf::Closure* done) {
+    if (!is_leader_) {
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
+        done->Run();
+        return;
+    }
+    response->set_sequence_id(request->sequence_id());
+    std::vector<std::string> paths;
+    std::set<std::string> path_set;
+    for (int i = 0; i < request->files_size(); i++) {
+        paths.push_back(NameSpace::NormalizePath(request->files(i).file_name()));
+        path_set.insert(paths.back());
+    }
+    // A write lock read-locks the ancestors of its path, a file can't be locked
+    // together with its own directory
+    for (size_t i = 0; i < paths.size(); i++) {
+        std::string parent = paths[i];
+        while (parent.size() > 1) {
+            parent.resize(std::max<size_t>(parent.find_last_of('/'), 1));
+            if (path_set.find(parent) != path_set.end()) {
+                LOG(INFO, "BatchCreateFile fail: %s is under %s",
+                    paths[i].c_str(), parent.c_str());
+                response->set_status(kBadParameter);
+                done->Run();
+                return;
+            }
+        }
+    }
+    g_create_file.Add(paths.size());
+    NameServerLog log;
+    std::vector<int64_t> blocks_to_remove;
+    NameSpace::DirCache dir_cache;
+    FileLockGuard file_lock(new WriteLock(paths));
+    for (size_t i = 0; i < paths.size(); i++) {
+        const CreateFileRequest& file = request->files(i);
+        int mode = file.mode();
+        if (mode == 0) {
+            mode = 0644;    // default mode
+        }
+        StatusCode status = namespace_->CreateFile(paths[i], file.flags(), mode,
+                                                   file.replica_num(), &blocks_to_remove,
+                                                   &log, &dir_cache);
+        response->add_results(status);
+    }
+    for (size_t i = 0; i < blocks_to_remove.size(); i++) {
+        block_mapping_manager_->RemoveBlock(blocks_to_remove[i]);
+    }
+    response->set_status(kOK);
+    sofa::pbrpc::RpcController* ctl = reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
+    LOG(INFO, "Sdk %s batch create %lu files, %d log entries",
+        ctl->RemoteAddress().c_str(), paths.size(), log.entries_size());
+    if (log.entries_size() == 0) {
+        done->Run();
+        return;
+    }
+    LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
+                               controller, LogIndexSetter(response), done,
+                               (std::vector<FileInfo>*)NULL, file_lock,
+                               std::placeholders::_1));
+}
+
 void NameServerImpl::Rename(::google::protobuf::RpcController* controller,
                             const RenameRequest* request,
                             RenameResponse* response,
                             ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -794,7 +1222,7 @@ void NameServerImpl::Rename(::google::protobuf::RpcController* controller,
         removed->push_back(remove_file);
     }
     LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                controller, request, response, done, removed,
+                controller, LogIndexSetter(response), done, removed,
                 file_lock_guard, std::placeholders::_1));
 }
 
@@ -803,7 +1231,7 @@ void NameServerImpl::Symlink(::google::protobuf::RpcController* controller,
                              SymlinkResponse* response,
                              ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -825,7 +1253,7 @@ void NameServerImpl::Symlink(::google::protobuf::RpcController* controller,
     }
 
     LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                               controller, request, response, done,
+                               controller, LogIndexSetter(response), done,
                                (std::vector<FileInfo>*)NULL,
                                file_lock_guard,
                                std::placeholders::_1));
@@ -836,7 +1264,7 @@ void NameServerImpl::Unlink(::google::protobuf::RpcController* controller,
                             UnlinkResponse* response,
                             ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -859,7 +1287,7 @@ void NameServerImpl::Unlink(::google::protobuf::RpcController* controller,
     std::vector<FileInfo>* removed = new std::vector<FileInfo>;
     removed->push_back(file_info);
     LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                               controller, request, response, done,
+                               controller, LogIndexSetter(response), done,
                                removed, file_lock_guard,
                                std::placeholders::_1));
 }
@@ -868,13 +1296,19 @@ void NameServerImpl::DiskUsage(::google::protobuf::RpcController* controller,
                                const DiskUsageRequest* request,
                                DiskUsageResponse* response,
                                ::google::protobuf::Closure* done) {
-    if (!is_leader_) {
+    bool follower_read = !is_leader_ && !safe_mode_;
+    if (follower_read
+        && !CheckFollowerRead(request->consistency(), request->min_log_index())) {
         response->set_status(kIsFollower);
         done->Run();
         return;
     }
+    if (sync_) {
+        response->set_log_index(sync_->GetAppliedIndex());
+    }
     response->set_sequence_id(request->sequence_id());
     std::string path = NameSpace::NormalizePath(request->path());
+    FileLockGuard lock_guard(follower_read ? new ReadLock(path) : NULL);
     if (path.empty() || path[0] != '/') {
         response->set_status(kBadParameter);
         done->Run();
@@ -884,6 +1318,12 @@ void NameServerImpl::DiskUsage(::google::protobuf::RpcController* controller,
     StatusCode ret_status = namespace_->DiskUsage(path, &du_size);
     response->set_status(ret_status);
     response->set_du_size(du_size);
+    DirUsage usage;
+    if (ret_status == kOK && namespace_->GetUsage(path, &usage) == kOK) {
+        response->set_files(usage.files());
+        response->set_space_quota(usage.space_quota());
+        response->set_file_quota(usage.file_quota());
+    }
     done->Run();
     return;
 }
@@ -893,7 +1333,7 @@ void NameServerImpl::DeleteDirectory(::google::protobuf::RpcController* controll
                                      DeleteDirectoryResponse* response,
                                      ::google::protobuf::Closure* done)  {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -905,20 +1345,28 @@ void NameServerImpl::DeleteDirectory(::google::protobuf::RpcController* controll
         done->Run();
         return;
     }
-    std::vector<FileInfo>* removed = new std::vector<FileInfo>;
+    std::vector<FileInfo>* removed = NULL;
     NameServerLog log;
     FileLockGuard file_lock_guard(new WriteLock(path));
-    StatusCode ret_status = namespace_->DeleteDirectory(path, recursive, removed, &log);
+    StatusCode ret_status = kOK;
+    if (recursive && path != "/") {
+        // ReapTrash deletes what is below in the background
+        ret_status = namespace_->TrashDirectory(path, &log);
+    } else {
+        removed = new std::vector<FileInfo>;
+        ret_status = namespace_->DeleteDirectory(path, recursive, removed, &log);
+    }
     sofa::pbrpc::RpcController* ctl = reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
     LOG(INFO, "Sdk %s delete directory %s returns %s",
             ctl->RemoteAddress().c_str(), path.c_str(), StatusCode_Name(ret_status).c_str());
     response->set_status(ret_status);
     if (ret_status != kOK) {
+        delete removed;
         done->Run();
         return;
     }
     LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                controller, request, response, done, removed,
+                controller, LogIndexSetter(response), done, removed,
                 file_lock_guard, std::placeholders::_1));
 }
 
@@ -927,7 +1375,7 @@ void NameServerImpl::Chmod(::google::protobuf::RpcController* controller,
                            ChmodResponse* response,
                            ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -944,7 +1392,7 @@ void NameServerImpl::Chmod(::google::protobuf::RpcController* controller,
         assert(ret);
         response->set_status(kOK);
         LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                                   controller, request, response, done,
+                                   controller, LogIndexSetter(response), done,
                                    (std::vector<FileInfo>*)NULL,
                                    file_lock_guard,
                                    std::placeholders::_1));
@@ -961,13 +1409,15 @@ void NameServerImpl::ChangeReplicaNum(::google::protobuf::RpcController* control
                                       ChangeReplicaNumResponse* response,
                                       ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
     response->set_sequence_id(request->sequence_id());
     std::string file_name = NameSpace::NormalizePath(request->file_name());
     int32_t replica_num = request->replica_num();
+    std::set<int32_t> keep(request->keep_chunkservers().begin(),
+                           request->keep_chunkservers().end());
     StatusCode ret_status = kOK;
     FileInfo file_info;
     FileLockGuard file_lock_guard(new WriteLock(file_name));
@@ -979,6 +1429,7 @@ void NameServerImpl::ChangeReplicaNum(::google::protobuf::RpcController* control
         for (int i = 0; i < file_info.blocks_size(); i++) {
             if (block_mapping_manager_->ChangeReplicaNum(file_info.blocks(i), replica_num)) {
                 LOG(INFO, "Change %s replica num to %d", file_name.c_str(), replica_num);
+                RemoveSurplusReplicas(file_info.blocks(i), keep);
             } else {
                 ///TODO: need to undo when file have multiple blocks?
                 LOG(WARNING, "Change %s replica num to %d fail", file_name.c_str(), replica_num);
@@ -988,7 +1439,7 @@ void NameServerImpl::ChangeReplicaNum(::google::protobuf::RpcController* control
         }
         response->set_status(kOK);
         LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
-                                   controller, request, response, done,
+                                   controller, LogIndexSetter(response), done,
                                    (std::vector<FileInfo>*)NULL,
                                    file_lock_guard, std::placeholders::_1));
         return;
@@ -1000,12 +1451,49 @@ void NameServerImpl::ChangeReplicaNum(::google::protobuf::RpcController* control
     done->Run();
 }
 
+void NameServerImpl::RemoveSurplusReplicas(int64_t block_id, const std::set<int32_t>& keep) {
+    std::vector<int32_t> replica;
+    int64_t block_size = 0;
+    RecoverStat rs;
+    if (!block_mapping_manager_->GetLocatedBlock(block_id, &replica, &block_size, &rs)
+        || replica.empty()) {
+        return;
+    }
+    // Replicas not asked to be kept go first
+    std::vector<int32_t> candidates;
+    int32_t keep_id = -1;
+    for (size_t i = 0; i < replica.size(); i++) {
+        if (keep.find(replica[i]) == keep.end()) {
+            candidates.push_back(replica[i]);
+        } else if (keep_id == -1) {
+            keep_id = replica[i];
+        }
+    }
+    for (size_t i = 0; i < replica.size(); i++) {
+        if (keep.find(replica[i]) != keep.end() && replica[i] != keep_id) {
+            candidates.push_back(replica[i]);
+        }
+    }
+    if (keep_id == -1) {
+        keep_id = candidates.back();
+        candidates.pop_back();
+    }
+    for (size_t i = 0; i < candidates.size(); i++) {
+        // Fails once the expected number is left, or while the block is in recover
+        if (!block_mapping_manager_->RemoveRedundantReplica(block_id, candidates[i], keep_id)) {
+            break;
+        }
+        chunkserver_manager_->RemoveBlock(candidates[i], block_id);
+        balancer_->DropReplica(candidates[i], block_id);
+    }
+}
+
 void NameServerImpl::LockDir(::google::protobuf::RpcController* controller,
                              const LockDirRequest* request,
                              LockDirResponse* response,
                              ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -1039,7 +1527,7 @@ void NameServerImpl::UnlockDir(::google::protobuf::RpcController* controller,
                                UnlockDirResponse* response,
                                ::google::protobuf::Closure* done) {
     if (!is_leader_) {
-        response->set_status(kIsFollower);
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
         done->Run();
         return;
     }
@@ -1062,13 +1550,47 @@ void NameServerImpl::UnlockDir(::google::protobuf::RpcController* controller,
     done->Run();
 }
 
-void NameServerImpl::RebuildBlockMapCallback(const FileInfo& file_info) {
-    for (int i = 0; i < file_info.blocks_size(); i++) {
-        int64_t block_id = file_info.blocks(i);
-        int64_t version = file_info.version();
-        block_mapping_manager_->RebuildBlock(block_id, file_info.replicas(),
-                                             version, file_info.size());
+void NameServerImpl::SetQuota(::google::protobuf::RpcController* controller,
+                              const SetQuotaRequest* request,
+                              SetQuotaResponse* response,
+                              ::google::protobuf::Closure* done) {
+    if (!is_leader_) {
+        response->set_status(safe_mode_ ? kSafeMode : kIsFollower);
+        done->Run();
+        return;
     }
+    response->set_sequence_id(request->sequence_id());
+    std::string path = NameSpace::NormalizePath(request->path());
+    if (path.empty() || path[0] != '/'
+        || request->space_quota() < 0 || request->file_quota() < 0) {
+        response->set_status(kBadParameter);
+        done->Run();
+        return;
+    }
+    // A field left out keeps its quota, NameSpace leaves negative ones as is
+    int64_t space_quota = request->has_space_quota() ? request->space_quota() : -1;
+    int64_t file_quota = request->has_file_quota() ? request->file_quota() : -1;
+    FileLockGuard file_lock_guard(new WriteLock(path));
+    NameServerLog log;
+    StatusCode status = namespace_->SetQuota(path, space_quota, file_quota, &log);
+    sofa::pbrpc::RpcController* ctl = reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
+    LOG(INFO, "SDK %s set quota of %s to space %ld files %ld returns %s",
+        ctl->RemoteAddress().c_str(), path.c_str(), space_quota,
+        file_quota, StatusCode_Name(status).c_str());
+    response->set_status(status);
+    if (status != kOK) {
+        done->Run();
+        return;
+    }
+    LogRemote(log, std::bind(&NameServerImpl::SyncLogCallback, this,
+                               controller, LogIndexSetter(response), done,
+                               (std::vector<FileInfo>*)NULL,
+                               file_lock_guard,
+                               std::placeholders::_1));
+}
+
+void NameServerImpl::RebuildBlockMapCallback(const std::vector<FileInfo>& files) {
+    block_mapping_manager_->RebuildBlocks(files);
 }
 
 void NameServerImpl::SysStat(::google::protobuf::RpcController* controller,
@@ -1082,6 +1604,12 @@ void NameServerImpl::SysStat(::google::protobuf::RpcController* controller,
     }
     sofa::pbrpc::RpcController* ctl = reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
     LOG(INFO, "SysStat from %s", ctl->RemoteAddress().c_str());
+    if (request->stat_name() == "RpcStat") {
+        ListRpcStats(response->mutable_rpc_latency());
+        response->set_status(kOK);
+        done->Run();
+        return;
+    }
     chunkserver_manager_->ListChunkServers(response->mutable_chunkservers());
     response->set_status(kOK);
     done->Run();
@@ -1189,6 +1717,27 @@ void NameServerImpl::ListDirForWeb(const std::string& path, std::string* str) {
     }
 }
 
+void NameServerImpl::ListRpcStats(google::protobuf::RepeatedPtrField<RpcLatency>* latency) {
+    for (int32_t method = 0; method < rpc_stats_->MethodNum(); method++) {
+        for (int stage = 0; stage < kRpcStageNum; stage++) {
+            const LatencyHistogram& histogram =
+                rpc_stats_->Get(method, static_cast<RpcStage>(stage));
+            if (histogram.Count() == 0) {
+                continue;
+            }
+            RpcLatency* l = latency->Add();
+            l->set_method(rpc_stats_->MethodName(method));
+            l->set_stage(RpcStats::StageName(static_cast<RpcStage>(stage)));
+            l->set_count(histogram.Count());
+            l->set_average(histogram.Average());
+            l->set_p50(histogram.Percentile(50));
+            l->set_p99(histogram.Percentile(99));
+            l->set_p999(histogram.Percentile(99.9));
+            l->set_max(histogram.Max());
+        }
+    }
+}
+
 bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
                                 sofa::pbrpc::HTTPResponse& response) {
     const std::string& path = request.path;
@@ -1216,10 +1765,89 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
         str += "<tr><td>report_size</td><td>" + common::NumToString(params.report_size()) + "</td></tr>";
         str += "<tr><td>recover_size</td><td>" + common::NumToString(params.recover_size()) + "</td></tr>";
         str += "<tr><td>keepalive_timeout</td><td>" + common::NumToString(params.keepalive_timeout()) + "</td></tr>";
+        str += "<tr><td>recover_bandwidth</td><td>" + common::NumToString(params.recover_bandwidth()) + "</td></tr>";
+        str += "<tr><td>recover_bandwidth_per_server</td><td>" + common::NumToString(params.recover_bandwidth_per_server()) + "</td></tr>";
         str += "<tr><td>clean_redundancy</td><td>" + common::NumToString(FLAGS_clean_redundancy) + "</td></tr></table>";
         str += "</body></html>";
         response.content->Append(str);
         return true;
+    } else if (path == "/dfs/rpc") {
+        google::protobuf::RepeatedPtrField<RpcLatency> latency;
+        ListRpcStats(&latency);
+        std::string str =
+            "<html><head><title>BFS console</title>"
+            "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />"
+            "<link rel=\"stylesheet\" type=\"text/css\" "
+                "href=\"http://www.w3school.com.cn/c5.css\"/>"
+            "<style> body { background: #f9f9f9;}</style>"
+            "</head>";
+        str += "<body> <h1>Rpc latency (us)</h1>";
+        str += "<table class=dataintable>";
+        str += "<tr><td>method</td><td>stage</td><td>count</td><td>avg</td>"
+               "<td>p50</td><td>p99</td><td>p999</td><td>max</td></tr>";
+        for (int i = 0; i < latency.size(); i++) {
+            const RpcLatency& l = latency.Get(i);
+            str += "<tr><td>" + l.method() + "</td><td>" + l.stage() + "</td><td>"
+                + common::NumToString(l.count()) + "</td><td>"
+                + common::NumToString(l.average()) + "</td><td>"
+                + common::NumToString(l.p50()) + "</td><td>"
+                + common::NumToString(l.p99()) + "</td><td>"
+                + common::NumToString(l.p999()) + "</td><td>"
+                + common::NumToString(l.max()) + "</td></tr>";
+        }
+        str += "</table></body></html>";
+        response.content->Append(str);
+        return true;
+    } else if (path == "/dfs/lane") {
+        std::map<const std::string, std::string>::const_iterator it =
+            request.query_params->find("client_max_pending");
+        if (it != request.query_params->end()) {
+            rpc_scheduler_->SetClientMaxPending(std::atoi(it->second.c_str()));
+        }
+        it = request.query_params->find("name");
+        if (it != request.query_params->end()) {
+            std::map<const std::string, std::string>::const_iterator weight =
+                request.query_params->find("weight");
+            std::map<const std::string, std::string>::const_iterator max_pending =
+                request.query_params->find("max_pending");
+            if (!rpc_scheduler_->SetLaneParam(it->second,
+                    weight == request.query_params->end() ? 0 : std::atoi(weight->second.c_str()),
+                    max_pending == request.query_params->end() ?
+                        -1 : std::atoi(max_pending->second.c_str()))) {
+                response.content->Append("<h1>Bad Parameter : unknown lane or bound on "
+                                         "chunkserver lane " + it->second + "</h1>");
+                return true;
+            }
+        }
+        std::vector<RpcLaneStat> lanes;
+        rpc_scheduler_->GetStat(&lanes);
+        std::string str =
+            "<html><head><title>BFS console</title>"
+            "<meta http-equiv=\"Content-Type\" content=\"text/html; charset=utf-8\" />"
+            "<link rel=\"stylesheet\" type=\"text/css\" "
+                "href=\"http://www.w3school.com.cn/c5.css\"/>"
+            "<style> body { background: #f9f9f9;}</style>"
+            "</head>";
+        str += "<body> <h1>Rpc lanes</h1>";
+        str += "<table class=dataintable>";
+        str += "<tr><td>lane</td><td>weight</td><td>max_pending</td><td>pending</td>"
+               "<td>clients</td><td>done</td><td>rejected</td></tr>";
+        for (size_t i = 0; i < lanes.size(); i++) {
+            const RpcLaneStat& l = lanes[i];
+            str += "<tr><td>" + l.name + "</td><td>"
+                + common::NumToString(l.weight) + "</td><td>"
+                + common::NumToString(l.max_pending) + "</td><td>"
+                + common::NumToString(l.pending) + "</td><td>"
+                + common::NumToString(l.clients) + "</td><td>"
+                + common::NumToString(l.done) + "</td><td>"
+                + common::NumToString(l.rejected) + "</td></tr>";
+        }
+        str += "</table>";
+        str += "Set with /dfs/lane?name=meta&amp;weight=2&amp;max_pending=5000 "
+               "(0 is unbounded) or /dfs/lane?client_max_pending=1000";
+        str += "</body></html>";
+        response.content->Append(str);
+        return true;
     } else if (path == "/dfs/hi_only") {
         recover_timeout_ = 0;
         LOG(INFO, "ChangeRecoverMode hi_only");
@@ -1238,6 +1866,14 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
         recover_mode_ = kStopRecover;
         response.content->Append("<body onload=\"history.back()\"></body>");
         return true;
+    } else if (path == "/dfs/start_balance") {
+        balancer_->Start();
+        response.content->Append("<body onload=\"history.back()\"></body>");
+        return true;
+    } else if (path == "/dfs/stop_balance") {
+        balancer_->Stop();
+        response.content->Append("<body onload=\"history.back()\"></body>");
+        return true;
     } else if (path == "/dfs/leave_read_only") {
         LOG(INFO, "ChangeStatus leave_read_only");
         LeaveReadOnly();
@@ -1266,7 +1902,7 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
     } else if (path == "/dfs/dead") {
         display_mode = kDeadOnly;
     } else if (path == "/dfs/overload") {
-        display_mode = kOverload;
+        display_mode = kOverloadOnly;
     } else if (path == "/dfs/set") {
         std::map<const std::string, std::string>::const_iterator it = request.query_params->begin();
         Params p;
@@ -1299,6 +1935,18 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
                     return true;
                 }
                 p.set_keepalive_timeout(v);
+            } else if (it->first == "recover_bandwidth") {
+                if (v < 0 || v > 1000000) {
+                    response.content->Append("<h1>Bad Parameter : 0 <= recover_bandwidth <= 1000000 </h1>");
+                    return true;
+                }
+                p.set_recover_bandwidth(v);
+            } else if (it->first == "recover_bandwidth_per_server") {
+                if (v < 0 || v > 10000) {
+                    response.content->Append("<h1>Bad Parameter : 0 <= recover_bandwidth_per_server <= 10000 </h1>");
+                    return true;
+                }
+                p.set_recover_bandwidth_per_server(v);
             } else if (it->first == "block_report_timeout") {
                 if (v < 2 || v > 3600) {
                     response.content->Append("<h1>Bad Parameter : 2 <= block_report_timeout <= 3600 </h1>");
@@ -1358,7 +2006,7 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
     table_str +=
         "<table class=\"table\">"
         "<tr><td>ID</td><td>Address</td><td>Blocks</td><td>Size</td>"
-        "<td>Quota</td><td>Used</td><td>Buffers</td>"
+        "<td>Quota</td><td>Used</td><td>Buffers</td><td>Disks</td>"
         "<td>Tag</td><td>Status</td><td>Check</td><td>Start</td><tr>";
     int dead_num = 0;
     int64_t total_quota = 0;
@@ -1379,7 +2027,7 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
             continue;
         } else if ( display_mode == kDeadOnly && !chunkservers->Get(i).is_dead()) {
             continue;
-        } else if (display_mode == kOverload &&
+        } else if (display_mode == kOverloadOnly &&
                    (chunkserver.load() < kChunkServerLoadMax ||
                    chunkservers->Get(i).is_dead())) {
             continue;
@@ -1415,6 +2063,16 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
         table_str += common::NumToString(chunkserver.pending_buf()) + "/" +
                      common::NumToString(chunkserver.buffers());
         table_str += "</td><td>";
+        int writable_disks = 0;
+        for (int j = 0; j < chunkserver.disks_size(); j++) {
+            const DiskInfo& disk = chunkserver.disks(j);
+            if (!disk.write_capped() && disk.data_size() < disk.quota() * 0.98) {
+                writable_disks++;
+            }
+        }
+        table_str += common::NumToString(writable_disks) + "/" +
+                     common::NumToString(chunkserver.disks_size());
+        table_str += "</td><td>";
         table_str += chunkserver.tag();
         table_str += "</td><td>";
         if (chunkserver.is_dead()) {
@@ -1450,6 +2108,8 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
 
     RecoverBlockNum recover_num;
     block_mapping_manager_->GetStat(-1, &recover_num);
+    BalanceStat balance_stat;
+    balancer_->GetStat(&balance_stat);
     int32_t w_qps, r_qps;
     int64_t w_speed, r_speed, recover_speed;
     chunkserver_manager_->GetStat(&w_qps, &w_speed, &r_qps, &r_speed, &recover_speed);
@@ -1473,13 +2133,16 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
             std::string ha_status = sync_ ? sync_->GetStatus() : "none";
             str += "HA status: " + ha_status + "</br>";
             str += "<a href=\"/service?name=baidu.bfs.NameServer\">Rpc</a><a href=\"/dfs/config\"> Config</a>";
+            str += "<a href=\"/dfs/rpc\"> Latency</a><a href=\"/dfs/lane\"> Lanes</a>";
             str += "</div>"; // <div class="col-sm-4 col-md-4">
         }
 
         {
             str += "<div class=\"col-sm-4 col-md-4\">";
             str += "Status: ";
-            if (readonly_) {
+            if (safe_mode_) {
+                str += "<font color=\"red\">SafeMode</font></br> Rebuilding block map";
+            } else if (readonly_) {
                 str += "<font color=\"red\">ReadOnly</font></br> <a href=\"/dfs/leave_read_only\">LeaveReadOnly</a>";
             } else {
                 str += "Normal</br> <a href=\"/dfs/entry_read_only\">EnterReadOnly</a>";
@@ -1502,6 +2165,12 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
                 str += " <a href=\"/dfs/hi_only\">HighOnly </a>";
                 str += "<a href=\"/dfs/recover_all\">RecoverAll</a>";
             }
+            str += "</br>Balance: ";
+            if (balance_stat.enabled) {
+                str += "On <a href=\"/dfs/stop_balance\">Stop</a>";
+            } else {
+                str += "Off <a href=\"/dfs/start_balance\">Start</a>";
+            }
             str += "</br><a href=\"/dfs/namespace\">Namespace</a>";
 
             str += "</div>"; // <div class="col-sm-4 col-md-4">
@@ -1516,6 +2185,10 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
                     common::NumToString(recover_num.lo_pending) + "</br>";
             str += "Lost: " + common::NumToString(recover_num.lost_num) + "</br>";
             str += "Incomplete: " + common::NumToString(recover_num.incomplete_num) + "</br>";
+            str += "Balance(moving/done/fail): " + common::NumToString(balance_stat.moving) + "/" +
+                    common::NumToString(balance_stat.finished) + "/" +
+                    common::NumToString(balance_stat.failed) + " " +
+                    common::HumanReadableString(balance_stat.moved_bytes) + "</br>";
             str += "<a href=\"/dfs/details\">Details</a>";
             str += "</div>"; // <div class="col-sm-4 col-md-4">
         }
@@ -1566,14 +2239,14 @@ bool NameServerImpl::WebService(const sofa::pbrpc::HTTPRequest& request,
     return true;
 }
 
-static void CallMethodHelper(NameServerImpl* impl,
+static void CallMethodHelper(NameServerImpl* impl, RpcStats* rpc_stats,
                              const ::google::protobuf::MethodDescriptor* method,
                              ::google::protobuf::RpcController* controller,
                              const ::google::protobuf::Message* request,
                              ::google::protobuf::Message* response,
                              ::google::protobuf::Closure* done,
                              int64_t recv_time) {
-    if (method->index() == 16) {
+    if (method->name() == "BlockReport") {
         int64_t delay = common::timer::get_micros() - recv_time;
         if (delay > FLAGS_block_report_timeout *1000L * 1000L) {
             const BlockReportRequest* report =
@@ -1584,7 +2257,9 @@ static void CallMethodHelper(NameServerImpl* impl,
             return;
         }
     }
+    rpc_stats->BeginRpc(method->index(), recv_time, &done);
     impl->NameServer::CallMethod(method, controller, request, response, done);
+    rpc_stats->EndRpc();
 }
 
 void NameServerImpl::CallMethod(const ::google::protobuf::MethodDescriptor* method,
@@ -1594,46 +2269,63 @@ void NameServerImpl::CallMethod(const ::google::protobuf::MethodDescriptor* meth
                                 ::google::protobuf::Closure* done) {
     // the sequence of following list must correspond to the sequence of rpc in
     // 'service NameServer { ... }' at nameserver.proto file
-    static std::pair<std::string, ThreadPool*> ThreadPoolOfMethod[] = {
-        std::make_pair("CreateFile", work_thread_pool_),
-        std::make_pair("AddBlock", work_thread_pool_),
-        std::make_pair("GetFileLocation", read_thread_pool_),
-        std::make_pair("ListDirectory", read_thread_pool_),
-        std::make_pair("Stat", read_thread_pool_),
-        std::make_pair("Rename", work_thread_pool_),
-        std::make_pair("SyncBlock", work_thread_pool_),
-        std::make_pair("FinishBlock", work_thread_pool_),
-        std::make_pair("Unlink", work_thread_pool_),
-        std::make_pair("DeleteDirectory", work_thread_pool_),
-        std::make_pair("ChangeReplicaNum", work_thread_pool_),
-        std::make_pair("ShutdownChunkServer", work_thread_pool_),
-        std::make_pair("ShutdownChunkServerStat", work_thread_pool_),
-        std::make_pair("DiskUsage", read_thread_pool_),
-        std::make_pair("Register", work_thread_pool_),
-        std::make_pair("HeartBeat", heartbeat_thread_pool_),
-        std::make_pair("BlockReport", report_thread_pool_),
-        std::make_pair("BlockReceived", work_thread_pool_),
-        std::make_pair("PushBlockReport", work_thread_pool_),
-        std::make_pair("SysStat", read_thread_pool_),
-        std::make_pair("Chmod", work_thread_pool_),
-        std::make_pair("Symlink", work_thread_pool_)
-
+    static std::pair<std::string, RpcLane> LaneOfMethod[] = {
+        std::make_pair("CreateFile", kLaneMeta),
+        std::make_pair("AddBlock", kLaneBlock),
+        std::make_pair("GetFileLocation", kLaneRead),
+        std::make_pair("ListDirectory", kLaneRead),
+        std::make_pair("Stat", kLaneRead),
+        std::make_pair("Rename", kLaneMeta),
+        std::make_pair("SyncBlock", kLaneBlock),
+        std::make_pair("FinishBlock", kLaneBlock),
+        std::make_pair("Unlink", kLaneMeta),
+        std::make_pair("DeleteDirectory", kLaneMeta),
+        std::make_pair("ChangeReplicaNum", kLaneMeta),
+        std::make_pair("ShutdownChunkServer", kLaneMeta),
+        std::make_pair("ShutdownChunkServerStat", kLaneMeta),
+        std::make_pair("DiskUsage", kLaneRead),
+        std::make_pair("BatchStat", kLaneRead),
+        std::make_pair("BatchGetFileLocation", kLaneRead),
+        std::make_pair("BatchCreateFile", kLaneMeta),
+        std::make_pair("Register", kLaneChunkServer),
+        std::make_pair("HeartBeat", kLaneHeartBeat),
+        std::make_pair("BlockReport", kLaneBlockReport),
+        std::make_pair("BlockReceived", kLaneChunkServer),
+        std::make_pair("PushBlockReport", kLaneChunkServer),
+        std::make_pair("SysStat", kLaneRead),
+        std::make_pair("Chmod", kLaneMeta),
+        std::make_pair("Symlink", kLaneMeta),
+        std::make_pair("LockDir", kLaneMeta),
+        std::make_pair("UnlockDir", kLaneMeta),
+        std::make_pair("SetQuota", kLaneMeta),
+        std::make_pair("Lookup", kLaneRead)
     };
-    static int method_num = sizeof(ThreadPoolOfMethod) /
-                            sizeof(std::pair<std::string, ThreadPool*>);
+    static int method_num = sizeof(LaneOfMethod) /
+                            sizeof(std::pair<std::string, RpcLane>);
     int id = method->index();
     assert(id < method_num);
-    assert(method->name() == ThreadPoolOfMethod[id].first);
-
-    ThreadPool* thread_pool = ThreadPoolOfMethod[id].second;
-    if (thread_pool != NULL) {
-        int64_t recv_time = common::timer::get_micros();
-        std::function<void ()> task =
-            std::bind(&CallMethodHelper, this, method, controller,
-                        request, response, done, recv_time);
-        thread_pool->AddTask(task);
-    } else {
-        NameServer::CallMethod(method, controller, request, response, done);
+    assert(method->name() == LaneOfMethod[id].first);
+
+    sofa::pbrpc::RpcController* sofa_cntl =
+        reinterpret_cast<sofa::pbrpc::RpcController*>(controller);
+    std::string client = sofa_cntl->RemoteAddress();
+    client = client.substr(0, client.find(':'));
+    int64_t recv_time = common::timer::get_micros();
+    std::function<void ()> task =
+        std::bind(&CallMethodHelper, this, rpc_stats_, method, controller,
+                    request, response, done, recv_time);
+    if (!rpc_scheduler_->AddTask(LaneOfMethod[id].second, client, task)) {
+        g_rpc_overload.Inc();
+        LOG(DEBUG, "%s from %s rejected, %s lane is full", method->name().c_str(),
+            client.c_str(), RpcScheduler::LaneName(LaneOfMethod[id].second));
+        // Every response has a StatusCode status
+        const google::protobuf::FieldDescriptor* status =
+            response->GetDescriptor()->FindFieldByName("status");
+        if (status && status->enum_type() == StatusCode_descriptor()) {
+            response->GetReflection()->SetEnum(response, status,
+                StatusCode_descriptor()->FindValueByNumber(kOverload));
+        }
+        done->Run();
     }
 }
 
@@ -7,6 +7,7 @@
 #ifndef  BFS_NAMESERVER_IMPL_H_
 #define  BFS_NAMESERVER_IMPL_H_
 
+#include <common/mutex.h>
 #include <common/thread_pool.h>
 #include <functional>
 
@@ -24,8 +25,11 @@ namespace baidu {
 namespace bfs {
 
 class NameSpace;
+class RpcStats;
+class RpcScheduler;
 class ChunkServerManager;
 class BlockMappingManager;
+class Balancer;
 class Sync;
 class FileLockManager;
 
@@ -39,7 +43,7 @@ enum DisplayMode {
     kDisplayAll = 0,
     kAliveOnly = 1,
     kDeadOnly = 2,
-    kOverload = 3,
+    kOverloadOnly = 3,
 };
 
 class NameServerImpl : public NameServer {
@@ -66,6 +70,22 @@ public:
                        const StatRequest* request,
                        StatResponse* response,
                        ::google::protobuf::Closure* done);
+    void Lookup(::google::protobuf::RpcController* controller,
+                       const LookupRequest* request,
+                       LookupResponse* response,
+                       ::google::protobuf::Closure* done);
+    void BatchStat(::google::protobuf::RpcController* controller,
+            const BatchStatRequest* request,
+            BatchStatResponse* response,
+            ::google::protobuf::Closure* done);
+    void BatchGetFileLocation(::google::protobuf::RpcController* controller,
+            const BatchFileLocationRequest* request,
+            BatchFileLocationResponse* response,
+            ::google::protobuf::Closure* done);
+    void BatchCreateFile(::google::protobuf::RpcController* controller,
+            const BatchCreateFileRequest* request,
+            BatchCreateFileResponse* response,
+            ::google::protobuf::Closure* done);
     void Rename(::google::protobuf::RpcController* controller,
                        const RenameRequest* request,
                        RenameResponse* response,
@@ -142,24 +162,42 @@ public:
             const UnlockDirRequest* request,
             UnlockDirResponse* response,
             ::google::protobuf::Closure* done);
+    void SetQuota(::google::protobuf::RpcController* controller,
+            const SetQuotaRequest* request,
+            SetQuotaResponse* response,
+            ::google::protobuf::Closure* done);
     bool WebService(const sofa::pbrpc::HTTPRequest&, sofa::pbrpc::HTTPResponse&);
 
 private:
     void CheckLeader();
-    void RebuildBlockMapCallback(const FileInfo& file_info);
+    void RebuildBlockMap();
+    /// Whether a follower may answer a read asking for 'consistency'
+    bool CheckFollowerRead(ReadConsistency consistency, int64_t min_log_index);
+    void EraseNamespace();
+    void RebuildBlockMapCallback(const std::vector<FileInfo>& files);
+    /// Delete a batch of trashed entries, reschedules itself while leader
+    void ReapTrash();
+    void ReapTrashCallback(std::vector<FileInfo>* removed, bool ret);
     void LogStatus();
     void CheckRecoverMode();
     void LeaveReadOnly();
     void ListRecover(sofa::pbrpc::HTTPResponse* response);
     void ListDirForWeb(const std::string& path, std::string* str);
+    void ListRpcStats(google::protobuf::RepeatedPtrField<RpcLatency>* latency);
     bool LogRemote(const NameServerLog& log, std::function<void (bool)> callback);
+    /// Hand the logs collected so far to sync_ as one entry
+    void FlushLogGroup();
+    void FlushLogGroupTimeout(int64_t group_seq);
+    void LogGroupCallback(std::vector<std::function<void (bool)> >* callbacks, bool ret);
+    /// 'set_log_index' is empty for responses without a log index
     void SyncLogCallback(::google::protobuf::RpcController* controller,
-                         const ::google::protobuf::Message* request,
-                         ::google::protobuf::Message* response,
+                         std::function<void (int64_t)> set_log_index,
                          ::google::protobuf::Closure* done,
                          std::vector<FileInfo>* removed,
                          FileLockGuard file_lock,
                          bool ret);
+    /// Drop the replicas of block_id beyond its expected number, those on 'keep' go last
+    void RemoveSurplusReplicas(int64_t block_id, const std::set<int32_t>& keep);
     void TransToString(const std::map<int32_t, std::set<int64_t> >& chk_set,
                        std::string* output);
     void TransToString(const std::set<int64_t>& block_set, std::string* output);
@@ -172,6 +210,8 @@ private:
                            const std::string& file_name,
                            int64_t block_id);
     void SetActualFileSize(FileInfo* file);
+    void GetLocatedBlocks(const std::string& path, const FileInfo& info,
+                          ::google::protobuf::RepeatedPtrField<LocatedBlock>* blocks);
 private:
     /// Global thread pool
     ThreadPool* read_thread_pool_;
@@ -183,6 +223,8 @@ private:
     ChunkServerManager* chunkserver_manager_;
     /// Block map
     BlockMappingManager* block_mapping_manager_;
+    /// Replica balancer
+    Balancer* balancer_;
 
     volatile bool readonly_;
     volatile int recover_timeout_;
@@ -191,9 +233,23 @@ private:
     /// Namespace
     NameSpace* namespace_;
     FileLockManager* file_lock_manager_;
+    /// Latency histograms of every rpc method
+    RpcStats* rpc_stats_;
+    /// Queues rpcs by lane and client in front of the thread pools
+    RpcScheduler* rpc_scheduler_;
     /// ha
     Sync* sync_;
     bool is_leader_;
+    /// Block map is rebuilding, only metadata reads are served
+    volatile bool safe_mode_;
+    /// Group commit: logs of concurrent mutations wait here while a group
+    /// is being replicated and go out together as the next group
+    Mutex log_mu_;
+    NameServerLog pending_log_;
+    int64_t pending_bytes_;
+    std::vector<std::function<void (bool)> > pending_callbacks_;
+    int64_t group_seq_;
+    int32_t logging_groups_;
 };
 
 } // namespace bfs
@@ -7,6 +7,7 @@
 #include "namespace.h"
 
 #include <fcntl.h>
+#include <algorithm>
 #include <gflags/gflags.h>
 #include <leveldb/db.h>
 #include <leveldb/cache.h>
@@ -16,7 +17,9 @@
 #include <common/util.h>
 #include <common/atomic.h>
 #include <common/string_util.h>
+#include <common/thread_pool.h>
 
+#include "nameserver/rpc_stats.h"
 #include "nameserver/sync.h"
 
 DECLARE_string(namedb_path);
@@ -25,13 +28,42 @@ DECLARE_int32(default_replica_num);
 DECLARE_int32(block_id_allocation_size);
 DECLARE_int32(snapshot_step);
 DECLARE_bool(check_orphan);
+DECLARE_int32(nameserver_rebuild_thread_num);
+DECLARE_int32(nameserver_rebuild_batch_size);
 
 const int64_t kRootEntryid = 1;
+/// Bounds walks up the usage records in case of a broken parent chain
+const int32_t kMaxUsageDepth = 1024;
+/// Symlinks followed at most, a loop of links ends here
+const int32_t kMaxSymlinkHops = 32;
 
 
 namespace baidu {
 namespace bfs {
 
+namespace {
+
+/// Usage records are kept under entry id 0 like the namespace version
+std::string UsageKeyPrefix() {
+    std::string prefix(8, 0);
+    prefix.append("usage");
+    return prefix;
+}
+
+/// Directories being deleted in the background, by entry id
+std::string TrashKeyPrefix() {
+    std::string prefix(8, 0);
+    prefix.append("trash");
+    return prefix;
+}
+
+bool OverQuota(const DirUsage& usage, int64_t space, int64_t files) {
+    return (space > 0 && usage.space_quota() > 0 && usage.space() + space > usage.space_quota())
+        || (files > 0 && usage.file_quota() > 0 && usage.files() + files > usage.file_quota());
+}
+
+} // namespace
+
 NameSpace::NameSpace(bool standalone): version_(0), last_entry_id_(1),
     block_id_upbound_(1), next_block_id_(1) {
     leveldb::Options options;
@@ -44,12 +76,15 @@ NameSpace::NameSpace(bool standalone): version_(0), last_entry_id_(1),
         LOG(ERROR, "Open leveldb fail: %s", s.ToString().c_str());
         exit(EXIT_FAILURE);
     }
+    // Followers never Activate but answer reads of "/" too
+    SetupRoot();
     if (standalone) {
-        Activate(NULL, NULL);
+        Activate(NULL);
+        RebuildBlockMap(NULL, NULL);
     }
 }
 
-void NameSpace::Activate(std::function<void (const FileInfo&)> callback, NameServerLog* log) {
+void NameSpace::Activate(NameServerLog* log) {
     std::string version_key(8, 0);
     version_key.append("version");
     std::string version_str;
@@ -73,8 +108,6 @@ void NameSpace::Activate(std::function<void (const FileInfo&)> callback, NameSer
         LOG(INFO, "Create new namespace version: %ld ", version_);
     }
     SetupRoot();
-    RebuildBlockMap(callback);
-    InitBlockIdUpbound(log);
 }
 NameSpace::~NameSpace() {
     delete db_;
@@ -94,7 +127,11 @@ bool NameSpace::GetLinkSrcPath(const FileInfo& info, FileInfo* src_info) {
     *src_info = info;
     FileType file_type = GetFileType(info.type());
 
-    while (file_type == kSymlink) {
+    for (int32_t hops = 0; file_type == kSymlink; hops++) {
+        if (hops >= kMaxSymlinkHops) {
+            LOG(INFO, "GetLinkSrcPath too many links from %s", info.name().c_str());
+            return false;
+        }
         std::string sym_link = src_info->sym_link() ;
         std::string sym_path = NormalizePath(sym_link);
         LOG(INFO, "GetLinkSrcPath sym_path %s", sym_path.c_str());
@@ -166,7 +203,7 @@ void NameSpace::SetupRoot() {
 /// 3filez -> 6
 /// 4filex -> 7
 /// 5filey -> 8
-bool NameSpace::LookUp(const std::string& path, FileInfo* info) {
+bool NameSpace::LookUp(const std::string& path, FileInfo* info, DirCache* dir_cache) {
     if (path == "/") {
         info->CopyFrom(root_path_);
         return true;
@@ -177,9 +214,20 @@ bool NameSpace::LookUp(const std::string& path, FileInfo* info) {
     }
     int64_t parent_id = kRootEntryid;
     int64_t entry_id = kRootEntryid;
+    std::string prefix;
     for (size_t i = 0; i < paths.size(); i++) {
-        if (!LookUp(entry_id, paths[i], info)) {
+        bool is_parent = (i + 1 < paths.size());
+        DirCache::iterator it;
+        if (dir_cache && is_parent) {
+            prefix += "/" + paths[i];
+            it = dir_cache->find(prefix);
+        }
+        if (dir_cache && is_parent && it != dir_cache->end()) {
+            info->CopyFrom(it->second);
+        } else if (!LookUp(entry_id, paths[i], info)) {
             return false;
+        } else if (dir_cache && is_parent && GetFileType(info->type()) == kDir) {
+            (*dir_cache)[prefix] = *info;
         }
         parent_id = entry_id;
         entry_id = info->entry_id();
@@ -203,6 +251,7 @@ bool NameSpace::LookUp(int64_t parent_id, const std::string& name, FileInfo* inf
 }
 
 bool NameSpace::DeleteFileInfo(const std::string file_key, NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
     leveldb::Status s = db_->Delete(leveldb::WriteOptions(), file_key);
     if (!s.ok()) {
         return false;
@@ -211,6 +260,7 @@ bool NameSpace::DeleteFileInfo(const std::string file_key, NameServerLog* log) {
     return true;
 }
 bool NameSpace::UpdateFileInfo(const FileInfo& file_info, NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
     {
         MutexLock lock(&mu_);
         for (auto i = 0; i < file_info.blocks_size(); ++i) {
@@ -229,6 +279,16 @@ bool NameSpace::UpdateFileInfo(const FileInfo& file_info, NameServerLog* log) {
     std::string infobuf_for_ldb;
     file_info_for_ldb.SerializeToString(&infobuf_for_ldb);
 
+    if (GetFileType(file_info.type()) == kDefault) {
+        FileInfo old_info;
+        int64_t files = GetFromStore(file_key, &old_info) ? 0 : 1;
+        if (file_info.size() != old_info.size() || files) {
+            UsageDelta delta;
+            AddUsage(file_info.parent_entry_id(), file_info.size() - old_info.size(), files, &delta);
+            UpdateUsage(delta, false, log);
+        }
+    }
+
     leveldb::Status s = db_->Put(leveldb::WriteOptions(), file_key, infobuf_for_ldb);
     if (!s.ok()) {
         LOG(WARNING, "NameSpace write to db fail: %s", s.ToString().c_str());
@@ -238,8 +298,10 @@ bool NameSpace::UpdateFileInfo(const FileInfo& file_info, NameServerLog* log) {
     return true;
 }
 
-bool NameSpace::GetFileInfo(const std::string& path, FileInfo* file_info) {
-    if (!LookUp(path, file_info)) {
+bool NameSpace::GetFileInfo(const std::string& path, FileInfo* file_info,
+                            DirCache* dir_cache) {
+    RpcStageTimer timer(kRpcNamespace);
+    if (!LookUp(path, file_info, dir_cache)) {
         return false;
     } else {
         if (GetFileType(file_info->type()) == kSymlink) {
@@ -252,7 +314,7 @@ bool NameSpace::GetFileInfo(const std::string& path, FileInfo* file_info) {
 }
 
 StatusCode NameSpace::BuildPath(const std::string& path, FileInfo* file_info, std::string* fname,
-                                NameServerLog* log) {
+                                NameServerLog* log, DirCache* dir_cache) {
     std::vector<std::string> paths;
     if (!common::util::SplitPath(path, &paths)) {
         LOG(INFO, "path split fail %s", path.c_str());
@@ -265,11 +327,27 @@ StatusCode NameSpace::BuildPath(const std::string& path, FileInfo* file_info, st
     /// if parent is root,  set "file_info"
     file_info->set_entry_id(kRootEntryid);
     std::string info_value;
+    std::string prefix;
     for (int i = 0; i < depth - 1; ++i) {
-        if (!LookUp(parent_id, paths[i], file_info)) {
+        DirCache::iterator it;
+        if (dir_cache) {
+            prefix += "/" + paths[i];
+            it = dir_cache->find(prefix);
+        }
+        if (dir_cache && it != dir_cache->end()) {
+            file_info->CopyFrom(it->second);
+        } else if (!LookUp(parent_id, paths[i], file_info)) {
             file_info->set_type((1 << 9) | 01755);
             file_info->set_ctime(time(NULL));
             file_info->set_entry_id(common::atomic_add64(&last_entry_id_, 1) + 1);
+            UsageDelta delta;
+            AddUsage(parent_id, 0, 1, &delta);
+            delta[file_info->entry_id()].set_parent(parent_id);
+            StatusCode status = UpdateUsage(delta, true, log);
+            if (status != kOK) {
+                LOG(INFO, "Create path fail: %s %s", paths[i].c_str(), StatusCode_Name(status).c_str());
+                return status;
+            }
             file_info->SerializeToString(&info_value);
             std::string key_str;
             EncodingStoreKey(parent_id, paths[i], &key_str);
@@ -283,6 +361,9 @@ StatusCode NameSpace::BuildPath(const std::string& path, FileInfo* file_info, st
                 return kBadParameter;
             }
         }
+        if (dir_cache) {
+            (*dir_cache)[prefix] = *file_info;
+        }
         parent_id = file_info->entry_id();
     }
     *fname = paths[depth - 1];
@@ -290,13 +371,15 @@ StatusCode NameSpace::BuildPath(const std::string& path, FileInfo* file_info, st
 }
 
 StatusCode NameSpace::CreateFile(const std::string& file_name, int flags, int mode, int replica_num,
-                                 std::vector<int64_t>* blocks_to_remove, NameServerLog* log) {
+                                 std::vector<int64_t>* blocks_to_remove, NameServerLog* log,
+                                 DirCache* dir_cache) {
+    RpcStageTimer timer(kRpcNamespace);
     if (file_name == "/") {
         return kBadParameter;
     }
     FileInfo file_info;
     std::string fname, info_value;
-    StatusCode status = BuildPath(file_name, &file_info, &fname, log);
+    StatusCode status = BuildPath(file_name, &file_info, &fname, log, dir_cache);
     if (status != kOK) {
         return status;
     }
@@ -322,6 +405,19 @@ StatusCode NameSpace::CreateFile(const std::string& file_name, int flags, int mo
     file_info.set_entry_id(common::atomic_add64(&last_entry_id_, 1) + 1);
     file_info.set_ctime(time(NULL));
     file_info.set_replicas(replica_num <= 0 ? FLAGS_default_replica_num : replica_num);
+    // A truncated file keeps its size until the first block is written
+    UsageDelta delta;
+    if (!exist) {
+        AddUsage(parent_id, 0, 1, &delta);
+    }
+    if (GetFileType(file_info.type()) == kDir) {
+        delta[file_info.entry_id()].set_parent(parent_id);
+    }
+    status = UpdateUsage(delta, true, log);
+    if (status != kOK) {
+        LOG(INFO, "CreateFile %s fail: %s", file_name.c_str(), StatusCode_Name(status).c_str());
+        return status;
+    }
     file_info.SerializeToString(&info_value);
 
     std::string file_key;
@@ -339,6 +435,7 @@ StatusCode NameSpace::CreateFile(const std::string& file_name, int flags, int mo
 
 StatusCode NameSpace::ListDirectory(const std::string& path,
                                     google::protobuf::RepeatedPtrField<FileInfo>* outputs) {
+    RpcStageTimer timer(kRpcNamespace);
     outputs->Clear();
     FileInfo info;
     if (!LookUp(path, &info)) {
@@ -355,9 +452,51 @@ StatusCode NameSpace::ListDirectory(const std::string& path,
     int64_t entry_id = info.entry_id();
     LOG(DEBUG, "ListDirectory entry_id= E%ld ", entry_id);
     common::timer::AutoTimer at1(100, "ListDirectory iterate", path.c_str());
+    ListEntries(entry_id, outputs);
+    LOG(INFO, "List return %ld items", outputs->size());
+    return kOK;
+}
+
+StatusCode NameSpace::ListDirectory(int64_t dir_id,
+                                    google::protobuf::RepeatedPtrField<FileInfo>* outputs) {
+    RpcStageTimer timer(kRpcNamespace);
+    outputs->Clear();
+    if (!IsLiveDir(dir_id)) {
+        LOG(INFO, "List E%ld return not found", dir_id);
+        return kNsNotFound;
+    }
+    ListEntries(dir_id, outputs);
+    LOG(INFO, "List E%ld return %ld items", dir_id, outputs->size());
+    return kOK;
+}
+
+bool NameSpace::IsLiveDir(int64_t dir_id) {
+    // Every directory has a usage record until it is reaped, a directory
+    // below a trashed one is gone as well
+    int64_t id = dir_id;
+    for (int32_t depth = 0; depth < kMaxUsageDepth; depth++) {
+        std::string trash_key, value;
+        EncodingTrashKey(id, &trash_key);
+        if (db_->Get(leveldb::ReadOptions(), trash_key, &value).ok()) {
+            return false;
+        }
+        if (id == kRootEntryid) {
+            return true;
+        }
+        DirUsage usage;
+        if (!GetUsage(id, &usage) || !usage.has_parent()) {
+            return false;
+        }
+        id = usage.parent();
+    }
+    return false;
+}
+
+void NameSpace::ListEntries(int64_t dir_id,
+                            google::protobuf::RepeatedPtrField<FileInfo>* outputs) {
     std::string key_start, key_end;
-    EncodingStoreKey(entry_id, "", &key_start);
-    EncodingStoreKey(entry_id + 1, "", &key_end);
+    EncodingStoreKey(dir_id, "", &key_start);
+    EncodingStoreKey(dir_id + 1, "", &key_end);
     leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
     for (it->Seek(key_start); it->Valid(); it->Next()) {
         leveldb::Slice key = it->key();
@@ -368,12 +507,25 @@ StatusCode NameSpace::ListDirectory(const std::string& path,
         bool ret = file_info->ParseFromArray(it->value().data(), it->value().size());
         assert(ret);
         file_info->set_name(std::string(key.data() + 8, key.size() - 8));
-        LOG(DEBUG, "List %s return %s[%s]",
-            path.c_str(), file_info->name().c_str(),
+        file_info->set_parent_entry_id(dir_id);
+        LOG(DEBUG, "List E%ld return %s[%s]",
+            dir_id, file_info->name().c_str(),
             common::DebugString(key.ToString()).c_str());
     }
-    LOG(INFO, "List return %ld items", outputs->size());
     delete it;
+}
+
+StatusCode NameSpace::Lookup(int64_t parent_id, const std::string& name, FileInfo* info) {
+    RpcStageTimer timer(kRpcNamespace);
+    if (name.empty() || name.find('/') != std::string::npos) {
+        return kBadParameter;
+    }
+    // Entries of a trashed directory stay until reaped, but can't be reached
+    if (!IsLiveDir(parent_id) || !LookUp(parent_id, name, info)) {
+        return kNsNotFound;
+    }
+    info->set_name(name);
+    info->set_parent_entry_id(parent_id);
     return kOK;
 }
 
@@ -382,6 +534,7 @@ StatusCode NameSpace::Rename(const std::string& old_path,
                              bool* need_unlink,
                              FileInfo* remove_file,
                              NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
     *need_unlink = false;
     if (old_path == "/" || new_path == "/" || old_path == new_path) {
         return kBadParameter;
@@ -421,6 +574,7 @@ StatusCode NameSpace::Rename(const std::string& old_path,
 
 
     const std::string& dst_name = new_paths[new_paths.size() - 1];
+    UsageDelta delta;
     {
         /// dst_file maybe not exist, don't use it elsewhere.
         FileInfo dst_file;
@@ -437,8 +591,28 @@ StatusCode NameSpace::Rename(const std::string& old_path,
                 remove_file->CopyFrom(dst_file);
                 remove_file->set_name(dst_name);
             }
+            AddUsage(parent_id, GetFileType(dst_file.type()) == kDefault ? -dst_file.size() : 0,
+                     -1, &delta);
         }
     }
+    // The usage of what is moved goes from the old directories to the new ones
+    int64_t space = GetFileType(old_file.type()) == kDefault ? old_file.size() : 0;
+    int64_t files = 1;
+    if (GetFileType(old_file.type()) == kDir) {
+        DirUsage usage;
+        GetUsage(old_file.entry_id(), &usage);
+        space = usage.space();
+        files += usage.files();
+        delta[old_file.entry_id()].set_parent(parent_id);
+    }
+    AddUsage(old_file.parent_entry_id(), -space, -files, &delta);
+    AddUsage(parent_id, space, files, &delta);
+    StatusCode status = UpdateUsage(delta, true, log);
+    if (status != kOK) {
+        LOG(INFO, "Rename %s to %s fail: %s",
+            old_path.c_str(), new_path.c_str(), StatusCode_Name(status).c_str());
+        return status;
+    }
 
     std::string old_key;
     EncodingStoreKey(old_file.parent_entry_id(), old_file.name(), &old_key);
@@ -470,6 +644,7 @@ StatusCode NameSpace::Rename(const std::string& old_path,
 }
 
 StatusCode NameSpace::Symlink(const std::string& src, const std::string& dst, NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
     if (src == "/" || dst == "/") {
         return kBadParameter;
     }
@@ -501,6 +676,13 @@ StatusCode NameSpace::Symlink(const std::string& src, const std::string& dst, Na
     file_info.set_entry_id(common::atomic_add64(&last_entry_id_, 1) + 1);
     file_info.set_ctime(time(NULL));
     file_info.set_sym_link(src);
+    UsageDelta delta;
+    AddUsage(parent_id, 0, 1, &delta);
+    status = UpdateUsage(delta, true, log);
+    if (status != kOK) {
+        LOG(INFO, "CreateSymlink %s fail: %s", dst.c_str(), StatusCode_Name(status).c_str());
+        return status;
+    }
     file_info.SerializeToString(&info_value);
 
     std::string file_key;
@@ -517,6 +699,7 @@ StatusCode NameSpace::Symlink(const std::string& src, const std::string& dst, Na
 }
 
 StatusCode NameSpace::RemoveFile(const std::string& path, FileInfo* file_removed, NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
     StatusCode ret_status = kOK;
     if (LookUp(path, file_removed)) {
         // Only support file
@@ -528,6 +711,11 @@ StatusCode NameSpace::RemoveFile(const std::string& path, FileInfo* file_removed
             EncodingStoreKey(file_removed->parent_entry_id(), file_removed->name(), &file_key);
             if (DeleteFileInfo(file_key, log)) {
                 LOG(INFO, "Unlink done: %s\n", path.c_str());
+                UsageDelta delta;
+                AddUsage(file_removed->parent_entry_id(),
+                         GetFileType(file_removed->type()) == kDefault ? -file_removed->size() : 0,
+                         -1, &delta);
+                UpdateUsage(delta, false, log);
                 ret_status = kOK;
             } else {
                 LOG(WARNING, "Unlink write meta fail: %s\n", path.c_str());
@@ -545,6 +733,7 @@ StatusCode NameSpace::RemoveFile(const std::string& path, FileInfo* file_removed
 }
 
 StatusCode NameSpace::DiskUsage(const std::string& path, uint64_t* du_size) {
+    RpcStageTimer timer(kRpcNamespace);
     if (!du_size) {
         return kOK;
     }
@@ -557,9 +746,226 @@ StatusCode NameSpace::DiskUsage(const std::string& path, uint64_t* du_size) {
         *du_size = info.size();
         return kOK;
     }
+    DirUsage usage;
+    if (GetUsage(info.entry_id(), &usage)) {
+        *du_size = usage.space();
+        return kOK;
+    }
+    // Not counted yet, the leader sums up every directory when it starts
     return InternalComputeDiskUsage(info, du_size);
 }
 
+StatusCode NameSpace::GetUsage(const std::string& path, DirUsage* usage) {
+    RpcStageTimer timer(kRpcNamespace);
+    FileInfo info;
+    if (!LookUp(path, &info)) {
+        return kNsNotFound;
+    } else if (GetFileType(info.type()) != kDir) {
+        return kBadParameter;
+    }
+    if (!GetUsage(info.entry_id(), usage)) {
+        uint64_t du_size = 0;
+        InternalComputeDiskUsage(info, &du_size);
+        usage->set_space(du_size);
+    }
+    return kOK;
+}
+
+StatusCode NameSpace::SetQuota(const std::string& path, int64_t space_quota, int64_t file_quota,
+                               NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
+    FileInfo info;
+    if (!LookUp(path, &info)) {
+        return kNsNotFound;
+    } else if (GetFileType(info.type()) != kDir) {
+        return kBadParameter;
+    }
+    UsageDelta delta;
+    DirUsage& usage = delta[info.entry_id()];
+    usage.set_parent(info.entry_id() == kRootEntryid ? 0 : info.parent_entry_id());
+    if (space_quota >= 0) {
+        usage.set_space_quota(space_quota);
+    }
+    if (file_quota >= 0) {
+        usage.set_file_quota(file_quota);
+    }
+    LOG(INFO, "SetQuota %s space %ld files %ld", path.c_str(), space_quota, file_quota);
+    return UpdateUsage(delta, false, log);
+}
+
+StatusCode NameSpace::CheckQuota(int64_t dir_id, int64_t space, int64_t files) {
+    RpcStageTimer timer(kRpcNamespace);
+    int64_t id = dir_id;
+    for (int32_t depth = 0; id > 0 && depth < kMaxUsageDepth; depth++) {
+        DirUsage usage;
+        if (!GetUsage(id, &usage)) {
+            break;
+        }
+        if (OverQuota(usage, space, files)) {
+            LOG(INFO, "E%ld over quota, space %ld/%ld files %ld/%ld", id,
+                usage.space(), usage.space_quota(), usage.files(), usage.file_quota());
+            return kNotEnoughQuota;
+        }
+        if (id == kRootEntryid) {
+            break;
+        }
+        id = usage.parent();
+    }
+    return kOK;
+}
+
+void NameSpace::EncodingUsageKey(int64_t entry_id, std::string* key_str) {
+    *key_str = UsageKeyPrefix();
+    key_str->resize(key_str->size() + 8);
+    common::util::EncodeBigEndian(&(*key_str)[key_str->size() - 8], (uint64_t)entry_id);
+}
+
+bool NameSpace::GetUsage(int64_t entry_id, DirUsage* usage) {
+    std::string key, value;
+    EncodingUsageKey(entry_id, &key);
+    leveldb::Status s = db_->Get(leveldb::ReadOptions(), key, &value);
+    if (!s.ok()) {
+        return false;
+    }
+    return usage->ParseFromString(value);
+}
+
+void NameSpace::AddUsage(int64_t dir_id, int64_t space, int64_t files, UsageDelta* delta) {
+    int64_t id = dir_id;
+    for (int32_t depth = 0; id > 0 && depth < kMaxUsageDepth; depth++) {
+        DirUsage& d = (*delta)[id];
+        d.set_space(d.space() + space);
+        d.set_files(d.files() + files);
+        if (id == kRootEntryid) {
+            return;
+        }
+        DirUsage usage;
+        if (!GetUsage(id, &usage) || !usage.has_parent()) {
+            // Fixed when the leader rebuilds the usage at start
+            LOG(WARNING, "No usage record of E%ld", id);
+            return;
+        }
+        id = usage.parent();
+    }
+}
+
+StatusCode NameSpace::UpdateUsage(const UsageDelta& delta, bool check_quota,
+                                  NameServerLog* log) {
+    if (delta.empty()) {
+        return kOK;
+    }
+    MutexLock lock(&usage_mu_);
+    std::vector<DirUsage> usages(delta.size());
+    int i = 0;
+    for (UsageDelta::const_iterator it = delta.begin(); it != delta.end(); ++it, ++i) {
+        GetUsage(it->first, &usages[i]);
+        if (check_quota && OverQuota(usages[i], it->second.space(), it->second.files())) {
+            LOG(INFO, "E%ld over quota, space %ld+%ld/%ld files %ld+%ld/%ld", it->first,
+                usages[i].space(), it->second.space(), usages[i].space_quota(),
+                usages[i].files(), it->second.files(), usages[i].file_quota());
+            return kNotEnoughQuota;
+        }
+        MergeUsage(it->second, &usages[i]);
+    }
+    leveldb::WriteBatch batch;
+    i = 0;
+    for (UsageDelta::const_iterator it = delta.begin(); it != delta.end(); ++it, ++i) {
+        std::string key, value;
+        EncodingUsageKey(it->first, &key);
+        // Concurrent changes may be logged in any order, followers keep the
+        // record with the highest seq, so replaying a log changes nothing
+        usages[i].set_seq(usages[i].seq() + 1);
+        usages[i].SerializeToString(&value);
+        batch.Put(key, value);
+        EncodeLog(log, kSyncWrite, key, value);
+    }
+    leveldb::Status s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok()) {
+        LOG(WARNING, "Update usage fail: %s", s.ToString().c_str());
+        return kUpdateError;
+    }
+    return kOK;
+}
+
+void NameSpace::MergeUsage(const DirUsage& delta, DirUsage* usage) {
+    usage->set_space(usage->space() + delta.space());
+    usage->set_files(usage->files() + delta.files());
+    if (delta.has_parent()) {
+        usage->set_parent(delta.parent());
+    }
+    if (delta.has_space_quota()) {
+        usage->set_space_quota(delta.space_quota());
+    }
+    if (delta.has_file_quota()) {
+        usage->set_file_quota(delta.file_quota());
+    }
+}
+
+void NameSpace::RebuildUsage(const std::map<int64_t, int64_t>& dir_parents,
+                             const std::map<int64_t, std::pair<int64_t, int64_t> >& dir_usage,
+                             NameServerLog* log) {
+    typedef std::map<int64_t, std::pair<int64_t, int64_t> > UsageMap;
+    UsageMap total;
+    total[kRootEntryid];
+    for (std::map<int64_t, int64_t>::const_iterator it = dir_parents.begin();
+         it != dir_parents.end(); ++it) {
+        total[it->first];
+    }
+    // Entries right under a directory count for it and every directory above
+    for (UsageMap::const_iterator it = dir_usage.begin(); it != dir_usage.end(); ++it) {
+        int64_t id = it->first;
+        for (int32_t depth = 0; depth < kMaxUsageDepth; depth++) {
+            UsageMap::iterator t = total.find(id);
+            if (t == total.end()) {
+                break;
+            }
+            t->second.first += it->second.first;
+            t->second.second += it->second.second;
+            if (id == kRootEntryid) {
+                break;
+            }
+            id = dir_parents.find(id)->second;
+        }
+    }
+    int64_t fixed = 0;
+    leveldb::WriteBatch batch;
+    for (UsageMap::iterator it = total.begin(); it != total.end(); ++it) {
+        int64_t parent = it->first == kRootEntryid ? 0 : dir_parents.find(it->first)->second;
+        DirUsage usage;
+        if (GetUsage(it->first, &usage) && usage.space() == it->second.first
+            && usage.files() == it->second.second && usage.parent() == parent) {
+            continue;
+        }
+        usage.set_space(it->second.first);
+        usage.set_files(it->second.second);
+        usage.set_parent(parent);
+        usage.set_seq(usage.seq() + 1);
+        std::string key, value;
+        EncodingUsageKey(it->first, &key);
+        usage.SerializeToString(&value);
+        batch.Put(key, value);
+        EncodeLog(log, kSyncWrite, key, value);
+        ++fixed;
+    }
+    // Records of directories that are gone
+    std::string prefix = UsageKeyPrefix();
+    leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
+    for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix); it->Next()) {
+        int64_t entry_id = common::util::DecodeBigEndian64(it->key().data() + prefix.size());
+        if (total.find(entry_id) == total.end()) {
+            batch.Delete(it->key());
+            EncodeLog(log, kSyncDelete, it->key().ToString(), "");
+            ++fixed;
+        }
+    }
+    delete it;
+    leveldb::Status s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok()) {
+        LOG(FATAL, "Rebuild usage fail: %s", s.ToString().c_str());
+    }
+    LOG(INFO, "Rebuild usage of %lu directories, %ld records fixed", total.size(), fixed);
+}
+
 StatusCode NameSpace::InternalComputeDiskUsage(const FileInfo& info, uint64_t* du_size) {
     int64_t entry_id = info.entry_id();
     std::string key_start, key_end;
@@ -594,6 +1000,7 @@ StatusCode NameSpace::InternalComputeDiskUsage(const FileInfo& info, uint64_t* d
 
 StatusCode NameSpace::DeleteDirectory(const std::string& path, bool recursive,
                                       std::vector<FileInfo>* files_removed, NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
     files_removed->clear();
     FileInfo info;
     if (!LookUp(path, &info)) {
@@ -603,7 +1010,19 @@ StatusCode NameSpace::DeleteDirectory(const std::string& path, bool recursive,
         LOG(INFO, "Delete Directory, %s %d is not a dir.", path.c_str(), info.type());
         return kBadParameter;
     }
-    return InternalDeleteDirectory(info, recursive, files_removed, log);
+    DirUsage usage;
+    GetUsage(info.entry_id(), &usage);
+    StatusCode status = InternalDeleteDirectory(info, recursive, files_removed, log);
+    if (status == kOK) {
+        UsageDelta delta;
+        if (info.entry_id() == kRootEntryid) {
+            AddUsage(kRootEntryid, -usage.space(), -usage.files(), &delta);
+        } else {
+            AddUsage(info.parent_entry_id(), -usage.space(), -usage.files() - 1, &delta);
+        }
+        UpdateUsage(delta, false, log);
+    }
+    return status;
 }
 
 StatusCode NameSpace::InternalDeleteDirectory(const FileInfo& dir_info,
@@ -659,6 +1078,12 @@ StatusCode NameSpace::InternalDeleteDirectory(const FileInfo& dir_info,
     EncodingStoreKey(dir_info.parent_entry_id(), dir_info.name(), &store_key);
     batch.Delete(store_key);
     EncodeLog(log, kSyncDelete, store_key, "");
+    if (entry_id != kRootEntryid) {
+        std::string usage_key;
+        EncodingUsageKey(entry_id, &usage_key);
+        batch.Delete(usage_key);
+        EncodeLog(log, kSyncDelete, usage_key, "");
+    }
 
     leveldb::Status s = db_->Write(leveldb::WriteOptions(), &batch);
     if (s.ok()) {
@@ -672,63 +1097,274 @@ StatusCode NameSpace::InternalDeleteDirectory(const FileInfo& dir_info,
     return ret_status;
 }
 
-bool NameSpace::RebuildBlockMap(std::function<void (const FileInfo&)> callback) {
+StatusCode NameSpace::TrashDirectory(const std::string& path, NameServerLog* log) {
+    RpcStageTimer timer(kRpcNamespace);
+    FileInfo info;
+    if (!LookUp(path, &info)) {
+        LOG(INFO, "Trash Directory, %s is not found.", path.c_str());
+        return kNsNotFound;
+    } else if (GetFileType(info.type()) != kDir) {
+        LOG(INFO, "Trash Directory, %s %d is not a dir.", path.c_str(), info.type());
+        return kBadParameter;
+    } else if (info.entry_id() == kRootEntryid) {
+        return kBadParameter;
+    }
+    DirUsage usage;
+    GetUsage(info.entry_id(), &usage);
+    UsageDelta delta;
+    AddUsage(info.parent_entry_id(), -usage.space(), -usage.files() - 1, &delta);
+    StatusCode status = UpdateUsage(delta, false, log);
+    if (status != kOK) {
+        return status;
+    }
+    // Entries below keep their keys, nothing reaches them once the directory is gone
+    std::string store_key, trash_key, trash_value;
+    EncodingStoreKey(info.parent_entry_id(), info.name(), &store_key);
+    EncodingTrashKey(info.entry_id(), &trash_key);
+    info.SerializeToString(&trash_value);
+    leveldb::WriteBatch batch;
+    batch.Delete(store_key);
+    batch.Put(trash_key, trash_value);
+    leveldb::Status s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok()) {
+        LOG(WARNING, "Trash directory %s fail: %s", path.c_str(), s.ToString().c_str());
+        return kUpdateError;
+    }
+    EncodeLog(log, kSyncDelete, store_key, "");
+    EncodeLog(log, kSyncWrite, trash_key, trash_value);
+    LOG(INFO, "Trash directory %s E%ld, %ld entries below", path.c_str(), info.entry_id(),
+        usage.files());
+    return kOK;
+}
+
+bool NameSpace::ReapTrash(int32_t max_entries, std::vector<FileInfo>* files_removed,
+                          NameServerLog* log) {
+    MutexLock lock(&trash_mu_);
+    std::string prefix = TrashKeyPrefix();
+    leveldb::Iterator* trash_it = db_->NewIterator(leveldb::ReadOptions());
+    trash_it->Seek(prefix);
+    if (!trash_it->Valid() || !trash_it->key().starts_with(prefix)) {
+        delete trash_it;
+        return false;
+    }
+    std::string trash_key = trash_it->key().ToString();
+    int64_t entry_id = common::util::DecodeBigEndian64(trash_key.data() + prefix.size());
+    delete trash_it;
+
+    std::string key_start, key_end;
+    EncodingStoreKey(entry_id, "", &key_start);
+    EncodingStoreKey(entry_id + 1, "", &key_end);
+    leveldb::WriteBatch batch;
+    int32_t entries = 0;
+    bool done = true;
+    leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
+    for (it->Seek(key_start); it->Valid() && it->key().compare(key_end) < 0; it->Next()) {
+        if (entries >= max_entries) {
+            done = false;
+            break;
+        }
+        std::string key = it->key().ToString();
+        FileInfo child_info;
+        bool ret = child_info.ParseFromArray(it->value().data(), it->value().size());
+        assert(ret);
+        child_info.set_parent_entry_id(entry_id);
+        child_info.set_name(key.substr(8));
+        batch.Delete(key);
+        EncodeLog(log, kSyncDelete, key, "");
+        if (GetFileType(child_info.type()) == kDir) {
+            // A sub directory is trashed on its own, so no batch walks a whole tree
+            std::string child_key, child_value;
+            EncodingTrashKey(child_info.entry_id(), &child_key);
+            child_info.SerializeToString(&child_value);
+            batch.Put(child_key, child_value);
+            EncodeLog(log, kSyncWrite, child_key, child_value);
+        } else {
+            files_removed->push_back(child_info);
+        }
+        ++entries;
+    }
+    delete it;
+    if (done) {
+        std::string usage_key;
+        EncodingUsageKey(entry_id, &usage_key);
+        batch.Delete(usage_key);
+        EncodeLog(log, kSyncDelete, usage_key, "");
+        batch.Delete(trash_key);
+        EncodeLog(log, kSyncDelete, trash_key, "");
+    }
+    leveldb::Status s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok()) {
+        LOG(FATAL, "Reap trash E%ld fail: %s", entry_id, s.ToString().c_str());
+    }
+    LOG(INFO, "Reap trash E%ld, %d entries removed%s", entry_id, entries,
+        done ? ", directory done" : "");
+    return true;
+}
+
+void NameSpace::EncodingTrashKey(int64_t entry_id, std::string* key_str) {
+    *key_str = TrashKeyPrefix();
+    key_str->resize(key_str->size() + 8);
+    common::util::EncodeBigEndian(&(*key_str)[key_str->size() - 8], (uint64_t)entry_id);
+}
+
+bool NameSpace::RebuildBlockMap(RebuildCallback callback, NameServerLog* log) {
+    // Entries are keyed by parent entry id, split the ids into ranges scanned in parallel
+    int64_t max_parent_id = kRootEntryid;
+    leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
+    it->SeekToLast();
+    if (it->Valid()) {
+        int64_t parent_id = 0;
+        std::string filename;
+        DecodingStoreKey(it->key().ToString(), &parent_id, &filename);
+        max_parent_id = std::max(max_parent_id, parent_id);
+    }
+    delete it;
+    int32_t thread_num = std::max(FLAGS_nameserver_rebuild_thread_num, 1);
+    int64_t range_num = std::min<int64_t>(thread_num * 4, max_parent_id);
+    int64_t range_size = (max_parent_id + range_num - 1) / range_num;
+    std::vector<RebuildStat> stats(range_num);
+    common::ThreadPool thread_pool(thread_num);
+    for (int64_t i = 0; i < range_num; i++) {
+        int64_t start_id = 1 + i * range_size;
+        int64_t end_id = std::min(start_id + range_size, max_parent_id + 1);
+        thread_pool.AddTask(std::bind(&NameSpace::RebuildRange, this,
+                                      start_id, end_id, callback, &stats[i]));
+    }
+    thread_pool.Stop(true);
+
     int64_t block_num = 0;
     int64_t file_num = 0;
     int64_t link_num = 0;
     std::set<int64_t> entry_id_set;
+    std::set<int64_t> parent_id_set;
     entry_id_set.insert(root_path_.entry_id());
+    for (size_t i = 0; i < stats.size(); i++) {
+        const RebuildStat& stat = stats[i];
+        block_num += stat.block_num;
+        file_num += stat.file_num;
+        link_num += stat.link_num;
+        if (last_entry_id_ < stat.last_entry_id) {
+            last_entry_id_ = stat.last_entry_id;
+        }
+        if (next_block_id_ < stat.next_block_id) {
+            next_block_id_ = stat.next_block_id;
+            block_id_upbound_ = next_block_id_;
+        }
+        entry_id_set.insert(stat.dirs.begin(), stat.dirs.end());
+        parent_id_set.insert(stat.parents.begin(), stat.parents.end());
+    }
+    std::map<int64_t, int64_t> dir_parents;
+    std::map<int64_t, std::pair<int64_t, int64_t> > dir_usage;
+    for (size_t i = 0; i < stats.size(); i++) {
+        dir_parents.insert(stats[i].dir_parents.begin(), stats[i].dir_parents.end());
+        dir_usage.insert(stats[i].dir_usage.begin(), stats[i].dir_usage.end());
+    }
+    LOG(INFO, "RebuildBlockMap done. %lu directories,  %ld symlinks, %ld files, "
+              "%ld blocks, last_entry_id= E%ld, %ld ranges",
+        entry_id_set.size(), link_num, file_num, block_num, last_entry_id_, range_num);
+    if (FLAGS_check_orphan) {
+        // Entries below trashed directories wait for ReapTrash, they are no orphans
+        std::string prefix = TrashKeyPrefix();
+        leveldb::Iterator* trash_it = db_->NewIterator(leveldb::ReadOptions());
+        for (trash_it->Seek(prefix); trash_it->Valid() && trash_it->key().starts_with(prefix);
+             trash_it->Next()) {
+            entry_id_set.insert(
+                common::util::DecodeBigEndian64(trash_it->key().data() + prefix.size()));
+        }
+        delete trash_it;
+        CheckOrphan(entry_id_set, parent_id_set);
+    }
+    RebuildUsage(dir_parents, dir_usage, log);
+    InitBlockIdUpbound(log);
+    return true;
+}
+
+void NameSpace::RebuildRange(int64_t start_id, int64_t end_id,
+                             RebuildCallback callback, RebuildStat* stat) {
+    std::string start_key;
+    std::string end_key;
+    EncodingStoreKey(start_id, "", &start_key);
+    EncodingStoreKey(end_id, "", &end_key);
+    int32_t batch_size = std::max(FLAGS_nameserver_rebuild_batch_size, 1);
+    std::vector<FileInfo> batch;
+    batch.reserve(batch_size);
+    int64_t last_parent_id = -1;
+    std::pair<int64_t, int64_t>* usage = NULL;
     leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
-    for (it->Seek(std::string(7, '\0') + '\1'); it->Valid(); it->Next()) {
+    for (it->Seek(start_key); it->Valid() && it->key().compare(end_key) < 0; it->Next()) {
         FileInfo file_info;
         bool ret = file_info.ParseFromArray(it->value().data(), it->value().size());
         assert(ret);
-        if (last_entry_id_ < file_info.entry_id()) {
-            last_entry_id_ = file_info.entry_id();
+        // Keys of one directory are adjacent, only look up where the parent changes
+        int64_t parent_id = common::util::DecodeBigEndian64(it->key().data());
+        if (parent_id != last_parent_id) {
+            if (FLAGS_check_orphan) {
+                stat->parents.insert(parent_id);
+            }
+            usage = &stat->dir_usage[parent_id];
+            last_parent_id = parent_id;
+        }
+        ++usage->second;
+        if (stat->last_entry_id < file_info.entry_id()) {
+            stat->last_entry_id = file_info.entry_id();
         }
         FileType file_type = GetFileType(file_info.type());
         if (file_type == kDefault) {
             //a file
             for (int i = 0; i < file_info.blocks_size(); i++) {
-                if (file_info.blocks(i) >= next_block_id_) {
-                    next_block_id_ = file_info.blocks(i) + 1;
-                    block_id_upbound_ = next_block_id_;
+                if (file_info.blocks(i) >= stat->next_block_id) {
+                    stat->next_block_id = file_info.blocks(i) + 1;
                 }
-                ++block_num;
+                ++stat->block_num;
             }
-            ++file_num;
+            ++stat->file_num;
+            usage->first += file_info.size();
             if (callback) {
-                callback(file_info);
+                batch.push_back(file_info);
+                if (static_cast<int32_t>(batch.size()) >= batch_size) {
+                    callback(batch);
+                    batch.clear();
+                }
             }
         } else if (file_type == kSymlink) {
-            ++link_num;
+            ++stat->link_num;
         } else {
-            entry_id_set.insert(file_info.entry_id());
+            stat->dirs.insert(file_info.entry_id());
+            stat->dir_parents[file_info.entry_id()] = parent_id;
         }
     }
-    LOG(INFO, "RebuildBlockMap done. %ld directories,  %ld symlinks, %ld files, "
-              "%lu blocks, last_entry_id= E%ld",
-        entry_id_set.size(), link_num, file_num, block_num, last_entry_id_);
-    if (FLAGS_check_orphan) {
-        std::vector<std::pair<std::string, std::string> > orphan_entrys;
-        for (it->Seek(std::string(7, '\0') + '\1'); it->Valid(); it->Next()) {
+    delete it;
+    if (!batch.empty()) {
+        callback(batch);
+    }
+    LOG(DEBUG, "RebuildRange [E%ld, E%ld) done, %ld files", start_id, end_id, stat->file_num);
+}
+
+void NameSpace::CheckOrphan(const std::set<int64_t>& dirs, const std::set<int64_t>& parents) {
+    std::vector<std::pair<std::string, std::string> > orphan_entrys;
+    leveldb::Iterator* it = db_->NewIterator(leveldb::ReadOptions());
+    for (std::set<int64_t>::const_iterator p = parents.begin(); p != parents.end(); ++p) {
+        if (dirs.find(*p) != dirs.end()) {
+            continue;
+        }
+        // Only the entries under a missing directory are read again
+        std::string start_key;
+        EncodingStoreKey(*p, "", &start_key);
+        for (it->Seek(start_key); it->Valid() && it->key().starts_with(start_key); it->Next()) {
             FileInfo file_info;
             bool ret = file_info.ParseFromArray(it->value().data(), it->value().size());
             assert(ret);
             int64_t parent_entry_id = 0;
             std::string filename;
             DecodingStoreKey(it->key().ToString(), &parent_entry_id, &filename);
-            if (entry_id_set.find(parent_entry_id) == entry_id_set.end()) {
-                LOG(WARNING, "Orphan entry PE%ld E%ld %s",
-                    parent_entry_id, file_info.entry_id(), filename.c_str());
-                orphan_entrys.push_back(std::make_pair(it->key().ToString(),
-                                                       it->value().ToString()));
-            }
+            LOG(WARNING, "Orphan entry PE%ld E%ld %s",
+                parent_entry_id, file_info.entry_id(), filename.c_str());
+            orphan_entrys.push_back(std::make_pair(it->key().ToString(),
+                                                   it->value().ToString()));
         }
-        LOG(INFO, "Check orphan done, %lu entries", orphan_entrys.size());
     }
     delete it;
-    return true;
+    LOG(INFO, "Check orphan done, %lu entries", orphan_entrys.size());
 }
 
 std::string NameSpace::NormalizePath(const std::string& path) {
@@ -758,19 +1394,57 @@ void NameSpace::TailLog(const std::string& logstr) {
     if(!log.ParseFromString(logstr)) {
         LOG(FATAL, "Parse log fail: %s", common::DebugString(logstr).c_str());
     }
+    // A log carries a whole group of mutations from the leader, apply it at once
+    leveldb::WriteBatch batch;
+    // Usage records as stored or as this log wrote them before
+    std::map<std::string, DirUsage> usages;
+    std::string usage_prefix = UsageKeyPrefix();
     for (int i = 0; i < log.entries_size(); i++) {
         const NsLogEntry& entry = log.entries(i);
         int type = entry.type();
-        leveldb::Status s;
-        if (type == kSyncWrite) {
-            s = db_->Put(leveldb::WriteOptions(), entry.key(), entry.value());
-        } else if (type == kSyncDelete) {
-            s = db_->Delete(leveldb::WriteOptions(), entry.key());
+        bool is_usage = entry.key().compare(0, usage_prefix.size(), usage_prefix) == 0;
+        std::map<std::string, DirUsage>::iterator it = usages.end();
+        if (is_usage && type != kSyncDelete) {
+            it = usages.find(entry.key());
+            std::string value;
+            if (it == usages.end()
+                && db_->Get(leveldb::ReadOptions(), entry.key(), &value).ok()) {
+                it = usages.insert(std::make_pair(entry.key(), DirUsage())).first;
+                it->second.ParseFromString(value);
+            }
         }
-        if (!s.ok()) {
-            LOG(FATAL, "TailLog failed");
+        if (type == kSyncWrite && is_usage) {
+            DirUsage usage;
+            usage.ParseFromString(entry.value());
+            // A record logged before the one we have is stale, a replay too
+            if (it != usages.end() && usage.seq() > 0 && usage.seq() <= it->second.seq()) {
+                continue;
+            }
+            usages[entry.key()] = usage;
+        } else if (type == kSyncWrite) {
+            batch.Put(entry.key(), entry.value());
+        } else if (type == kSyncDelete) {
+            batch.Delete(entry.key());
+            usages.erase(entry.key());
+        } else if (type == kSyncAddUsage) {
+            // Only logged by older leaders
+            if (it == usages.end()) {
+                it = usages.insert(std::make_pair(entry.key(), DirUsage())).first;
+            }
+            DirUsage delta;
+            delta.ParseFromString(entry.value());
+            MergeUsage(delta, &it->second);
         }
     }
+    for (std::map<std::string, DirUsage>::iterator it = usages.begin(); it != usages.end(); ++it) {
+        std::string value;
+        it->second.SerializeToString(&value);
+        batch.Put(it->first, value);
+    }
+    leveldb::Status s = db_->Write(leveldb::WriteOptions(), &batch);
+    if (!s.ok()) {
+        LOG(FATAL, "TailLog failed");
+    }
 }
 
 void NameSpace::TailSnapshot(int32_t ns_id, std::string* logstr) {
@@ -8,7 +8,10 @@
 #define  BFS_NAMESPACE_H_
 
 #include <stdint.h>
+#include <map>
+#include <set>
 #include <string>
+#include <vector>
 #include <functional>
 #include <common/mutex.h>
 
@@ -24,22 +27,49 @@ namespace bfs {
 
 class NameSpace {
 public:
+    /// Called with batches of files from several threads at the same time
+    typedef std::function<void (const std::vector<FileInfo>&)> RebuildCallback;
+    /// Directories already looked up by a batch request, by path.
+    /// Only valid while the batch holds the locks of its paths
+    typedef std::map<std::string, FileInfo> DirCache;
     NameSpace(bool standalone = true);
-    void Activate(std::function<void (const FileInfo&)> rebuild_callback, NameServerLog* log);
+    /// Load version and root, metadata can be read after this
+    void Activate(NameServerLog* log);
     ~NameSpace();
     /// List a directory
     StatusCode ListDirectory(const std::string& path,
                       google::protobuf::RepeatedPtrField<FileInfo>* outputs);
+    /// List the directory with entry id 'dir_id', no path is resolved
+    StatusCode ListDirectory(int64_t dir_id,
+                             google::protobuf::RepeatedPtrField<FileInfo>* outputs);
+    /// Entry 'name' of directory 'parent_id', a symlink is returned as is
+    StatusCode Lookup(int64_t parent_id, const std::string& name, FileInfo* info);
     /// Create file by name
     StatusCode CreateFile(const std::string& file_name, int flags, int mode,
                           int replica_num, std::vector<int64_t>* blocks_to_remove,
-                          NameServerLog* log = NULL);
+                          NameServerLog* log = NULL, DirCache* dir_cache = NULL);
     /// Remove file by name
     StatusCode RemoveFile(const std::string& path, FileInfo* file_removed, NameServerLog* log = NULL);
     /// Remove director.
     StatusCode DeleteDirectory(const std::string& path, bool recursive,
                                std::vector<FileInfo>* files_removed, NameServerLog* log = NULL);
+    /// Detach a directory into the trash, ReapTrash deletes what is below it later.
+    /// The usage of the directory is taken off at once
+    StatusCode TrashDirectory(const std::string& path, NameServerLog* log = NULL);
+    /// Delete up to 'max_entries' entries from the trash, files deleted go to
+    /// 'files_removed'. Returns false when the trash is empty
+    bool ReapTrash(int32_t max_entries, std::vector<FileInfo>* files_removed,
+                   NameServerLog* log = NULL);
+    /// Bytes below 'path', read from its usage record
     StatusCode DiskUsage(const std::string& path, uint64_t* du_size);
+    /// Usage and quota of directory 'path'
+    StatusCode GetUsage(const std::string& path, DirUsage* usage);
+    /// Quotas below 0 are left as is, 0 removes a quota
+    StatusCode SetQuota(const std::string& path, int64_t space_quota, int64_t file_quota,
+                        NameServerLog* log = NULL);
+    /// kNotEnoughQuota if 'space' bytes and 'files' entries more under directory
+    /// 'dir_id' go over a quota of it or of a directory above
+    StatusCode CheckQuota(int64_t dir_id, int64_t space, int64_t files);
     /// File rename
     StatusCode Rename(const std::string& old_path,
                       const std::string& new_path,
@@ -52,15 +82,18 @@ public:
                        NameServerLog* log = NULL);
 
     /// Get file
-    bool GetFileInfo(const std::string& path, FileInfo* file_info);
-    /// Update file
+    bool GetFileInfo(const std::string& path, FileInfo* file_info,
+                     DirCache* dir_cache = NULL);
+    /// Update file, a change of size goes to the usage of the directories above.
+    /// 'file_info' needs its parent_entry_id, as returned by GetFileInfo
     bool UpdateFileInfo(const FileInfo& file_info, NameServerLog* log = NULL);
     /// Delete file
     bool DeleteFileInfo(const std::string file_key, NameServerLog* log = NULL);
     /// Namespace version
     int64_t Version() const;
-    /// Rebuild blockmap
-    bool RebuildBlockMap(std::function<void (const FileInfo&)> callback);
+    /// Rebuild blockmap, scan key ranges in parallel and hand files to callback.
+    /// New block ids can be allocated after this
+    bool RebuildBlockMap(RebuildCallback callback, NameServerLog* log);
     /// NormalizePath
     static std::string NormalizePath(const std::string& path);
     /// ha - tail log from leader/master
@@ -78,10 +111,27 @@ private:
         kDir = 1,
         kSymlink = 2,
     };
+    /// Usage changes by directory entry id
+    typedef std::map<int64_t, DirUsage> UsageDelta;
+    struct RebuildStat {
+        int64_t file_num;
+        int64_t link_num;
+        int64_t block_num;
+        int64_t last_entry_id;
+        int64_t next_block_id;
+        std::set<int64_t> dirs;
+        std::set<int64_t> parents;
+        /// Parent of every directory
+        std::map<int64_t, int64_t> dir_parents;
+        /// Usage of the entries right under every directory
+        std::map<int64_t, std::pair<int64_t, int64_t> > dir_usage;
+        RebuildStat() : file_num(0), link_num(0), block_num(0),
+                        last_entry_id(0), next_block_id(0) {}
+    };
     FileType GetFileType(int type) const;
     bool GetLinkSrcPath(const FileInfo& info, FileInfo* src_info);
     StatusCode BuildPath(const std::string& path, FileInfo* file_info, std::string* fname,
-                                NameServerLog* log = NULL);
+                                NameServerLog* log = NULL, DirCache* dir_cache = NULL);
     static void EncodingStoreKey(int64_t entry_id,
                           const std::string& path,
                           std::string* key_str);
@@ -90,16 +140,37 @@ private:
                                  std::string* path);
     bool GetFromStore(const std::string& key, FileInfo* info);
     void SetupRoot();
-    bool LookUp(const std::string& path, FileInfo* info);
+    bool LookUp(const std::string& path, FileInfo* info, DirCache* dir_cache = NULL);
     bool LookUp(int64_t pid, const std::string& name, FileInfo* info);
     StatusCode InternalDeleteDirectory(const FileInfo& dir_info,
                                 bool recursive,
                                 std::vector<FileInfo>* files_removed,
                                 NameServerLog* log);
+    void ListEntries(int64_t dir_id, google::protobuf::RepeatedPtrField<FileInfo>* outputs);
+    /// Whether directory 'dir_id' exists and is not in the trash
+    bool IsLiveDir(int64_t dir_id);
     StatusCode InternalComputeDiskUsage(const FileInfo& info, uint64_t* du_size);
+    static void EncodingUsageKey(int64_t entry_id, std::string* key_str);
+    static void EncodingTrashKey(int64_t entry_id, std::string* key_str);
+    bool GetUsage(int64_t entry_id, DirUsage* usage);
+    /// Add 'space' and 'files' to directory 'dir_id' and every directory above it
+    void AddUsage(int64_t dir_id, int64_t space, int64_t files, UsageDelta* delta);
+    /// Apply 'delta' to the usage records, with check_quota nothing is changed
+    /// if a directory that grows goes over its quota
+    StatusCode UpdateUsage(const UsageDelta& delta, bool check_quota, NameServerLog* log);
+    static void MergeUsage(const DirUsage& delta, DirUsage* usage);
+    /// Sum up the usage of every directory after a full scan, fix records that differ
+    void RebuildUsage(const std::map<int64_t, int64_t>& dir_parents,
+                      const std::map<int64_t, std::pair<int64_t, int64_t> >& dir_usage,
+                      NameServerLog* log);
     uint32_t EncodeLog(NameServerLog* log, int32_t type,
                        const std::string& key, const std::string& value);
     void InitBlockIdUpbound(NameServerLog* log);
+    /// Scan entries whose parent id is in [start_id, end_id)
+    void RebuildRange(int64_t start_id, int64_t end_id,
+                      RebuildCallback callback, RebuildStat* stat);
+    /// Log entries whose parent directory does not exist
+    void CheckOrphan(const std::set<int64_t>& dirs, const std::set<int64_t>& parents);
     void UpdateBlockIdUpbound(NameServerLog* log);
 private:
     leveldb::DB* db_;   /// NameSpace storage
@@ -110,6 +181,10 @@ private:
     int64_t block_id_upbound_;
     int64_t next_block_id_;
     Mutex mu_;
+    /// Serializes read-modify-write of usage records
+    Mutex usage_mu_;
+    /// Serializes ReapTrash
+    Mutex trash_mu_;
 
     /// HA module
     std::map<int32_t, leveldb::Iterator*> snapshot_tasks_;
@@ -55,6 +55,18 @@ std::string RaftImpl::GetStatus() {
     }
 }
 
+int64_t RaftImpl::GetAppliedIndex() {
+    return raft_node_->GetAppliedIndex();
+}
+
+int64_t RaftImpl::GetLeaderLag(int32_t max_delay_ms) {
+    return raft_node_->GetLeaderLag(max_delay_ms);
+}
+
+bool RaftImpl::GetReadIndex(int64_t* read_index) {
+    return raft_node_->GetReadIndex(read_index);
+}
+
 google::protobuf::Service* RaftImpl::GetService() {
     return raft_node_;
 }
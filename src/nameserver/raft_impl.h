@@ -32,6 +32,9 @@ public:
     void Log(const std::string& entry, std::function<void (bool)> callback);
     void SwitchToLeader() {}
     std::string GetStatus();
+    int64_t GetAppliedIndex();
+    int64_t GetLeaderLag(int32_t max_delay_ms);
+    bool GetReadIndex(int64_t* read_index);
 public:
     google::protobuf::Service* GetService();
 private:
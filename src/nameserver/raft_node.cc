@@ -6,6 +6,7 @@
 
 #include "nameserver/raft_node.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <gflags/gflags.h>
@@ -16,6 +17,8 @@
 
 #include "rpc/rpc_client.h"
 
+DECLARE_int32(follower_read_index_timeout);
+
 namespace baidu {
 namespace bfs {
 
@@ -23,7 +26,8 @@ RaftNodeImpl::RaftNodeImpl(const std::string& raft_nodes,
                            int node_index, int election_timeout,
                            const std::string& db_path)
     : current_term_(0), log_index_(0), log_term_(0), commit_index_(0),
-      last_applied_(0), applying_(false), node_stop_(false), election_taskid_(-1),
+      last_applied_(0), applying_(false), node_stop_(false),
+      term_start_index_(0), last_contact_(0), apply_cond_(&mu_), election_taskid_(-1),
       election_timeout_(election_timeout), node_state_(kFollower) {
     common::SplitString(raft_nodes, ",", &nodes_);
     if (nodes_.size() < 1U || static_cast<int>(nodes_.size()) <= node_index) {
@@ -193,6 +197,7 @@ void RaftNodeImpl::ElectionCallback(const VoteRequest* request,
         LOG(INFO, "Change state to Leader, term %ld index %ld commit %ld applied %ld",
             current_term_, log_index_, commit_index_, last_applied_);
         StoreLog(current_term_, ++log_index_, "", kRaftCmd);
+        term_start_index_ = log_index_;
         for (uint32_t i = 0;i < follower_context_.size(); i++) {
             if (nodes_[i] != self_) {
                 follower_context_[i]->match_index = 0;
@@ -331,6 +336,7 @@ void RaftNodeImpl::ReplicateLogForNode(uint32_t id) {
     }
     RaftNode_Stub* node;
     rpc_client_->GetStub(nodes_[id], &node);
+    int64_t send_time = common::timer::get_micros();
     bool ret = rpc_client_->SendRequest(node, &RaftNode_Stub::AppendEntries,
                                         request.get(), response.get(), 1, 1);
     LOG(INFO, "Replicate %d entrys to %s return %d",
@@ -342,6 +348,7 @@ void RaftNodeImpl::ReplicateLogForNode(uint32_t id) {
         int64_t term = response->term();
         if (CheckTerm(term)) {
             if (response->success()) {
+                follower->ack_time = send_time;
                 if (max_index && max_term == current_term_) {
                     follower->match_index = max_index;
                     follower->next_index = max_index + 1;
@@ -383,6 +390,7 @@ void RaftNodeImpl::ReplicateLogForNode(uint32_t id) {
                         if (last_applied_ == commit_index) {
                             StoreContext("last_applied", last_applied_);
                         }
+                        apply_cond_.Broadcast();
                     }
                 }
             } else {
@@ -518,6 +526,7 @@ void RaftNodeImpl::ApplyLog() {
     LOG(INFO, "Apply to %ld", last_applied_);
     StoreContext("last_applied", last_applied_);
     applying_ = false;
+    apply_cond_.Broadcast();
 }
 
 void RaftNodeImpl::AppendEntries(::google::protobuf::RpcController* controller,
@@ -538,6 +547,7 @@ void RaftNodeImpl::AppendEntries(::google::protobuf::RpcController* controller,
         node_state_ = kFollower;
     }
     leader_ = request->leader();
+    last_contact_ = common::timer::get_micros();
     ResetElection();
     int64_t prev_log_term = request->prev_log_term();
     int64_t prev_log_index = request->prev_log_index();
@@ -599,6 +609,93 @@ void RaftNodeImpl::AppendEntries(::google::protobuf::RpcController* controller,
 }
 
 
+bool RaftNodeImpl::HasLease() {
+    mu_.AssertHeld();
+    int64_t lease_start = common::timer::get_micros() - election_timeout_ * 1000L;
+    uint32_t acked = 1;
+    for (uint32_t i = 0; i < follower_context_.size(); i++) {
+        if (follower_context_[i] && follower_context_[i]->ack_time > lease_start) {
+            ++acked;
+        }
+    }
+    return acked >= nodes_.size() / 2 + 1;
+}
+
+void RaftNodeImpl::ReadIndex(::google::protobuf::RpcController* controller,
+                             const ::baidu::bfs::ReadIndexRequest* request,
+                             ::baidu::bfs::ReadIndexResponse* response,
+                             ::google::protobuf::Closure* done) {
+    MutexLock lock(&mu_);
+    // Entries of former terms are only known committed after the first one of this term
+    if (node_state_ != kLeader || commit_index_ < term_start_index_ || !HasLease()) {
+        LOG(INFO, "[Raft] Reject ReadIndex from %s, state %d commit %ld term start %ld",
+            request->follower().c_str(), node_state_, commit_index_, term_start_index_);
+        response->set_success(false);
+        done->Run();
+        return;
+    }
+    response->set_success(true);
+    response->set_read_index(commit_index_);
+    done->Run();
+    // Push the commit index to the follower now instead of at the next heartbeat
+    for (uint32_t i = 0; i < nodes_.size(); i++) {
+        if (nodes_[i] == request->follower() && follower_context_[i]) {
+            follower_context_[i]->condition.Signal();
+        }
+    }
+}
+
+int64_t RaftNodeImpl::GetAppliedIndex() {
+    MutexLock lock(&mu_);
+    return last_applied_;
+}
+
+int64_t RaftNodeImpl::GetLeaderLag(int32_t max_delay_ms) {
+    MutexLock lock(&mu_);
+    if (node_state_ == kLeader) {
+        return 0;
+    }
+    if (last_contact_ + max_delay_ms * 1000L < common::timer::get_micros()) {
+        return -1;
+    }
+    return std::max(commit_index_ - last_applied_, 0L);
+}
+
+bool RaftNodeImpl::GetReadIndex(int64_t* read_index) {
+    std::string leader;
+    {
+        MutexLock lock(&mu_);
+        if (node_state_ == kLeader || leader_.empty()) {
+            return false;
+        }
+        leader = leader_;
+    }
+    ReadIndexRequest request;
+    ReadIndexResponse response;
+    request.set_follower(self_);
+    RaftNode_Stub* node;
+    rpc_client_->GetStub(leader, &node);
+    bool ret = rpc_client_->SendRequest(node, &RaftNode_Stub::ReadIndex,
+                                        &request, &response, 1, 1);
+    delete node;
+    if (!ret || !response.success()) {
+        return false;
+    }
+    int64_t index = response.read_index();
+    int64_t deadline = common::timer::get_micros() + FLAGS_follower_read_index_timeout * 1000L;
+    MutexLock lock(&mu_);
+    while (last_applied_ < index) {
+        int64_t remaining = (deadline - common::timer::get_micros()) / 1000;
+        if (remaining <= 0) {
+            LOG(INFO, "[Raft] Apply read index %ld timeout", index);
+            return false;
+        }
+        apply_cond_.TimeWait(remaining, "ReadIndex");
+    }
+    *read_index = index;
+    return true;
+}
+
 void RaftNodeImpl::Init(std::function<void (const std::string& log)> callback,
                         std::function<void (int32_t, std::string*)> /*snapshot_callback*/) {
     log_callback_ = callback;
@@ -45,8 +45,15 @@ public:
                        const ::baidu::bfs::AppendEntriesRequest* request,
                        ::baidu::bfs::AppendEntriesResponse* response,
                        ::google::protobuf::Closure* done);
+    void ReadIndex(::google::protobuf::RpcController* controller,
+                   const ::baidu::bfs::ReadIndexRequest* request,
+                   ::baidu::bfs::ReadIndexResponse* response,
+                   ::google::protobuf::Closure* done);
 public:
     bool GetLeader(std::string* leader);
+    int64_t GetAppliedIndex();
+    int64_t GetLeaderLag(int32_t max_delay_ms);
+    bool GetReadIndex(int64_t* read_index);
     void AppendLog(const std::string& log, std::function<void (bool)> callback);
     bool AppendLog(const std::string& log, int timeout_ms = 10000);
     void Init(std::function<void (const std::string& log)> callback,
@@ -70,6 +77,9 @@ private:
                           const std::string& node_addr);
     bool StoreLog(int64_t term, int64_t index, const std::string& log, LogType type = kUserLog);
     void ApplyLog();
+    /// Majority of followers acked within an election timeout, none of them votes for
+    /// another leader before it runs out
+    bool HasLease();
 
     std::string LoadVoteFor();
     void SetVeteFor(const std::string& votefor);
@@ -92,16 +102,21 @@ private:
     bool applying_;             /// ύ״̬
 
     bool node_stop_;
+    int64_t term_start_index_;  /// first log of this leader's term
+    int64_t last_contact_;      /// last AppendEntries from leader
     struct FollowerContext {
         int64_t next_index;
         int64_t match_index;
+        int64_t ack_time;       /// send time of the last AppendEntries it accepted
         common::ThreadPool worker;
         common::CondVar condition;
-        FollowerContext(Mutex* mu) : next_index(0), match_index(0), worker(1), condition(mu) {}
+        FollowerContext(Mutex* mu) : next_index(0), match_index(0), ack_time(0),
+                                     worker(1), condition(mu) {}
     };
     std::vector<FollowerContext*> follower_context_;
 
     Mutex mu_;
+    common::CondVar apply_cond_;    /// last_applied_ moved forward
     common::ThreadPool*  thread_pool_;
     RpcClient*   rpc_client_;
     std::set<std::string> voted_;   /// ˭Ͷ
@@ -0,0 +1,175 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "nameserver/rpc_scheduler.h"
+
+#include <assert.h>
+#include <algorithm>
+
+#include <common/logging.h>
+
+namespace baidu {
+namespace bfs {
+
+/// Pass a lane advances by per task, divided by its weight
+static const int64_t kStride = 1L << 20;
+
+RpcScheduler::RpcScheduler() : client_max_pending_(0) {
+    for (int i = 0; i < kLaneNum; i++) {
+        Lane& lane = lanes_[i];
+        lane.thread_pool = NULL;
+        lane.weight = 1;
+        lane.max_pending = 0;
+        lane.pending = 0;
+        lane.pass = 0;
+        lane.done = 0;
+        lane.rejected = 0;
+    }
+}
+
+void RpcScheduler::SetLane(RpcLane lane, ThreadPool* thread_pool,
+                           int32_t weight, int32_t max_pending) {
+    MutexLock lock(&mu_);
+    lanes_[lane].thread_pool = thread_pool;
+    lanes_[lane].weight = std::max(weight, 1);
+    lanes_[lane].max_pending = IsClientLane(lane) ? max_pending : 0;
+}
+
+bool RpcScheduler::SetLaneParam(const std::string& name, int32_t weight, int32_t max_pending) {
+    MutexLock lock(&mu_);
+    for (int i = 0; i < kLaneNum; i++) {
+        if (name != LaneName(static_cast<RpcLane>(i))) {
+            continue;
+        }
+        if (max_pending > 0 && !IsClientLane(static_cast<RpcLane>(i))) {
+            LOG(WARNING, "Rpc lane %s can not be bounded", name.c_str());
+            return false;
+        }
+        if (weight > 0) {
+            lanes_[i].weight = weight;
+        }
+        if (max_pending >= 0) {
+            lanes_[i].max_pending = max_pending;
+        }
+        LOG(INFO, "Rpc lane %s weight %d max_pending %d",
+            name.c_str(), lanes_[i].weight, lanes_[i].max_pending);
+        return true;
+    }
+    return false;
+}
+
+void RpcScheduler::SetClientMaxPending(int32_t max_pending) {
+    MutexLock lock(&mu_);
+    client_max_pending_ = max_pending;
+}
+
+bool RpcScheduler::AddTask(RpcLane lane_id, const std::string& client,
+                           const std::function<void ()>& task) {
+    ThreadPool* thread_pool = NULL;
+    {
+        MutexLock lock(&mu_);
+        Lane& lane = lanes_[lane_id];
+        assert(lane.thread_pool);
+        if (lane.max_pending > 0 && lane.pending >= lane.max_pending) {
+            ++lane.rejected;
+            return false;
+        }
+        std::deque<std::function<void ()> >& queue = lane.clients[client];
+        if (lane.max_pending > 0 && client_max_pending_ > 0
+            && static_cast<int32_t>(queue.size()) >= client_max_pending_) {
+            ++lane.rejected;
+            return false;
+        }
+        if (queue.empty()) {
+            lane.turns.push_back(client);
+        }
+        if (lane.pending == 0) {
+            // An idle lane does not save up its share
+            lane.pass = std::max(lane.pass, pass_[lane.thread_pool]);
+        }
+        queue.push_back(task);
+        ++lane.pending;
+        thread_pool = lane.thread_pool;
+    }
+    // One RunTask for every queued task, it picks whichever task is due
+    thread_pool->AddTask(std::bind(&RpcScheduler::RunTask, this, thread_pool));
+    return true;
+}
+
+void RpcScheduler::RunTask(ThreadPool* thread_pool) {
+    std::function<void ()> task;
+    {
+        MutexLock lock(&mu_);
+        Lane* lane = NULL;
+        for (int i = 0; i < kLaneNum; i++) {
+            Lane& l = lanes_[i];
+            if (l.thread_pool == thread_pool && l.pending > 0
+                && (lane == NULL || l.pass < lane->pass)) {
+                lane = &l;
+            }
+        }
+        assert(lane);
+        pass_[thread_pool] = lane->pass;
+        lane->pass += kStride / lane->weight;
+        std::string client = lane->turns.front();
+        lane->turns.pop_front();
+        std::map<std::string, std::deque<std::function<void ()> > >::iterator it =
+            lane->clients.find(client);
+        task.swap(it->second.front());
+        it->second.pop_front();
+        if (it->second.empty()) {
+            lane->clients.erase(it);
+        } else {
+            lane->turns.push_back(client);
+        }
+        --lane->pending;
+        ++lane->done;
+    }
+    task();
+}
+
+void RpcScheduler::GetStat(std::vector<RpcLaneStat>* stats) {
+    MutexLock lock(&mu_);
+    for (int i = 0; i < kLaneNum; i++) {
+        const Lane& lane = lanes_[i];
+        RpcLaneStat stat;
+        stat.name = LaneName(static_cast<RpcLane>(i));
+        stat.weight = lane.weight;
+        stat.max_pending = lane.max_pending;
+        stat.pending = lane.pending;
+        stat.clients = lane.clients.size();
+        stat.done = lane.done;
+        stat.rejected = lane.rejected;
+        stats->push_back(stat);
+    }
+}
+
+bool RpcScheduler::IsClientLane(RpcLane lane) {
+    return lane == kLaneRead || lane == kLaneMeta || lane == kLaneBlock;
+}
+
+const char* RpcScheduler::LaneName(RpcLane lane) {
+    switch (lane) {
+        case kLaneRead:
+            return "read";
+        case kLaneMeta:
+            return "meta";
+        case kLaneBlock:
+            return "block";
+        case kLaneChunkServer:
+            return "chunkserver";
+        case kLaneHeartBeat:
+            return "heartbeat";
+        case kLaneBlockReport:
+            return "report";
+        default:
+            return "unknown";
+    }
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
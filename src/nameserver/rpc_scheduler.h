@@ -0,0 +1,93 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_NAMESERVER_RPC_SCHEDULER_H_
+#define  BFS_NAMESERVER_RPC_SCHEDULER_H_
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <common/mutex.h>
+#include <common/thread_pool.h>
+
+namespace baidu {
+namespace bfs {
+
+enum RpcLane {
+    kLaneRead = 0,          // metadata reads
+    kLaneMeta = 1,          // namespace mutations
+    kLaneBlock = 2,         // AddBlock/SyncBlock/FinishBlock of open files
+    kLaneChunkServer = 3,   // Register/BlockReceived/PushBlockReport
+    kLaneHeartBeat = 4,
+    kLaneBlockReport = 5,
+    kLaneNum = 6,
+};
+
+struct RpcLaneStat {
+    std::string name;
+    int32_t weight;
+    int32_t max_pending;
+    int32_t pending;
+    int32_t clients;
+    int64_t done;
+    int64_t rejected;
+};
+
+/// Admission control and weighted fair queueing of rpcs in front of the thread pools.
+/// Every lane has a bounded queue and is served by one thread pool, lanes sharing a
+/// pool get its threads in proportion to their weights. Inside a lane the client
+/// hosts take turns, so a flood from one host only delays that host.
+class RpcScheduler {
+public:
+    RpcScheduler();
+    /// Serve 'lane' by 'thread_pool', max_pending <= 0 means unbounded.
+    /// Chunkserver lanes are always unbounded, see IsClientLane
+    void SetLane(RpcLane lane, ThreadPool* thread_pool, int32_t weight, int32_t max_pending);
+    /// Change the weight and bound of a lane at runtime. weight <= 0 and
+    /// max_pending < 0 are left as is, max_pending 0 is unbounded.
+    /// False if the lane is unknown or a chunkserver lane would be bounded
+    bool SetLaneParam(const std::string& name, int32_t weight, int32_t max_pending);
+    /// Max tasks a client host may have queued in a bounded lane
+    void SetClientMaxPending(int32_t max_pending);
+    /// Queue 'task', false if the lane or the client's share of it is full
+    bool AddTask(RpcLane lane, const std::string& client, const std::function<void ()>& task);
+    void GetStat(std::vector<RpcLaneStat>* stats);
+    static const char* LaneName(RpcLane lane);
+    /// Only lanes of client rpcs may be bounded, chunkservers do not retry
+    /// BlockReceived and PushBlockReport on kOverload
+    static bool IsClientLane(RpcLane lane);
+private:
+    /// One thread of 'thread_pool' runs the next task of its lanes
+    void RunTask(ThreadPool* thread_pool);
+private:
+    struct Lane {
+        ThreadPool* thread_pool;
+        int32_t weight;
+        int32_t max_pending;
+        int32_t pending;
+        int64_t pass;
+        int64_t done;
+        int64_t rejected;
+        std::map<std::string, std::deque<std::function<void ()> > > clients;
+        /// Clients with queued tasks, in the order they are served
+        std::deque<std::string> turns;
+    };
+    Mutex mu_;
+    Lane lanes_[kLaneNum];
+    int32_t client_max_pending_;
+    /// Pass of the last task run by each pool, its lanes waking up start from here
+    std::map<ThreadPool*, int64_t> pass_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_NAMESERVER_RPC_SCHEDULER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,203 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "nameserver/rpc_stats.h"
+
+#include <string.h>
+
+#include <common/atomic.h>
+#include <common/timer.h>
+
+namespace baidu {
+namespace bfs {
+
+namespace {
+
+/// The RPC served by this thread, see RpcStats::BeginRpc
+__thread RpcStats* t_stats = NULL;
+__thread int32_t t_method = 0;
+__thread int64_t t_stage_time[kRpcStageNum];
+__thread int32_t t_stage_depth[kRpcStageNum];
+__thread bool t_stage_used[kRpcStageNum];
+
+class RpcDone : public google::protobuf::Closure {
+public:
+    RpcDone(RpcStats* stats, int32_t method, int64_t recv_time, google::protobuf::Closure* done)
+        : stats_(stats), method_(method), recv_time_(recv_time), done_(done) {}
+    void Run() {
+        stats_->Add(method_, kRpcTotal, common::timer::get_micros() - recv_time_);
+        done_->Run();
+        delete this;
+    }
+private:
+    RpcStats* stats_;
+    int32_t method_;
+    int64_t recv_time_;
+    google::protobuf::Closure* done_;
+};
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram() : count_(0), sum_(0), max_(0) {
+    memset(const_cast<int64_t*>(buckets_), 0, sizeof(buckets_));
+}
+
+int32_t LatencyHistogram::BucketOf(int64_t latency) {
+    if (latency < 8) {
+        return latency < 0 ? 0 : latency;
+    }
+    int32_t msb = 63 - __builtin_clzll(latency);
+    int32_t sub = (latency >> (msb - 3)) & 7;
+    int32_t bucket = (msb - 2) * 8 + sub;
+    return bucket < kBucketNum ? bucket : kBucketNum - 1;
+}
+
+int64_t LatencyHistogram::BucketUpperBound(int32_t bucket) {
+    if (bucket < 8) {
+        return bucket;
+    }
+    int32_t msb = bucket / 8 + 2;
+    int64_t width = 1L << (msb - 3);
+    return (8 + bucket % 8) * width + width - 1;
+}
+
+void LatencyHistogram::Add(int64_t latency) {
+    if (latency < 0) {
+        latency = 0;
+    }
+    common::atomic_add64(&buckets_[BucketOf(latency)], 1);
+    common::atomic_add64(&count_, 1);
+    common::atomic_add64(&sum_, latency);
+    int64_t max = max_;
+    while (latency > max) {
+        int64_t old = common::atomic_comp_swap(&max_, latency, max);
+        if (old == max) {
+            break;
+        }
+        max = old;
+    }
+}
+
+int64_t LatencyHistogram::Average() const {
+    int64_t count = count_;
+    return count ? sum_ / count : 0;
+}
+
+int64_t LatencyHistogram::Percentile(double percentile) const {
+    int64_t count = count_;
+    if (count == 0) {
+        return 0;
+    }
+    int64_t rank = static_cast<int64_t>(count * percentile / 100);
+    int64_t seen = 0;
+    for (int32_t i = 0; i < kBucketNum; i++) {
+        seen += buckets_[i];
+        if (seen > rank) {
+            return BucketUpperBound(i);
+        }
+    }
+    return max_;
+}
+
+RpcStats::RpcStats(const google::protobuf::ServiceDescriptor* service) {
+    for (int i = 0; i < service->method_count(); i++) {
+        method_names_.push_back(service->method(i)->name());
+        for (int j = 0; j < kRpcStageNum; j++) {
+            histograms_.push_back(new LatencyHistogram);
+        }
+    }
+}
+
+RpcStats::~RpcStats() {
+    for (size_t i = 0; i < histograms_.size(); i++) {
+        delete histograms_[i];
+    }
+}
+
+void RpcStats::BeginRpc(int32_t method, int64_t recv_time, google::protobuf::Closure** done) {
+    t_stats = this;
+    t_method = method;
+    for (int i = 0; i < kRpcStageNum; i++) {
+        t_stage_time[i] = 0;
+        t_stage_depth[i] = 0;
+        t_stage_used[i] = false;
+    }
+    Add(method, kRpcQueue, common::timer::get_micros() - recv_time);
+    *done = new RpcDone(this, method, recv_time, *done);
+}
+
+void RpcStats::EndRpc() {
+    // Only RPCs that took locks or touched the namespace count for these
+    if (t_stage_used[kRpcLock]) {
+        Add(t_method, kRpcLock, t_stage_time[kRpcLock]);
+    }
+    if (t_stage_used[kRpcNamespace]) {
+        Add(t_method, kRpcNamespace, t_stage_time[kRpcNamespace]);
+    }
+    t_stats = NULL;
+}
+
+std::function<void (bool)> RpcStats::TimeSync(std::function<void (bool)> callback) {
+    if (t_stats != this) {
+        return callback;
+    }
+    return std::bind(&RpcStats::SyncDone, this, t_method, common::timer::get_micros(),
+                     callback, std::placeholders::_1);
+}
+
+void RpcStats::SyncDone(int32_t method, int64_t start,
+                        std::function<void (bool)> callback, bool ret) {
+    Add(method, kRpcSync, common::timer::get_micros() - start);
+    callback(ret);
+}
+
+void RpcStats::Add(int32_t method, RpcStage stage, int64_t latency) {
+    histograms_[method * kRpcStageNum + stage]->Add(latency);
+}
+
+const LatencyHistogram& RpcStats::Get(int32_t method, RpcStage stage) const {
+    return *histograms_[method * kRpcStageNum + stage];
+}
+
+const char* RpcStats::StageName(RpcStage stage) {
+    switch (stage) {
+        case kRpcQueue:
+            return "queue";
+        case kRpcLock:
+            return "lock";
+        case kRpcNamespace:
+            return "namespace";
+        case kRpcSync:
+            return "sync";
+        case kRpcTotal:
+            return "total";
+        default:
+            return "unknown";
+    }
+}
+
+void RpcStats::AddToCurrent(RpcStage stage, int64_t latency) {
+    if (t_stats) {
+        t_stage_time[stage] += latency;
+        t_stage_used[stage] = true;
+    }
+}
+
+RpcStageTimer::RpcStageTimer(RpcStage stage) : stage_(stage), start_(-1) {
+    if (t_stats && t_stage_depth[stage]++ == 0) {
+        start_ = common::timer::get_micros();
+    }
+}
+
+RpcStageTimer::~RpcStageTimer() {
+    if (t_stats && --t_stage_depth[stage_] == 0 && start_ >= 0) {
+        RpcStats::AddToCurrent(stage_, common::timer::get_micros() - start_);
+    }
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,94 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_NAMESERVER_RPC_STATS_H_
+#define  BFS_NAMESERVER_RPC_STATS_H_
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/service.h>
+
+namespace baidu {
+namespace bfs {
+
+/// Log-linear latency histogram in us, 8 buckets per power of two, so a
+/// percentile is off by at most 12.5%. Add() is lock free.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void Add(int64_t latency);
+    int64_t Count() const { return count_; }
+    int64_t Average() const;
+    int64_t Max() const { return max_; }
+    /// Upper bound of the bucket holding the 'percentile'th sample, 0 if empty
+    int64_t Percentile(double percentile) const;
+    static int32_t BucketOf(int64_t latency);
+    static int64_t BucketUpperBound(int32_t bucket);
+    static const int32_t kBucketNum = 320;
+private:
+    volatile int64_t buckets_[kBucketNum];
+    volatile int64_t count_;
+    volatile int64_t sum_;
+    volatile int64_t max_;
+};
+
+enum RpcStage {
+    kRpcQueue = 0,      // waiting in the thread pool
+    kRpcLock = 1,       // waiting for file locks
+    kRpcNamespace = 2,  // in NameSpace, mostly leveldb
+    kRpcSync = 3,       // replicating the log
+    kRpcTotal = 4,      // from receipt to response
+    kRpcStageNum = 5,
+};
+
+/// Latency of every stage of every method of a service.
+/// The RPC a thread is serving is kept thread local, so locks and NameSpace
+/// time themselves with RpcStageTimer without knowing about the RPC.
+class RpcStats {
+public:
+    RpcStats(const google::protobuf::ServiceDescriptor* service);
+    ~RpcStats();
+    /// Run 'method' on this thread, stages timed meanwhile go to it.
+    /// 'done' is replaced by a closure that records the total time
+    void BeginRpc(int32_t method, int64_t recv_time, google::protobuf::Closure** done);
+    void EndRpc();
+    /// Wrap 'callback' to record the time until it is called as kRpcSync
+    /// of the RPC running on this thread
+    std::function<void (bool)> TimeSync(std::function<void (bool)> callback);
+    void Add(int32_t method, RpcStage stage, int64_t latency);
+    const LatencyHistogram& Get(int32_t method, RpcStage stage) const;
+    int32_t MethodNum() const { return method_names_.size(); }
+    const std::string& MethodName(int32_t method) const { return method_names_[method]; }
+    static const char* StageName(RpcStage stage);
+    /// Add time spent in 'stage' to the RPC running on this thread
+    static void AddToCurrent(RpcStage stage, int64_t latency);
+private:
+    void SyncDone(int32_t method, int64_t start, std::function<void (bool)> callback, bool ret);
+private:
+    std::vector<std::string> method_names_;
+    std::vector<LatencyHistogram*> histograms_;
+};
+
+/// Time the scope as 'stage' of the RPC running on this thread,
+/// nested timers of the same stage count once
+class RpcStageTimer {
+public:
+    RpcStageTimer(RpcStage stage);
+    ~RpcStageTimer();
+private:
+    RpcStage stage_;
+    int64_t start_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_NAMESERVER_RPC_STATS_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -6,6 +6,7 @@
 #ifndef  BFS_NAMESERVER_SYNC_H_
 #define  BFS_NAMESERVER_SYNC_H_
 
+#include <stdint.h>
 #include <string>
 #include <functional>
 
@@ -53,6 +54,16 @@ public:
     virtual void SwitchToLeader() = 0;
     // Return ha status.
     virtual std::string GetStatus() = 0;
+    // Description: Index of the last log applied to the local namespace.
+    virtual int64_t GetAppliedIndex() = 0;
+    // Description: Follower only. Number of logs the leader has and this follower
+    // has not applied, -1 if the leader has not been heard of for 'max_delay_ms'.
+    // Leader returns 0.
+    virtual int64_t GetLeaderLag(int32_t max_delay_ms) = 0;
+    // Description: Follower only. Get the leader's commit index, confirmed by its
+    // lease, and wait until it is applied locally. Reads served after this see all
+    // logs committed before the call. Return false if not supported or not in time.
+    virtual bool GetReadIndex(int64_t* read_index) = 0;
 };
 
 } // namespace bfs
@@ -94,6 +94,44 @@ TEST_F(BlockMappingTest, DoNotRemoteHigherVersionBlock) {
     ASSERT_TRUE(ret);
 }
 
+TEST_F(BlockMappingTest, RemoveRedundantReplica) {
+    BlockMapping* bm = new BlockMapping(&thread_pool);
+    int64_t block_id = 1;
+    bm->RebuildBlock(block_id, 3, 0, 1024);
+    for (int32_t cs = 1; cs <= 3; ++cs) {
+        ASSERT_TRUE(bm->UpdateBlockInfo(block_id, cs, 1024, 0));
+    }
+    // Target not reported yet
+    ASSERT_FALSE(bm->RemoveRedundantReplica(block_id, 1, 4));
+    ASSERT_TRUE(bm->UpdateBlockInfo(block_id, 4, 1024, 0));
+    ASSERT_TRUE(bm->RemoveRedundantReplica(block_id, 1, 4));
+    NSBlock block;
+    ASSERT_TRUE(bm->GetBlock(block_id, &block));
+    ASSERT_EQ(block.replica.size(), 3U);
+    ASSERT_TRUE(block.replica.find(1) == block.replica.end());
+    // Never below the expected replica num
+    ASSERT_FALSE(bm->RemoveRedundantReplica(block_id, 2, 4));
+}
+
+TEST_F(BlockMappingTest, PickRecoverBlocksByBytes) {
+    BlockMapping* bm = new BlockMapping(&thread_pool);
+    for (int64_t id = 1; id <= 10; ++id) {
+        bm->RebuildBlock(id, 3, 0, 100);
+        ASSERT_TRUE(bm->UpdateBlockInfo(id, 1, 100, 0));
+        ASSERT_TRUE(bm->UpdateBlockInfo(id, 2, 100, 0));
+    }
+    ASSERT_EQ(bm->lo_pri_recover_.size(), 10U);
+    std::vector<std::pair<int64_t, std::set<int32_t> > > blocks;
+    int64_t quota = 250;
+    bm->PickRecoverBlocks(1, 100, &quota, &blocks, kLow);
+    ASSERT_EQ(blocks.size(), 3U);
+    ASSERT_EQ(quota, -50);
+    // No budget left, nothing picked
+    blocks.clear();
+    bm->PickRecoverBlocks(2, 100, &quota, &blocks, kLow);
+    ASSERT_TRUE(blocks.empty());
+}
+
 TEST_F(BlockMappingTest, NotRecoverEmptyBlock) {
     int64_t block_id = 1;
     int64_t block_version = 0;
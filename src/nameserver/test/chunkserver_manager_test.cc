@@ -0,0 +1,329 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#define private public
+#include "nameserver/chunkserver_manager.h"
+#include "nameserver/load_model.h"
+
+#include <stdio.h>
+#include <set>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <common/logging.h>
+#include <common/thread_pool.h>
+#include <common/timer.h>
+
+DECLARE_bool(select_chunkserver_by_sample);
+DECLARE_bool(select_chunkserver_by_rack);
+
+namespace baidu {
+namespace bfs {
+
+class ChunkServerManagerTest : public ::testing::Test {
+public:
+    ChunkServerManagerTest() : thread_pool_(4) {
+        csm_ = new ChunkServerManager(&thread_pool_, NULL);
+    }
+    ~ChunkServerManagerTest() {
+        thread_pool_.Stop(false);
+        delete csm_;
+    }
+    void DoHeartBeat(int32_t index, int32_t id, int64_t data_size) {
+        HeartBeat(index, id, data_size, 0);
+    }
+protected:
+    int32_t AddServer(int32_t index) {
+        char addr[64];
+        snprintf(addr, sizeof(addr), "host%05d:8825", index);
+        char ip[64];
+        // Ten servers per rack
+        snprintf(ip, sizeof(ip), "10.%d.%d.%d",
+                 index / 2560, index / 10 % 256, index % 10);
+        RegisterRequest request;
+        RegisterResponse response;
+        request.set_chunkserver_addr(addr);
+        request.set_disk_quota(kQuota);
+        csm_->HandleRegister(ip, &request, &response);
+        return response.chunkserver_id();
+    }
+    void HeartBeat(int32_t index, int32_t id, int64_t data_size, int32_t buffers) {
+        char addr[64];
+        snprintf(addr, sizeof(addr), "host%05d:8825", index);
+        HeartBeatRequest request;
+        HeartBeatResponse response;
+        request.set_chunkserver_id(id);
+        request.set_chunkserver_addr(addr);
+        request.set_data_size(data_size);
+        request.set_buffers(buffers);
+        csm_->HandleHeartBeat(&request, &response);
+    }
+    void AddServers(int32_t num) {
+        for (int32_t i = 0; i < num; i++) {
+            int32_t id = AddServer(i);
+            HeartBeat(i, id, kQuota / 100 * (rand() % 80), rand() % 1000);
+        }
+        csm_->RebuildSnapshot();
+    }
+    static const int64_t kQuota = 1024LL * 1024 * 1024 * 1024;
+    ThreadPool thread_pool_;
+    ChunkServerManager* csm_;
+};
+
+TEST_F(ChunkServerManagerTest, PlacementIndex) {
+    AddServers(100);
+    ASSERT_EQ(csm_->GetSnapshot()->placement.size(), 100U);
+
+    // Full disks and servers going offline must not be chosen
+    std::set<int32_t> excluded;
+    for (int32_t i = 0; i < 10; i++) {
+        int32_t id = csm_->GetChunkServerId("host0000" + std::to_string(i) + ":8825");
+        HeartBeat(i, id, kQuota, 0);
+        excluded.insert(id);
+    }
+    ::google::protobuf::RepeatedPtrField<std::string> offline;
+    offline.Add()->assign("host00010:8825");
+    csm_->ShutdownChunkServer(offline);
+    excluded.insert(csm_->GetChunkServerId("host00010:8825"));
+    ASSERT_EQ(csm_->GetSnapshot()->placement.size(), 89U);
+
+    for (int i = 0; i < 1000; i++) {
+        std::vector<std::pair<int32_t, std::string> > chains;
+        ASSERT_TRUE(csm_->GetChunkServerChains(3, &chains, "client"));
+        ASSERT_EQ(chains.size(), 3U);
+        std::set<int32_t> ids;
+        for (size_t j = 0; j < chains.size(); j++) {
+            ASSERT_TRUE(excluded.find(chains[j].first) == excluded.end());
+            ids.insert(chains[j].first);
+        }
+        ASSERT_EQ(ids.size(), 3U);
+    }
+
+    // Recovered server goes back to the index
+    HeartBeat(0, csm_->GetChunkServerId("host00000:8825"), 0, 0);
+    csm_->RebuildSnapshot();
+    ASSERT_EQ(csm_->GetSnapshot()->placement.size(), 90U);
+}
+
+TEST_F(ChunkServerManagerTest, RackAware) {
+    FLAGS_select_chunkserver_by_rack = true;
+    AddServers(100);
+    int32_t local_id = csm_->GetChunkServerId("host00005:8825");
+    for (int i = 0; i < 1000; i++) {
+        std::vector<std::pair<int32_t, std::string> > chains;
+        ASSERT_TRUE(csm_->GetChunkServerChains(3, &chains, "host00005"));
+        ASSERT_EQ(chains.size(), 3U);
+        MutexLock lock(&csm_->mu_);
+        ChunkServerInfo* cs[3];
+        for (int j = 0; j < 3; j++) {
+            ASSERT_TRUE(csm_->GetChunkServerPtr(chains[j].first, &cs[j]));
+        }
+        ASSERT_EQ(cs[0]->id(), local_id);
+        ASSERT_NE(cs[1]->rack(), cs[0]->rack());
+        ASSERT_EQ(cs[2]->rack(), cs[1]->rack());
+    }
+
+    // Both replicas in one rack, recover to another
+    MutexLock lock(&csm_->mu_);
+    csm_->localzone_ = "default";
+    std::set<int32_t> replica;
+    replica.insert(csm_->address_map_["host00000:8825"]);
+    replica.insert(csm_->address_map_["host00001:8825"]);
+    std::vector<std::string> chains;
+    ASSERT_TRUE(csm_->GetRecoverChains(replica, &chains));
+    ASSERT_FALSE(chains.empty());
+    int32_t id = csm_->address_map_[chains[0]];
+    ChunkServerInfo* cs = NULL;
+    ASSERT_TRUE(csm_->GetChunkServerPtr(id, &cs));
+    ASSERT_NE(cs->rack(), std::string("10_0_0"));
+    FLAGS_select_chunkserver_by_rack = false;
+}
+
+TEST_F(ChunkServerManagerTest, ExcludePlacement) {
+    FLAGS_select_chunkserver_by_rack = true;
+    AddServers(30);
+    std::vector<int32_t> ids;
+    for (int32_t i = 0; i < 30; i++) {
+        char addr[64];
+        snprintf(addr, sizeof(addr), "host%05d:8825", i);
+        ids.push_back(csm_->GetChunkServerId(addr));
+    }
+    // Excluded servers in racks 0 and 1, the writer is one of them
+    std::set<int32_t> exclude;
+    exclude.insert(ids[0]);
+    exclude.insert(ids[10]);
+    for (int i = 0; i < 200; i++) {
+        std::vector<std::pair<int32_t, std::string> > chains;
+        ASSERT_TRUE(csm_->GetChunkServerChains(3, &chains, "host00000", exclude));
+        ASSERT_EQ(chains.size(), 3U);
+        MutexLock lock(&csm_->mu_);
+        for (int j = 0; j < 3; j++) {
+            ChunkServerInfo* cs = NULL;
+            ASSERT_TRUE(csm_->GetChunkServerPtr(chains[j].first, &cs));
+            ASSERT_EQ(cs->rack(), std::string("10_0_2"));
+        }
+    }
+
+    // Every rack taken, distinct servers is what is left
+    exclude.insert(ids[20]);
+    for (int i = 0; i < 200; i++) {
+        std::vector<std::pair<int32_t, std::string> > chains;
+        ASSERT_TRUE(csm_->GetChunkServerChains(1, &chains, "host00000", exclude));
+        ASSERT_EQ(chains.size(), 1U);
+        ASSERT_TRUE(exclude.find(chains[0].first) == exclude.end());
+    }
+    FLAGS_select_chunkserver_by_rack = false;
+}
+
+TEST_F(ChunkServerManagerTest, BalanceTarget) {
+    FLAGS_select_chunkserver_by_rack = true;
+    // Servers 0-49 are 90% full, the others 10%
+    std::vector<int32_t> ids;
+    for (int32_t i = 0; i < 100; i++) {
+        ids.push_back(AddServer(i));
+        HeartBeat(i, ids[i], kQuota / 10 * (i < 50 ? 9 : 1), 0);
+    }
+    csm_->RebuildSnapshot();
+    csm_->LogStats();
+    ASSERT_TRUE(csm_->IsBalanceSource(ids[0]));
+    ASSERT_FALSE(csm_->IsBalanceSource(ids[60]));
+
+    // Replicas in racks 0, 0 and 6: moving the rack 6 one must keep two racks
+    std::set<int32_t> replica;
+    replica.insert(ids[0]);
+    replica.insert(ids[1]);
+    replica.insert(ids[60]);
+    for (int i = 0; i < 100; i++) {
+        int32_t target = -1;
+        std::string addr;
+        ASSERT_TRUE(csm_->GetBalanceTarget(ids[60], replica, &target, &addr));
+        ASSERT_TRUE(replica.find(target) == replica.end());
+        MutexLock lock(&csm_->mu_);
+        ChunkServerInfo* cs = NULL;
+        ASSERT_TRUE(csm_->GetChunkServerPtr(target, &cs));
+        ASSERT_NE(cs->rack(), std::string("10_0_0"));
+        ASSERT_LT(csm_->DiskUsage(cs), 0.5);
+    }
+    FLAGS_select_chunkserver_by_rack = false;
+}
+
+TEST_F(ChunkServerManagerTest, ConcurrentHeartBeat) {
+    const int32_t kServerNum = 1000;
+    std::vector<int32_t> ids;
+    for (int32_t i = 0; i < kServerNum; i++) {
+        ids.push_back(AddServer(i));
+    }
+    // Heartbeats of different servers only share a shard lock now and then
+    ThreadPool pool(8);
+    for (int32_t round = 0; round < 10; round++) {
+        for (int32_t i = 0; i < kServerNum; i++) {
+            pool.AddTask(std::bind(&ChunkServerManagerTest::DoHeartBeat, this,
+                                   i, ids[i], kQuota / 100 * round));
+        }
+    }
+    pool.Stop(true);
+    csm_->RebuildSnapshot();
+    std::shared_ptr<LoadSnapshot> snapshot = csm_->GetSnapshot();
+    ASSERT_EQ(snapshot->alive.size(), static_cast<size_t>(kServerNum));
+    ASSERT_EQ(snapshot->placement.size(), static_cast<size_t>(kServerNum));
+    for (size_t i = 0; i < snapshot->servers.size(); i++) {
+        ASSERT_GE(snapshot->servers[i].last_heartbeat(), common::timer::now_time() - 5);
+    }
+
+    // Each living server waits in the dead check wheel exactly once
+    MutexLock lock(&csm_->mu_);
+    size_t scheduled = 0;
+    for (int32_t i = 0; i < ChunkServerManager::kDeadCheckSlotNum; i++) {
+        scheduled += csm_->dead_check_wheel_[i].size();
+    }
+    ASSERT_EQ(scheduled, static_cast<size_t>(kServerNum));
+}
+
+TEST_F(ChunkServerManagerTest, EwmaLoadModel) {
+    EwmaLoadModel model;
+    ChunkServerInfo idle;
+    idle.set_id(1);
+    idle.set_disk_quota(kQuota);
+    idle.set_data_size(kQuota / 2);
+    ChunkServerInfo hot(idle);
+    hot.set_id(2);
+    HeartBeatRequest idle_hb;
+    HeartBeatRequest hot_hb;
+    hot_hb.set_r_speed(150LL * 1024 * 1024);
+    double idle_load = 0, hot_load = 0;
+    for (int i = 0; i < 10; i++) {
+        idle_load = model.UpdateLoad(idle, idle_hb);
+        hot_load = model.UpdateLoad(hot, hot_hb);
+    }
+    ASSERT_LT(idle_load, hot_load);
+    ASSERT_LT(hot_load, kChunkServerLoadMax);
+    ASSERT_EQ(model.GetBusyRatio(1), 0);
+    ASSERT_GT(model.GetBusyRatio(2), 0.5);
+
+    // One quiet heartbeat only moves the average part of the way
+    double busy = model.GetBusyRatio(2);
+    model.UpdateLoad(hot, idle_hb);
+    ASSERT_GT(model.GetBusyRatio(2), 0);
+    ASSERT_LT(model.GetBusyRatio(2), busy);
+
+    // Full disk is overloaded at once
+    hot.set_data_size(kQuota);
+    ASSERT_GT(model.UpdateLoad(hot, hot_hb), kChunkServerLoadMax);
+}
+
+TEST_F(ChunkServerManagerTest, RecoverBudget) {
+    const int64_t kMB = 1024 * 1024;
+    MutexLock lock(&csm_->mu_);
+    csm_->params_.set_report_interval(1);
+    csm_->params_.set_recover_bandwidth(10);
+    csm_->params_.set_recover_bandwidth_per_server(100);
+    csm_->recover_tokens_ = 0;
+    csm_->last_recover_refill_ = common::timer::get_micros();
+    int64_t hi_bytes = 0, lo_bytes = 0;
+    csm_->GetRecoverBytes(&hi_bytes, &lo_bytes);
+    // Blocks at risk may borrow one interval of the cluster budget, not the server budget
+    ASSERT_GT(hi_bytes, 9 * kMB);
+    ASSERT_LT(hi_bytes, 11 * kMB);
+    ASSERT_LT(lo_bytes, kMB);
+
+    // Once the debt is taken, high priority waits too
+    csm_->recover_tokens_ = -10.0 * kMB;
+    csm_->GetRecoverBytes(&hi_bytes, &lo_bytes);
+    ASSERT_LT(hi_bytes, kMB);
+    ASSERT_LT(lo_bytes, 0);
+}
+
+TEST_F(ChunkServerManagerTest, PlacementBenchmark) {
+    const int32_t kServerNum = 5000;
+    const int32_t kRounds = 100000;
+    AddServers(kServerNum);
+    ASSERT_EQ(csm_->GetSnapshot()->placement.size(), static_cast<size_t>(kServerNum));
+
+    bool sample = FLAGS_select_chunkserver_by_sample;
+    int64_t cost[2] = {0, 0};
+    for (int32_t k = 0; k < 2; k++) {
+        FLAGS_select_chunkserver_by_sample = (k == 0);
+        int32_t rounds = (k == 0) ? kRounds : kRounds / 100;
+        int64_t start = common::timer::get_micros();
+        for (int32_t i = 0; i < rounds; i++) {
+            std::vector<std::pair<int32_t, std::string> > chains;
+            ASSERT_TRUE(csm_->GetChunkServerChains(3, &chains, "client"));
+        }
+        cost[k] = (common::timer::get_micros() - start) * 1000 / rounds;
+    }
+    FLAGS_select_chunkserver_by_sample = sample;
+    printf("GetChunkServerChains with %d chunkservers: sampled %ld ns/op, full scan %ld ns/op\n",
+           kServerNum, cost[0], cost[1]);
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::baidu::common::SetLogLevel(2);
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -2,9 +2,12 @@
 #include "nameserver/file_lock_manager.h"
 
 #include <functional>
+#include <iostream>
+#include <stdio.h>
 
 #include <gtest/gtest.h>
 #include <common/thread_pool.h>
+#include <common/timer.h>
 
 baidu::bfs::FileLockManager flm;
 
@@ -36,6 +39,37 @@ void Unlock(const std::string& file_path) {
     flm.Unlock(file_path);
 }
 
+// Idle entries may stay in the buckets, but none is held
+void CheckReleased(FileLockManager* manager) {
+    for (size_t i = 0; i < manager->locks_.size(); i++) {
+        FileLockManager::LockBucket* l = manager->locks_[i];
+        for (auto it = l->lock_map.begin(); it != l->lock_map.end(); ++it) {
+            ASSERT_EQ(0, it->second->ref);
+        }
+    }
+}
+
+size_t EntryNum(FileLockManager* manager) {
+    size_t num = 0;
+    for (size_t i = 0; i < manager->locks_.size(); i++) {
+        num += manager->locks_[i]->lock_map.size();
+    }
+    return num;
+}
+
+void LockLoop(FileLockManager* manager, int thread_id, int loop,
+              const std::vector<std::string>* paths) {
+    for (int i = 0; i < loop; i++) {
+        const std::string& path = (*paths)[(thread_id + i) % paths->size()];
+        if (i % 10 == 0) {
+            manager->WriteLock(path);
+        } else {
+            manager->ReadLock(path);
+        }
+        manager->Unlock(path);
+    }
+}
+
 TEST_F(FileLockManagerTest, Basic) {
     std::string file_path1 = "/home/dir1/file1";
     std::string file_path2 = "/home/dir2/file2";
@@ -71,10 +105,7 @@ TEST_F(FileLockManagerTest, RandomReadWriteLock) {
         }
     }
     thread_pool.Stop(true);
-    for (size_t i = 0; i < flm.locks_.size(); i++) {
-        FileLockManager::LockBucket* l = flm.locks_[i];
-        ASSERT_EQ(l->lock_map.size(), 0);
-    }
+    CheckReleased(&flm);
 }
 
 TEST_F(FileLockManagerTest, UnlockInAnotherThread) {
@@ -94,10 +125,47 @@ TEST_F(FileLockManagerTest, NormailzeLockPath) {
     // wait for task to be executed
     thread_pool.Stop(true);
     Unlock(unlock_file_path);
-    for (size_t i = 0; i < flm.locks_.size(); i++) {
-        FileLockManager::LockBucket* l = flm.locks_[i];
-        ASSERT_EQ(l->lock_map.size(), 0);
+    CheckReleased(&flm);
+}
+
+TEST_F(FileLockManagerTest, IdleEntry) {
+    FileLockManager cached(1, 8);
+    cached.ReadLock("/home/dir1/file1");
+    cached.Unlock("/home/dir1/file1");
+    ASSERT_EQ(3U, EntryNum(&cached));
+    cached.WriteLock("/home//dir1/file2");
+    cached.Unlock("/home/dir1/file2/");
+    ASSERT_EQ(4U, EntryNum(&cached));
+    CheckReleased(&cached);
+
+    FileLockManager uncached(1, 0);
+    uncached.ReadLock("/home/dir1/file1");
+    ASSERT_EQ(3U, EntryNum(&uncached));
+    uncached.Unlock("/home/dir1/file1");
+    ASSERT_EQ(0U, EntryNum(&uncached));
+}
+
+TEST_F(FileLockManagerTest, Benchmark) {
+    const int kThreadNum = 8;
+    const int kLoop = 100000;
+    std::vector<std::string> paths;
+    for (int i = 0; i < 100; i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/user/job/data/2017/01/%02d/part/%d/sub/file_%d",
+                 i % 30, i % 7, i);
+        paths.push_back(path);
     }
+    FileLockManager manager;
+    baidu::common::ThreadPool thread_pool(kThreadNum);
+    int64_t start = baidu::common::timer::get_micros();
+    for (int i = 0; i < kThreadNum; i++) {
+        thread_pool.AddTask(std::bind(LockLoop, &manager, i, kLoop, &paths));
+    }
+    thread_pool.Stop(true);
+    int64_t interval = baidu::common::timer::get_micros() - start;
+    std::cerr << "10-level path lock/unlock: "
+              << kThreadNum * kLoop * 1000000.0 / interval << " ops/s" << std::endl;
+    CheckReleased(&manager);
 }
 
 } // namespace bfs
@@ -38,6 +38,22 @@ TEST_F(FileLockTest, ReadLock) {
     FileLockGuard guard2(new ReadLock("/home/dir1/file2"));
 }
 
+TEST_F(FileLockTest, MultiPathLock) {
+    std::vector<std::string> paths;
+    paths.push_back("/home/dir2/file2");
+    paths.push_back("/home/dir1/file1");
+    paths.push_back("/home/dir2/file2");
+    {
+        FileLockGuard guard(new WriteLock(paths));
+        WriteLock* lock = reinterpret_cast<WriteLock*>(guard.get());
+        ASSERT_EQ(2U, lock->file_path_.size());
+        ASSERT_EQ("/home/dir1/file1", lock->file_path_[0]);
+    }
+    paths.push_back("/home");
+    FileLockGuard guard1(new ReadLock(paths));
+    FileLockGuard guard2(new ReadLock(paths));
+}
+
 } // namespace bfs
 } // namespace baidu
 
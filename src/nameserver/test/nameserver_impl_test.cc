@@ -3,24 +3,38 @@
 // found in the LICENSE file.
 //
 
+#define private public
 #include "proto/nameserver.pb.h"
 #include "proto/file.pb.h"
 #include "nameserver/nameserver_impl.h"
+#include "nameserver/master_slave.h"
+#include "nameserver/raft_node.h"
+#include "nameserver/sync.h"
+#include "rpc/nameserver_client.h"
+#include "rpc/rpc_client.h"
 
 #include <iostream>
 #include <string>
 #include <functional>
+#include <deque>
 
 #include <sofa/pbrpc/pbrpc.h>
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
 #include <common/counter.h>
+#include <common/mutex.h>
 #include <common/string_util.h>
 #include <common/timer.h>
 #include <common/thread_pool.h>
 
 DECLARE_string(bfs_log);
 DECLARE_int32(nameserver_work_thread_num);
+DECLARE_string(namedb_path);
+DECLARE_int32(nameserver_log_group_max_delay);
+DECLARE_int64(follower_read_max_lag);
+DECLARE_string(nameserver_nodes);
+DECLARE_int32(node_index);
+DECLARE_string(master_slave_role);
 
 namespace baidu {
 namespace bfs {
@@ -94,6 +108,325 @@ TEST_F(NameServerImplTest, NameServerImpl) {
     std::cerr << 100000.0 * 1000000.0 / interval << std::endl;
 }
 
+/// Leader unless told otherwise, logs are done only when the test says so
+class FakeSync : public Sync {
+public:
+    FakeSync() : leader_(true), applied_index_(0), lag_(0), read_index_(-1) {}
+    void Init(SyncCallbacks callbacks) {}
+    bool IsLeader(std::string* leader_addr = NULL) {
+        MutexLock lock(&mu_);
+        return leader_;
+    }
+    bool Log(const std::string& entry, int timeout_ms = 10000) { return true; }
+    void Log(const std::string& entry, std::function<void (bool)> callback) {
+        NameServerLog log;
+        log.ParseFromString(entry);
+        MutexLock lock(&mu_);
+        entry_num_.push_back(log.entries_size());
+        callbacks_.push_back(callback);
+    }
+    void SwitchToLeader() {}
+    std::string GetStatus() { return "fake"; }
+    int64_t GetAppliedIndex() {
+        MutexLock lock(&mu_);
+        return applied_index_;
+    }
+    int64_t GetLeaderLag(int32_t max_delay_ms) {
+        MutexLock lock(&mu_);
+        return lag_;
+    }
+    bool GetReadIndex(int64_t* read_index) {
+        MutexLock lock(&mu_);
+        if (read_index_ < 0) {
+            return false;
+        }
+        *read_index = read_index_;
+        return true;
+    }
+    /// 'read_index' -1 means the leader refuses it
+    void SetFollower(int64_t applied_index, int64_t lag, int64_t read_index) {
+        MutexLock lock(&mu_);
+        leader_ = false;
+        applied_index_ = applied_index;
+        lag_ = lag;
+        read_index_ = read_index;
+    }
+    int GroupNum() {
+        MutexLock lock(&mu_);
+        return entry_num_.size();
+    }
+    int EntryNum(int group) {
+        MutexLock lock(&mu_);
+        return entry_num_[group];
+    }
+    void Done() {
+        std::function<void (bool)> callback;
+        {
+            MutexLock lock(&mu_);
+            callback = callbacks_.front();
+            callbacks_.pop_front();
+        }
+        callback(true);
+    }
+private:
+    Mutex mu_;
+    bool leader_;
+    int64_t applied_index_;
+    int64_t lag_;
+    int64_t read_index_;
+    std::vector<int> entry_num_;
+    std::deque<std::function<void (bool)> > callbacks_;
+};
+
+void SetDone(bool* done) {
+    *done = true;
+}
+
+TEST_F(NameServerImplTest, LogGroup) {
+    FLAGS_namedb_path = "./log_group_db";
+    FLAGS_nameserver_log_group_max_delay = 100000;
+    system("rm -rf ./log_group_db");
+    FakeSync sync;
+    NameServerImpl nameserver(&sync);
+    sofa::pbrpc::RpcController controller;
+
+    CreateFileRequest request;
+    CreateFileResponse response;
+    request.set_file_name("/file0");
+    bool done = false;
+    do {
+        usleep(10000);
+        done = false;
+        response.Clear();
+        nameserver.CreateFile(&controller, &request, &response,
+                              sofa::pbrpc::NewClosure(&SetDone, &done));
+    } while (response.status() == kSafeMode);
+    ASSERT_EQ(kOK, response.status());
+    ASSERT_FALSE(done);
+    ASSERT_EQ(1, sync.GroupNum());
+
+    // Logs of the next creates wait for the group in flight
+    bool done1 = false, done2 = false;
+    CreateFileRequest request1, request2;
+    CreateFileResponse response1, response2;
+    request1.set_file_name("/file1");
+    request2.set_file_name("/file2");
+    nameserver.CreateFile(&controller, &request1, &response1,
+                          sofa::pbrpc::NewClosure(&SetDone, &done1));
+    nameserver.CreateFile(&controller, &request2, &response2,
+                          sofa::pbrpc::NewClosure(&SetDone, &done2));
+    ASSERT_EQ(1, sync.GroupNum());
+    ASSERT_FALSE(done1);
+
+    sync.Done();
+    ASSERT_TRUE(done);
+    ASSERT_EQ(2, sync.GroupNum());
+    ASSERT_EQ(2, sync.EntryNum(1));
+    ASSERT_FALSE(done1 || done2);
+    sync.Done();
+    ASSERT_TRUE(done1 && done2);
+}
+
+StatusCode FollowerStat(NameServerImpl* nameserver, ReadConsistency consistency,
+                        int64_t min_log_index) {
+    sofa::pbrpc::RpcController controller;
+    StatRequest request;
+    StatResponse response;
+    request.set_path("/");
+    request.set_consistency(consistency);
+    request.set_min_log_index(min_log_index);
+    bool done = false;
+    nameserver->Stat(&controller, &request, &response, sofa::pbrpc::NewClosure(&SetDone, &done));
+    EXPECT_TRUE(done);
+    if (response.status() != kIsFollower) {
+        EXPECT_EQ(10, response.log_index());
+    }
+    return response.status();
+}
+
+TEST_F(NameServerImplTest, FollowerRead) {
+    FLAGS_namedb_path = "./follower_read_db";
+    FLAGS_follower_read_max_lag = 100;
+    system("rm -rf ./follower_read_db");
+    // Follower keeps checking for leadership in its threads, both outlive the test
+    FakeSync* sync = new FakeSync();
+    sync->SetFollower(10, 0, -1);
+    NameServerImpl* nameserver = new NameServerImpl(sync);
+
+    ASSERT_EQ(kIsFollower, FollowerStat(nameserver, kReadLeader, 0));
+    // Bounded stale, by lag
+    ASSERT_NE(kIsFollower, FollowerStat(nameserver, kReadBoundedStale, 0));
+    sync->SetFollower(10, 100, -1);
+    ASSERT_NE(kIsFollower, FollowerStat(nameserver, kReadBoundedStale, 0));
+    sync->SetFollower(10, 101, -1);
+    ASSERT_EQ(kIsFollower, FollowerStat(nameserver, kReadBoundedStale, 0));
+    // Leader not heard of
+    sync->SetFollower(10, -1, -1);
+    ASSERT_EQ(kIsFollower, FollowerStat(nameserver, kReadBoundedStale, 0));
+    // Bounded stale, by what the client has seen
+    sync->SetFollower(10, 0, -1);
+    ASSERT_NE(kIsFollower, FollowerStat(nameserver, kReadBoundedStale, 10));
+    ASSERT_EQ(kIsFollower, FollowerStat(nameserver, kReadBoundedStale, 11));
+
+    // Linearizable reads need the leader's read index, lag does not matter
+    sync->SetFollower(10, 0, -1);
+    ASSERT_EQ(kIsFollower, FollowerStat(nameserver, kReadLinearizable, 0));
+    sync->SetFollower(10, 101, 10);
+    ASSERT_NE(kIsFollower, FollowerStat(nameserver, kReadLinearizable, 0));
+    ASSERT_EQ(kIsFollower, FollowerStat(nameserver, kReadLinearizable, 11));
+}
+
+TEST_F(NameServerImplTest, MasterSlaveReadIndex) {
+    system("rm -rf ./logdb");
+    FLAGS_nameserver_nodes = "127.0.0.1:18840,127.0.0.1:18841";
+    FLAGS_node_index = 1;
+    FLAGS_master_slave_role = "slave";
+    MasterSlaveImpl slave;
+    // No lease on master/slave, linearizable reads go to the master
+    int64_t read_index = 0;
+    ASSERT_FALSE(slave.GetReadIndex(&read_index));
+    system("rm -rf ./logdb");
+}
+
+bool RaftReadIndex(RaftNodeImpl* node, int64_t* read_index) {
+    sofa::pbrpc::RpcController controller;
+    ReadIndexRequest request;
+    ReadIndexResponse response;
+    request.set_follower("127.0.0.1:18851");
+    bool done = false;
+    node->ReadIndex(&controller, &request, &response, sofa::pbrpc::NewClosure(&SetDone, &done));
+    EXPECT_TRUE(done);
+    *read_index = response.read_index();
+    return response.success();
+}
+
+TEST_F(NameServerImplTest, RaftReadIndex) {
+    system("rm -rf ./raft_read_index_db");
+    // Election does not start during the test
+    RaftNodeImpl node("127.0.0.1:18850,127.0.0.1:18851,127.0.0.1:18852", 0,
+                      60000, "./raft_read_index_db");
+    int64_t now = common::timer::get_micros();
+    {
+        MutexLock lock(&node.mu_);
+        node.follower_context_.resize(3);
+        for (int i = 1; i < 3; i++) {
+            node.follower_context_[i] = new RaftNodeImpl::FollowerContext(&node.mu_);
+        }
+        node.follower_context_[1]->ack_time = now;
+        node.commit_index_ = 10;
+        node.term_start_index_ = 10;
+    }
+    int64_t read_index = 0;
+    // Only the leader gives a read index
+    ASSERT_FALSE(RaftReadIndex(&node, &read_index));
+    {
+        MutexLock lock(&node.mu_);
+        node.node_state_ = kLeader;
+    }
+    ASSERT_TRUE(RaftReadIndex(&node, &read_index));
+    ASSERT_EQ(10, read_index);
+    {
+        // Entries of former terms may not be committed yet
+        MutexLock lock(&node.mu_);
+        node.term_start_index_ = 11;
+    }
+    ASSERT_FALSE(RaftReadIndex(&node, &read_index));
+    {
+        // Lease runs out an election timeout after the last ack of a majority
+        MutexLock lock(&node.mu_);
+        node.term_start_index_ = 10;
+        node.follower_context_[1]->ack_time = now - node.election_timeout_ * 1000L - 1;
+    }
+    ASSERT_FALSE(RaftReadIndex(&node, &read_index));
+    {
+        MutexLock lock(&node.mu_);
+        node.follower_context_[2]->ack_time = common::timer::get_micros();
+    }
+    ASSERT_TRUE(RaftReadIndex(&node, &read_index));
+    system("rm -rf ./raft_read_index_db");
+}
+
+/// Answers Stat as a leader or a follower of the client
+class FakeNameServer : public NameServer {
+public:
+    FakeNameServer(StatusCode status, int64_t log_index)
+        : status_(status), log_index_(log_index), stat_num_(0), min_log_index_(-1) {}
+    virtual void Stat(::google::protobuf::RpcController* controller,
+                      const StatRequest* request,
+                      StatResponse* response,
+                      ::google::protobuf::Closure* done) {
+        MutexLock lock(&mu_);
+        ++stat_num_;
+        min_log_index_ = request->min_log_index();
+        response->set_status(status_);
+        response->set_log_index(log_index_);
+        done->Run();
+    }
+    void Set(StatusCode status, int64_t log_index) {
+        MutexLock lock(&mu_);
+        status_ = status;
+        log_index_ = log_index;
+    }
+    int StatNum() {
+        MutexLock lock(&mu_);
+        return stat_num_;
+    }
+    int64_t MinLogIndex() {
+        MutexLock lock(&mu_);
+        return min_log_index_;
+    }
+private:
+    Mutex mu_;
+    StatusCode status_;
+    int64_t log_index_;
+    int stat_num_;
+    int64_t min_log_index_;
+};
+
+TEST_F(NameServerImplTest, ClientReadFallback) {
+    // Owned by the rpc servers
+    FakeNameServer* leader = new FakeNameServer(kOK, 20);
+    FakeNameServer* follower = new FakeNameServer(kOK, 10);
+    sofa::pbrpc::RpcServer leader_server((sofa::pbrpc::RpcServerOptions()));
+    sofa::pbrpc::RpcServer follower_server((sofa::pbrpc::RpcServerOptions()));
+    ASSERT_TRUE(leader_server.RegisterService(leader));
+    ASSERT_TRUE(follower_server.RegisterService(follower));
+    ASSERT_TRUE(leader_server.Start("127.0.0.1:18860"));
+    ASSERT_TRUE(follower_server.Start("127.0.0.1:18861"));
+    RpcClient rpc_client;
+    NameServerClient client(&rpc_client, "127.0.0.1:18860,127.0.0.1:18861");
+
+    StatRequest request;
+    StatResponse response;
+    request.set_path("/");
+    request.set_consistency(kReadBoundedStale);
+    ASSERT_TRUE(client.SendReadRequest(&NameServer_Stub::Stat, &request, &response, 5));
+    ASSERT_EQ(10, response.log_index());
+    ASSERT_EQ(1, follower->StatNum());
+    ASSERT_EQ(0, leader->StatNum());
+
+    // Follower behind, the leader answers
+    follower->Set(kIsFollower, 0);
+    ASSERT_TRUE(client.SendReadRequest(&NameServer_Stub::Stat, &request, &response, 5));
+    ASSERT_EQ(kOK, response.status());
+    ASSERT_EQ(20, response.log_index());
+    ASSERT_EQ(2, follower->StatNum());
+    ASSERT_EQ(10, follower->MinLogIndex());
+    ASSERT_EQ(1, leader->StatNum());
+
+    // Later reads don't go back behind what the leader answered
+    follower->Set(kOK, 20);
+    ASSERT_TRUE(client.SendReadRequest(&NameServer_Stub::Stat, &request, &response, 5));
+    ASSERT_EQ(20, follower->MinLogIndex());
+    ASSERT_EQ(1, leader->StatNum());
+
+    // Leader reads skip the followers
+    request.set_consistency(kReadLeader);
+    ASSERT_TRUE(client.SendReadRequest(&NameServer_Stub::Stat, &request, &response, 5));
+    ASSERT_EQ(3, follower->StatNum());
+    ASSERT_EQ(2, leader->StatNum());
+}
+
 } // namespace baidu
 } // namespace bfs
 
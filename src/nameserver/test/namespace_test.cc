@@ -19,6 +19,8 @@
 
 DECLARE_string(namedb_path);
 DECLARE_int32(block_id_allocation_size);
+DECLARE_int32(nameserver_rebuild_thread_num);
+DECLARE_int32(nameserver_rebuild_batch_size);
 
 namespace baidu {
 namespace bfs {
@@ -325,6 +327,39 @@ TEST_F(NameSpaceTest, GetFileInfo) {
     ASSERT_EQ(2, info.entry_id());
 }
 
+TEST_F(NameSpaceTest, DirCache) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    NameSpace ns;
+    NameSpace::DirCache dir_cache;
+    std::vector<int64_t> blocks_to_remove;
+    ASSERT_EQ(kOK, ns.CreateFile("/dir1/subdir1/file1", 0, 0, -1, &blocks_to_remove,
+                                 NULL, &dir_cache));
+    ASSERT_EQ(2U, dir_cache.size());
+    ASSERT_EQ(kOK, ns.CreateFile("/dir1/subdir1/file2", 0, 0, -1, &blocks_to_remove,
+                                 NULL, &dir_cache));
+    ASSERT_EQ(kOK, ns.CreateFile("/dir1/file3", 0, 0, -1, &blocks_to_remove,
+                                 NULL, &dir_cache));
+    ASSERT_EQ(kFileExists, ns.CreateFile("/dir1/subdir1/file1", 0, 0, -1, &blocks_to_remove,
+                                         NULL, &dir_cache));
+    ASSERT_EQ(2U, dir_cache.size());
+    ASSERT_EQ(kBadParameter, ns.CreateFile("/dir1/file3/file4", 0, 0, -1, &blocks_to_remove,
+                                           NULL, &dir_cache));
+
+    FileInfo info, cached_info;
+    dir_cache.clear();
+    ASSERT_TRUE(ns.GetFileInfo("/dir1/subdir1/file2", &info));
+    ASSERT_TRUE(ns.GetFileInfo("/dir1/subdir1/file2", &cached_info, &dir_cache));
+    ASSERT_EQ(info.entry_id(), cached_info.entry_id());
+    ASSERT_EQ(info.parent_entry_id(), cached_info.parent_entry_id());
+    ASSERT_EQ("file2", cached_info.name());
+    ASSERT_TRUE(ns.GetFileInfo("/dir1/subdir1/file1", &cached_info, &dir_cache));
+    ASSERT_EQ(info.parent_entry_id(), cached_info.parent_entry_id());
+    ASSERT_FALSE(ns.GetFileInfo("/dir1/subdir1/file5", &cached_info, &dir_cache));
+    ASSERT_FALSE(ns.GetFileInfo("/dir1/file3/file4", &cached_info, &dir_cache));
+    ASSERT_EQ(2U, dir_cache.size());
+}
+
 TEST_F(NameSpaceTest, NormalizePath) {
     ASSERT_EQ(NameSpace::NormalizePath("home") , std::string("/home"));
     ASSERT_EQ(NameSpace::NormalizePath("") , std::string("/"));
@@ -363,6 +398,333 @@ TEST_F(NameSpaceTest, GetNewBlockId) {
     system("rm -rf ./db");
 }
 
+void RebuildCallbackHelper(Mutex* mu, std::set<int64_t>* blocks, int* batch_num,
+                           const std::vector<FileInfo>& files) {
+    MutexLock lock(mu);
+    ++*batch_num;
+    for (size_t i = 0; i < files.size(); i++) {
+        for (int j = 0; j < files[i].blocks_size(); j++) {
+            blocks->insert(files[i].blocks(j));
+        }
+    }
+}
+
+TEST_F(NameSpaceTest, RebuildBlockMap) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    int64_t last_entry_id = 0;
+    int64_t max_block_id = 0;
+    {
+        NameSpace ns;
+        std::vector<int64_t> blocks_to_remove;
+        for (int i = 0; i < 10; i++) {
+            for (int j = 0; j < 20; j++) {
+                std::string path = "/dir" + common::NumToString(i)
+                                   + "/file" + common::NumToString(j);
+                ASSERT_EQ(kOK, ns.CreateFile(path, 0, 0, -1, &blocks_to_remove));
+                FileInfo info;
+                ASSERT_TRUE(ns.GetFileInfo(path, &info));
+                max_block_id = ns.GetNewBlockId();
+                info.add_blocks(max_block_id);
+                ASSERT_TRUE(ns.UpdateFileInfo(info));
+            }
+        }
+        last_entry_id = ns.last_entry_id_;
+    }
+    FLAGS_nameserver_rebuild_thread_num = 4;
+    FLAGS_nameserver_rebuild_batch_size = 7;
+    NameSpace ns(false);
+    ns.Activate(NULL);
+    Mutex mu;
+    std::set<int64_t> blocks;
+    int batch_num = 0;
+    ns.RebuildBlockMap(std::bind(&RebuildCallbackHelper, &mu, &blocks, &batch_num,
+                                 std::placeholders::_1), NULL);
+    ASSERT_EQ(blocks.size(), 200U);
+    ASSERT_GE(batch_num, 200 / 7);
+    ASSERT_EQ(ns.last_entry_id_, last_entry_id);
+    ASSERT_GT(ns.GetNewBlockId(), max_block_id);
+    system("rm -rf ./db");
+}
+
+TEST_F(NameSpaceTest, Usage) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    NameSpace ns;
+    std::vector<int64_t> blocks_to_remove;
+    ASSERT_EQ(kOK, ns.CreateFile("/a/b/file1", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kOK, ns.CreateFile("/a/file2", 0, 0, -1, &blocks_to_remove));
+    FileInfo info;
+    ASSERT_TRUE(ns.GetFileInfo("/a/b/file1", &info));
+    info.set_size(100);
+    ASSERT_TRUE(ns.UpdateFileInfo(info));
+
+    DirUsage usage;
+    ASSERT_EQ(kOK, ns.GetUsage("/a", &usage));
+    ASSERT_EQ(100, usage.space());
+    ASSERT_EQ(3, usage.files());
+    ASSERT_EQ(kOK, ns.GetUsage("/a/b", &usage));
+    ASSERT_EQ(100, usage.space());
+    ASSERT_EQ(1, usage.files());
+    ASSERT_EQ(kBadParameter, ns.GetUsage("/a/file2", &usage));
+    uint64_t du_size = 0;
+    ASSERT_EQ(kOK, ns.DiskUsage("/", &du_size));
+    ASSERT_EQ(100U, du_size);
+
+    // Move the usage of /a/b to /c
+    bool need_unlink = false;
+    FileInfo remove_file;
+    ASSERT_EQ(kOK, ns.Rename("/a/b", "/c", &need_unlink, &remove_file));
+    ASSERT_EQ(kOK, ns.GetUsage("/a", &usage));
+    ASSERT_EQ(0, usage.space());
+    ASSERT_EQ(1, usage.files());
+    ASSERT_EQ(kOK, ns.GetUsage("/", &usage));
+    ASSERT_EQ(100, usage.space());
+    ASSERT_EQ(4, usage.files());
+
+    // Overwrite /a/file2 by /c/file1
+    ASSERT_EQ(kOK, ns.Rename("/c/file1", "/a/file2", &need_unlink, &remove_file));
+    ASSERT_EQ(kOK, ns.GetUsage("/a", &usage));
+    ASSERT_EQ(100, usage.space());
+    ASSERT_EQ(1, usage.files());
+    ASSERT_EQ(kOK, ns.GetUsage("/", &usage));
+    ASSERT_EQ(3, usage.files());
+
+    ASSERT_EQ(kOK, ns.RemoveFile("/a/file2", &remove_file));
+    ASSERT_EQ(kOK, ns.GetUsage("/", &usage));
+    ASSERT_EQ(0, usage.space());
+    ASSERT_EQ(2, usage.files());
+
+    std::vector<FileInfo> files_removed;
+    ASSERT_EQ(kOK, ns.DeleteDirectory("/a", true, &files_removed));
+    ASSERT_EQ(kOK, ns.GetUsage("/", &usage));
+    ASSERT_EQ(1, usage.files());
+    system("rm -rf ./db");
+}
+
+TEST_F(NameSpaceTest, Quota) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    NameSpace ns;
+    std::vector<int64_t> blocks_to_remove;
+    ASSERT_EQ(kOK, ns.CreateFile("/quota", 0, 01755, -1, &blocks_to_remove));
+    ASSERT_EQ(kOK, ns.SetQuota("/quota", 100, 3));
+    ASSERT_EQ(kOK, ns.CreateFile("/quota/file1", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kOK, ns.CreateFile("/quota/dir/file2", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kNotEnoughQuota, ns.CreateFile("/quota/file3", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kNotEnoughQuota, ns.CreateFile("/quota/dir/file3", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kNotEnoughQuota, ns.Symlink("/quota/file1", "/quota/link"));
+    bool need_unlink = false;
+    FileInfo remove_file;
+    ASSERT_EQ(kOK, ns.CreateFile("/file4", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kNotEnoughQuota, ns.Rename("/file4", "/quota/file4", &need_unlink, &remove_file));
+
+    FileInfo info;
+    ASSERT_TRUE(ns.GetFileInfo("/quota/file1", &info));
+    ASSERT_EQ(kOK, ns.CheckQuota(info.parent_entry_id(), 1, 0));
+    info.set_size(100);
+    ASSERT_TRUE(ns.UpdateFileInfo(info));
+    ASSERT_EQ(kNotEnoughQuota, ns.CheckQuota(info.parent_entry_id(), 1, 0));
+    ASSERT_TRUE(ns.GetFileInfo("/quota/dir/file2", &info));
+    ASSERT_EQ(kNotEnoughQuota, ns.CheckQuota(info.parent_entry_id(), 1, 0));
+
+    // Raise the limit on files, the space quota stays
+    ASSERT_EQ(kOK, ns.SetQuota("/quota", -1, 0));
+    ASSERT_EQ(kOK, ns.CreateFile("/quota/file3", 0, 0, -1, &blocks_to_remove));
+    DirUsage usage;
+    ASSERT_EQ(kOK, ns.GetUsage("/quota", &usage));
+    ASSERT_EQ(100, usage.space_quota());
+    ASSERT_EQ(0, usage.file_quota());
+    ASSERT_EQ(4, usage.files());
+    system("rm -rf ./db");
+}
+
+TEST_F(NameSpaceTest, RebuildUsage) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    {
+        NameSpace ns;
+        std::vector<int64_t> blocks_to_remove;
+        for (int i = 0; i < 5; i++) {
+            std::string path = "/dir/sub" + common::NumToString(i) + "/file";
+            ASSERT_EQ(kOK, ns.CreateFile(path, 0, 0, -1, &blocks_to_remove));
+            FileInfo info;
+            ASSERT_TRUE(ns.GetFileInfo(path, &info));
+            info.set_size(10);
+            ASSERT_TRUE(ns.UpdateFileInfo(info));
+        }
+        ASSERT_EQ(kOK, ns.SetQuota("/dir", 1000, 0));
+        // Lose the record of /dir/sub0 and break the one of /dir
+        FileInfo info;
+        ASSERT_TRUE(ns.GetFileInfo("/dir/sub0", &info));
+        std::string key;
+        NameSpace::EncodingUsageKey(info.entry_id(), &key);
+        ns.db_->Delete(leveldb::WriteOptions(), key);
+        ASSERT_TRUE(ns.GetFileInfo("/dir", &info));
+        DirUsage usage;
+        ASSERT_TRUE(ns.GetUsage(info.entry_id(), &usage));
+        usage.set_files(1);
+        std::string value;
+        usage.SerializeToString(&value);
+        NameSpace::EncodingUsageKey(info.entry_id(), &key);
+        ns.db_->Put(leveldb::WriteOptions(), key, value);
+    }
+    NameSpace ns(false);
+    ns.Activate(NULL);
+    ns.RebuildBlockMap(NULL, NULL);
+    DirUsage usage;
+    ASSERT_EQ(kOK, ns.GetUsage("/dir", &usage));
+    ASSERT_EQ(50, usage.space());
+    ASSERT_EQ(10, usage.files());
+    ASSERT_EQ(1000, usage.space_quota());
+    ASSERT_EQ(kOK, ns.GetUsage("/dir/sub0", &usage));
+    ASSERT_EQ(10, usage.space());
+    ASSERT_EQ(1, usage.files());
+    system("rm -rf ./db");
+}
+
+TEST_F(NameSpaceTest, TailLogReplay) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db ./db_follower");
+    std::vector<std::string> logs;
+    {
+        NameSpace ns;
+        std::vector<int64_t> blocks_to_remove;
+        NameServerLog log;
+        ASSERT_EQ(kOK, ns.CreateFile("/a/file1", 0, 0, -1, &blocks_to_remove, &log));
+        logs.push_back(log.SerializeAsString());
+        FileInfo info;
+        ASSERT_TRUE(ns.GetFileInfo("/a/file1", &info));
+        info.set_size(100);
+        log.Clear();
+        ASSERT_TRUE(ns.UpdateFileInfo(info, &log));
+        logs.push_back(log.SerializeAsString());
+        log.Clear();
+        ASSERT_EQ(kOK, ns.CreateFile("/a/file2", 0, 0, -1, &blocks_to_remove, &log));
+        logs.push_back(log.SerializeAsString());
+    }
+    FLAGS_namedb_path = "./db_follower";
+    NameSpace follower(false);
+    // Replayed after a restart, or sent again to a follower that had it
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < logs.size(); i++) {
+            follower.TailLog(logs[i]);
+        }
+    }
+    // Logged out of order, the older record is dropped
+    follower.TailLog(logs[1]);
+    DirUsage usage;
+    ASSERT_EQ(kOK, follower.GetUsage("/a", &usage));
+    ASSERT_EQ(100, usage.space());
+    ASSERT_EQ(2, usage.files());
+    ASSERT_EQ(kOK, follower.GetUsage("/", &usage));
+    ASSERT_EQ(100, usage.space());
+    ASSERT_EQ(3, usage.files());
+    system("rm -rf ./db ./db_follower");
+}
+
+TEST_F(NameSpaceTest, ReapTrash) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    NameSpace ns;
+    std::vector<int64_t> blocks_to_remove;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 5; j++) {
+            std::string path = "/dir/sub" + common::NumToString(i)
+                               + "/file" + common::NumToString(j);
+            ASSERT_EQ(kOK, ns.CreateFile(path, 0, 0, -1, &blocks_to_remove));
+        }
+    }
+    ASSERT_EQ(kOK, ns.CreateFile("/file", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kBadParameter, ns.TrashDirectory("/file"));
+    ASSERT_EQ(kBadParameter, ns.TrashDirectory("/"));
+    ASSERT_EQ(kOK, ns.TrashDirectory("/dir"));
+    FileInfo info;
+    ASSERT_FALSE(ns.GetFileInfo("/dir", &info));
+    DirUsage usage;
+    ASSERT_EQ(kOK, ns.GetUsage("/", &usage));
+    ASSERT_EQ(1, usage.files());
+    // Same name can be used again before the trash is reaped
+    ASSERT_EQ(kOK, ns.CreateFile("/dir/sub0/file0", 0, 0, -1, &blocks_to_remove));
+
+    std::vector<FileInfo> files_removed;
+    int rounds = 0;
+    while (ns.ReapTrash(3, &files_removed)) {
+        ++rounds;
+    }
+    ASSERT_EQ(20U, files_removed.size());
+    ASSERT_GE(rounds, 24 / 3);
+    ASSERT_TRUE(ns.GetFileInfo("/dir/sub0/file0", &info));
+    ASSERT_EQ(kOK, ns.GetUsage("/", &usage));
+    ASSERT_EQ(4, usage.files());
+    system("rm -rf ./db");
+}
+
+TEST_F(NameSpaceTest, LookupById) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    NameSpace ns;
+    ASSERT_TRUE(CreateTree(&ns));
+    FileInfo dir1, subdir1, info;
+    ASSERT_EQ(kOK, ns.Lookup(1, "dir1", &dir1));
+    ASSERT_EQ(1, dir1.parent_entry_id());
+    ASSERT_EQ(kOK, ns.Lookup(dir1.entry_id(), "subdir1", &subdir1));
+    ASSERT_EQ(kOK, ns.Lookup(subdir1.entry_id(), "file3", &info));
+    ASSERT_TRUE(ns.GetFileInfo("/dir1/subdir1/file3", &info));
+    ASSERT_EQ(kNsNotFound, ns.Lookup(dir1.entry_id(), "file3", &info));
+    ASSERT_EQ(kBadParameter, ns.Lookup(1, "dir1/subdir1", &info));
+    ASSERT_EQ(kBadParameter, ns.Lookup(1, "", &info));
+    // Symlinks are not followed
+    ASSERT_EQ(kOK, ns.Lookup(1, "link1", &info));
+    ASSERT_EQ("/file1", info.sym_link());
+
+    google::protobuf::RepeatedPtrField<FileInfo> outputs;
+    ASSERT_EQ(kOK, ns.ListDirectory(dir1.entry_id(), &outputs));
+    ASSERT_EQ(2, outputs.size());
+    ASSERT_EQ("subdir1", outputs.Get(0).name());
+    ASSERT_EQ(dir1.entry_id(), outputs.Get(0).parent_entry_id());
+    ASSERT_EQ(kOK, ns.ListDirectory(1, &outputs));
+    ASSERT_EQ(6, outputs.size());
+
+    // Entry ids stay across renames
+    bool need_unlink = false;
+    FileInfo remove_file;
+    ASSERT_EQ(kOK, ns.Rename("/dir1/subdir1", "/subdir1", &need_unlink, &remove_file));
+    ASSERT_EQ(kOK, ns.ListDirectory(subdir1.entry_id(), &outputs));
+    ASSERT_EQ(2, outputs.size());
+    ASSERT_EQ(kOK, ns.Lookup(subdir1.entry_id(), "file3", &info));
+    std::vector<int64_t> blocks_to_remove;
+    FileInfo nested;
+    ASSERT_EQ(kOK, ns.CreateFile("/subdir1/nested/file6", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kOK, ns.Lookup(subdir1.entry_id(), "nested", &nested));
+    ASSERT_EQ(kOK, ns.Lookup(nested.entry_id(), "file6", &info));
+    ASSERT_EQ(kOK, ns.TrashDirectory("/subdir1"));
+    ASSERT_EQ(kNsNotFound, ns.ListDirectory(subdir1.entry_id(), &outputs));
+    ASSERT_EQ(kNsNotFound, ns.Lookup(subdir1.entry_id(), "file3", &info));
+    // Directories below the trashed one are gone too
+    ASSERT_EQ(kNsNotFound, ns.ListDirectory(nested.entry_id(), &outputs));
+    ASSERT_EQ(kNsNotFound, ns.Lookup(nested.entry_id(), "file6", &info));
+    ASSERT_EQ(kOK, ns.ListDirectory(dir1.entry_id(), &outputs));
+    ASSERT_EQ(1, outputs.size());
+    system("rm -rf ./db");
+}
+
+TEST_F(NameSpaceTest, SymlinkLoop) {
+    FLAGS_namedb_path = "./db";
+    system("rm -rf ./db");
+    NameSpace ns;
+    std::vector<int64_t> blocks_to_remove;
+    ASSERT_EQ(kOK, ns.CreateFile("/file", 0, 0, -1, &blocks_to_remove));
+    ASSERT_EQ(kOK, ns.Symlink("/file", "/link1"));
+    ASSERT_EQ(kOK, ns.Symlink("/link1", "/link2"));
+    FileInfo info;
+    ASSERT_EQ(kOK, ns.RemoveFile("/file", &info));
+    bool need_unlink = false;
+    ASSERT_EQ(kOK, ns.Rename("/link2", "/file", &need_unlink, &info));
+    ASSERT_FALSE(ns.GetFileInfo("/link1", &info));
+    system("rm -rf ./db");
+}
+
 }
 }
 
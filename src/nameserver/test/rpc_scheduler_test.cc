@@ -0,0 +1,161 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "nameserver/rpc_scheduler.h"
+
+#include <gtest/gtest.h>
+#include <common/logging.h>
+
+namespace baidu {
+namespace bfs {
+
+class RpcSchedulerTest : public ::testing::Test {
+public:
+    RpcSchedulerTest() : thread_pool_(1), cond_(&mu_), blocked_(true) {}
+protected:
+    /// Hold the only thread until Release, so tasks queue up in the scheduler
+    void Block() {
+        thread_pool_.AddTask(std::bind(&RpcSchedulerTest::Wait, this));
+    }
+    void Release() {
+        MutexLock lock(&mu_);
+        blocked_ = false;
+        cond_.Signal();
+    }
+    void Wait() {
+        MutexLock lock(&mu_);
+        while (blocked_) {
+            cond_.Wait();
+        }
+    }
+    void Record(const std::string& name) {
+        MutexLock lock(&mu_);
+        order_.push_back(name);
+    }
+    bool Add(RpcScheduler* scheduler, RpcLane lane, const std::string& client,
+             const std::string& name) {
+        return scheduler->AddTask(lane, client,
+                                  std::bind(&RpcSchedulerTest::Record, this, name));
+    }
+protected:
+    ThreadPool thread_pool_;
+    Mutex mu_;
+    CondVar cond_;
+    bool blocked_;
+    std::vector<std::string> order_;
+};
+
+TEST_F(RpcSchedulerTest, Weight) {
+    RpcScheduler scheduler;
+    scheduler.SetLane(kLaneMeta, &thread_pool_, 1, 0);
+    scheduler.SetLane(kLaneBlock, &thread_pool_, 3, 0);
+    Block();
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host1", "meta"));
+    }
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(Add(&scheduler, kLaneBlock, "host1", "block"));
+    }
+    Release();
+    thread_pool_.Stop(true);
+    ASSERT_EQ(16U, order_.size());
+    // block gets three of every four turns until it runs dry
+    int block = 0;
+    for (int i = 0; i < 8; i++) {
+        block += order_[i] == "block";
+    }
+    ASSERT_EQ(6, block);
+}
+
+TEST_F(RpcSchedulerTest, ClientTurns) {
+    RpcScheduler scheduler;
+    scheduler.SetLane(kLaneMeta, &thread_pool_, 1, 0);
+    Block();
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host1", "host1"));
+    }
+    ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host2", "host2"));
+    Release();
+    thread_pool_.Stop(true);
+    ASSERT_EQ(5U, order_.size());
+    ASSERT_EQ("host1", order_[0]);
+    ASSERT_EQ("host2", order_[1]);
+}
+
+TEST_F(RpcSchedulerTest, TwoPools) {
+    RpcScheduler scheduler;
+    ThreadPool other_pool(1);
+    scheduler.SetLane(kLaneRead, &thread_pool_, 1, 0);
+    scheduler.SetLane(kLaneBlockReport, &thread_pool_, 1, 0);
+    scheduler.SetLane(kLaneMeta, &other_pool, 1, 0);
+    Block();
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(Add(&scheduler, kLaneBlockReport, "host1", "report"));
+    }
+    // The other pool runs ahead, it must not push back lanes of this one
+    for (int i = 0; i < 8; i++) {
+        ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host1", "meta"));
+    }
+    other_pool.Stop(true);
+    ASSERT_TRUE(Add(&scheduler, kLaneRead, "host1", "read"));
+    Release();
+    thread_pool_.Stop(true);
+    ASSERT_EQ(13U, order_.size());
+    ASSERT_EQ("read", order_[8]);
+}
+
+TEST_F(RpcSchedulerTest, Overload) {
+    RpcScheduler scheduler;
+    scheduler.SetLane(kLaneMeta, &thread_pool_, 1, 3);
+    scheduler.SetLane(kLaneHeartBeat, &thread_pool_, 1, 0);
+    scheduler.SetClientMaxPending(2);
+    Block();
+    ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host1", "a"));
+    ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host1", "b"));
+    // host1 used up its share, the lane still has room for others
+    ASSERT_FALSE(Add(&scheduler, kLaneMeta, "host1", "c"));
+    ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host2", "d"));
+    ASSERT_FALSE(Add(&scheduler, kLaneMeta, "host3", "e"));
+    // Unbounded lanes take everything
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(Add(&scheduler, kLaneHeartBeat, "host1", "hb"));
+    }
+    ASSERT_TRUE(scheduler.SetLaneParam("meta", 0, 4));
+    ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host3", "f"));
+    ASSERT_FALSE(scheduler.SetLaneParam("nosuchlane", 1, 1));
+    // Chunkservers drop what is rejected, their lanes stay unbounded
+    ASSERT_FALSE(scheduler.SetLaneParam("heartbeat", 0, 5));
+    ASSERT_TRUE(scheduler.SetLaneParam("heartbeat", 2, -1));
+    ASSERT_TRUE(Add(&scheduler, kLaneHeartBeat, "host1", "hb"));
+
+    std::vector<RpcLaneStat> stats;
+    scheduler.GetStat(&stats);
+    ASSERT_EQ(static_cast<size_t>(kLaneNum), stats.size());
+    ASSERT_EQ("meta", stats[kLaneMeta].name);
+    ASSERT_EQ(4, stats[kLaneMeta].pending);
+    ASSERT_EQ(3, stats[kLaneMeta].clients);
+    ASSERT_EQ(2, stats[kLaneMeta].rejected);
+    ASSERT_EQ(2, stats[kLaneHeartBeat].weight);
+    ASSERT_EQ(0, stats[kLaneHeartBeat].max_pending);
+    // -1 leaves the bound as is, 0 lifts it
+    ASSERT_TRUE(scheduler.SetLaneParam("meta", 3, -1));
+    ASSERT_FALSE(Add(&scheduler, kLaneMeta, "host4", "g"));
+    ASSERT_TRUE(scheduler.SetLaneParam("meta", 0, 0));
+    ASSERT_TRUE(Add(&scheduler, kLaneMeta, "host4", "g"));
+    Release();
+    thread_pool_.Stop(true);
+    ASSERT_EQ(16U, order_.size());
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    baidu::common::SetLogLevel(2);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
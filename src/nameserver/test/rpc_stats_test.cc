@@ -0,0 +1,105 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "nameserver/rpc_stats.h"
+
+#include <gtest/gtest.h>
+#include <common/logging.h>
+#include <common/timer.h>
+
+#include "proto/nameserver.pb.h"
+
+namespace baidu {
+namespace bfs {
+
+using std::placeholders::_1;
+
+class RpcStatsTest : public ::testing::Test {
+public:
+    RpcStatsTest() {}
+};
+
+class Done : public google::protobuf::Closure {
+public:
+    Done() : run(false) {}
+    void Run() { run = true; }
+    bool run;
+};
+
+bool g_synced = false;
+void SyncDone(bool ret) {
+    g_synced = ret;
+}
+
+TEST_F(RpcStatsTest, Bucket) {
+    for (int64_t latency = 0; latency < 100000; latency++) {
+        int32_t bucket = LatencyHistogram::BucketOf(latency);
+        ASSERT_LE(latency, LatencyHistogram::BucketUpperBound(bucket));
+        if (bucket > 0) {
+            ASSERT_GT(latency, LatencyHistogram::BucketUpperBound(bucket - 1));
+        }
+    }
+    ASSERT_EQ(LatencyHistogram::kBucketNum - 1, LatencyHistogram::BucketOf(1L << 62));
+}
+
+TEST_F(RpcStatsTest, Percentile) {
+    LatencyHistogram histogram;
+    ASSERT_EQ(0, histogram.Percentile(99));
+    for (int64_t i = 1; i <= 1000; i++) {
+        histogram.Add(i);
+    }
+    ASSERT_EQ(1000, histogram.Count());
+    ASSERT_EQ(500, histogram.Average());
+    ASSERT_EQ(1000, histogram.Max());
+    int64_t p50 = histogram.Percentile(50);
+    ASSERT_GE(p50, 500);
+    ASSERT_LE(p50, 500 * 1.125);
+    int64_t p99 = histogram.Percentile(99);
+    ASSERT_GE(p99, 990);
+    ASSERT_LE(p99, 990 * 1.125);
+}
+
+TEST_F(RpcStatsTest, Stages) {
+    RpcStats stats(NameServer::descriptor());
+    Done done;
+    google::protobuf::Closure* closure = &done;
+    stats.BeginRpc(1, common::timer::get_micros() - 1000, &closure);
+    {
+        RpcStageTimer timer(kRpcLock);
+        RpcStageTimer nested(kRpcLock);
+    }
+    std::function<void (bool)> sync_callback = stats.TimeSync(std::bind(&SyncDone, _1));
+    stats.EndRpc();
+    ASSERT_EQ(0, stats.Get(1, kRpcSync).Count());
+    sync_callback(true);
+    ASSERT_TRUE(g_synced);
+    ASSERT_EQ(1, stats.Get(1, kRpcSync).Count());
+    ASSERT_EQ(1, stats.Get(1, kRpcQueue).Count());
+    ASSERT_GE(stats.Get(1, kRpcQueue).Max(), 1000);
+    ASSERT_EQ(1, stats.Get(1, kRpcLock).Count());
+    ASSERT_EQ(0, stats.Get(1, kRpcNamespace).Count());
+    ASSERT_EQ(0, stats.Get(1, kRpcTotal).Count());
+    closure->Run();
+    ASSERT_TRUE(done.run);
+    ASSERT_EQ(1, stats.Get(1, kRpcTotal).Count());
+
+    // Outside an rpc nothing is timed
+    {
+        RpcStageTimer timer(kRpcNamespace);
+    }
+    ASSERT_EQ(0, stats.Get(1, kRpcNamespace).Count());
+    ASSERT_EQ("GetFileLocation", stats.MethodName(2));
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    baidu::common::SetLogLevel(2);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
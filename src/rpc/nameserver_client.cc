@@ -14,7 +14,7 @@ namespace bfs {
 
 
 NameServerClient::NameServerClient(RpcClient* rpc_client, const std::string& nameserver_nodes)
-    : rpc_client_(rpc_client), leader_id_(0) {
+    : rpc_client_(rpc_client), leader_id_(0), read_id_(0), last_log_index_(0) {
     common::SplitString(nameserver_nodes, ",", &nameserver_nodes_);
     stubs_.resize(nameserver_nodes_.size());
     for (uint32_t i = 0; i < nameserver_nodes_.size(); i++) {
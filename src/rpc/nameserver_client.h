@@ -7,6 +7,7 @@
 #ifndef  BFS_NAMESERVER_CLIENT_H_
 #define  BFS_NAMESERVER_CLIENT_H_
 
+#include <unistd.h>
 #include <string>
 #include <vector>
 
@@ -38,6 +39,13 @@ public:
             int ns_id = leader_id_;
             ret = rpc_client_->SendRequest(stubs_[ns_id], func, request, response,
                                            rpc_timeout, retry_times);
+            // kOverload is returned before the request is run, back off and try again
+            for (int backoff = 10; ret && response->status() == kOverload && backoff <= 320;
+                 backoff *= 2) {
+                usleep(backoff * 1000);
+                ret = rpc_client_->SendRequest(stubs_[ns_id], func, request, response,
+                                               rpc_timeout, retry_times);
+            }
             if (ret && response->status() != kIsFollower) {
             //    LOG(DEBUG, "Send rpc to %d %s return %s", 
             //        leader_id_, nameserver_nodes_[leader_id_].c_str(),
@@ -53,12 +61,65 @@ public:
         }
         return ret;
     }
+    /// Send a metadata read to a follower if 'request' allows it, to the leader if
+    /// the follower is too far behind. Reads never see an older log than before.
+    template <class Request, class Response, class Callback>
+    bool SendReadRequest(void(NameServer_Stub::*func)(google::protobuf::RpcController*,
+                                                      const Request*, Response*, Callback*),
+                         Request* request, Response* response,
+                         int32_t rpc_timeout, int retry_times = 1) {
+        if (request->consistency() != kReadLeader && stubs_.size() > 1) {
+            int ns_id = 0;
+            {
+                MutexLock lock(&mu_);
+                request->set_min_log_index(last_log_index_);
+                read_id_ = (read_id_ + 1) % stubs_.size();
+                if (read_id_ == leader_id_) {
+                    read_id_ = (read_id_ + 1) % stubs_.size();
+                }
+                ns_id = read_id_;
+            }
+            bool ret = rpc_client_->SendRequest(stubs_[ns_id], func, request, response,
+                                                rpc_timeout, retry_times);
+            if (ret && response->status() != kIsFollower && response->status() != kOverload) {
+                UpdateLogIndex(response->log_index());
+                return true;
+            }
+            response->Clear();
+        }
+        bool ret = SendRequest(func, request, response, rpc_timeout, retry_times);
+        if (ret) {
+            UpdateLogIndex(response->log_index());
+        }
+        return ret;
+    }
+    /// Send a metadata write, later reads through this client see it
+    template <class Request, class Response, class Callback>
+    bool SendWriteRequest(void(NameServer_Stub::*func)(google::protobuf::RpcController*,
+                                                       const Request*, Response*, Callback*),
+                          const Request* request, Response* response,
+                          int32_t rpc_timeout, int retry_times = 1) {
+        bool ret = SendRequest(func, request, response, rpc_timeout, retry_times);
+        if (ret) {
+            UpdateLogIndex(response->log_index());
+        }
+        return ret;
+    }
+private:
+    void UpdateLogIndex(int64_t log_index) {
+        MutexLock lock(&mu_);
+        if (log_index > last_log_index_) {
+            last_log_index_ = log_index;
+        }
+    }
 private:
     RpcClient* rpc_client_;
     std::vector<std::string> nameserver_nodes_;
     std::vector<NameServer_Stub*> stubs_;
     Mutex mu_;
     int leader_id_;
+    int read_id_;
+    int64_t last_log_index_;
 };
 
 }
@@ -12,6 +12,7 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <functional>
 
 namespace baidu {
 namespace bfs {
@@ -52,6 +53,20 @@ struct ReadOptions {
     ReadOptions() : timeout(-1) {}
 };
 
+/// A range of vectored read
+struct ReadRange {
+    char* buf;
+    int32_t len;
+    int64_t offset;
+    int32_t ret;    // filled by ReadV, bytes read
+    ReadRange() : buf(NULL), len(0), offset(0), ret(0) {}
+    ReadRange(char* b, int32_t l, int64_t o) : buf(b), len(l), offset(o), ret(0) {}
+};
+
+/// Completion callback of asynchronous read,
+/// 'ret' is the length of data read or a negative error code
+typedef std::function<void (int32_t ret)> AioCallback;
+
 struct FSOptions {
     const char* username;
     const char* passwd;
@@ -64,6 +79,12 @@ public:
     File() {}
     virtual ~File() {}
     virtual int32_t Pread(char* buf, int32_t read_size, int64_t offset, bool reada = false) = 0;
+    /// Asynchronous pread, return OK if the request is issued and 'callback' will be
+    /// invoked once it completes; 'buf' must be kept valid until then.
+    virtual int32_t AioRead(char* buf, int32_t read_size, int64_t offset,
+                            AioCallback callback) = 0;
+    /// Read multiple ranges in one round trip, return OK or error code
+    virtual int32_t ReadV(ReadRange* ranges, int32_t num) = 0;
     //for files opened with O_WRONLY, only support Seek(0, SEEK_CUR)
     virtual int64_t Seek(int64_t offset, int32_t whence) = 0;
     virtual int32_t Read(char* buf, int32_t read_size) = 0;
@@ -83,6 +104,16 @@ struct BfsFileInfo {
     uint32_t mode;
     char name[1024];
     char link[1024];
+    /// Stays the same across renames, the root directory is 1
+    int64_t entry_id;
+};
+
+/// Usage of a directory tree, a quota of 0 means unlimited
+struct BfsQuotaInfo {
+    int64_t space;
+    int64_t files;
+    int64_t space_quota;
+    int64_t file_quota;
 };
 
 // Bfs fileSystem interface
@@ -96,6 +127,11 @@ public:
     virtual int32_t CreateDirectory(const char* path) = 0;
     /// List Directory
     virtual int32_t ListDirectory(const char* path, BfsFileInfo** filelist, int *num) = 0;
+    /// List the directory with entry id 'dir_id'
+    virtual int32_t ListDirectoryById(int64_t dir_id, BfsFileInfo** filelist, int *num) = 0;
+    /// Stat entry 'name' of the directory with entry id 'parent_id', no path is
+    /// resolved and symlinks are not followed
+    virtual int32_t Lookup(int64_t parent_id, const char* name, BfsFileInfo* fileinfo) = 0;
     /// Delete Directory
     virtual int32_t DeleteDirectory(const char* path, bool recursive) = 0;
     /// Lock Directory
@@ -104,6 +140,11 @@ public:
     virtual int32_t UnlockDirectory(const char* path) = 0;
     /// Du
     virtual int32_t DiskUsage(const char* path, int64_t* du_size) = 0;
+    /// Limit the bytes and the number of entries under a directory, 0 for no limit,
+    /// a negative value keeps the current limit
+    virtual int32_t SetQuota(const char* path, int64_t space_quota, int64_t file_quota) = 0;
+    /// Usage and quota of a directory
+    virtual int32_t GetQuota(const char* path, BfsQuotaInfo* quota) = 0;
     /// Access
     virtual int32_t Access(const char* path, int32_t mode) = 0;
     /// Stat
@@ -117,11 +158,26 @@ public:
                              const WriteOptions& options) = 0;
     virtual int32_t OpenFile(const char* path, int32_t flags, int32_t mode,
                              File** file, const WriteOptions& options) = 0;
+    /// Stat or open many files in one round trip to the nameserver,
+    /// (*rets)[i] is the result for paths[i]
+    virtual int32_t BatchStat(const std::vector<std::string>& paths,
+                              std::vector<BfsFileInfo>* fileinfos,
+                              std::vector<int32_t>* rets) = 0;
+    virtual int32_t BatchOpenFile(const std::vector<std::string>& paths, int32_t flags,
+                                  std::vector<File*>* files, std::vector<int32_t>* rets,
+                                  const ReadOptions& options) = 0;
+    virtual int32_t BatchOpenFile(const std::vector<std::string>& paths, int32_t flags,
+                                  int32_t mode, std::vector<File*>* files,
+                                  std::vector<int32_t>* rets, const WriteOptions& options) = 0;
     virtual int32_t CloseFile(File* file) = 0;
     virtual int32_t DeleteFile(const char* path) = 0;
     virtual int32_t Rename(const char* oldpath, const char* newpath) = 0;
     virtual int32_t Chmod(int32_t mode, const char* path) = 0;
     virtual int32_t ChangeReplicaNum(const char* file_name, int32_t replica_num) = 0;
+    /// Erasure code cold files of a directory, data_num files and parity_num
+    /// parity files in a stripe, encoded files keep one replica
+    virtual int32_t ErasureCodeDirectory(const char* path, int32_t data_num,
+                                         int32_t parity_num) = 0;
     /// Create symlink
     virtual int32_t Symlink(const char* oldpath, const char* newpath) = 0;
 
@@ -17,6 +17,7 @@
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <map>
+#include <functional>
 
 #include <common/string_util.h>
 #include <common/timer.h>
@@ -100,6 +101,14 @@ int bfs_read_file(bfs_file_t* file, char* buf, int32_t len) {
     return file->bfs_file->Read(buf, len);
 }
 
+int bfs_aio_read(bfs_file_t* file, char* buf, int32_t len, int64_t offset,
+                 bfs_aio_callback callback, void* arg) {
+    if (callback == NULL) {
+        return baidu::bfs::BAD_PARAMETER;
+    }
+    return file->bfs_file->AioRead(buf, len, offset, std::bind(callback, std::placeholders::_1, arg));
+}
+
 int64_t bfs_seek(bfs_file_t* file, int64_t offset, int32_t whence) {
     return file->bfs_file->Seek(offset, whence);
 }
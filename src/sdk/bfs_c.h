@@ -17,11 +17,16 @@ extern "C"{
 struct bfs_fs_t;
 struct bfs_file_t;
 
+/// Completion callback of bfs_aio_read, 'ret' is the read length or a negative error code
+typedef void (*bfs_aio_callback)(int32_t ret, void* arg);
+
 bfs_fs_t* bfs_open_file_system(const char* flag_file_path);
 bfs_file_t* bfs_open_file(const bfs_fs_t* fs, const char* path, int flag);
 int bfs_close_file(bfs_file_t* file);
 int bfs_write_file(bfs_file_t* file, const char* buf, int32_t len);
 int bfs_read_file(bfs_file_t* file, char* buf, int32_t len);
+int bfs_aio_read(bfs_file_t* file, char* buf, int32_t len, int64_t offset,
+                 bfs_aio_callback callback, void* arg);
 int64_t bfs_seek(bfs_file_t* file, int64_t offset, int32_t whence);
 int bfs_create_directory(bfs_fs_t* fs, const char* path);
 int bfs_list_directory(bfs_fs_t* fs, const char* path);
@@ -0,0 +1,465 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "cold_store.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <common/logging.h>
+
+#include "proto/file.pb.h"
+#include "erasure_code.h"
+#include "fs_impl.h"
+
+DECLARE_int32(sdk_ec_cold_days);
+DECLARE_int32(sdk_ec_cell_size);
+
+namespace baidu {
+namespace bfs {
+
+static std::string JoinPath(const std::string& dir, const std::string& name) {
+    if (!dir.empty() && dir[dir.size() - 1] == '/') {
+        return dir + name;
+    }
+    return dir + "/" + name;
+}
+
+/// Read len bytes at offset, bytes beyond the end of file read as zero
+static int32_t ReadFull(File* file, char* buf, int32_t len, int64_t offset) {
+    int32_t done = 0;
+    while (done < len) {
+        int32_t ret = file->Pread(buf + done, len - done, offset + done);
+        if (ret < 0) {
+            return ret;
+        } else if (ret == 0) {
+            break;
+        }
+        done += ret;
+    }
+    memset(buf + done, 0, len - done);
+    return len;
+}
+
+/// Degraded reads fetch other units of the stripe, which must not
+/// fall back to reconstruction themselves
+static __thread bool in_reconstruct = false;
+
+/// Units of a stripe are on distinct chunkservers, losing one of them
+/// loses a single unit, which the rest of the stripe rebuilds
+static const int32_t kUnitReplica = 1;
+
+/// Chunkservers and racks taken by the units of a stripe
+struct StripePlacement {
+    std::set<int32_t> servers;
+    std::set<std::string> racks;
+};
+
+struct ColdFile {
+    std::string name;
+    int64_t size;
+    int64_t entry_id;
+    bool operator<(const ColdFile& other) const {
+        return name < other.name;
+    }
+};
+
+ColdStore::ColdStore(FSImpl* fs) : fs_(fs) {
+}
+
+int32_t ColdStore::LoadManifest(const std::string& dir, ErasureCodeManifest* manifest) {
+    std::string path = JoinPath(dir, ".ec/manifest");
+    int64_t size = 0;
+    int32_t ret = fs_->GetFileSize(path.c_str(), &size);
+    if (ret == BAD_PARAMETER) {
+        // No stripe yet
+        return OK;
+    } else if (ret != OK) {
+        return ret;
+    }
+    File* file = NULL;
+    ret = fs_->OpenFile(path.c_str(), O_RDONLY, &file, ReadOptions());
+    if (ret != OK) {
+        return ret;
+    }
+    std::string buf(size, '\0');
+    ret = size > 0 ? ReadFull(file, &buf[0], size, 0) : OK;
+    file->Close();
+    delete file;
+    if (ret < 0) {
+        return ret;
+    }
+    if (!manifest->ParseFromString(buf)) {
+        LOG(WARNING, "Bad erasure code manifest %s", path.c_str());
+        return UNKNOWN_ERROR;
+    }
+    return OK;
+}
+
+int32_t ColdStore::SaveManifest(const std::string& dir, const ErasureCodeManifest& manifest) {
+    std::string path = JoinPath(dir, ".ec/manifest");
+    std::string tmp_path = path + ".tmp";
+    std::string buf;
+    manifest.SerializeToString(&buf);
+    File* file = NULL;
+    int32_t ret = fs_->OpenFile(tmp_path.c_str(), O_WRONLY | O_TRUNC, 0644, &file, WriteOptions());
+    if (ret != OK) {
+        return ret;
+    }
+    if (file->Write(buf.data(), buf.size()) != static_cast<int32_t>(buf.size())) {
+        ret = UNKNOWN_ERROR;
+    }
+    if (file->Close() != OK) {
+        ret = UNKNOWN_ERROR;
+    }
+    delete file;
+    if (ret != OK) {
+        LOG(WARNING, "Write erasure code manifest %s fail", tmp_path.c_str());
+        return ret;
+    }
+    return fs_->Rename(tmp_path.c_str(), path.c_str());
+}
+
+int32_t ColdStore::PickUnitReplica(const std::string& path, StripePlacement* placement) {
+    std::vector<LocatedBlock> blocks;
+    if (fs_->GetLocatedBlocks(path, &blocks) != OK || blocks.empty()) {
+        return -1;
+    }
+    // Only a chunkserver with a replica of every block can keep the unit
+    std::map<int32_t, std::string> racks;
+    for (int i = 0; i < blocks[0].chains_size(); i++) {
+        racks[blocks[0].chains(i).id()] = blocks[0].chains(i).rack();
+    }
+    for (size_t i = 1; i < blocks.size(); i++) {
+        std::map<int32_t, std::string> common;
+        for (int j = 0; j < blocks[i].chains_size(); j++) {
+            int32_t cs_id = blocks[i].chains(j).id();
+            if (racks.find(cs_id) != racks.end()) {
+                common[cs_id] = racks[cs_id];
+            }
+        }
+        racks.swap(common);
+    }
+    std::vector<int32_t> candidates;
+    for (std::map<int32_t, std::string>::iterator it = racks.begin(); it != racks.end(); ++it) {
+        if (placement->servers.find(it->first) == placement->servers.end()) {
+            candidates.push_back(it->first);
+        }
+    }
+    if (candidates.empty()) {
+        return -1;
+    }
+    // Random start spreads the kept replicas, a new rack is better than a new server
+    int32_t start = rand() % candidates.size();
+    int32_t picked = candidates[start];
+    for (size_t i = 0; i < candidates.size(); i++) {
+        int32_t cs_id = candidates[(start + i) % candidates.size()];
+        if (placement->racks.find(racks[cs_id]) == placement->racks.end()) {
+            picked = cs_id;
+            break;
+        }
+    }
+    placement->servers.insert(picked);
+    placement->racks.insert(racks[picked]);
+    return picked;
+}
+
+int32_t ColdStore::AddUnitPlacement(const std::string& path, StripePlacement* placement) {
+    std::vector<LocatedBlock> blocks;
+    int32_t ret = fs_->GetLocatedBlocks(path, &blocks);
+    if (ret != OK) {
+        return ret;
+    }
+    for (size_t i = 0; i < blocks.size(); i++) {
+        for (int j = 0; j < blocks[i].chains_size(); j++) {
+            placement->servers.insert(blocks[i].chains(j).id());
+            placement->racks.insert(blocks[i].chains(j).rack());
+        }
+    }
+    return OK;
+}
+
+int32_t ColdStore::EncodeStripe(const std::string& dir, ErasureCodeStripe* stripe,
+                                StripePlacement* placement) {
+    int32_t data_num = stripe->data_num();
+    int32_t parity_num = stripe->parity_num();
+    std::vector<File*> files(data_num + parity_num, NULL);
+    int32_t ret = OK;
+    for (int32_t i = 0; i < data_num && ret == OK; i++) {
+        std::string path = JoinPath(dir, stripe->files(i));
+        ret = fs_->OpenFile(path.c_str(), O_RDONLY, &files[i], ReadOptions());
+    }
+    WriteOptions options;
+    options.replica = kUnitReplica;
+
+    ErasureCode ec(data_num, parity_num);
+    int32_t cell_size = FLAGS_sdk_ec_cell_size;
+    std::vector<std::string> bufs(data_num + parity_num, std::string(cell_size, '\0'));
+    std::vector<const char*> data(data_num);
+    std::vector<char*> parity(parity_num);
+    for (int32_t i = 0; i < data_num; i++) {
+        data[i] = &bufs[i][0];
+    }
+    for (int32_t i = 0; i < parity_num; i++) {
+        parity[i] = &bufs[data_num + i][0];
+    }
+    for (int64_t offset = 0; offset < stripe->unit_size() && ret == OK; offset += cell_size) {
+        int32_t len = std::min(static_cast<int64_t>(cell_size), stripe->unit_size() - offset);
+        for (int32_t i = 0; i < data_num && ret == OK; i++) {
+            int32_t read_len = ReadFull(files[i], &bufs[i][0], len, offset);
+            ret = read_len < 0 ? read_len : OK;
+        }
+        if (ret != OK) {
+            break;
+        }
+        ec.Encode(&data[0], &parity[0], len);
+        for (int32_t i = 0; i < parity_num && ret == OK; i++) {
+            File*& file = files[data_num + i];
+            std::string path = JoinPath(dir, stripe->parity_files(i));
+            if (file == NULL) {
+                // The first write adds the block, opened one by one so each
+                // parity is placed apart from the units before it
+                std::vector<int32_t> exclude(placement->servers.begin(),
+                                             placement->servers.end());
+                ret = fs_->OpenFileExcluding(path.c_str(), O_WRONLY | O_TRUNC, 0644,
+                                             exclude, &file, options);
+                if (ret != OK) {
+                    break;
+                }
+            }
+            if (file->Write(parity[i], len) != len) {
+                ret = UNKNOWN_ERROR;
+            } else if (offset == 0) {
+                ret = AddUnitPlacement(path, placement);
+            }
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        if (files[i] != NULL) {
+            if (files[i]->Close() != OK && ret == OK) {
+                ret = UNKNOWN_ERROR;
+            }
+            delete files[i];
+        }
+    }
+    for (int32_t i = 0; i < parity_num && ret == OK; i++) {
+        BfsFileInfo info;
+        ret = fs_->Stat(JoinPath(dir, stripe->parity_files(i)).c_str(), &info);
+        stripe->add_entry_ids(info.entry_id);
+    }
+    if (ret != OK) {
+        LOG(WARNING, "Encode stripe %s of %s fail: %s",
+            stripe->parity_files(0).c_str(), dir.c_str(), StrError(ret));
+        for (int32_t i = 0; i < parity_num; i++) {
+            fs_->DeleteFile(JoinPath(dir, stripe->parity_files(i)).c_str());
+        }
+    }
+    return ret;
+}
+
+int32_t ColdStore::EncodeDirectory(const std::string& dir, int32_t data_num, int32_t parity_num) {
+    if (data_num <= 0 || parity_num <= 0 || data_num + parity_num > 255) {
+        return BAD_PARAMETER;
+    }
+    ErasureCodeManifest manifest;
+    int32_t ret = LoadManifest(dir, &manifest);
+    if (ret != OK) {
+        return ret;
+    }
+    std::set<std::string> encoded;
+    for (int i = 0; i < manifest.stripes_size(); i++) {
+        const ErasureCodeStripe& stripe = manifest.stripes(i);
+        encoded.insert(stripe.files().begin(), stripe.files().end());
+    }
+
+    BfsFileInfo* files = NULL;
+    int num = 0;
+    ret = fs_->ListDirectory(dir.c_str(), &files, &num);
+    if (ret != OK) {
+        return ret;
+    }
+    uint32_t cold_time = time(NULL) - FLAGS_sdk_ec_cold_days * 86400;
+    std::vector<ColdFile> cold_files;
+    for (int i = 0; i < num; i++) {
+        // Regular files only, .ec and other hidden entries are left alone
+        if ((files[i].mode >> 9) != 0 || files[i].name[0] == '.'
+            || files[i].size <= 0 || files[i].ctime > cold_time
+            || encoded.find(files[i].name) != encoded.end()) {
+            continue;
+        }
+        ColdFile file = {files[i].name, files[i].size, files[i].entry_id};
+        cold_files.push_back(file);
+    }
+    delete[] files;
+    std::sort(cold_files.begin(), cold_files.end());
+    if (cold_files.size() < static_cast<size_t>(data_num)) {
+        LOG(INFO, "%lu cold files in %s, not enough for a stripe",
+            cold_files.size(), dir.c_str());
+        return OK;
+    }
+    fs_->CreateDirectory(JoinPath(dir, ".ec").c_str());
+
+    // The files left over wait for the next run
+    for (size_t start = 0; start + data_num <= cold_files.size(); start += data_num) {
+        ErasureCodeStripe stripe;
+        stripe.set_data_num(data_num);
+        stripe.set_parity_num(parity_num);
+        int64_t unit_size = 0;
+        for (int32_t i = 0; i < data_num; i++) {
+            const ColdFile& file = cold_files[start + i];
+            stripe.add_files(file.name);
+            stripe.add_sizes(file.size);
+            stripe.add_entry_ids(file.entry_id);
+            unit_size = std::max(unit_size, file.size);
+        }
+        stripe.set_unit_size(unit_size);
+        for (int32_t i = 0; i < parity_num; i++) {
+            char name[64];
+            snprintf(name, sizeof(name), ".ec/%d.p%d", manifest.stripes_size(), i);
+            stripe.add_parity_files(name);
+        }
+        StripePlacement placement;
+        std::vector<int32_t> keep(data_num);
+        for (int32_t i = 0; i < data_num; i++) {
+            keep[i] = PickUnitReplica(JoinPath(dir, stripe.files(i)), &placement);
+        }
+        ret = EncodeStripe(dir, &stripe, &placement);
+        if (ret != OK) {
+            return ret;
+        }
+        manifest.add_stripes()->CopyFrom(stripe);
+        ret = SaveManifest(dir, manifest);
+        if (ret != OK) {
+            return ret;
+        }
+        // Only drop replicas once the stripe can be found by readers
+        for (int32_t i = 0; i < data_num; i++) {
+            std::string path = JoinPath(dir, stripe.files(i));
+            if (keep[i] < 0) {
+                LOG(WARNING, "No replica of %s apart from the other units, keep them all",
+                    path.c_str());
+                continue;
+            }
+            if (fs_->ChangeReplicaNum(path.c_str(), kUnitReplica,
+                                      std::vector<int32_t>(1, keep[i])) != OK) {
+                LOG(WARNING, "Change replica num of %s fail", path.c_str());
+            }
+        }
+        LOG(INFO, "Erasure coded %d files of %s into stripe %d, unit size %ld",
+            data_num, dir.c_str(), manifest.stripes_size() - 1, unit_size);
+    }
+    return OK;
+}
+
+bool ColdStore::IsUnit(const std::string& dir, const ErasureCodeStripe& stripe, int32_t i) {
+    int32_t data_num = stripe.data_num();
+    std::string path = i < data_num ? JoinPath(dir, stripe.files(i))
+                                    : JoinPath(dir, stripe.parity_files(i - data_num));
+    BfsFileInfo info;
+    if (fs_->Stat(path.c_str(), &info) != OK) {
+        return false;
+    }
+    if (i < data_num && info.size != stripe.sizes(i)) {
+        return false;
+    }
+    // Stripes encoded before entry ids were kept only have the size to go by
+    return stripe.entry_ids_size() <= i || info.entry_id == stripe.entry_ids(i);
+}
+
+int32_t ColdStore::ReconstructRead(const std::string& path, char* buf,
+                                   int32_t len, int64_t offset) {
+    if (in_reconstruct) {
+        return UNKNOWN_ERROR;
+    }
+    std::string::size_type pos = path.rfind('/');
+    if (pos == std::string::npos) {
+        return BAD_PARAMETER;
+    }
+    std::string dir = pos == 0 ? "/" : path.substr(0, pos);
+    std::string name = path.substr(pos + 1);
+    ErasureCodeManifest manifest;
+    int32_t ret = LoadManifest(dir, &manifest);
+    if (ret != OK) {
+        return ret;
+    }
+    const ErasureCodeStripe* stripe = NULL;
+    int32_t target = -1;
+    for (int i = 0; i < manifest.stripes_size() && stripe == NULL; i++) {
+        const ErasureCodeStripe& s = manifest.stripes(i);
+        for (int j = 0; j < s.files_size(); j++) {
+            if (s.files(j) == name) {
+                stripe = &s;
+                target = j;
+                break;
+            }
+        }
+    }
+    if (stripe == NULL || !IsUnit(dir, *stripe, target)) {
+        return BAD_PARAMETER;
+    }
+    if (offset >= stripe->sizes(target)) {
+        return 0;
+    }
+    len = std::min(static_cast<int64_t>(len), stripe->sizes(target) - offset);
+
+    in_reconstruct = true;
+    int32_t data_num = stripe->data_num();
+    int32_t total = data_num + stripe->parity_num();
+    std::vector<int32_t> index;
+    std::vector<std::string> bufs;
+    for (int32_t i = 0; i < total && static_cast<int32_t>(index.size()) < data_num; i++) {
+        if (i == target) {
+            continue;
+        }
+        if (!IsUnit(dir, *stripe, i)) {
+            continue;
+        }
+        std::string unit_path = i < data_num ? JoinPath(dir, stripe->files(i))
+                                             : JoinPath(dir, stripe->parity_files(i - data_num));
+        File* file = NULL;
+        if (fs_->OpenFile(unit_path.c_str(), O_RDONLY, &file, ReadOptions()) != OK) {
+            continue;
+        }
+        std::string unit(len, '\0');
+        ret = ReadFull(file, &unit[0], len, offset);
+        file->Close();
+        delete file;
+        if (ret < 0) {
+            LOG(INFO, "Read %s for reconstruction fail: %s", unit_path.c_str(), StrError(ret));
+            continue;
+        }
+        index.push_back(i);
+        bufs.push_back(unit);
+    }
+    in_reconstruct = false;
+
+    if (static_cast<int32_t>(index.size()) < data_num) {
+        LOG(WARNING, "Reconstruct %s fail, only %lu units of stripe alive",
+            path.c_str(), index.size());
+        return UNKNOWN_ERROR;
+    }
+    std::vector<const char*> units(data_num);
+    for (int32_t i = 0; i < data_num; i++) {
+        units[i] = bufs[i].data();
+    }
+    ErasureCode ec(data_num, stripe->parity_num());
+    if (!ec.Decode(index, &units[0], target, buf, len)) {
+        return UNKNOWN_ERROR;
+    }
+    LOG(INFO, "Reconstructed %s [%ld, %ld)", path.c_str(), offset, offset + len);
+    return len;
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
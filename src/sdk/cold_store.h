@@ -0,0 +1,57 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_SDK_COLD_STORE_H_
+#define  BFS_SDK_COLD_STORE_H_
+
+#include <stdint.h>
+#include <string>
+
+namespace baidu {
+namespace bfs {
+
+class FSImpl;
+class ErasureCodeManifest;
+class ErasureCodeStripe;
+struct StripePlacement;
+
+/// Erasure coded tier for cold files.
+/// Every data_num cold files of a directory form a stripe, parity_num
+/// parity files are written to <dir>/.ec/ and every unit keeps one replica,
+/// each on its own chunkserver, and rack when there are enough of them.
+/// <dir>/.ec/manifest lists the stripes, a read that finds no live replica
+/// rebuilds the range from the rest of the stripe.
+class ColdStore {
+public:
+    ColdStore(FSImpl* fs);
+    /// Encode files of 'dir' not changed for sdk_ec_cold_days, files already
+    /// in a stripe are skipped, so it can run again as files get cold
+    int32_t EncodeDirectory(const std::string& dir, int32_t data_num, int32_t parity_num);
+    /// Read [offset, offset + len) of 'path' from the other units of its stripe
+    int32_t ReconstructRead(const std::string& path, char* buf, int32_t len, int64_t offset);
+private:
+    int32_t LoadManifest(const std::string& dir, ErasureCodeManifest* manifest);
+    int32_t SaveManifest(const std::string& dir, const ErasureCodeManifest& manifest);
+    /// Write the parity files of 'stripe' off the chunkservers in 'placement',
+    /// deleted again on failure
+    int32_t EncodeStripe(const std::string& dir, ErasureCodeStripe* stripe,
+                         StripePlacement* placement);
+    /// Chunkserver to keep the replica of 'path' on, apart from the units in
+    /// 'placement'. Return -1 if there is none
+    int32_t PickUnitReplica(const std::string& path, StripePlacement* placement);
+    /// Add the chunkservers holding 'path' to 'placement'
+    int32_t AddUnitPlacement(const std::string& path, StripePlacement* placement);
+    /// Whether unit i of 'stripe' is still the file that was encoded
+    bool IsUnit(const std::string& dir, const ErasureCodeStripe& stripe, int32_t i);
+private:
+    FSImpl* fs_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_SDK_COLD_STORE_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,193 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "erasure_code.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+namespace baidu {
+namespace bfs {
+
+namespace {
+
+/// log/exp tables of GF(2^8) with polynomial x^8+x^4+x^3+x^2+1
+struct GaloisField {
+    uint8_t exp[512];
+    uint8_t log[256];
+    GaloisField() {
+        int x = 1;
+        for (int i = 0; i < 255; i++) {
+            exp[i] = x;
+            log[x] = i;
+            x <<= 1;
+            if (x & 0x100) {
+                x ^= 0x11d;
+            }
+        }
+        for (int i = 255; i < 512; i++) {
+            exp[i] = exp[i - 255];
+        }
+        log[0] = 0;
+    }
+    uint8_t Mul(uint8_t a, uint8_t b) const {
+        if (a == 0 || b == 0) {
+            return 0;
+        }
+        return exp[log[a] + log[b]];
+    }
+    uint8_t Inv(uint8_t a) const {
+        assert(a != 0);
+        return exp[255 - log[a]];
+    }
+};
+
+const GaloisField& GF() {
+    static GaloisField gf;
+    return gf;
+}
+
+} // namespace
+
+ErasureCode::ErasureCode(int32_t data_num, int32_t parity_num)
+    : data_num_(data_num), parity_num_(parity_num) {
+    assert(data_num > 0 && parity_num >= 0 && data_num + parity_num <= 256);
+}
+
+uint8_t ErasureCode::Coefficient(int32_t row, int32_t col) const {
+    if (row < data_num_) {
+        return row == col ? 1 : 0;
+    }
+    // Cauchy matrix 1 / (x_i + y_j), x_i = row and y_j = col never meet
+    return GF().Inv(static_cast<uint8_t>(row ^ col));
+}
+
+/// dst ^= c * src. Products of c with the low and high nibble of every byte
+/// are looked up in two 16 entry tables, 16 or 32 bytes at a time by pshufb.
+void ErasureCode::MulAdd(uint8_t c, const char* src, char* dst, int64_t len) {
+    if (c == 0) {
+        return;
+    }
+    const GaloisField& gf = GF();
+    uint8_t lo[16] __attribute__((aligned(16)));
+    uint8_t hi[16] __attribute__((aligned(16)));
+    for (int i = 0; i < 16; i++) {
+        lo[i] = gf.Mul(c, i);
+        hi[i] = gf.Mul(c, i << 4);
+    }
+    int64_t i = 0;
+#if defined(__AVX2__)
+    __m256i lo_tbl = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i*>(lo)));
+    __m256i hi_tbl = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i*>(hi)));
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i out = _mm256_loadu_si256(reinterpret_cast<__m256i*>(dst + i));
+        __m256i l = _mm256_shuffle_epi8(lo_tbl, _mm256_and_si256(in, mask));
+        __m256i h = _mm256_shuffle_epi8(hi_tbl,
+                        _mm256_and_si256(_mm256_srli_epi64(in, 4), mask));
+        out = _mm256_xor_si256(out, _mm256_xor_si256(l, h));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), out);
+    }
+#elif defined(__SSSE3__)
+    __m128i lo_tbl = _mm_load_si128(reinterpret_cast<__m128i*>(lo));
+    __m128i hi_tbl = _mm_load_si128(reinterpret_cast<__m128i*>(hi));
+    __m128i mask = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i out = _mm_loadu_si128(reinterpret_cast<__m128i*>(dst + i));
+        __m128i l = _mm_shuffle_epi8(lo_tbl, _mm_and_si128(in, mask));
+        __m128i h = _mm_shuffle_epi8(hi_tbl, _mm_and_si128(_mm_srli_epi64(in, 4), mask));
+        out = _mm_xor_si128(out, _mm_xor_si128(l, h));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+    }
+#endif
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+    uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+    for (; i < len; i++) {
+        d[i] ^= lo[s[i] & 0x0f] ^ hi[s[i] >> 4];
+    }
+}
+
+void ErasureCode::Encode(const char* const* data, char** parity, int64_t len) const {
+    for (int32_t p = 0; p < parity_num_; p++) {
+        memset(parity[p], 0, len);
+        for (int32_t d = 0; d < data_num_; d++) {
+            MulAdd(Coefficient(data_num_ + p, d), data[d], parity[p], len);
+        }
+    }
+}
+
+bool ErasureCode::Decode(const std::vector<int32_t>& index, const char* const* units,
+                         int32_t target, char* out, int64_t len) const {
+    int32_t n = data_num_;
+    if (static_cast<int32_t>(index.size()) != n) {
+        return false;
+    }
+    const GaloisField& gf = GF();
+    // Invert the rows of the surviving units, row 'target' of the inverse
+    // gives the data units from the survivors
+    std::vector<uint8_t> m(n * n);
+    std::vector<uint8_t> inv(n * n, 0);
+    for (int32_t r = 0; r < n; r++) {
+        for (int32_t c = 0; c < n; c++) {
+            m[r * n + c] = Coefficient(index[r], c);
+        }
+        inv[r * n + r] = 1;
+    }
+    for (int32_t c = 0; c < n; c++) {
+        int32_t pivot = c;
+        while (pivot < n && m[pivot * n + c] == 0) {
+            ++pivot;
+        }
+        if (pivot == n) {
+            return false;
+        }
+        for (int32_t k = 0; k < n; k++) {
+            std::swap(m[c * n + k], m[pivot * n + k]);
+            std::swap(inv[c * n + k], inv[pivot * n + k]);
+        }
+        uint8_t scale = gf.Inv(m[c * n + c]);
+        for (int32_t k = 0; k < n; k++) {
+            m[c * n + k] = gf.Mul(m[c * n + k], scale);
+            inv[c * n + k] = gf.Mul(inv[c * n + k], scale);
+        }
+        for (int32_t r = 0; r < n; r++) {
+            uint8_t f = m[r * n + c];
+            if (r == c || f == 0) {
+                continue;
+            }
+            for (int32_t k = 0; k < n; k++) {
+                m[r * n + k] ^= gf.Mul(f, m[c * n + k]);
+                inv[r * n + k] ^= gf.Mul(f, inv[c * n + k]);
+            }
+        }
+    }
+    // A parity unit is its row of the code applied to the rebuilt data
+    std::vector<uint8_t> coef(n, 0);
+    for (int32_t d = 0; d < n; d++) {
+        uint8_t t = Coefficient(target, d);
+        if (t == 0) {
+            continue;
+        }
+        for (int32_t k = 0; k < n; k++) {
+            coef[k] ^= gf.Mul(t, inv[d * n + k]);
+        }
+    }
+    memset(out, 0, len);
+    for (int32_t k = 0; k < n; k++) {
+        MulAdd(coef[k], units[k], out, len);
+    }
+    return true;
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,43 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_SDK_ERASURE_CODE_H_
+#define  BFS_SDK_ERASURE_CODE_H_
+
+#include <stdint.h>
+#include <vector>
+
+namespace baidu {
+namespace bfs {
+
+/// Systematic Reed-Solomon code over GF(2^8) with a Cauchy parity matrix,
+/// any data_num of the data_num + parity_num units rebuild the others.
+/// Units 0 .. data_num-1 are data, the rest parity.
+class ErasureCode {
+public:
+    ErasureCode(int32_t data_num, int32_t parity_num);
+    int32_t DataNum() const { return data_num_; }
+    int32_t ParityNum() const { return parity_num_; }
+    /// Compute parity_num parity buffers of len bytes from data_num data buffers
+    void Encode(const char* const* data, char** parity, int64_t len) const;
+    /// Rebuild unit 'target' from the data_num units listed in 'index'
+    bool Decode(const std::vector<int32_t>& index, const char* const* units,
+                int32_t target, char* out, int64_t len) const;
+private:
+    friend class ErasureCodeTest;
+    /// Coefficient of data unit 'col' in unit 'row'
+    uint8_t Coefficient(int32_t row, int32_t col) const;
+    static void MulAdd(uint8_t c, const char* src, char* dst, int64_t len);
+private:
+    int32_t data_num_;
+    int32_t parity_num_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_SDK_ERASURE_CODE_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
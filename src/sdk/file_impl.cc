@@ -14,11 +14,15 @@
 #include "rpc/rpc_client.h"
 #include "rpc/nameserver_client.h"
 
+#include "cold_store.h"
 #include "fs_impl.h"
+#include "latency_tracker.h"
+#include "replica_scorer.h"
 
-DECLARE_int32(sdk_file_reada_len);
 DECLARE_int32(sdk_createblock_retry);
 DECLARE_int32(sdk_write_retry_times);
+DECLARE_bool(sdk_read_hedge);
+DECLARE_bool(sdk_ec_degraded_read);
 
 
 namespace baidu {
@@ -87,11 +91,11 @@ FileImpl::FileImpl(FSImpl* fs, RpcClient* rpc_client,
     open_flags_(flags), write_offset_(0), block_for_write_(NULL),
     write_buf_(NULL), last_seq_(-1), back_writing_(0),
     w_options_(options),
-    chunkserver_(NULL), last_chunkserver_index_(-1),
-    read_offset_(0), reada_buffer_(NULL),
-    reada_buf_len_(0), reada_base_(0), sequential_ratio_(0),
+    read_offset_(0), sequential_ratio_(0),
     last_read_offset_(-1), r_options_(ReadOptions()), closed_(false), synced_(false),
-    sync_signal_(&mu_), bg_error_(false) {
+    sync_signal_(&mu_),
+    reada_(&mu_, std::bind(&FileImpl::ScheduleReadahead, this, std::placeholders::_1)),
+    bg_error_(false) {
         thread_pool_ = fs->thread_pool_;
 }
 
@@ -101,11 +105,11 @@ FileImpl::FileImpl(FSImpl* fs, RpcClient* rpc_client,
     open_flags_(flags), write_offset_(0), block_for_write_(NULL),
     write_buf_(NULL), last_seq_(-1), back_writing_(0),
     w_options_(WriteOptions()),
-    chunkserver_(NULL), last_chunkserver_index_(-1),
-    read_offset_(0), reada_buffer_(NULL),
-    reada_buf_len_(0), reada_base_(0), sequential_ratio_(0),
+    read_offset_(0), sequential_ratio_(0),
     last_read_offset_(-1), r_options_(options), closed_(false), synced_(false),
-    sync_signal_(&mu_), bg_error_(false) {
+    sync_signal_(&mu_),
+    reada_(&mu_, std::bind(&FileImpl::ScheduleReadahead, this, std::placeholders::_1)),
+    bg_error_(false) {
         thread_pool_ = fs->thread_pool_;
 }
 
@@ -115,10 +119,6 @@ FileImpl::~FileImpl () {
     }
     delete block_for_write_;
     block_for_write_ = NULL;
-    delete chunkserver_;
-    chunkserver_ = NULL;
-    delete[] reada_buffer_;
-    reada_buffer_ = NULL;
     std::map<std::string, common::SlidingWindow<int>* >::iterator w_it;
     for (w_it = write_windows_.begin(); w_it != write_windows_.end(); ++w_it) {
         delete w_it->second;
@@ -129,11 +129,6 @@ FileImpl::~FileImpl () {
         delete it->second;
         it->second = NULL;
     }
-    std::set<ChunkServer_Stub*>::iterator bad_cs_it;
-    for (bad_cs_it = bad_chunkservers_.begin();
-            bad_cs_it != bad_chunkservers_.end(); ++bad_cs_it) {
-        delete *bad_cs_it;
-    }
 }
 
 int32_t FileImpl::Pread(char* buf, int32_t read_len, int64_t offset, bool reada) {
@@ -153,123 +148,405 @@ int32_t FileImpl::Pread(char* buf, int32_t read_len, int64_t offset, bool reada)
             sequential_ratio_++;
         }
         last_read_offset_ = offset + read_len;
-        if (reada_buffer_ && reada_base_ <= offset &&
-                reada_base_ + reada_buf_len_ >= offset + read_len) {
-            memcpy(buf, reada_buffer_ + (offset - reada_base_), read_len);
-            //LOG(INFO, "Read %s %ld from cache %ld", _name.c_str(), offset, read_len);
-            return read_len;
+        if (reada && open_flags_ == O_RDONLY) {
+            // Streams stop at the located block size
+            int64_t size = located_blocks_.blocks_.empty()
+                           ? 0 : located_blocks_.blocks_[0].block_size();
+            int32_t ret = reada_.Read(buf, read_len, offset, size, sequential_ratio_ > 2);
+            if (ret >= 0) {
+                return ret;
+            }
         }
     }
 
     LocatedBlock lcblock;
-    ChunkServer_Stub* chunk_server = NULL;
-    std::string cs_addr;
+    int32_t cs_index = -1;
     int64_t block_id;
     {
         MutexLock lock(&mu_, "Pread GetStub", 1000);
         if (located_blocks_.blocks_.empty()) {
             return 0;
-        } else if (located_blocks_.blocks_[0].chains_size() == 0) {
-            if (located_blocks_.blocks_[0].block_size() == 0) {
-                return 0;
-            } else {
-                LOG(WARNING, "No located chunkserver of block #%ld",
-                    located_blocks_.blocks_[0].block_id());
-                return TIMEOUT;
-            }
         }
         lcblock.CopyFrom(located_blocks_.blocks_[0]);
-        if (last_chunkserver_index_ == -1 || !chunkserver_) {
-            const std::string& local_host_name = fs_->local_host_name_;
-            for (int i = 0; i < lcblock.chains_size(); i++) {
-                std::string addr = lcblock.chains(i).address();
-                std::string cs_name = std::string(addr, 0, addr.find_last_of(':'));
-                if (cs_name == local_host_name) {
-                    last_chunkserver_index_ = i;
-                    cs_addr = lcblock.chains(i).address();
-                    break;
-                }
-            }
-            if (last_chunkserver_index_ == -1) {
-                int server_index = rand() % lcblock.chains_size();
-                cs_addr = lcblock.chains(server_index).address();
-                last_chunkserver_index_ = server_index;
-            }
-            fs_->rpc_client_->GetStub(cs_addr, &chunkserver_);
-        }
-        chunk_server = chunkserver_;
         block_id = lcblock.block_id();
     }
+    if (lcblock.chains_size() == 0) {
+        if (lcblock.block_size() == 0) {
+            return 0;
+        }
+        LOG(WARNING, "No located chunkserver of block #%ld", block_id);
+        return DegradedRead(buf, read_len, offset, TIMEOUT);
+    }
+    cs_index = fs_->replica_scorer_->SelectReplica(lcblock);
 
     ReadBlockRequest request;
     ReadBlockResponse response;
     request.set_sequence_id(common::timer::get_micros());
     request.set_block_id(block_id);
     request.set_offset(offset);
-    int32_t rlen = read_len;
-    if (sequential_ratio_ > 2
-        && reada
-        && read_len < FLAGS_sdk_file_reada_len) {
-        rlen = std::min(static_cast<int64_t>(FLAGS_sdk_file_reada_len),
-                        static_cast<int64_t>(sequential_ratio_) * read_len);
-        LOG(DEBUG, "Pread(%s, %ld, %d) sequential_ratio_: %d, readahead to %d",
-            name_.c_str(), offset, read_len, sequential_ratio_, rlen);
-    }
-    request.set_read_len(rlen);
+    request.set_read_len(read_len);
     bool ret = false;
+    bool succeed = false;
+
+    if (FLAGS_sdk_read_hedge && lcblock.chains_size() > 1) {
+        succeed = ret = HedgedRead(lcblock, cs_index, request, &response);
+        if (!succeed) {
+            cs_index = fs_->replica_scorer_->SelectReplica(lcblock);
+        }
+    }
 
-    for (int retry_times = 0; retry_times < lcblock.chains_size() * 2; retry_times++) {
+    for (int retry_times = 0; !succeed && retry_times < lcblock.chains_size() * 2; retry_times++) {
+        const std::string& cs_addr = lcblock.chains(cs_index).address();
+        ChunkServer_Stub* chunk_server = NULL;
+        {
+            MutexLock lock(&mu_, "Pread GetStub", 1000);
+            chunk_server = GetReadStub(cs_addr);
+        }
         LOG(DEBUG, "Start Pread: %s", cs_addr.c_str());
+        int64_t send_time = common::timer::get_micros();
         ret = fs_->rpc_client_->SendRequest(chunk_server, &ChunkServer_Stub::ReadBlock,
                     &request, &response, 15, 3);
 
         if (!ret || response.status() != kOK) {
-            cs_addr = lcblock.chains((++last_chunkserver_index_) % lcblock.chains_size()).address();
-            LOG(INFO, "Pread retry another chunkserver: %s", cs_addr.c_str());
-            {
-                MutexLock lock(&mu_, "Pread change chunkserver", 1000);
-                if (chunk_server != chunkserver_) {
-                    chunk_server = chunkserver_;
-                } else {
-                    bad_chunkservers_.insert(chunk_server);
-                    fs_->rpc_client_->GetStub(cs_addr, &chunk_server);
-                    chunkserver_ = chunk_server;
-                }
-            }
+            fs_->replica_scorer_->ReportFailure(cs_addr);
+            cs_index = fs_->replica_scorer_->SelectReplica(lcblock, cs_index);
+            LOG(INFO, "Pread retry another chunkserver: %s",
+                lcblock.chains(cs_index).address().c_str());
         } else {
-            break;
+            int64_t latency = common::timer::get_micros() - send_time;
+            fs_->replica_scorer_->ReportSuccess(cs_addr, latency);
+            fs_->read_latency_->Record(cs_addr, latency);
+            succeed = true;
         }
     }
 
-    if (!ret || response.status() != kOK) {
+    if (!succeed) {
         LOG(WARNING, "Read block %ld fail, ret= %d status= %s\n", block_id, ret, StatusCode_Name(response.status()).c_str());
-        if (!ret) {
-            return TIMEOUT;
-        } else {
-            return GetErrorCode(response.status());
-        }
+        return DegradedRead(buf, read_len, offset,
+                            ret ? GetErrorCode(response.status()) : TIMEOUT);
     }
 
     //printf("Pread[%s:%ld:%ld] return %lu bytes\n",
     //       _name.c_str(), offset, read_len, response.databuf().size());
     int32_t ret_len = response.databuf().size();
-    if (read_len < ret_len) {
-        MutexLock lock(&mu_, "Pread fill buffer", 1000);
-        int32_t cache_len = ret_len - read_len;
-        if (cache_len > reada_buf_len_) {
-            delete[] reada_buffer_;
-            reada_buffer_ = new char[cache_len];
-        }
-        reada_buf_len_ = cache_len;
-        memcpy(reada_buffer_, response.databuf().data() + read_len, cache_len);
-        reada_base_ = offset + read_len;
-        ret_len = read_len;
-    }
     assert(read_len >= ret_len);
     memcpy(buf, response.databuf().data(), ret_len);
     return ret_len;
 }
 
+int32_t FileImpl::DegradedRead(char* buf, int32_t read_len, int64_t offset, int32_t error) {
+    if (!FLAGS_sdk_ec_degraded_read) {
+        return error;
+    }
+    int32_t ret = fs_->cold_store_->ReconstructRead(name_, buf, read_len, offset);
+    return ret >= 0 ? ret : error;
+}
+
+void FileImpl::ScheduleReadahead(ReadaheadBuffer* rb) {
+    // In-flight read ahead holds a reference to us, so all buffers are done
+    // before reada_ goes away
+    thread_pool_->AddTask(std::bind(&FileImpl::StartReadahead, shared_from_this(), rb));
+}
+
+void FileImpl::StartReadahead(ReadaheadBuffer* rb) {
+    int32_t ret = AioRead(rb->data, rb->len, rb->offset,
+                          std::bind(&FileImpl::OnReadaheadDone, shared_from_this(),
+                                    rb, std::placeholders::_1));
+    if (ret != OK) {
+        OnReadaheadDone(rb, ret);
+    }
+}
+
+void FileImpl::OnReadaheadDone(ReadaheadBuffer* rb, int32_t ret) {
+    MutexLock lock(&mu_, "OnReadaheadDone", 1000);
+    reada_.Done(rb, ret);
+}
+
+bool FileImpl::HedgedRead(const LocatedBlock& lcblock, int32_t cs_index,
+                          const ReadBlockRequest& request, ReadBlockResponse* response) {
+    const std::string& primary = lcblock.chains(cs_index).address();
+    int64_t delay = fs_->read_latency_->HedgeDelay(primary);
+    std::shared_ptr<HedgedReadContext> ctx(new HedgedReadContext);
+    ctx->request.CopyFrom(request);
+    SendHedgedRead(ctx, primary, cs_index);
+
+    bool need_hedge = false;
+    {
+        MutexLock lock(&ctx->mu, "HedgedRead wait primary", 1000);
+        int64_t deadline = common::timer::get_micros() + delay * 1000;
+        int64_t remaining = delay;
+        while (ctx->winner == -1 && ctx->pending > 0 && remaining > 0) {
+            ctx->cond.TimeWait(remaining, "HedgedRead");
+            remaining = (deadline - common::timer::get_micros()) / 1000;
+        }
+        need_hedge = (ctx->winner == -1);
+    }
+    if (need_hedge) {
+        int32_t backup_index = fs_->replica_scorer_->SelectReplica(lcblock, cs_index);
+        const std::string& backup = lcblock.chains(backup_index).address();
+        LOG(DEBUG, "HedgedRead #%ld %s not answered in %ld ms, hedge to %s",
+            request.block_id(), primary.c_str(), delay, backup.c_str());
+        SendHedgedRead(ctx, backup, backup_index);
+    }
+
+    MutexLock lock(&ctx->mu, "HedgedRead wait", 1000);
+    while (ctx->winner == -1 && ctx->pending > 0) {
+        ctx->cond.Wait("HedgedRead");
+    }
+    if (ctx->winner == -1) {
+        return false;
+    }
+    // The slower rpc can't be cancelled, its response will be dropped in callback
+    response->Swap(&ctx->response);
+    return true;
+}
+
+void FileImpl::SendHedgedRead(std::shared_ptr<HedgedReadContext> ctx,
+                              const std::string& cs_addr, int32_t cs_index) {
+    ChunkServer_Stub* stub = NULL;
+    {
+        MutexLock lock(&mu_, "SendHedgedRead", 1000);
+        stub = GetReadStub(cs_addr);
+    }
+    {
+        MutexLock lock(&ctx->mu, "SendHedgedRead", 1000);
+        ++ctx->pending;
+    }
+    std::function<void (const ReadBlockRequest*, ReadBlockResponse*, bool, int)> callback
+        = std::bind(&FileImpl::HedgedReadCallback, shared_from_this(), ctx,
+                    cs_addr, cs_index, common::timer::get_micros(),
+                    std::placeholders::_1, std::placeholders::_2,
+                    std::placeholders::_3, std::placeholders::_4);
+    ReadBlockResponse* response = new ReadBlockResponse;
+    rpc_client_->AsyncRequest(stub, &ChunkServer_Stub::ReadBlock,
+                              &ctx->request, response, callback, 15, 1);
+}
+
+void FileImpl::HedgedReadCallback(std::shared_ptr<HedgedReadContext> ctx,
+                                  const std::string& cs_addr, int32_t cs_index,
+                                  int64_t send_time,
+                                  const ReadBlockRequest* request,
+                                  ReadBlockResponse* response,
+                                  bool failed, int error) {
+    bool ok = !failed && response->status() == kOK;
+    if (ok) {
+        int64_t latency = common::timer::get_micros() - send_time;
+        fs_->replica_scorer_->ReportSuccess(cs_addr, latency);
+        fs_->read_latency_->Record(cs_addr, latency);
+    } else {
+        fs_->replica_scorer_->ReportFailure(cs_addr);
+        LOG(INFO, "HedgedRead #%ld from %s fail, error= %d status= %s",
+            request->block_id(), cs_addr.c_str(), error,
+            StatusCode_Name(response->status()).c_str());
+    }
+    {
+        MutexLock lock(&ctx->mu, "HedgedReadCallback", 1000);
+        --ctx->pending;
+        if (ok && ctx->winner == -1) {
+            ctx->winner = cs_index;
+            ctx->response.Swap(response);
+        }
+        if (ctx->winner != -1 || ctx->pending == 0) {
+            ctx->cond.Broadcast();
+        }
+    }
+    delete response;
+}
+
+ChunkServer_Stub* FileImpl::GetReadStub(const std::string& cs_addr) {
+    mu_.AssertHeld();
+    ChunkServer_Stub*& stub = chunkservers_[cs_addr];
+    if (stub == NULL) {
+        rpc_client_->GetStub(cs_addr, &stub);
+    }
+    return stub;
+}
+
+int32_t FileImpl::AioRead(char* buf, int32_t read_len, int64_t offset,
+                          AioCallback callback) {
+    if (read_len <= 0 || buf == NULL || offset < 0 || !callback) {
+        LOG(WARNING, "AioRead(%s, %ld, %d), bad parameters!",
+            name_.c_str(), offset, read_len);
+        return BAD_PARAMETER;
+    }
+    if (open_flags_ != O_RDONLY) {
+        return BAD_PARAMETER;
+    }
+    int32_t cs_index = -1;
+    int64_t block_id = -1;
+    {
+        MutexLock lock(&mu_, "AioRead GetStub", 1000);
+        if (!located_blocks_.blocks_.empty()) {
+            const LocatedBlock& lcblock = located_blocks_.blocks_[0];
+            if (offset >= lcblock.block_size()) {
+                // At or past the end, chunkserver would fail the read
+                cs_index = -1;
+            } else if (lcblock.chains_size() > 0) {
+                cs_index = fs_->replica_scorer_->SelectReplica(lcblock);
+                block_id = lcblock.block_id();
+            } else {
+                LOG(WARNING, "No located chunkserver of block #%ld", lcblock.block_id());
+                return TIMEOUT;
+            }
+        }
+    }
+    if (cs_index == -1) {
+        // Empty file or end of file, complete immediately
+        callback(0);
+        return OK;
+    }
+
+    ReadBlockRequest* request = new ReadBlockRequest;
+    request->set_sequence_id(common::timer::get_micros());
+    request->set_block_id(block_id);
+    request->set_offset(offset);
+    request->set_read_len(read_len);
+    SendAioRead(request, buf, read_len, cs_index, 0, callback);
+    return OK;
+}
+
+void FileImpl::SendAioRead(ReadBlockRequest* request, char* buf, int32_t read_len,
+                           int32_t cs_index, int retry_times, AioCallback callback) {
+    ChunkServer_Stub* stub = NULL;
+    std::string cs_addr;
+    {
+        MutexLock lock(&mu_, "SendAioRead", 1000);
+        const LocatedBlock& lcblock = located_blocks_.blocks_[0];
+        cs_addr = lcblock.chains(cs_index).address();
+        stub = GetReadStub(cs_addr);
+        LOG(DEBUG, "AioRead #%ld from %s, offset= %ld, len= %d, retry= %d",
+            request->block_id(), cs_addr.c_str(), request->offset(), read_len, retry_times);
+    }
+    // The callback holds a reference of FileImpl, so the stub outlives the rpc
+    std::function<void (const ReadBlockRequest*, ReadBlockResponse*, bool, int)> rpc_callback
+        = std::bind(&FileImpl::AioReadCallback, shared_from_this(),
+                    cs_addr, common::timer::get_micros(),
+                    std::placeholders::_1, std::placeholders::_2,
+                    std::placeholders::_3, std::placeholders::_4,
+                    buf, read_len, cs_index, retry_times, callback);
+    ReadBlockResponse* response = new ReadBlockResponse;
+    rpc_client_->AsyncRequest(stub, &ChunkServer_Stub::ReadBlock,
+                              request, response, rpc_callback, 15, 1);
+}
+
+void FileImpl::AioReadCallback(const std::string& cs_addr, int64_t send_time,
+                               const ReadBlockRequest* request,
+                               ReadBlockResponse* response,
+                               bool failed, int error,
+                               char* buf, int32_t read_len,
+                               int32_t cs_index, int retry_times,
+                               AioCallback callback) {
+    if (failed || response->status() != kOK) {
+        fs_->replica_scorer_->ReportFailure(cs_addr);
+        int32_t chains_size = 0;
+        {
+            MutexLock lock(&mu_, "AioReadCallback", 1000);
+            const LocatedBlock& lcblock = located_blocks_.blocks_[0];
+            chains_size = lcblock.chains_size();
+            cs_index = fs_->replica_scorer_->SelectReplica(lcblock, cs_index);
+        }
+        if (retry_times + 1 < chains_size * 2) {
+            LOG(INFO, "AioRead #%ld retry another chunkserver, error= %d status= %s",
+                request->block_id(), error, StatusCode_Name(response->status()).c_str());
+            delete response;
+            SendAioRead(const_cast<ReadBlockRequest*>(request), buf, read_len,
+                        cs_index, retry_times + 1, callback);
+            return;
+        }
+        LOG(WARNING, "AioRead #%ld fail, error= %d status= %s",
+            request->block_id(), error, StatusCode_Name(response->status()).c_str());
+        int32_t ret = failed ? TIMEOUT : GetErrorCode(response->status());
+        delete request;
+        delete response;
+        callback(ret);
+        return;
+    }
+    fs_->replica_scorer_->ReportSuccess(cs_addr, common::timer::get_micros() - send_time);
+    int32_t ret_len = std::min(read_len, static_cast<int32_t>(response->databuf().size()));
+    memcpy(buf, response->databuf().data(), ret_len);
+    delete request;
+    delete response;
+    callback(ret_len);
+}
+
+int32_t FileImpl::ReadV(ReadRange* ranges, int32_t num) {
+    if (ranges == NULL || num <= 0) {
+        return BAD_PARAMETER;
+    }
+    for (int32_t i = 0; i < num; i++) {
+        if (ranges[i].buf == NULL || ranges[i].len <= 0 || ranges[i].offset < 0) {
+            LOG(WARNING, "ReadV(%s, %ld, %d), bad parameters!",
+                name_.c_str(), ranges[i].offset, ranges[i].len);
+            return BAD_PARAMETER;
+        }
+        ranges[i].ret = 0;
+    }
+    LocatedBlock lcblock;
+    {
+        MutexLock lock(&mu_, "ReadV", 1000);
+        if (located_blocks_.blocks_.empty()) {
+            return OK;
+        } else if (located_blocks_.blocks_[0].chains_size() == 0) {
+            if (located_blocks_.blocks_[0].block_size() == 0) {
+                return OK;
+            }
+            LOG(WARNING, "No located chunkserver of block #%ld",
+                located_blocks_.blocks_[0].block_id());
+            return TIMEOUT;
+        }
+        lcblock.CopyFrom(located_blocks_.blocks_[0]);
+    }
+
+    ReadBlockVRequest request;
+    ReadBlockVResponse response;
+    request.set_sequence_id(common::timer::get_micros());
+    request.set_block_id(lcblock.block_id());
+    for (int32_t i = 0; i < num; i++) {
+        BlockRange* range = request.add_ranges();
+        range->set_offset(ranges[i].offset);
+        range->set_len(ranges[i].len);
+    }
+    bool ret = false;
+    bool succeed = false;
+    int32_t cs_index = fs_->replica_scorer_->SelectReplica(lcblock);
+    for (int retry_times = 0; !succeed && retry_times < lcblock.chains_size() * 2; retry_times++) {
+        const std::string& cs_addr = lcblock.chains(cs_index).address();
+        ChunkServer_Stub* chunk_server = NULL;
+        {
+            MutexLock lock(&mu_, "ReadV GetStub", 1000);
+            chunk_server = GetReadStub(cs_addr);
+        }
+        int64_t send_time = common::timer::get_micros();
+        ret = rpc_client_->SendRequest(chunk_server, &ChunkServer_Stub::ReadBlockV,
+                                       &request, &response, 15, 3);
+        if (!ret || response.status() != kOK || response.databuf_size() != num) {
+            fs_->replica_scorer_->ReportFailure(cs_addr);
+            cs_index = fs_->replica_scorer_->SelectReplica(lcblock, cs_index);
+            LOG(INFO, "ReadV retry another chunkserver: %s",
+                lcblock.chains(cs_index).address().c_str());
+        } else {
+            fs_->replica_scorer_->ReportSuccess(cs_addr, common::timer::get_micros() - send_time);
+            succeed = true;
+        }
+    }
+    if (!succeed) {
+        LOG(WARNING, "ReadV block #%ld fail, ret= %d status= %s",
+            lcblock.block_id(), ret, StatusCode_Name(response.status()).c_str());
+        if (!ret) {
+            return TIMEOUT;
+        } else {
+            return GetErrorCode(response.status());
+        }
+    }
+    for (int32_t i = 0; i < num; i++) {
+        const std::string& databuf = response.databuf(i);
+        int32_t len = std::min(ranges[i].len, static_cast<int32_t>(databuf.size()));
+        memcpy(ranges[i].buf, databuf.data(), len);
+        ranges[i].ret = len;
+    }
+    return OK;
+}
+
 int64_t FileImpl::Seek(int64_t offset, int32_t whence) {
     //printf("Seek[%s:%d:%ld]\n", _name.c_str(), whence, offset);
     if (open_flags_ != O_RDONLY) {
@@ -318,6 +595,9 @@ int32_t FileImpl::AddBlock() {
     request.set_file_name(name_);
     const std::string& local_host_name = fs_->local_host_name_;
     request.set_client_address(local_host_name);
+    for (size_t i = 0; i < exclude_chunkservers_.size(); i++) {
+        request.add_exclude_chunkservers(exclude_chunkservers_[i]);
+    }
     bool ret = fs_->nameserver_client_->SendRequest(&NameServer_Stub::AddBlock,
                                                     &request, &response, 15, 1);
     if (!ret || !response.has_block()) {
@@ -768,8 +1048,8 @@ int32_t FileImpl::Sync() {
         request.set_block_id(block_for_write_->block_id());
         request.set_file_name(name_);
         request.set_size(sync_offset);
-        bool rpc_ret = fs_->nameserver_client_->SendRequest(&NameServer_Stub::SyncBlock,
-                                                            &request, &response, 15, 1);
+        bool rpc_ret = fs_->nameserver_client_->SendWriteRequest(&NameServer_Stub::SyncBlock,
+                                                                 &request, &response, 15, 1);
         if (!(rpc_ret && response.status() == kOK))  {
             LOG(WARNING, "Starting file %s fail, starting report returns %d, status: %s",
                     name_.c_str(), rpc_ret, StatusCode_Name(response.status()).c_str());
@@ -844,7 +1124,7 @@ int32_t FileImpl::Close() {
         request.set_block_version(last_seq_);
         request.set_block_size(write_offset_);
         request.set_close_with_error(bg_error_);
-        bool rpc_ret = fs_->nameserver_client_->SendRequest(&NameServer_Stub::FinishBlock,
+        bool rpc_ret = fs_->nameserver_client_->SendWriteRequest(&NameServer_Stub::FinishBlock,
                                                    &request, &response, 15, 1);
         if (!(rpc_ret && response.status() == kOK))  {
             LOG(WARNING, "Close file %s fail, finish report returns %d, status: %s",
@@ -6,6 +6,7 @@
 #ifndef  BFS_SDK_FILE_IMPL_H_
 #define  BFS_SDK_FILE_IMPL_H_
 
+#include <deque>
 #include <map>
 #include <set>
 #include <string>
@@ -21,6 +22,7 @@
 #include "proto/chunkserver.pb.h"
 
 #include "bfs.h"
+#include "readahead.h"
 
 namespace baidu {
 namespace bfs {
@@ -56,6 +58,17 @@ private:
 class FSImpl;
 class RpcClient;
 
+/// Shared by the primary and the hedged read of one Pread
+struct HedgedReadContext {
+    Mutex mu;
+    CondVar cond;
+    ReadBlockRequest request;
+    ReadBlockResponse response;
+    int32_t pending;        ///< outstanding rpcs
+    int32_t winner;         ///< index of the replica which answered first, -1 if none
+    HedgedReadContext() : cond(&mu), pending(0), winner(-1) {}
+};
+
 struct LocatedBlocks {
     int64_t file_length_;
     std::vector<LocatedBlock> blocks_;
@@ -74,6 +87,8 @@ public:
              int32_t flags, const ReadOptions& options);
     ~FileImpl ();
     int32_t Pread(char* buf, int32_t read_size, int64_t offset, bool reada = false);
+    int32_t AioRead(char* buf, int32_t read_size, int64_t offset, AioCallback callback);
+    int32_t ReadV(ReadRange* ranges, int32_t num);
     int64_t Seek(int64_t offset, int32_t whence);
     int32_t Read(char* buf, int32_t read_size);
     int32_t Write(const char* buf, int32_t write_size);
@@ -121,6 +136,32 @@ private:
                                  const WriteBlockRequest* request,
                                  int retry_times, const std::string& cs_addr);
     bool IsChainsWrite();
+    ChunkServer_Stub* GetReadStub(const std::string& cs_addr);
+    void SendAioRead(ReadBlockRequest* request, char* buf, int32_t read_size,
+                     int32_t cs_index, int retry_times, AioCallback callback);
+    bool HedgedRead(const LocatedBlock& lcblock, int32_t cs_index,
+                    const ReadBlockRequest& request, ReadBlockResponse* response);
+    void SendHedgedRead(std::shared_ptr<HedgedReadContext> ctx,
+                        const std::string& cs_addr, int32_t cs_index);
+    void HedgedReadCallback(std::shared_ptr<HedgedReadContext> ctx,
+                            const std::string& cs_addr, int32_t cs_index,
+                            int64_t send_time,
+                            const ReadBlockRequest* request,
+                            ReadBlockResponse* response,
+                            bool failed, int error);
+    void AioReadCallback(const std::string& cs_addr, int64_t send_time,
+                         const ReadBlockRequest* request,
+                         ReadBlockResponse* response,
+                         bool failed, int error,
+                         char* buf, int32_t read_size,
+                         int32_t cs_index, int retry_times,
+                         AioCallback callback);
+    /// Rebuild the range from the erasure code stripe, 'error' if it can't be
+    int32_t DegradedRead(char* buf, int32_t read_len, int64_t offset, int32_t error);
+    /// Hand 'rb' to the thread pool, the file stays alive until it is done
+    void ScheduleReadahead(ReadaheadBuffer* rb);
+    void StartReadahead(ReadaheadBuffer* rb);
+    void OnReadaheadDone(ReadaheadBuffer* rb, int32_t ret);
     bool EnoughReplica();
     std::string GetSlowChunkserver();
 private:
@@ -143,18 +184,13 @@ private:
     std::map<std::string, WriteBufferQueue*> cs_write_queue_;
     volatile int back_writing_;         ///< Async write running backgroud
     const WriteOptions w_options_;
+    std::vector<int32_t> exclude_chunkservers_; ///< placement hint for AddBlock
 
     /// for read
     LocatedBlocks located_blocks_;      ///< block meta for read
-    ChunkServer_Stub* chunkserver_;     ///< chunkserver stub for read
     std::map<std::string, ChunkServer_Stub*> chunkservers_; ///< located chunkservers
-    std::set<ChunkServer_Stub*> bad_chunkservers_;
-    int32_t last_chunkserver_index_;
     int64_t read_offset_;               ///< last read offset
     Mutex read_offset_mu_;
-    char* reada_buffer_;                ///< Read ahead buffer
-    int32_t reada_buf_len_;             ///< Read ahead buffer length
-    int64_t reada_base_;                ///< Read ahead base offset
     int32_t sequential_ratio_;          ///< Sequential read ratio
     int64_t last_read_offset_;
     const ReadOptions r_options_;
@@ -163,6 +199,7 @@ private:
     bool synced_;                       ///< file is synced
     Mutex   mu_;
     CondVar sync_signal_;               ///< _sync_var
+    Readahead reada_;                   ///< Read ahead ring, guarded by mu_
     bool bg_error_;                     ///< background write error
     std::map<std::string, bool> cs_errors_;        ///< background write error for each chunkserver
 };
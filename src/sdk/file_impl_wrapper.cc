@@ -27,6 +27,15 @@ int32_t FileImplWrapper::Pread(char* buf, int32_t read_size, int64_t offset, boo
     return impl_->Pread(buf, read_size, offset, reada);
 }
 
+int32_t FileImplWrapper::AioRead(char* buf, int32_t read_size, int64_t offset,
+                                 AioCallback callback) {
+    return impl_->AioRead(buf, read_size, offset, callback);
+}
+
+int32_t FileImplWrapper::ReadV(ReadRange* ranges, int32_t num) {
+    return impl_->ReadV(ranges, num);
+}
+
 int64_t FileImplWrapper::Seek(int64_t offset, int32_t whence) {
     return impl_->Seek(offset, whence);
 }
@@ -26,6 +26,9 @@ public:
     FileImplWrapper(FileImpl* file_impl);
     virtual ~FileImplWrapper();
     virtual int32_t Pread(char* buf, int32_t read_size, int64_t offset, bool reada = false);
+    virtual int32_t AioRead(char* buf, int32_t read_size, int64_t offset,
+                            AioCallback callback);
+    virtual int32_t ReadV(ReadRange* ranges, int32_t num);
     virtual int64_t Seek(int64_t offset, int32_t whence);
     virtual int32_t Read(char* buf, int32_t read_size);
     virtual int32_t Write(const char* buf, int32_t write_size);
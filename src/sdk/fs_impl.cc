@@ -5,6 +5,8 @@
 
 #include "fs_impl.h"
 
+#include <algorithm>
+
 #include <gflags/gflags.h>
 
 #include <common/sliding_window.h>
@@ -18,12 +20,16 @@
 #include "rpc/rpc_client.h"
 #include "rpc/nameserver_client.h"
 
+#include "cold_store.h"
 #include "file_impl.h"
 #include "file_impl_wrapper.h"
+#include "latency_tracker.h"
+#include "replica_scorer.h"
 
 DECLARE_int32(sdk_thread_num);
 DECLARE_string(nameserver_nodes);
 DECLARE_string(sdk_write_mode);
+DECLARE_string(sdk_read_consistency);
 
 namespace baidu {
 namespace bfs {
@@ -78,12 +84,25 @@ const char* StrError(int error_code) {
 FSImpl::FSImpl() : rpc_client_(NULL), nameserver_client_(NULL), leader_nameserver_idx_(0) {
     local_host_name_ = common::util::GetLocalHostName();
     thread_pool_ = new ThreadPool(FLAGS_sdk_thread_num);
+    read_latency_ = new LatencyTracker();
+    replica_scorer_ = new ReplicaScorer(local_host_name_);
+    cold_store_ = new ColdStore(this);
+    if (FLAGS_sdk_read_consistency == "bounded") {
+        read_consistency_ = kReadBoundedStale;
+    } else if (FLAGS_sdk_read_consistency == "linearizable") {
+        read_consistency_ = kReadLinearizable;
+    } else {
+        read_consistency_ = kReadLeader;
+    }
 }
 FSImpl::~FSImpl() {
     delete nameserver_client_;
     delete rpc_client_;
     thread_pool_->Stop(true);
     delete thread_pool_;
+    delete read_latency_;
+    delete replica_scorer_;
+    delete cold_store_;
 }
 bool FSImpl::ConnectNameServer(const char* nameserver) {
     std::string nameserver_nodes = FLAGS_nameserver_nodes;
@@ -100,7 +119,7 @@ int32_t FSImpl::CreateDirectory(const char* path) {
     request.set_file_name(path);
     request.set_mode(0755|(1<<9));
     request.set_sequence_id(0);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::CreateFile,
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::CreateFile,
         &request, &response, 15, 3);
     if (!ret) {
         return TIMEOUT;
@@ -111,17 +130,29 @@ int32_t FSImpl::CreateDirectory(const char* path) {
 }
 int32_t FSImpl::ListDirectory(const char* path, BfsFileInfo** filelist, int *num) {
     common::timer::AutoTimer at(1000, "ListDirectory", path);
+    ListDirectoryRequest request;
+    request.set_path(path);
+    return SendListDirectory(request, filelist, num);
+}
+int32_t FSImpl::ListDirectoryById(int64_t dir_id, BfsFileInfo** filelist, int *num) {
+    ListDirectoryRequest request;
+    request.set_entry_id(dir_id);
+    return SendListDirectory(request, filelist, num);
+}
+int32_t FSImpl::SendListDirectory(const ListDirectoryRequest& list_request,
+                                  BfsFileInfo** filelist, int *num) {
     *filelist = NULL;
     *num = 0;
-    ListDirectoryRequest request;
+    ListDirectoryRequest request(list_request);
     ListDirectoryResponse response;
-    request.set_path(path);
     request.set_sequence_id(0);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::ListDirectory,
+    request.set_consistency(read_consistency_);
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::ListDirectory,
             &request, &response, 60, 1);
     if (!ret || response.status() != kOK) {
-        LOG(WARNING, "List fail: %s, ret= %d, status= %s\n",
-            path, ret, StatusCode_Name(response.status()).c_str());
+        LOG(WARNING, "List fail: %s E%ld, ret= %d, status= %s\n",
+            request.path().c_str(), request.entry_id(), ret,
+            StatusCode_Name(response.status()).c_str());
         if (!ret) {
             return TIMEOUT;
         } else {
@@ -137,18 +168,45 @@ int32_t FSImpl::ListDirectory(const char* path, BfsFileInfo** filelist, int *num
             binfo.ctime = info.ctime();
             binfo.mode = info.type();
             binfo.size = info.size();
+            binfo.entry_id = info.entry_id();
             snprintf(binfo.name, sizeof(binfo.name), "%s", info.name().c_str());
             snprintf(binfo.link, sizeof(binfo.link), "%s", info.sym_link().c_str());
         }
     }
     return OK;
 }
+int32_t FSImpl::Lookup(int64_t parent_id, const char* name, BfsFileInfo* fileinfo) {
+    LookupRequest request;
+    LookupResponse response;
+    request.set_parent_entry_id(parent_id);
+    request.set_name(name);
+    request.set_sequence_id(0);
+    request.set_consistency(read_consistency_);
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::Lookup,
+        &request, &response, 15, 1);
+    if (!ret) {
+        LOG(WARNING, "Lookup rpc fail: E%ld %s", parent_id, name);
+        return TIMEOUT;
+    }
+    if (response.status() != kOK) {
+        return GetErrorCode(response.status());
+    }
+    const FileInfo& info = response.file_info();
+    fileinfo->ctime = info.ctime();
+    fileinfo->mode = info.type();
+    fileinfo->size = info.size();
+    fileinfo->entry_id = info.entry_id();
+    snprintf(fileinfo->name, sizeof(fileinfo->name), "%s", info.name().c_str());
+    snprintf(fileinfo->link, sizeof(fileinfo->link), "%s", info.sym_link().c_str());
+    return OK;
+}
 int32_t FSImpl::DiskUsage(const char* path, int64_t* du_size) {
     DiskUsageRequest request;
     DiskUsageResponse response;
     request.set_sequence_id(0);
+    request.set_consistency(read_consistency_);
     request.set_path(path);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::DiskUsage,
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::DiskUsage,
             &request, &response, 3600, 1);
     if (!ret) {
         LOG(WARNING, "Compute Disk Usage fail: %s\n", path);
@@ -159,13 +217,56 @@ int32_t FSImpl::DiskUsage(const char* path, int64_t* du_size) {
     *du_size = response.du_size();
     return OK;
 }
+int32_t FSImpl::SetQuota(const char* path, int64_t space_quota, int64_t file_quota) {
+    SetQuotaRequest request;
+    SetQuotaResponse response;
+    request.set_sequence_id(0);
+    request.set_path(path);
+    if (space_quota >= 0) {
+        request.set_space_quota(space_quota);
+    }
+    if (file_quota >= 0) {
+        request.set_file_quota(file_quota);
+    }
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::SetQuota,
+            &request, &response, 15, 1);
+    if (!ret) {
+        LOG(WARNING, "SetQuota fail: %s\n", path);
+        return TIMEOUT;
+    } else if (response.status() != kOK) {
+        LOG(WARNING, "SetQuota %s return: %s\n",
+                path, StatusCode_Name(response.status()).c_str());
+        return GetErrorCode(response.status());
+    }
+    return OK;
+}
+int32_t FSImpl::GetQuota(const char* path, BfsQuotaInfo* quota) {
+    DiskUsageRequest request;
+    DiskUsageResponse response;
+    request.set_sequence_id(0);
+    request.set_consistency(read_consistency_);
+    request.set_path(path);
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::DiskUsage,
+            &request, &response, 15, 1);
+    if (!ret) {
+        LOG(WARNING, "GetQuota fail: %s\n", path);
+        return TIMEOUT;
+    } else if (response.status() != kOK) {
+        return GetErrorCode(response.status());
+    }
+    quota->space = response.du_size();
+    quota->files = response.files();
+    quota->space_quota = response.space_quota();
+    quota->file_quota = response.file_quota();
+    return OK;
+}
 int32_t FSImpl::DeleteDirectory(const char* path, bool recursive) {
     DeleteDirectoryRequest request;
     DeleteDirectoryResponse response;
     request.set_sequence_id(0);
     request.set_path(path);
     request.set_recursive(recursive);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::DeleteDirectory,
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::DeleteDirectory,
             &request, &response, 3600, 1);
     if (!ret) {
         LOG(WARNING, "DeleteDirectory fail: %s\n", path);
@@ -180,7 +281,8 @@ int32_t FSImpl::Access(const char* path, int32_t mode) {
     StatResponse response;
     request.set_path(path);
     request.set_sequence_id(0);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::Stat,
+    request.set_consistency(read_consistency_);
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::Stat,
         &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "Access fail: %s\n", path);
@@ -193,7 +295,8 @@ int32_t FSImpl::Stat(const char* path, BfsFileInfo* fileinfo) {
     StatResponse response;
     request.set_path(path);
     request.set_sequence_id(0);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::Stat,
+    request.set_consistency(read_consistency_);
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::Stat,
         &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "Stat rpc fail: %s", path);
@@ -204,6 +307,7 @@ int32_t FSImpl::Stat(const char* path, BfsFileInfo* fileinfo) {
         fileinfo->ctime = info.ctime();
         fileinfo->mode = info.type();
         fileinfo->size = info.size();
+        fileinfo->entry_id = info.entry_id();
         snprintf(fileinfo->name, sizeof(fileinfo->name), "%s", info.name().c_str());
         return OK;
     }
@@ -272,6 +376,22 @@ int32_t FSImpl::GetFileLocation(const std::string& path,
     if (locations == NULL) {
         return BAD_PARAMETER;
     }
+    std::vector<LocatedBlock> blocks;
+    int32_t ret = GetLocatedBlocks(path, &blocks);
+    if (ret != OK) {
+        return ret;
+    }
+    for (size_t i = 0; i < blocks.size(); i++) {
+        const LocatedBlock& block = blocks[i];
+        std::map<int64_t, std::vector<std::string> >::iterator it =
+            locations->insert(std::make_pair(block.block_id(), std::vector<std::string>())).first;
+        for (int j = 0; j < block.chains_size(); ++j) {
+            (it->second).push_back(block.chains(j).address());
+        }
+    }
+    return OK;
+}
+int32_t FSImpl::GetLocatedBlocks(const std::string& path, std::vector<LocatedBlock>* blocks) {
     FileLocationRequest request;
     FileLocationResponse response;
     request.set_file_name(path);
@@ -287,14 +407,7 @@ int32_t FSImpl::GetFileLocation(const std::string& path,
             return GetErrorCode(response.status());
         }
     }
-    for (int i = 0; i < response.blocks_size(); i++) {
-        const LocatedBlock& block = response.blocks(i);
-        std::map<int64_t, std::vector<std::string> >::iterator it =
-            locations->insert(std::make_pair(block.block_id(), std::vector<std::string>())).first;
-        for (int j = 0; j < block.chains_size(); ++j) {
-            (it->second).push_back(block.chains(j).address());
-        }
-    }
+    blocks->assign(response.blocks().begin(), response.blocks().end());
     return OK;
 }
 int32_t FSImpl::Chmod(int32_t mode, const char* path) {
@@ -303,7 +416,7 @@ int32_t FSImpl::Chmod(int32_t mode, const char* path) {
     request.set_sequence_id(0);
     request.set_mode(mode&0777);
     request.set_path(path);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::Chmod,
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::Chmod,
         &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "Chmod rpc fail: change %s mode to %u\n", path, mode);
@@ -321,21 +434,16 @@ int32_t FSImpl::OpenFile(const char* path, int32_t flags, File** file, const Wri
 }
 int32_t FSImpl::OpenFile(const char* path, int32_t flags, int32_t mode,
                          File** file, const WriteOptions& options) {
+    return OpenFileExcluding(path, flags, mode, std::vector<int32_t>(), file, options);
+}
+int32_t FSImpl::OpenFileExcluding(const char* path, int32_t flags, int32_t mode,
+                                  const std::vector<int32_t>& exclude,
+                                  File** file, const WriteOptions& options) {
     *file = NULL;
     if (!(flags & O_WRONLY)) {
         return BAD_PARAMETER;
     }
-    WriteOptions write_option = options;
-    if (options.write_mode == kWriteDefault) {
-        if (FLAGS_sdk_write_mode == "fanout") {
-            write_option.write_mode = kWriteFanout;
-        } else if (FLAGS_sdk_write_mode == "chains") {
-            write_option.write_mode = kWriteChains;
-        } else {
-            LOG(FATAL, "wrong flag %s for sdk write mode",
-                    FLAGS_sdk_write_mode.c_str());
-        }
-    }
+    WriteOptions write_option = GetWriteOptions(options);
     common::timer::AutoTimer at(100, "OpenFile", path);
 
     CreateFileRequest request;
@@ -345,7 +453,7 @@ int32_t FSImpl::OpenFile(const char* path, int32_t flags, int32_t mode,
     request.set_flags(flags);
     request.set_mode(mode&0777);
     request.set_replica_num(write_option.replica);
-    bool rpc_ret = nameserver_client_->SendRequest(&NameServer_Stub::CreateFile,
+    bool rpc_ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::CreateFile,
         &request, &response, 15, 1);
     if (!rpc_ret || response.status() != kOK) {
         LOG(WARNING, "Open file for write fail: %s, rpc_ret= %d, status= %s\n",
@@ -356,7 +464,9 @@ int32_t FSImpl::OpenFile(const char* path, int32_t flags, int32_t mode,
             return GetErrorCode(response.status());
         }
     } else {
-        *file = new FileImplWrapper(this, rpc_client_, path, flags, write_option);
+        FileImpl* file_impl = new FileImpl(this, rpc_client_, path, flags, write_option);
+        file_impl->exclude_chunkservers_ = exclude;
+        *file = new FileImplWrapper(file_impl);
     }
     return OK;
 }
@@ -375,6 +485,9 @@ int32_t FSImpl::OpenFile(const char* path, int32_t flags, File** file, const Rea
     bool rpc_ret = nameserver_client_->SendRequest(&NameServer_Stub::GetFileLocation,
         &request, &response, 15, 1);
     if (rpc_ret && response.status() == kOK) {
+        if (response.has_client_ip()) {
+            replica_scorer_->SetLocalLocation(response.client_ip(), response.client_rack());
+        }
         FileImpl* f = new FileImpl(this, rpc_client_, path, flags, options);
         f->located_blocks_.CopyFrom(response.blocks());
         *file = new FileImplWrapper(f);
@@ -388,6 +501,118 @@ int32_t FSImpl::OpenFile(const char* path, int32_t flags, File** file, const Rea
     }
     return ret;
 }
+int32_t FSImpl::BatchStat(const std::vector<std::string>& paths,
+                          std::vector<BfsFileInfo>* fileinfos,
+                          std::vector<int32_t>* rets) {
+    BatchStatRequest request;
+    BatchStatResponse response;
+    for (size_t i = 0; i < paths.size(); i++) {
+        request.add_paths(paths[i]);
+    }
+    request.set_sequence_id(0);
+    request.set_consistency(read_consistency_);
+    bool ret = nameserver_client_->SendReadRequest(&NameServer_Stub::BatchStat,
+        &request, &response, 15, 1);
+    if (!ret) {
+        LOG(WARNING, "BatchStat rpc fail: %lu files", paths.size());
+        return TIMEOUT;
+    }
+    if (response.status() != kOK
+        || response.stats_size() != static_cast<int>(paths.size())) {
+        return GetErrorCode(response.status());
+    }
+    fileinfos->resize(paths.size());
+    rets->resize(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        const StatResponse& stat = response.stats(i);
+        (*rets)[i] = GetErrorCode(stat.status());
+        if (stat.status() != kOK) {
+            continue;
+        }
+        const FileInfo& info = stat.file_info();
+        BfsFileInfo* fileinfo = &(*fileinfos)[i];
+        fileinfo->ctime = info.ctime();
+        fileinfo->mode = info.type();
+        fileinfo->size = info.size();
+        fileinfo->entry_id = info.entry_id();
+        snprintf(fileinfo->name, sizeof(fileinfo->name), "%s", info.name().c_str());
+    }
+    return OK;
+}
+int32_t FSImpl::BatchOpenFile(const std::vector<std::string>& paths, int32_t flags,
+                              std::vector<File*>* files, std::vector<int32_t>* rets,
+                              const ReadOptions& options) {
+    if (flags != O_RDONLY) {
+        return BAD_PARAMETER;
+    }
+    common::timer::AutoTimer at(100, "BatchOpenFile", paths.empty() ? "" : paths[0].c_str());
+    BatchFileLocationRequest request;
+    BatchFileLocationResponse response;
+    for (size_t i = 0; i < paths.size(); i++) {
+        request.add_file_names(paths[i]);
+    }
+    request.set_sequence_id(0);
+    bool rpc_ret = nameserver_client_->SendRequest(&NameServer_Stub::BatchGetFileLocation,
+        &request, &response, 15, 1);
+    if (!rpc_ret || response.status() != kOK
+        || response.locations_size() != static_cast<int>(paths.size())) {
+        LOG(WARNING, "BatchOpenFile return %d, %s\n",
+            rpc_ret, StatusCode_Name(response.status()).c_str());
+        return rpc_ret ? GetErrorCode(response.status()) : TIMEOUT;
+    }
+    if (response.has_client_ip()) {
+        replica_scorer_->SetLocalLocation(response.client_ip(), response.client_rack());
+    }
+    files->assign(paths.size(), NULL);
+    rets->resize(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        const FileLocationResponse& location = response.locations(i);
+        (*rets)[i] = GetErrorCode(location.status());
+        if (location.status() != kOK) {
+            continue;
+        }
+        FileImpl* f = new FileImpl(this, rpc_client_, paths[i], flags, options);
+        f->located_blocks_.CopyFrom(location.blocks());
+        (*files)[i] = new FileImplWrapper(f);
+    }
+    return OK;
+}
+int32_t FSImpl::BatchOpenFile(const std::vector<std::string>& paths, int32_t flags,
+                              int32_t mode, std::vector<File*>* files,
+                              std::vector<int32_t>* rets, const WriteOptions& options) {
+    if (!(flags & O_WRONLY)) {
+        return BAD_PARAMETER;
+    }
+    WriteOptions write_option = GetWriteOptions(options);
+    common::timer::AutoTimer at(100, "BatchOpenFile", paths.empty() ? "" : paths[0].c_str());
+    BatchCreateFileRequest request;
+    BatchCreateFileResponse response;
+    for (size_t i = 0; i < paths.size(); i++) {
+        CreateFileRequest* file = request.add_files();
+        file->set_file_name(paths[i]);
+        file->set_flags(flags);
+        file->set_mode(mode&0777);
+        file->set_replica_num(write_option.replica);
+    }
+    request.set_sequence_id(0);
+    bool rpc_ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::BatchCreateFile,
+        &request, &response, 15, 1);
+    if (!rpc_ret || response.status() != kOK
+        || response.results_size() != static_cast<int>(paths.size())) {
+        LOG(WARNING, "Batch open %lu files for write fail, rpc_ret= %d, status= %s\n",
+            paths.size(), rpc_ret, StatusCode_Name(response.status()).c_str());
+        return rpc_ret ? GetErrorCode(response.status()) : TIMEOUT;
+    }
+    files->assign(paths.size(), NULL);
+    rets->resize(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        (*rets)[i] = GetErrorCode(response.results(i));
+        if (response.results(i) == kOK) {
+            (*files)[i] = new FileImplWrapper(this, rpc_client_, paths[i], flags, write_option);
+        }
+    }
+    return OK;
+}
 int32_t FSImpl::CloseFile(File* file) {
     return file->Close();
 }
@@ -398,7 +623,7 @@ int32_t FSImpl::DeleteFile(const char* path) {
     int64_t seq = common::timer::get_micros();
     request.set_sequence_id(seq);
     // printf("Delete file: %s\n", path);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::Unlink,
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::Unlink,
         &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "Unlink rpc fail: %s", path);
@@ -439,7 +664,7 @@ int32_t FSImpl::Rename(const char* oldpath, const char* newpath) {
     request.set_oldpath(oldpath);
     request.set_newpath(newpath);
     request.set_sequence_id(0);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::Rename,
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::Rename,
         &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "Rename rpc fail: %s to %s\n", oldpath, newpath);
@@ -453,14 +678,20 @@ int32_t FSImpl::Rename(const char* oldpath, const char* newpath) {
     return OK;
 }
 int32_t FSImpl::ChangeReplicaNum(const char* file_name, int32_t replica_num) {
-    /*
+    return ChangeReplicaNum(file_name, replica_num, std::vector<int32_t>());
+}
+int32_t FSImpl::ChangeReplicaNum(const char* file_name, int32_t replica_num,
+                                 const std::vector<int32_t>& keep) {
     ChangeReplicaNumRequest request;
     ChangeReplicaNumResponse response;
     request.set_file_name(file_name);
     request.set_replica_num(replica_num);
+    for (size_t i = 0; i < keep.size(); i++) {
+        request.add_keep_chunkservers(keep[i]);
+    }
     request.set_sequence_id(0);
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::ChangeReplicaNum,
-                                               &request, &response, 15, 1);
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::ChangeReplicaNum,
+                                                    &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "Change %s replica num to %d rpc fail\n",
                 file_name, replica_num);
@@ -471,8 +702,10 @@ int32_t FSImpl::ChangeReplicaNum(const char* file_name, int32_t replica_num) {
                 file_name, replica_num, StatusCode_Name(response.status()).c_str());
         return GetErrorCode(response.status());
     }
-    */
-    return PERMISSION_DENIED;
+    return OK;
+}
+int32_t FSImpl::ErasureCodeDirectory(const char* path, int32_t data_num, int32_t parity_num) {
+    return cold_store_->EncodeDirectory(path, data_num, parity_num);
 }
 
 int32_t FSImpl::Symlink(const char* src, const char* dst)
@@ -483,7 +716,7 @@ int32_t FSImpl::Symlink(const char* src, const char* dst)
     request.set_dst(dst);
     request.set_sequence_id(0);
 
-    bool ret = nameserver_client_->SendRequest(&NameServer_Stub::Symlink,
+    bool ret = nameserver_client_->SendWriteRequest(&NameServer_Stub::Symlink,
         &request, &response, 15, 1);
     if (!ret) {
         LOG(WARNING, "CreateSymlink rpc fail: %s -> %s", dst, src);
@@ -500,12 +733,32 @@ int32_t FSImpl::Symlink(const char* src, const char* dst)
 int32_t FSImpl::SysStat(const std::string& stat_name, std::string* result) {
     SysStatRequest request;
     SysStatResponse response;
+    request.set_stat_name(stat_name);
     bool ret = nameserver_client_->SendRequest(&NameServer_Stub::SysStat,
                                                &request, &response, 60, 1);
     if (!ret) {
         LOG(WARNING, "SysStat fail %s", StatusCode_Name(response.status()).c_str());
         return TIMEOUT;
     }
+    if (stat_name == "RpcStat") {
+        common::TPrinter tp(8);
+        tp.AddRow(8, "method", "stage", "count", "avg(us)", "p50", "p99", "p999", "max");
+        for (int i = 0; i < response.rpc_latency_size(); i++) {
+            const RpcLatency& latency = response.rpc_latency(i);
+            std::vector<std::string> vs;
+            vs.push_back(latency.method());
+            vs.push_back(latency.stage());
+            vs.push_back(common::NumToString(latency.count()));
+            vs.push_back(common::NumToString(latency.average()));
+            vs.push_back(common::NumToString(latency.p50()));
+            vs.push_back(common::NumToString(latency.p99()));
+            vs.push_back(common::NumToString(latency.p999()));
+            vs.push_back(common::NumToString(latency.max()));
+            tp.AddRow(vs);
+        }
+        result->append(tp.ToString());
+        return OK;
+    }
     bool stat_all = (stat_name == "StatAll");
     common::TPrinter tp(9);
     tp.AddRow(9, "", "id", "address", "data_size", "disk_quota", "blocks",
@@ -588,5 +841,20 @@ const std::string& FSImpl::GetUUID() {
     return uuid;
 }
 
+WriteOptions FSImpl::GetWriteOptions(const WriteOptions& options) {
+    WriteOptions write_option = options;
+    if (options.write_mode == kWriteDefault) {
+        if (FLAGS_sdk_write_mode == "fanout") {
+            write_option.write_mode = kWriteFanout;
+        } else if (FLAGS_sdk_write_mode == "chains") {
+            write_option.write_mode = kWriteChains;
+        } else {
+            LOG(FATAL, "wrong flag %s for sdk write mode",
+                    FLAGS_sdk_write_mode.c_str());
+        }
+    }
+    return write_option;
+}
+
 } // namespace bfs
 } // namespace baidu
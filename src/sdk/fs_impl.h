@@ -12,6 +12,7 @@
 #include <common/thread_pool.h>
 
 #include "bfs.h"
+#include "proto/nameserver.pb.h"
 #include "proto/status_code.pb.h"
 
 
@@ -20,6 +21,9 @@ namespace bfs {
 
 class RpcClient;
 class NameServerClient;
+class LatencyTracker;
+class ReplicaScorer;
+class ColdStore;
 
 int32_t GetErrorCode(baidu::bfs::StatusCode stat);
 
@@ -31,32 +35,59 @@ public:
     bool ConnectNameServer(const char* nameserver);
     int32_t CreateDirectory(const char* path);
     int32_t ListDirectory(const char* path, BfsFileInfo** filelist, int *num);
+    int32_t ListDirectoryById(int64_t dir_id, BfsFileInfo** filelist, int *num);
+    int32_t Lookup(int64_t parent_id, const char* name, BfsFileInfo* fileinfo);
     int32_t DeleteDirectory(const char* path, bool recursive);
     int32_t LockDirectory(const char* path);
     int32_t UnlockDirectory(const char* path);
     int32_t DiskUsage(const char* path, int64_t* du_size);
+    int32_t SetQuota(const char* path, int64_t space_quota, int64_t file_quota);
+    int32_t GetQuota(const char* path, BfsQuotaInfo* quota);
     int32_t Access(const char* path, int32_t mode);
     int32_t Stat(const char* path, BfsFileInfo* fileinfo);
     int32_t Chmod(int32_t mode, const char* path);
     int32_t GetFileSize(const char* path, int64_t* file_size);
     int32_t GetFileLocation(const std::string& path,
                             std::map<int64_t, std::vector<std::string> >* locations);
+    /// Blocks of 'path' with the id, address and rack of every replica
+    virtual int32_t GetLocatedBlocks(const std::string& path, std::vector<LocatedBlock>* blocks);
     int32_t OpenFile(const char* path, int32_t flags, File** file,
                      const ReadOptions& options);
     int32_t OpenFile(const char* path, int32_t flags, File** file,
                      const WriteOptions& options);
     int32_t OpenFile(const char* path, int32_t flags, int32_t mode,
                      File** file, const WriteOptions& options);
+    /// Open for write, blocks are not placed on the chunkservers in 'exclude'
+    virtual int32_t OpenFileExcluding(const char* path, int32_t flags, int32_t mode,
+                                      const std::vector<int32_t>& exclude,
+                                      File** file, const WriteOptions& options);
+    int32_t BatchStat(const std::vector<std::string>& paths,
+                      std::vector<BfsFileInfo>* fileinfos,
+                      std::vector<int32_t>* rets);
+    int32_t BatchOpenFile(const std::vector<std::string>& paths, int32_t flags,
+                          std::vector<File*>* files, std::vector<int32_t>* rets,
+                          const ReadOptions& options);
+    int32_t BatchOpenFile(const std::vector<std::string>& paths, int32_t flags,
+                          int32_t mode, std::vector<File*>* files,
+                          std::vector<int32_t>* rets, const WriteOptions& options);
     int32_t CloseFile(File* file);
     int32_t DeleteFile(const char* path);
     int32_t Rename(const char* oldpath, const char* newpath);
     int32_t ChangeReplicaNum(const char* file_name, int32_t replica_num);
+    /// Surplus replicas are removed, those on the chunkservers in 'keep' last
+    virtual int32_t ChangeReplicaNum(const char* file_name, int32_t replica_num,
+                                     const std::vector<int32_t>& keep);
+    int32_t ErasureCodeDirectory(const char* path, int32_t data_num, int32_t parity_num);
     int32_t Symlink(const char* src, const char* dst);
     int32_t SysStat(const std::string& stat_name, std::string* result);
     int32_t ShutdownChunkServer(const std::vector<std::string>& cs_addr);
     int32_t ShutdownChunkServerStat();
 private:
     const std::string& GetUUID();
+    int32_t SendListDirectory(const ListDirectoryRequest& request,
+                              BfsFileInfo** filelist, int *num);
+    /// 'options' with the default write mode taken from sdk_write_mode
+    WriteOptions GetWriteOptions(const WriteOptions& options);
 private:
     RpcClient* rpc_client_;
     NameServerClient* nameserver_client_;
@@ -66,6 +97,11 @@ private:
     //std::string nameserver_address_;
     std::string local_host_name_;
     ThreadPool* thread_pool_;
+    LatencyTracker* read_latency_;
+    ReplicaScorer* replica_scorer_;
+    ColdStore* cold_store_;
+    /// Consistency asked for by Stat, ListDirectory and DiskUsage
+    ReadConsistency read_consistency_;
 };
 
 } // namespace bfs
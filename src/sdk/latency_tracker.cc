@@ -0,0 +1,68 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "latency_tracker.h"
+
+#include <algorithm>
+
+#include <gflags/gflags.h>
+
+DECLARE_int32(sdk_read_hedge_percentile);
+DECLARE_int32(sdk_read_hedge_min_delay);
+DECLARE_int32(sdk_read_hedge_default_delay);
+
+namespace baidu {
+namespace bfs {
+
+// Too few samples make the percentile meaningless
+const int32_t kMinLatencySamples = 16;
+
+LatencyTracker::LatencyTracker(int32_t window_size)
+    : window_size_(window_size) {
+}
+
+LatencyTracker::~LatencyTracker() {
+}
+
+void LatencyTracker::Record(const std::string& cs_addr, int64_t latency) {
+    MutexLock lock(&mu_);
+    Samples& samples = samples_[cs_addr];
+    if (static_cast<int32_t>(samples.latency.size()) < window_size_) {
+        samples.latency.push_back(latency);
+    } else {
+        samples.latency[samples.next] = latency;
+        samples.next = (samples.next + 1) % window_size_;
+    }
+}
+
+int64_t LatencyTracker::Percentile(const std::string& cs_addr, int32_t percentile) {
+    std::vector<int64_t> latency;
+    {
+        MutexLock lock(&mu_);
+        std::map<std::string, Samples>::iterator it = samples_.find(cs_addr);
+        if (it == samples_.end()
+            || static_cast<int32_t>(it->second.latency.size()) < kMinLatencySamples) {
+            return -1;
+        }
+        latency = it->second.latency;
+    }
+    percentile = std::max(0, std::min(100, percentile));
+    size_t n = (latency.size() - 1) * percentile / 100;
+    std::nth_element(latency.begin(), latency.begin() + n, latency.end());
+    return latency[n];
+}
+
+int64_t LatencyTracker::HedgeDelay(const std::string& cs_addr) {
+    int64_t latency = Percentile(cs_addr, FLAGS_sdk_read_hedge_percentile);
+    if (latency < 0) {
+        return FLAGS_sdk_read_hedge_default_delay;
+    }
+    return std::max(static_cast<int64_t>(FLAGS_sdk_read_hedge_min_delay), latency / 1000);
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
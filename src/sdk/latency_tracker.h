@@ -0,0 +1,48 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_SDK_LATENCY_TRACKER_H_
+#define  BFS_SDK_LATENCY_TRACKER_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <common/mutex.h>
+
+namespace baidu {
+namespace bfs {
+
+/// Keeps the most recent read latencies of each chunkserver,
+/// used to decide when a hedged read should be sent.
+class LatencyTracker {
+public:
+    LatencyTracker(int32_t window_size = 256);
+    ~LatencyTracker();
+    /// Record a latency sample (in us) of 'cs_addr'
+    void Record(const std::string& cs_addr, int64_t latency);
+    /// Return the 'percentile' latency (in us) of 'cs_addr',
+    /// or -1 if there are not enough samples yet
+    int64_t Percentile(const std::string& cs_addr, int32_t percentile);
+    /// Delay in ms before a read sent to 'cs_addr' is hedged
+    int64_t HedgeDelay(const std::string& cs_addr);
+private:
+    struct Samples {
+        std::vector<int64_t> latency;
+        int32_t next;
+        Samples() : next(0) {}
+    };
+    Mutex mu_;
+    int32_t window_size_;
+    std::map<std::string, Samples> samples_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_SDK_LATENCY_TRACKER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,152 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "readahead.h"
+
+#include <string.h>
+#include <algorithm>
+
+#include <gflags/gflags.h>
+#include <common/logging.h>
+
+DECLARE_int32(sdk_file_reada_len);
+DECLARE_int32(sdk_file_reada_max_pending);
+
+namespace baidu {
+namespace bfs {
+
+// First request of a stream, unless the reader asks for more
+const int32_t kMinReadaheadChunk = 64 * 1024;
+
+Readahead::Readahead(Mutex* mu, StartCallback start)
+    : mu_(mu), cond_(mu), start_(start), depth_(0), chunk_size_(0),
+      next_offset_(0), eof_(-1) {
+}
+
+Readahead::~Readahead() {
+    for (size_t i = 0; i < buffers_.size(); i++) {
+        delete buffers_[i];
+    }
+    buffers_.clear();
+}
+
+int32_t Readahead::Read(char* buf, int32_t read_len, int64_t offset,
+                        int64_t size, bool sequential) {
+    mu_->AssertHeld();
+    int32_t done_len = 0;
+    bool waited = false;
+    while (done_len < read_len) {
+        int64_t pos = offset + done_len;
+        // Drop the buffers behind the cursor
+        while (!buffers_.empty()) {
+            ReadaheadBuffer* front = buffers_.front();
+            if (front->offset + front->len > pos) {
+                break;
+            }
+            buffers_.pop_front();
+            Release(front);
+        }
+        if (!buffers_.empty() && buffers_.front()->offset > pos) {
+            // Seek backward
+            Clear();
+        }
+        if (eof_ >= 0 && pos >= eof_) {
+            // The file may have grown since, a new stream or a direct read finds out
+            Clear();
+        }
+        if (buffers_.empty()) {
+            if (done_len > 0 || !sequential || pos >= size) {
+                break;
+            }
+            eof_ = size;
+            next_offset_ = pos;
+            depth_ = 2;
+            chunk_size_ = std::min(FLAGS_sdk_file_reada_len,
+                                   std::max(read_len, kMinReadaheadChunk));
+            LOG(DEBUG, "Readahead start at %ld, chunk %d", pos, chunk_size_);
+            Fill();
+        }
+        ReadaheadBuffer* rb = buffers_.front();
+        if (!rb->done) {
+            if (!waited) {
+                // Reader is faster than the pipeline, keep more requests in flight
+                depth_ = std::min(depth_ + 1, FLAGS_sdk_file_reada_max_pending);
+                Fill();
+                waited = true;
+            }
+            cond_.Wait();
+            continue;
+        }
+        if (!waited && done_len == 0 && chunk_size_ < FLAGS_sdk_file_reada_len) {
+            // Pipeline is ahead of the reader, issue larger requests
+            chunk_size_ = std::min(chunk_size_ * 2, FLAGS_sdk_file_reada_len);
+        }
+        if (rb->ret < 0) {
+            LOG(INFO, "Readahead at %ld fail: %d, fallback to direct read",
+                rb->offset, rb->ret);
+            Clear();
+            break;
+        }
+        if (rb->ret < rb->len) {
+            eof_ = rb->offset + rb->ret;
+        }
+        int64_t end = rb->offset + rb->ret;
+        if (pos >= end) {
+            break;
+        }
+        int32_t len = std::min(static_cast<int64_t>(read_len - done_len), end - pos);
+        memcpy(buf + done_len, rb->data + (pos - rb->offset), len);
+        done_len += len;
+        if (pos + len == rb->offset + rb->len) {
+            buffers_.pop_front();
+            delete rb;
+            Fill();
+        }
+    }
+    return done_len > 0 ? done_len : -1;
+}
+
+void Readahead::Done(ReadaheadBuffer* rb, int32_t ret) {
+    mu_->AssertHeld();
+    if (rb->abandoned) {
+        delete rb;
+        return;
+    }
+    rb->ret = ret;
+    rb->done = true;
+    cond_.Broadcast();
+}
+
+void Readahead::Clear() {
+    mu_->AssertHeld();
+    for (size_t i = 0; i < buffers_.size(); i++) {
+        Release(buffers_[i]);
+    }
+    buffers_.clear();
+    eof_ = -1;
+}
+
+void Readahead::Fill() {
+    while (static_cast<int32_t>(buffers_.size()) < depth_ && next_offset_ < eof_) {
+        int32_t len = std::min(static_cast<int64_t>(chunk_size_), eof_ - next_offset_);
+        ReadaheadBuffer* rb = new ReadaheadBuffer(next_offset_, len);
+        next_offset_ += len;
+        buffers_.push_back(rb);
+        start_(rb);
+    }
+}
+
+void Readahead::Release(ReadaheadBuffer* rb) {
+    if (rb->done) {
+        delete rb;
+    } else {
+        rb->abandoned = true;
+    }
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
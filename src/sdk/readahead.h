@@ -0,0 +1,73 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_SDK_READAHEAD_H_
+#define  BFS_SDK_READAHEAD_H_
+
+#include <stdint.h>
+#include <deque>
+#include <functional>
+
+#include <common/mutex.h>
+
+namespace baidu {
+namespace bfs {
+
+/// One slot of the read-ahead ring, filled by an asynchronous read
+struct ReadaheadBuffer {
+    int64_t offset;
+    int32_t len;
+    char* data;
+    int32_t ret;            ///< bytes read or error code, valid when done
+    bool done;
+    bool abandoned;         ///< dropped by reader before done, freed by Done
+    ReadaheadBuffer(int64_t off, int32_t size)
+        : offset(off), len(size), data(new char[size]), ret(0),
+          done(false), abandoned(false) {}
+    ~ReadaheadBuffer() {
+        delete[] data;
+    }
+};
+
+/// Read-ahead ring of one file. A sequential reader starts a stream at its
+/// cursor, the stream keeps requests in flight ahead of it and adapts their
+/// number and size to how far the reader is behind.
+/// The ring has no lock of its own, all calls hold the mutex it is given.
+class Readahead {
+public:
+    /// Issue the read of 'rb', its completion is reported by Done
+    typedef std::function<void (ReadaheadBuffer*)> StartCallback;
+    Readahead(Mutex* mu, StartCallback start);
+    /// Buffers in flight must be done before
+    ~Readahead();
+    /// Read from the stream, or start one at 'offset' if 'sequential'.
+    /// A stream ends at 'size' or at a short read.
+    /// Return the bytes read, -1 if the caller has to read directly
+    int32_t Read(char* buf, int32_t read_len, int64_t offset, int64_t size, bool sequential);
+    /// Read of 'rb' finished, 'ret' is the bytes read or an error code
+    void Done(ReadaheadBuffer* rb, int32_t ret);
+    /// Drop the stream, buffers in flight are freed when done
+    void Clear();
+private:
+    void Fill();
+    void Release(ReadaheadBuffer* rb);
+private:
+    Mutex* mu_;
+    CondVar cond_;                      ///< a buffer is done
+    StartCallback start_;
+    std::deque<ReadaheadBuffer*> buffers_;  ///< in offset order
+    int32_t depth_;                     ///< requests to keep in flight
+    int32_t chunk_size_;                ///< request size
+    int64_t next_offset_;               ///< offset of the next request
+    int64_t eof_;                       ///< end of the stream, -1 if there is none
+    friend class ReadaheadTest;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_SDK_READAHEAD_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,116 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "replica_scorer.h"
+
+#include <stdlib.h>
+
+#include <gflags/gflags.h>
+#include <common/logging.h>
+#include <common/timer.h>
+
+DECLARE_int32(sdk_replica_blacklist_errors);
+DECLARE_int32(sdk_replica_blacklist_time);
+
+namespace baidu {
+namespace bfs {
+
+const double kEwmaAlpha = 0.2;
+// Keeps unmeasured and fast replicas comparable, in us
+const double kBaseLatency = 1000.0;
+const double kErrorPenalty = 10.0;
+const double kSameHostFactor = 0.25;
+const double kSameRackFactor = 0.5;
+
+ReplicaScorer::ReplicaScorer(const std::string& local_host_name)
+    : local_host_name_(local_host_name) {
+}
+
+void ReplicaScorer::SetLocalLocation(const std::string& ip, const std::string& rack) {
+    MutexLock lock(&mu_);
+    local_ip_ = ip;
+    local_rack_ = rack;
+}
+
+void ReplicaScorer::ReportSuccess(const std::string& cs_addr, int64_t latency) {
+    MutexLock lock(&mu_);
+    ReplicaStat& stat = stats_[cs_addr];
+    if (stat.latency == 0) {
+        stat.latency = latency;
+    } else {
+        stat.latency = stat.latency * (1 - kEwmaAlpha) + latency * kEwmaAlpha;
+    }
+    stat.error_rate *= (1 - kEwmaAlpha);
+    stat.continuous_errors = 0;
+    stat.blacklist_until = 0;
+}
+
+void ReplicaScorer::ReportFailure(const std::string& cs_addr) {
+    MutexLock lock(&mu_);
+    ReplicaStat& stat = stats_[cs_addr];
+    stat.error_rate = stat.error_rate * (1 - kEwmaAlpha) + kEwmaAlpha;
+    if (++stat.continuous_errors >= FLAGS_sdk_replica_blacklist_errors) {
+        stat.blacklist_until = common::timer::get_micros()
+                               + FLAGS_sdk_replica_blacklist_time * 1000000L;
+        LOG(INFO, "Blacklist chunkserver %s for %d seconds after %d errors",
+            cs_addr.c_str(), FLAGS_sdk_replica_blacklist_time, stat.continuous_errors);
+    }
+}
+
+double ReplicaScorer::GetScore(const ChunkServerInfo& cs, const ReplicaStat& stat) {
+    mu_.AssertHeld();
+    double score = (stat.latency + kBaseLatency) * (1 + kErrorPenalty * stat.error_rate);
+    const std::string& addr = cs.address();
+    std::string cs_host(addr, 0, addr.find_last_of(':'));
+    if (cs_host == local_ip_ || cs_host == local_host_name_) {
+        score *= kSameHostFactor;
+    } else if (!local_rack_.empty() && cs.rack() == local_rack_) {
+        score *= kSameRackFactor;
+    }
+    // Random jitter spreads load over replicas with similar scores
+    return score * (1 + (rand() % 100) / 1000.0);
+}
+
+int32_t ReplicaScorer::SelectReplica(const LocatedBlock& lcblock, int32_t exclude) {
+    int32_t chains_size = lcblock.chains_size();
+    if (chains_size == 1) {
+        return 0;
+    }
+    int64_t now = common::timer::get_micros();
+    int32_t best = -1;
+    double best_score = 0;
+    // Used when all candidates are blacklisted
+    int32_t earliest = -1;
+    int64_t earliest_time = 0;
+    MutexLock lock(&mu_);
+    for (int32_t i = 0; i < chains_size; i++) {
+        if (i == exclude) {
+            continue;
+        }
+        const ChunkServerInfo& cs = lcblock.chains(i);
+        const ReplicaStat& stat = stats_[cs.address()];
+        if (stat.blacklist_until > now) {
+            if (earliest == -1 || stat.blacklist_until < earliest_time) {
+                earliest = i;
+                earliest_time = stat.blacklist_until;
+            }
+            continue;
+        }
+        double score = GetScore(cs, stat);
+        if (best == -1 || score < best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    if (best == -1) {
+        best = earliest;
+    }
+    return best;
+}
+
+} // namespace bfs
+} // namespace baidu
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,54 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#ifndef  BFS_SDK_REPLICA_SCORER_H_
+#define  BFS_SDK_REPLICA_SCORER_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+#include <common/mutex.h>
+
+#include "proto/nameserver.pb.h"
+
+namespace baidu {
+namespace bfs {
+
+/// Scores chunkservers by measured read latency, error rate and locality.
+/// Shared by all files of a FSImpl.
+class ReplicaScorer {
+public:
+    ReplicaScorer(const std::string& local_host_name);
+    /// Client location reported by nameserver
+    void SetLocalLocation(const std::string& ip, const std::string& rack);
+    void ReportSuccess(const std::string& cs_addr, int64_t latency);
+    void ReportFailure(const std::string& cs_addr);
+    /// Return the index of the best replica in 'lcblock' other than 'exclude'
+    int32_t SelectReplica(const LocatedBlock& lcblock, int32_t exclude = -1);
+private:
+    struct ReplicaStat {
+        double latency;             ///< ewma of latency, in us
+        double error_rate;          ///< ewma of failures
+        int32_t continuous_errors;
+        int64_t blacklist_until;    ///< in us, 0 means not blacklisted
+        ReplicaStat() : latency(0), error_rate(0),
+                        continuous_errors(0), blacklist_until(0) {}
+    };
+    double GetScore(const ChunkServerInfo& cs, const ReplicaStat& stat);
+private:
+    Mutex mu_;
+    std::string local_host_name_;
+    std::string local_ip_;
+    std::string local_rack_;
+    std::map<std::string, ReplicaStat> stats_;
+};
+
+} // namespace bfs
+} // namespace baidu
+
+#endif  // BFS_SDK_REPLICA_SCORER_H_
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,411 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "sdk/cold_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "proto/file.pb.h"
+#include "sdk/fs_impl.h"
+
+DECLARE_int32(sdk_ec_cold_days);
+DECLARE_int32(sdk_ec_cell_size);
+
+namespace baidu {
+namespace bfs {
+
+struct FakeEntry {
+    std::string data;
+    bool dir;
+    int64_t entry_id;
+    uint32_t ctime;
+    int32_t replica;
+    std::vector<int32_t> servers;   ///< chunkservers holding the only block
+};
+
+class FakeFile : public File {
+public:
+    explicit FakeFile(std::string* data) : data_(data), offset_(0) {}
+    int32_t Pread(char* buf, int32_t read_size, int64_t offset, bool) {
+        int64_t size = data_->size();
+        if (offset >= size) {
+            return 0;
+        }
+        int32_t len = std::min(static_cast<int64_t>(read_size), size - offset);
+        memcpy(buf, data_->data() + offset, len);
+        return len;
+    }
+    int32_t AioRead(char*, int32_t, int64_t, AioCallback) {
+        return BAD_PARAMETER;
+    }
+    int32_t ReadV(ReadRange*, int32_t) {
+        return BAD_PARAMETER;
+    }
+    int64_t Seek(int64_t, int32_t) {
+        return BAD_PARAMETER;
+    }
+    int32_t Read(char* buf, int32_t read_size) {
+        int32_t ret = Pread(buf, read_size, offset_, false);
+        offset_ += ret;
+        return ret;
+    }
+    int32_t Write(const char* buf, int32_t write_size) {
+        data_->append(buf, write_size);
+        return write_size;
+    }
+    int32_t Flush() {
+        return OK;
+    }
+    int32_t Sync() {
+        return OK;
+    }
+    int32_t Close() {
+        return OK;
+    }
+private:
+    std::string* data_;
+    int64_t offset_;
+};
+
+/// Namespace and block placement of a cluster of 'servers' chunkservers,
+/// server i is in rack i % racks. Placement skips excluded servers and,
+/// while enough are left, their racks, as the nameserver does.
+class FakeFS : public FSImpl {
+public:
+    FakeFS(int32_t servers, int32_t racks)
+        : servers_(servers), racks_(racks), next_entry_id_(2) {}
+    /// A cold file of 'size' random bytes with a replica on every one of 'servers'
+    void AddFile(const std::string& path, int64_t size, const std::vector<int32_t>& servers) {
+        FakeEntry& entry = entries_[path];
+        entry.data.resize(size);
+        for (int64_t i = 0; i < size; i++) {
+            entry.data[i] = static_cast<char>(rand() & 0xff);
+        }
+        entry.dir = false;
+        entry.entry_id = next_entry_id_++;
+        entry.ctime = time(NULL) - 2 * 86400;
+        entry.replica = servers.size();
+        entry.servers = servers;
+    }
+    const FakeEntry* Find(const std::string& path) {
+        std::map<std::string, FakeEntry>::iterator it = entries_.find(path);
+        return it == entries_.end() ? NULL : &it->second;
+    }
+    std::string Rack(int32_t cs_id) {
+        char rack[16];
+        snprintf(rack, sizeof(rack), "rack%d", cs_id % racks_);
+        return rack;
+    }
+    int32_t CreateDirectory(const char* path) {
+        FakeEntry& entry = entries_[path];
+        entry.dir = true;
+        entry.entry_id = next_entry_id_++;
+        entry.ctime = time(NULL);
+        entry.replica = 0;
+        return OK;
+    }
+    int32_t ListDirectory(const char* path, BfsFileInfo** filelist, int* num) {
+        std::string prefix = std::string(path) + "/";
+        std::vector<std::string> names;
+        for (std::map<std::string, FakeEntry>::iterator it = entries_.begin();
+             it != entries_.end(); ++it) {
+            if (it->first.compare(0, prefix.size(), prefix) == 0
+                && it->first.find('/', prefix.size()) == std::string::npos) {
+                names.push_back(it->first);
+            }
+        }
+        *num = names.size();
+        *filelist = new BfsFileInfo[names.size()];
+        for (size_t i = 0; i < names.size(); i++) {
+            const FakeEntry& entry = entries_[names[i]];
+            BfsFileInfo& info = (*filelist)[i];
+            info.size = entry.data.size();
+            info.ctime = entry.ctime;
+            info.mode = entry.dir ? (0755 | (1 << 9)) : 0644;
+            snprintf(info.name, sizeof(info.name), "%s", names[i].c_str() + prefix.size());
+            info.link[0] = '\0';
+            info.entry_id = entry.entry_id;
+        }
+        return OK;
+    }
+    int32_t Stat(const char* path, BfsFileInfo* fileinfo) {
+        const FakeEntry* entry = Find(path);
+        if (entry == NULL) {
+            return BAD_PARAMETER;
+        }
+        fileinfo->size = entry->data.size();
+        fileinfo->ctime = entry->ctime;
+        fileinfo->entry_id = entry->entry_id;
+        return OK;
+    }
+    int32_t GetFileSize(const char* path, int64_t* file_size) {
+        const FakeEntry* entry = Find(path);
+        if (entry == NULL) {
+            return BAD_PARAMETER;
+        }
+        *file_size = entry->data.size();
+        return OK;
+    }
+    int32_t OpenFile(const char* path, int32_t, File** file, const ReadOptions&) {
+        std::map<std::string, FakeEntry>::iterator it = entries_.find(path);
+        if (it == entries_.end()) {
+            return BAD_PARAMETER;
+        }
+        *file = new FakeFile(&it->second.data);
+        return OK;
+    }
+    int32_t OpenFile(const char* path, int32_t flags, int32_t mode,
+                     File** file, const WriteOptions& options) {
+        return OpenFileExcluding(path, flags, mode, std::vector<int32_t>(), file, options);
+    }
+    int32_t OpenFileExcluding(const char* path, int32_t, int32_t,
+                              const std::vector<int32_t>& exclude,
+                              File** file, const WriteOptions& options) {
+        int32_t replica = options.replica > 0 ? options.replica : 3;
+        std::set<std::string> racks;
+        for (size_t i = 0; i < exclude.size(); i++) {
+            racks.insert(Rack(exclude[i]));
+        }
+        std::vector<int32_t> by_id;
+        std::vector<int32_t> by_rack;
+        for (int32_t cs_id = 0; cs_id < servers_; cs_id++) {
+            if (std::find(exclude.begin(), exclude.end(), cs_id) != exclude.end()) {
+                continue;
+            }
+            by_id.push_back(cs_id);
+            if (racks.find(Rack(cs_id)) == racks.end()) {
+                by_rack.push_back(cs_id);
+            }
+        }
+        std::vector<int32_t>& candidates =
+            static_cast<int32_t>(by_rack.size()) >= replica ? by_rack : by_id;
+        if (static_cast<int32_t>(candidates.size()) < replica) {
+            return UNKNOWN_ERROR;
+        }
+        FakeEntry& entry = entries_[path];
+        entry.data.clear();
+        entry.dir = false;
+        entry.entry_id = next_entry_id_++;
+        entry.ctime = time(NULL);
+        entry.replica = replica;
+        entry.servers.assign(candidates.begin(), candidates.begin() + replica);
+        *file = new FakeFile(&entry.data);
+        return OK;
+    }
+    int32_t Rename(const char* oldpath, const char* newpath) {
+        std::map<std::string, FakeEntry>::iterator it = entries_.find(oldpath);
+        if (it == entries_.end()) {
+            return BAD_PARAMETER;
+        }
+        FakeEntry entry = it->second;
+        entries_.erase(it);
+        entries_[newpath] = entry;
+        return OK;
+    }
+    int32_t DeleteFile(const char* path) {
+        return entries_.erase(path) ? OK : BAD_PARAMETER;
+    }
+    int32_t GetLocatedBlocks(const std::string& path, std::vector<LocatedBlock>* blocks) {
+        const FakeEntry* entry = Find(path);
+        if (entry == NULL || entry->dir) {
+            return BAD_PARAMETER;
+        }
+        LocatedBlock block;
+        block.set_block_id(entry->entry_id);
+        block.set_block_size(entry->data.size());
+        for (size_t i = 0; i < entry->servers.size(); i++) {
+            ChunkServerInfo* info = block.add_chains();
+            info->set_id(entry->servers[i]);
+            info->set_rack(Rack(entry->servers[i]));
+        }
+        blocks->push_back(block);
+        return OK;
+    }
+    int32_t ChangeReplicaNum(const char* file_name, int32_t replica_num,
+                             const std::vector<int32_t>& keep) {
+        std::map<std::string, FakeEntry>::iterator it = entries_.find(file_name);
+        if (it == entries_.end()) {
+            return BAD_PARAMETER;
+        }
+        FakeEntry& entry = it->second;
+        // Kept ones first, the surplus is cut off the end
+        std::vector<int32_t> servers;
+        for (size_t i = 0; i < entry.servers.size(); i++) {
+            if (std::find(keep.begin(), keep.end(), entry.servers[i]) != keep.end()) {
+                servers.push_back(entry.servers[i]);
+            }
+        }
+        for (size_t i = 0; i < entry.servers.size(); i++) {
+            if (std::find(keep.begin(), keep.end(), entry.servers[i]) == keep.end()) {
+                servers.push_back(entry.servers[i]);
+            }
+        }
+        if (static_cast<int32_t>(servers.size()) > replica_num) {
+            servers.resize(replica_num);
+        }
+        entry.replica = replica_num;
+        entry.servers = servers;
+        return OK;
+    }
+private:
+    int32_t servers_;
+    int32_t racks_;
+    int64_t next_entry_id_;
+    std::map<std::string, FakeEntry> entries_;
+};
+
+class ColdStoreTest : public ::testing::Test {
+public:
+    ColdStoreTest() : fs_(12, 6), store_(&fs_) {
+        FLAGS_sdk_ec_cold_days = 1;
+        FLAGS_sdk_ec_cell_size = 4096;
+        fs_.CreateDirectory("/cold");
+    }
+protected:
+    void AddFile(int32_t i, int64_t size, const std::vector<int32_t>& servers) {
+        char path[64];
+        snprintf(path, sizeof(path), "/cold/f%d", i);
+        fs_.AddFile(path, size, servers);
+    }
+    std::vector<int32_t> Servers(int32_t a, int32_t b, int32_t c) {
+        std::vector<int32_t> servers;
+        servers.push_back(a);
+        servers.push_back(b);
+        servers.push_back(c);
+        return servers;
+    }
+    bool LoadManifest(ErasureCodeManifest* manifest) {
+        const FakeEntry* entry = fs_.Find("/cold/.ec/manifest");
+        return entry != NULL && manifest->ParseFromString(entry->data);
+    }
+    /// Paths of the data then the parity files of 'stripe'
+    std::vector<std::string> Units(const ErasureCodeStripe& stripe) {
+        std::vector<std::string> units;
+        for (int i = 0; i < stripe.files_size(); i++) {
+            units.push_back("/cold/" + stripe.files(i));
+        }
+        for (int i = 0; i < stripe.parity_files_size(); i++) {
+            units.push_back("/cold/" + stripe.parity_files(i));
+        }
+        return units;
+    }
+protected:
+    FakeFS fs_;
+    ColdStore store_;
+};
+
+TEST_F(ColdStoreTest, DistinctPlacement) {
+    // Replicas of neighbouring files overlap
+    for (int32_t i = 0; i < 6; i++) {
+        AddFile(i, 10000 + i * 1000, Servers(i, i + 1, i + 2));
+    }
+    ASSERT_EQ(OK, store_.EncodeDirectory("/cold", 3, 2));
+
+    ErasureCodeManifest manifest;
+    ASSERT_TRUE(LoadManifest(&manifest));
+    ASSERT_TRUE(fs_.Find("/cold/.ec/manifest.tmp") == NULL);
+    ASSERT_EQ(2, manifest.stripes_size());
+    for (int s = 0; s < manifest.stripes_size(); s++) {
+        const ErasureCodeStripe& stripe = manifest.stripes(s);
+        ASSERT_EQ(3, stripe.data_num());
+        ASSERT_EQ(2, stripe.parity_num());
+        ASSERT_EQ(3, stripe.files_size());
+        ASSERT_EQ(3, stripe.sizes_size());
+        ASSERT_EQ(2, stripe.parity_files_size());
+        ASSERT_EQ(5, stripe.entry_ids_size());
+        char name[16];
+        snprintf(name, sizeof(name), "f%d", s * 3);
+        ASSERT_EQ(name, stripe.files(0));
+        snprintf(name, sizeof(name), ".ec/%d.p1", s);
+        ASSERT_EQ(name, stripe.parity_files(1));
+        ASSERT_EQ(stripe.sizes(2), stripe.unit_size());
+
+        std::vector<std::string> units = Units(stripe);
+        std::set<int32_t> servers;
+        std::set<std::string> racks;
+        for (size_t i = 0; i < units.size(); i++) {
+            const FakeEntry* entry = fs_.Find(units[i]);
+            ASSERT_TRUE(entry != NULL) << units[i];
+            ASSERT_EQ(stripe.entry_ids(i), entry->entry_id) << units[i];
+            if (static_cast<int>(i) < stripe.data_num()) {
+                ASSERT_EQ(stripe.sizes(i), static_cast<int64_t>(entry->data.size()));
+            } else {
+                ASSERT_EQ(stripe.unit_size(), static_cast<int64_t>(entry->data.size()));
+            }
+            // One replica a unit, every unit on its own server and rack
+            ASSERT_EQ(1, entry->replica) << units[i];
+            ASSERT_EQ(1u, entry->servers.size()) << units[i];
+            servers.insert(entry->servers[0]);
+            racks.insert(fs_.Rack(entry->servers[0]));
+        }
+        ASSERT_EQ(units.size(), servers.size());
+        ASSERT_EQ(units.size(), racks.size());
+    }
+
+    // Parity rebuilds a data unit
+    const FakeEntry* entry = fs_.Find("/cold/f4");
+    int32_t size = entry->data.size();
+    std::string buf(size, '\0');
+    ASSERT_EQ(size, store_.ReconstructRead("/cold/f4", &buf[0], size, 0));
+    ASSERT_TRUE(buf == entry->data);
+
+    // Nothing left to encode
+    ASSERT_EQ(OK, store_.EncodeDirectory("/cold", 3, 2));
+    ASSERT_TRUE(LoadManifest(&manifest));
+    ASSERT_EQ(2, manifest.stripes_size());
+}
+
+TEST_F(ColdStoreTest, NoDistinctReplica) {
+    // The last unit only has replicas where the others are kept
+    for (int32_t i = 0; i < 4; i++) {
+        AddFile(i, 5000, Servers(0, 1, 2));
+    }
+    ASSERT_EQ(OK, store_.EncodeDirectory("/cold", 4, 1));
+
+    ErasureCodeManifest manifest;
+    ASSERT_TRUE(LoadManifest(&manifest));
+    ASSERT_EQ(1, manifest.stripes_size());
+    std::vector<std::string> units = Units(manifest.stripes(0));
+    ASSERT_EQ(5u, units.size());
+    std::set<int32_t> servers;
+    for (size_t i = 0; i < units.size(); i++) {
+        const FakeEntry* entry = fs_.Find(units[i]);
+        ASSERT_TRUE(entry != NULL) << units[i];
+        if (i == 3) {
+            // Left with all its replicas
+            ASSERT_EQ(3, entry->replica);
+            ASSERT_EQ(3u, entry->servers.size());
+            continue;
+        }
+        ASSERT_EQ(1, entry->replica) << units[i];
+        ASSERT_EQ(1u, entry->servers.size()) << units[i];
+        servers.insert(entry->servers[0]);
+    }
+    ASSERT_EQ(4u, servers.size());
+    // Parity is off the servers of the kept replicas
+    const FakeEntry* parity = fs_.Find(units[4]);
+    ASSERT_GT(parity->servers[0], 2);
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,133 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "sdk/erasure_code.h"
+
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace baidu {
+namespace bfs {
+
+class ErasureCodeTest : public ::testing::Test {
+public:
+    ErasureCodeTest() {}
+protected:
+    static void MulAdd(uint8_t c, const char* src, char* dst, int64_t len) {
+        ErasureCode::MulAdd(c, src, dst, len);
+    }
+    std::string RandomBuffer(int64_t len) {
+        std::string buf(len, '\0');
+        for (int64_t i = 0; i < len; i++) {
+            buf[i] = static_cast<char>(rand() & 0xff);
+        }
+        return buf;
+    }
+};
+
+/// Multiply in GF(2^8) bit by bit, independent of the tables of the codec
+static uint8_t SlowMul(uint8_t a, uint8_t b) {
+    uint8_t r = 0;
+    while (b) {
+        if (b & 1) {
+            r ^= a;
+        }
+        b >>= 1;
+        a = (a & 0x80) ? ((a << 1) ^ 0x1d) : (a << 1);
+    }
+    return r;
+}
+
+TEST_F(ErasureCodeTest, MulAdd) {
+    const int64_t kMaxLen = 100;
+    std::vector<uint8_t> coefs;
+    coefs.push_back(1);
+    coefs.push_back(2);
+    coefs.push_back(0x8e);
+    coefs.push_back(0xff);
+    for (size_t c = 0; c < coefs.size(); c++) {
+        // Odd lengths and offsets, so the vector loop, its tail and
+        // unaligned loads are all covered
+        for (int64_t len = 0; len <= kMaxLen; len++) {
+            for (int64_t shift = 0; shift < 4; shift++) {
+                std::string src = RandomBuffer(len + shift);
+                std::string dst = RandomBuffer(len + shift);
+                std::string expect = dst;
+                for (int64_t i = 0; i < len; i++) {
+                    expect[shift + i] ^= SlowMul(coefs[c], src[shift + i]);
+                }
+                MulAdd(coefs[c], &src[0] + shift, &dst[0] + shift, len);
+                ASSERT_EQ(expect, dst) << "coef " << int(coefs[c])
+                                       << " len " << len << " shift " << shift;
+            }
+        }
+    }
+}
+
+TEST_F(ErasureCodeTest, RoundTrip) {
+    const int32_t kDataNum = 5;
+    const int32_t kParityNum = 3;
+    const int32_t kTotal = kDataNum + kParityNum;
+    const int64_t kLen = 1000 + 7;
+    ErasureCode ec(kDataNum, kParityNum);
+    std::vector<std::string> units(kTotal);
+    std::vector<const char*> data(kDataNum);
+    std::vector<char*> parity(kParityNum);
+    for (int32_t i = 0; i < kTotal; i++) {
+        units[i] = RandomBuffer(kLen);
+    }
+    for (int32_t i = 0; i < kDataNum; i++) {
+        data[i] = units[i].data();
+    }
+    for (int32_t i = 0; i < kParityNum; i++) {
+        parity[i] = &units[kDataNum + i][0];
+    }
+    ec.Encode(&data[0], &parity[0], kLen);
+
+    // Every pattern of up to kParityNum lost units
+    int32_t patterns = 0;
+    for (int32_t lost = 1; lost < (1 << kTotal); lost++) {
+        if (__builtin_popcount(lost) > kParityNum) {
+            continue;
+        }
+        ++patterns;
+        std::vector<int32_t> index;
+        std::vector<const char*> alive;
+        for (int32_t i = 0; i < kTotal && static_cast<int32_t>(index.size()) < kDataNum; i++) {
+            if (!(lost & (1 << i))) {
+                index.push_back(i);
+                alive.push_back(units[i].data());
+            }
+        }
+        for (int32_t target = 0; target < kTotal; target++) {
+            if (!(lost & (1 << target))) {
+                continue;
+            }
+            std::string out(kLen, '\0');
+            ASSERT_TRUE(ec.Decode(index, &alive[0], target, &out[0], kLen));
+            ASSERT_EQ(units[target], out) << "lost " << lost << " target " << target;
+        }
+    }
+    ASSERT_EQ(patterns, 8 + 28 + 56);
+
+    // Fewer units than data_num can't decode
+    std::vector<int32_t> index(1, 0);
+    std::vector<const char*> alive(1, units[0].data());
+    std::string out(kLen, '\0');
+    ASSERT_FALSE(ec.Decode(index, &alive[0], 1, &out[0], kLen));
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,92 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "sdk/latency_tracker.h"
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+DECLARE_int32(sdk_read_hedge_percentile);
+DECLARE_int32(sdk_read_hedge_min_delay);
+DECLARE_int32(sdk_read_hedge_default_delay);
+
+namespace baidu {
+namespace bfs {
+
+class LatencyTrackerTest : public ::testing::Test {
+public:
+    LatencyTrackerTest() {
+        FLAGS_sdk_read_hedge_percentile = 95;
+        FLAGS_sdk_read_hedge_min_delay = 5;
+        FLAGS_sdk_read_hedge_default_delay = 50;
+    }
+};
+
+TEST_F(LatencyTrackerTest, Percentile) {
+    LatencyTracker tracker;
+    ASSERT_EQ(-1, tracker.Percentile("cs1", 50));
+    // 1..100 in a shuffled order
+    for (int i = 0; i < 100; i++) {
+        if (i == 15) {
+            ASSERT_EQ(-1, tracker.Percentile("cs1", 50));
+        }
+        tracker.Record("cs1", (i * 37) % 100 + 1);
+    }
+    ASSERT_EQ(1, tracker.Percentile("cs1", 0));
+    ASSERT_EQ(50, tracker.Percentile("cs1", 50));
+    ASSERT_EQ(95, tracker.Percentile("cs1", 95));
+    ASSERT_EQ(100, tracker.Percentile("cs1", 100));
+    // Out of range percentiles are clamped
+    ASSERT_EQ(1, tracker.Percentile("cs1", -10));
+    ASSERT_EQ(100, tracker.Percentile("cs1", 200));
+    // Chunkservers are tracked apart
+    ASSERT_EQ(-1, tracker.Percentile("cs2", 50));
+}
+
+TEST_F(LatencyTrackerTest, Window) {
+    LatencyTracker tracker(32);
+    for (int i = 0; i < 32; i++) {
+        tracker.Record("cs1", 1000);
+    }
+    ASSERT_EQ(1000, tracker.Percentile("cs1", 100));
+    // Old samples are replaced by the new ones
+    for (int i = 0; i < 32; i++) {
+        tracker.Record("cs1", 10);
+    }
+    ASSERT_EQ(10, tracker.Percentile("cs1", 100));
+    for (int i = 0; i < 16; i++) {
+        tracker.Record("cs1", 500);
+    }
+    ASSERT_EQ(10, tracker.Percentile("cs1", 0));
+    ASSERT_EQ(500, tracker.Percentile("cs1", 100));
+}
+
+TEST_F(LatencyTrackerTest, HedgeDelay) {
+    LatencyTracker tracker;
+    // No history
+    ASSERT_EQ(50, tracker.HedgeDelay("cs1"));
+    for (int i = 0; i < 100; i++) {
+        tracker.Record("cs1", (i + 1) * 1000);
+        tracker.Record("cs2", 100);
+    }
+    // 95th percentile in ms
+    ASSERT_EQ(95, tracker.HedgeDelay("cs1"));
+    FLAGS_sdk_read_hedge_percentile = 50;
+    ASSERT_EQ(50, tracker.HedgeDelay("cs1"));
+    // A fast chunkserver is not hedged below the min delay
+    ASSERT_EQ(5, tracker.HedgeDelay("cs2"));
+    FLAGS_sdk_read_hedge_min_delay = 0;
+    ASSERT_EQ(0, tracker.HedgeDelay("cs2"));
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
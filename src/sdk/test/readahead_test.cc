@@ -0,0 +1,162 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "sdk/readahead.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+#include <common/thread_pool.h>
+
+DECLARE_int32(sdk_file_reada_len);
+DECLARE_int32(sdk_file_reada_max_pending);
+
+namespace baidu {
+namespace bfs {
+
+class ReadaheadTest : public ::testing::Test {
+public:
+    ReadaheadTest() : thread_pool_(4), delay_(0), fail_offset_(-1), started_(0),
+                      reada_(&mu_, std::bind(&ReadaheadTest::Start, this,
+                                             std::placeholders::_1)) {
+        FLAGS_sdk_file_reada_len = 256 * 1024;
+        FLAGS_sdk_file_reada_max_pending = 4;
+        data_.resize(1000 * 1000 + 7);
+        for (size_t i = 0; i < data_.size(); i++) {
+            data_[i] = static_cast<char>(rand() & 0xff);
+        }
+    }
+    ~ReadaheadTest() {
+        thread_pool_.Stop(true);
+    }
+protected:
+    /// Buffers are read right away, or in the thread pool after delay_ ms
+    void Start(ReadaheadBuffer* rb) {
+        ++started_;
+        if (delay_ > 0) {
+            thread_pool_.AddTask(std::bind(&ReadaheadTest::DelayedRead, this, rb));
+        } else {
+            reada_.Done(rb, FileRead(rb));
+        }
+    }
+    void DelayedRead(ReadaheadBuffer* rb) {
+        usleep(delay_ * 1000);
+        MutexLock lock(&mu_);
+        reada_.Done(rb, FileRead(rb));
+    }
+    int32_t FileRead(ReadaheadBuffer* rb) {
+        if (rb->offset == fail_offset_) {
+            return -1;
+        }
+        int64_t size = data_.size();
+        int32_t len = std::max(0L, std::min(static_cast<int64_t>(rb->len), size - rb->offset));
+        memcpy(rb->data, data_.data() + rb->offset, len);
+        return len;
+    }
+    /// Read [offset, offset + len) through the ring, 'size' as located
+    int32_t Read(int64_t offset, int32_t len, int64_t size, std::string* out) {
+        out->assign(len, '\0');
+        MutexLock lock(&mu_);
+        int32_t ret = reada_.Read(&(*out)[0], len, offset, size, true);
+        out->resize(ret > 0 ? ret : 0);
+        return ret;
+    }
+    int32_t depth() {
+        return reada_.depth_;
+    }
+    int32_t chunk_size() {
+        return reada_.chunk_size_;
+    }
+protected:
+    ThreadPool thread_pool_;
+    Mutex mu_;
+    std::string data_;
+    int32_t delay_;
+    int64_t fail_offset_;
+    int32_t started_;
+    Readahead reada_;
+};
+
+TEST_F(ReadaheadTest, Sequential) {
+    const int32_t kReadLen = 4096;
+    int64_t size = data_.size();
+    std::string out;
+    for (int64_t offset = 0; offset < size; offset += kReadLen) {
+        int32_t expect = std::min(static_cast<int64_t>(kReadLen), size - offset);
+        ASSERT_EQ(expect, Read(offset, kReadLen, size, &out));
+        ASSERT_TRUE(out == data_.substr(offset, expect)) << offset;
+    }
+    // Reads are always done before needed, requests grow to the max size
+    ASSERT_EQ(FLAGS_sdk_file_reada_len, chunk_size());
+    ASSERT_EQ(2, depth());
+    ASSERT_LT(started_, 20);
+    // The end of the stream is left to a direct read
+    ASSERT_EQ(-1, Read(size, kReadLen, size, &out));
+}
+
+TEST_F(ReadaheadTest, DepthGrows) {
+    delay_ = 5;
+    int64_t size = data_.size();
+    std::string out;
+    for (int64_t offset = 0; offset < 512 * 1024; offset += 64 * 1024) {
+        ASSERT_EQ(64 * 1024, Read(offset, 64 * 1024, size, &out));
+        ASSERT_TRUE(out == data_.substr(offset, 64 * 1024)) << offset;
+    }
+    // Reader waits on every request, more are kept in flight
+    ASSERT_EQ(FLAGS_sdk_file_reada_max_pending, depth());
+}
+
+TEST_F(ReadaheadTest, ShortRead) {
+    // Located size is ahead of what was written so far
+    int64_t written = data_.size();
+    int64_t size = written + 100000;
+    std::string out;
+    ASSERT_EQ(1000, Read(written - 1000, 4096, size, &out));
+    ASSERT_TRUE(out == data_.substr(written - 1000));
+    ASSERT_EQ(-1, Read(written, 4096, size, &out));
+    // The file grew, the next stream reads the new data
+    data_.append(5000, 'x');
+    ASSERT_EQ(4096, Read(written, 4096, size, &out));
+    ASSERT_EQ(std::string(4096, 'x'), out);
+}
+
+TEST_F(ReadaheadTest, SeekBackward) {
+    delay_ = 1;
+    int64_t size = data_.size();
+    std::string out;
+    for (int64_t offset = 300000; offset < 400000; offset += 10000) {
+        ASSERT_EQ(10000, Read(offset, 10000, size, &out));
+    }
+    ASSERT_EQ(10000, Read(10, 10000, size, &out));
+    ASSERT_TRUE(out == data_.substr(10, 10000));
+    ASSERT_EQ(10000, Read(10010, 10000, size, &out));
+    ASSERT_TRUE(out == data_.substr(10010, 10000));
+    // Abandoned buffers are freed by Done
+    thread_pool_.Stop(true);
+}
+
+TEST_F(ReadaheadTest, ReadFail) {
+    int64_t size = data_.size();
+    fail_offset_ = 0;
+    std::string out;
+    ASSERT_EQ(-1, Read(0, 4096, size, &out));
+    fail_offset_ = -1;
+    ASSERT_EQ(4096, Read(0, 4096, size, &out));
+    ASSERT_TRUE(out == data_.substr(0, 4096));
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */
@@ -0,0 +1,125 @@
+// Copyright (c) 2017, Baidu.com, Inc. All Rights Reserved
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+
+#include "sdk/replica_scorer.h"
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+DECLARE_int32(sdk_replica_blacklist_errors);
+DECLARE_int32(sdk_replica_blacklist_time);
+
+namespace baidu {
+namespace bfs {
+
+class ReplicaScorerTest : public ::testing::Test {
+public:
+    ReplicaScorerTest() : scorer_("host0") {
+        FLAGS_sdk_replica_blacklist_errors = 3;
+        FLAGS_sdk_replica_blacklist_time = 30;
+        scorer_.SetLocalLocation("10.0.0.1", "rack0");
+    }
+protected:
+    void AddReplica(const std::string& addr, const std::string& rack) {
+        ChunkServerInfo* cs = lcblock_.add_chains();
+        cs->set_address(addr);
+        cs->set_rack(rack);
+    }
+protected:
+    ReplicaScorer scorer_;
+    LocatedBlock lcblock_;
+};
+
+// Scores compared below are over 30% apart, beyond the 10% random jitter
+
+TEST_F(ReplicaScorerTest, Locality) {
+    AddReplica("10.0.1.1:8825", "rack1");
+    AddReplica("10.0.0.2:8825", "rack0");
+    AddReplica("10.0.0.1:8825", "rack0");
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(2, scorer_.SelectReplica(lcblock_));
+        // Same rack before remote
+        ASSERT_EQ(1, scorer_.SelectReplica(lcblock_, 2));
+    }
+    // Local host by name
+    lcblock_.mutable_chains(0)->set_address("host0:8825");
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_, 2));
+}
+
+TEST_F(ReplicaScorerTest, Latency) {
+    AddReplica("10.0.1.1:8825", "rack1");
+    AddReplica("10.0.2.1:8825", "rack2");
+    scorer_.ReportSuccess("10.0.1.1:8825", 10000);
+    scorer_.ReportSuccess("10.0.2.1:8825", 1000);
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_));
+    // A slow local replica loses to a fast remote one
+    AddReplica("10.0.0.1:8825", "rack0");
+    scorer_.ReportSuccess("10.0.0.1:8825", 50000);
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_));
+    // The average follows recent latency
+    for (int i = 0; i < 20; i++) {
+        scorer_.ReportSuccess("10.0.0.1:8825", 1000);
+    }
+    ASSERT_EQ(2, scorer_.SelectReplica(lcblock_));
+}
+
+TEST_F(ReplicaScorerTest, FailurePenaltyAndDecay) {
+    AddReplica("10.0.1.1:8825", "rack1");
+    AddReplica("10.0.0.2:8825", "rack0");
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_));
+    // One failure outweighs the same rack
+    scorer_.ReportFailure("10.0.0.2:8825");
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_));
+    // Error rate decays with successful reads
+    scorer_.ReportSuccess("10.0.0.2:8825", 0);
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_));
+    for (int i = 0; i < 10; i++) {
+        scorer_.ReportSuccess("10.0.0.2:8825", 0);
+    }
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_));
+}
+
+TEST_F(ReplicaScorerTest, Blacklist) {
+    AddReplica("10.0.1.1:8825", "rack1");
+    AddReplica("10.0.0.1:8825", "rack0");
+    scorer_.ReportSuccess("10.0.1.1:8825", 1000000);
+    for (int i = 0; i < FLAGS_sdk_replica_blacklist_errors - 1; i++) {
+        scorer_.ReportFailure("10.0.0.1:8825");
+    }
+    // Still preferred, the remote one is much slower
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_));
+    scorer_.ReportFailure("10.0.0.1:8825");
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_));
+    // All blacklisted, the one leaving the blacklist first is tried
+    FLAGS_sdk_replica_blacklist_time = 10;
+    for (int i = 0; i < FLAGS_sdk_replica_blacklist_errors; i++) {
+        scorer_.ReportFailure("10.0.1.1:8825");
+    }
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_));
+    // A successful read lifts the blacklist
+    scorer_.ReportSuccess("10.0.0.1:8825", 1000);
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_));
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_, 1));
+}
+
+TEST_F(ReplicaScorerTest, Exclude) {
+    AddReplica("10.0.0.1:8825", "rack0");
+    // A single replica is returned anyway
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_, 0));
+    AddReplica("10.0.1.1:8825", "rack1");
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_));
+    ASSERT_EQ(1, scorer_.SelectReplica(lcblock_, 0));
+    ASSERT_EQ(0, scorer_.SelectReplica(lcblock_, 1));
+}
+
+} // namespace bfs
+} // namespace baidu
+
+int main(int argc, char** argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
+
+/* vim: set expandtab ts=4 sw=4 sts=4 tw=100: */